@@ -0,0 +1,1271 @@
+﻿/*
+Sharp86 - 8086 Emulator
+Copyright (C) 2017-2018 Topten Software.
+
+Sharp86 is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Sharp86 is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Sharp86.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Reflection;
+using System.Reflection.Emit;
+
+namespace Sharp86
+{
+    // Compiled code for a block, returns the number of instructions executed
+    delegate int BlockFunction(CPU cpu);
+
+    class CompiledBlock
+    {
+        public BlockFunction function;
+        public int instructionCount;        // Most instructions a single run can execute
+    }
+
+    // Translates hot runs of decoded instructions into IL.
+    //
+    // A block is a straight run of instructions from a hot entry point up to
+    // the first branch, the first instruction not handled here or the end of
+    // the decode cache page the block starts in.  Staying within one page
+    // means the block is discarded along with the page when the code under
+    // it is modified.
+    //
+    // Compiled code works directly on the register fields and calls the same
+    // ALU methods and memory accessors as the interpreter so flags and faults
+    // come out identical, except where flag liveness shows an instruction's
+    // flags are overwritten before anything can see them, in which case the
+    // plain arithmetic is done inline instead.  Anything
+    // that loads a segment register, touches the interrupt flag, does port
+    // I/O, raises an interrupt or leaves the code segment ends the block and
+    // is left to the interpreter.  Writes to memory are followed by a check
+    // of the decode cache generation so a block that modifies code (anywhere)
+    // exits straight after the write.
+    class BlockTranslator
+    {
+        public const int HotThreshold = 50;
+        const int MaxInstructions = 64;
+
+        enum Kind
+        {
+            Unsupported,
+            Normal,
+            Branch,
+        }
+
+        public CompiledBlock Translate(DecodeCache cache, IMemoryBus bus, ushort cs, ushort ip)
+        {
+            // Collect the instructions
+            var instructions = new List<DecodedInstruction>();
+            var addresses = new List<ushort>();
+            int pos = ip;
+            while (instructions.Count < MaxInstructions)
+            {
+                var d = cache.Lookup(bus, cs, (ushort)pos);
+                if (d == null)
+                    break;
+
+                var kind = Classify(d);
+                if (kind == Kind.Unsupported)
+                    break;
+
+                instructions.Add(d);
+                addresses.Add((ushort)pos);
+
+                if (kind == Kind.Branch)
+                    break;
+
+                pos += d.length;
+                if ((pos >> DecodeCache.PageShift) != (ip >> DecodeCache.PageShift))
+                    break;
+            }
+
+            // Not worth compiling?
+            if (instructions.Count < 2)
+                return null;
+
+            // Generate it
+            var method = new DynamicMethod(string.Format("block_{0:X4}_{1:X4}", cs, ip), typeof(int), new Type[] { typeof(CPU) }, typeof(CPU), true);
+            _il = method.GetILGenerator();
+            _generation = _il.DeclareLocal(typeof(int));
+            _seg = _il.DeclareLocal(typeof(ushort));
+            _ofs = _il.DeclareLocal(typeof(ushort));
+            _temp = _il.DeclareLocal(typeof(ushort));
+
+            // generation = cpu._decodeCache.Generation
+            _il.Emit(OpCodes.Ldarg_0);
+            _il.Emit(OpCodes.Ldfld, _fieldDecodeCache);
+            _il.Emit(OpCodes.Ldfld, _fieldGeneration);
+            _il.Emit(OpCodes.Stloc, _generation);
+
+            var flagsDead = FindDeadFlags(instructions);
+            for (int i = 0; i < instructions.Count; i++)
+            {
+                _d = instructions[i];
+                _flagsDead = flagsDead[i];
+                _address = addresses[i];
+                _next = (ushort)(_address + _d.length);
+                _executed = i + 1;
+                _wroteMemory = false;
+                EmitInstruction();
+            }
+
+            // Fell off the end
+            if (Classify(_d) != Kind.Branch)
+                EmitExit(_next);
+
+            _il = null;
+            _d = null;
+
+            var block = new CompiledBlock();
+            block.function = (BlockFunction)method.CreateDelegate(typeof(BlockFunction));
+            block.instructionCount = instructions.Count;
+            return block;
+        }
+
+        #region Instruction Selection
+
+        static Kind Classify(DecodedInstruction d)
+        {
+            int reg = (d.modRM >> 3) & 7;
+            bool isRegister = (d.modRM & 0xC0) == 0xC0;
+
+            switch (d.opCode)
+            {
+                case 0x00: case 0x01: case 0x02: case 0x03: case 0x04: case 0x05:
+                case 0x08: case 0x09: case 0x0A: case 0x0B: case 0x0C: case 0x0D:
+                case 0x10: case 0x11: case 0x12: case 0x13: case 0x14: case 0x15:
+                case 0x18: case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D:
+                case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25:
+                case 0x28: case 0x29: case 0x2A: case 0x2B: case 0x2C: case 0x2D:
+                case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35:
+                case 0x38: case 0x39: case 0x3A: case 0x3B: case 0x3C: case 0x3D:
+                    return Kind.Normal;
+
+                case 0x68: case 0x69: case 0x6A: case 0x6B:
+                    return Kind.Normal;
+
+                case 0x80: case 0x81: case 0x82: case 0x83:
+                case 0x84: case 0x85: case 0x86: case 0x87:
+                case 0x88: case 0x89: case 0x8A: case 0x8B:
+                    return Kind.Normal;
+
+                case 0x8D:
+                    return isRegister ? Kind.Unsupported : Kind.Normal;
+
+                case 0x98: case 0x99:
+                case 0xA0: case 0xA1: case 0xA2: case 0xA3:
+                case 0xA8: case 0xA9:
+                case 0xC6: case 0xC7:
+                case 0xF5: case 0xF8: case 0xF9: case 0xFC: case 0xFD:
+                    return Kind.Normal;
+
+                case 0xC0: case 0xC1: case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+                    return reg == 6 ? Kind.Unsupported : Kind.Normal;
+
+                case 0xF6: case 0xF7:
+                    return reg == 1 ? Kind.Unsupported : Kind.Normal;
+
+                case 0xFE:
+                    return reg < 2 ? Kind.Normal : Kind.Unsupported;
+
+                case 0xFF:
+                    switch (reg)
+                    {
+                        case 0: case 1: case 6: return Kind.Normal;
+                        case 2: case 4: return Kind.Branch;
+                    }
+                    return Kind.Unsupported;
+
+                case 0xC2: case 0xC3:
+                case 0xE0: case 0xE1: case 0xE2: case 0xE3:
+                case 0xE8: case 0xE9: case 0xEB:
+                    return Kind.Branch;
+            }
+
+            if (d.opCode >= 0x40 && d.opCode < 0x60)
+                return Kind.Normal;         // INC/DEC/PUSH/POP r16
+
+            if (d.opCode >= 0x70 && d.opCode < 0x80)
+                return Kind.Branch;         // Jcc
+
+            if (d.opCode >= 0x90 && d.opCode < 0x98)
+                return Kind.Normal;         // XCHG r16, AX
+
+            if (d.opCode >= 0xB0 && d.opCode < 0xC0)
+                return Kind.Normal;         // MOV r, I
+
+            return Kind.Unsupported;
+        }
+
+        void EmitInstruction()
+        {
+            // Save the instruction address so faults restore ip correctly
+            _il.Emit(OpCodes.Ldarg_0);
+            EmitConst(_address);
+            _il.Emit(OpCodes.Stfld, _fieldIpInstruction);
+
+            // Resolve the effective address up front
+            if ((_d.modRM & 0xC0) != 0xC0 && HasModRM(_d.opCode))
+                EmitEffectiveAddress();
+
+            int op = _d.opCode;
+            int reg = (_d.modRM >> 3) & 7;
+
+            if (op < 0x40)
+            {
+                // ALU ops
+                EmitAlu((op >> 3) & 7, op & 7);
+            }
+            else if (op < 0x48)
+            {
+                // INC r16
+                EmitStoreReg16(op & 7, () => EmitCall(_inc16, () => EmitLoadReg16(op & 7)));
+            }
+            else if (op < 0x50)
+            {
+                // DEC r16
+                EmitStoreReg16(op & 7, () => EmitCall(_dec16, () => EmitLoadReg16(op & 7)));
+            }
+            else if (op < 0x58)
+            {
+                // PUSH r16 (PUSH SP pushes the value before the decrement)
+                EmitLoadReg16(op & 7);
+                _il.Emit(OpCodes.Stloc, _temp);
+                EmitPush(() => _il.Emit(OpCodes.Ldloc, _temp));
+            }
+            else if (op < 0x60)
+            {
+                // POP r16 (POP SP doesn't adjust sp after the load)
+                EmitStoreReg16(op & 7, () => EmitReadWord(() => EmitLoadSeg(RegSeg.SS), () => EmitLoadReg16(Reg16SP)));
+                if (op != 0x5C)
+                    EmitAddReg16(Reg16SP, 2);
+            }
+            else if (op >= 0x70 && op < 0x80)
+            {
+                EmitJcc(op & 0x0F);
+            }
+            else if (op >= 0x90 && op < 0x98)
+            {
+                // XCHG r16, AX
+                if (op != 0x90)
+                {
+                    EmitLoadReg16(Reg16AX);
+                    _il.Emit(OpCodes.Stloc, _temp);
+                    EmitStoreReg16(Reg16AX, () => EmitLoadReg16(op & 7));
+                    EmitStoreReg16(op & 7, () => _il.Emit(OpCodes.Ldloc, _temp));
+                }
+            }
+            else if (op >= 0xB0 && op < 0xB8)
+            {
+                // MOV r8, Ib
+                EmitStoreReg8(op & 7, () => EmitConst(Ib));
+            }
+            else if (op >= 0xB8 && op < 0xC0)
+            {
+                // MOV r16, Iv
+                EmitStoreReg16(op & 7, () => EmitConst(Iv));
+            }
+            else
+            {
+                switch (op)
+                {
+                    case 0x68:
+                        // PUSH Iv
+                        EmitPush(() => EmitConst(Iv));
+                        break;
+
+                    case 0x6A:
+                        // PUSH Ib
+                        EmitPush(() => EmitConst((ushort)(sbyte)Ib));
+                        break;
+
+                    case 0x69:
+                    case 0x6B:
+                        {
+                            // IMUL Gv, Ev, Iv/Ib
+                            ushort imm = op == 0x69 ? Iv : (ushort)(sbyte)Ib;
+                            EmitStoreG(false, () =>
+                            {
+                                EmitCall(_imul16, () => EmitLoadE(false), () => EmitConst(imm));
+                                _il.Emit(OpCodes.Conv_U2);
+                            });
+                            break;
+                        }
+
+                    case 0x80:
+                    case 0x82:
+                        EmitAluE(reg, true, () => EmitConst(Ib));
+                        break;
+
+                    case 0x81:
+                        EmitAluE(reg, false, () => EmitConst(Iv));
+                        break;
+
+                    case 0x83:
+                        EmitAluE(reg, false, () => EmitConst((ushort)(sbyte)Ib));
+                        break;
+
+                    case 0x84:
+                    case 0x85:
+                        // TEST Gv, Ev
+                        EmitDiscard(op == 0x84 ? _and8 : _and16, () => EmitLoadG(op == 0x84), () => EmitLoadE(op == 0x84));
+                        break;
+
+                    case 0x86:
+                    case 0x87:
+                        // XCHG Gv, Ev
+                        EmitLoadG(op == 0x86);
+                        _il.Emit(OpCodes.Stloc, _temp);
+                        EmitStoreG(op == 0x86, () => EmitLoadE(op == 0x86));
+                        EmitStoreE(op == 0x86, () => _il.Emit(OpCodes.Ldloc, _temp));
+                        break;
+
+                    case 0x88: EmitStoreE(true, () => EmitLoadG(true)); break;
+                    case 0x89: EmitStoreE(false, () => EmitLoadG(false)); break;
+                    case 0x8A: EmitStoreG(true, () => EmitLoadE(true)); break;
+                    case 0x8B: EmitStoreG(false, () => EmitLoadE(false)); break;
+
+                    case 0x8D:
+                        // LEA Gv, M
+                        EmitStoreG(false, () => _il.Emit(OpCodes.Ldloc, _ofs));
+                        break;
+
+                    case 0x98:
+                        // CBW
+                        EmitStoreReg16(Reg16AX, () => EmitCall(_cbw, () => EmitLoadReg8(Reg8AL)));
+                        break;
+
+                    case 0x99:
+                        // CWD
+                        _il.Emit(OpCodes.Ldarg_0);
+                        EmitCall(_cwd, () => EmitLoadReg16(Reg16AX));
+                        _il.Emit(OpCodes.Call, _setDxAx);
+                        break;
+
+                    case 0xA0:
+                    case 0xA1:
+                    case 0xA2:
+                    case 0xA3:
+                        {
+                            // MOV AL/AX <-> [Ov]
+                            EmitLoadSeg(_d.prefixSegment != RegSeg.None ? _d.prefixSegment : RegSeg.DS);
+                            _il.Emit(OpCodes.Stloc, _seg);
+                            ushort offset = Iv;
+                            Action seg = () => _il.Emit(OpCodes.Ldloc, _seg);
+                            switch (op)
+                            {
+                                case 0xA0: EmitStoreReg8(Reg8AL, () => EmitReadByte(seg, () => EmitConst(offset))); break;
+                                case 0xA1: EmitStoreReg16(Reg16AX, () => EmitReadWord(seg, () => EmitConst(offset))); break;
+                                case 0xA2: EmitWriteByte(seg, () => EmitConst(offset), () => EmitLoadReg8(Reg8AL)); break;
+                                case 0xA3: EmitWriteWord(seg, () => EmitConst(offset), () => EmitLoadReg16(Reg16AX)); break;
+                            }
+                            break;
+                        }
+
+                    case 0xA8:
+                        // TEST AL, Ib
+                        EmitDiscard(_and8, () => EmitLoadReg8(Reg8AL), () => EmitConst(Ib));
+                        break;
+
+                    case 0xA9:
+                        // TEST AX, Iv
+                        EmitDiscard(_and16, () => EmitLoadReg16(Reg16AX), () => EmitConst(Iv));
+                        break;
+
+                    case 0xC0:
+                    case 0xC1:
+                        {
+                            byte count = Ib;
+                            EmitShift(reg, op == 0xC0, () => EmitConst(count));
+                            break;
+                        }
+
+                    case 0xD0:
+                    case 0xD1:
+                        EmitShift(reg, op == 0xD0, () => EmitConst(1));
+                        break;
+
+                    case 0xD2:
+                    case 0xD3:
+                        EmitShift(reg, op == 0xD2, () => EmitLoadReg8(Reg8CL));
+                        break;
+
+                    case 0xC6: EmitStoreE(true, () => EmitConst(Ib)); break;
+                    case 0xC7: EmitStoreE(false, () => EmitConst(Iv)); break;
+
+                    case 0xF6:
+                    case 0xF7:
+                        EmitGroup3(reg, op == 0xF6);
+                        break;
+
+                    case 0xFE:
+                        EmitStoreE(true, () => EmitCall(reg == 0 ? _inc8 : _dec8, () => EmitLoadE(true)));
+                        break;
+
+                    case 0xFF:
+                        switch (reg)
+                        {
+                            case 0:
+                            case 1:
+                                EmitStoreE(false, () => EmitCall(reg == 0 ? _inc16 : _dec16, () => EmitLoadE(false)));
+                                break;
+
+                            case 2:
+                                // CALL Ev
+                                EmitLoadE(false);
+                                _il.Emit(OpCodes.Stloc, _temp);
+                                EmitPush(() => EmitConst(_next));
+                                EmitExit(() => _il.Emit(OpCodes.Ldloc, _temp));
+                                break;
+
+                            case 4:
+                                // JMP Ev
+                                EmitExit(() => EmitLoadE(false));
+                                break;
+
+                            case 6:
+                                // PUSH Ev
+                                EmitLoadE(false);
+                                _il.Emit(OpCodes.Stloc, _temp);
+                                EmitPush(() => _il.Emit(OpCodes.Ldloc, _temp));
+                                break;
+                        }
+                        break;
+
+                    case 0xF5:
+                        // CMC
+                        _il.Emit(OpCodes.Ldarg_0);
+                        _il.Emit(OpCodes.Ldarg_0);
+                        _il.Emit(OpCodes.Call, _getFlagC);
+                        _il.Emit(OpCodes.Ldc_I4_0);
+                        _il.Emit(OpCodes.Ceq);
+                        _il.Emit(OpCodes.Call, _setFlagC);
+                        break;
+
+                    case 0xF8:
+                    case 0xF9:
+                        // CLC/STC
+                        _il.Emit(OpCodes.Ldarg_0);
+                        EmitConst(op & 1);
+                        _il.Emit(OpCodes.Call, _setFlagC);
+                        break;
+
+                    case 0xFC:
+                    case 0xFD:
+                        // CLD/STD
+                        _il.Emit(OpCodes.Ldarg_0);
+                        EmitConst(op & 1);
+                        _il.Emit(OpCodes.Stfld, _fieldFlagD);
+                        break;
+
+                    case 0xC2:
+                    case 0xC3:
+                        {
+                            // RET
+                            int adjust = op == 0xC2 ? Iv + 2 : 2;
+                            _il.Emit(OpCodes.Ldarg_0);
+                            EmitReadWord(() => EmitLoadSeg(RegSeg.SS), () => EmitLoadReg16(Reg16SP));
+                            _il.Emit(OpCodes.Stfld, _fieldIp);
+                            EmitAddReg16(Reg16SP, adjust);
+                            _il.Emit(OpCodes.Ldarg_0);
+                            _il.Emit(OpCodes.Ldc_I4_1);
+                            _il.Emit(OpCodes.Stfld, _fieldDidReturn);
+                            EmitConst(_executed);
+                            _il.Emit(OpCodes.Ret);
+                            break;
+                        }
+
+                    case 0xE0:
+                    case 0xE1:
+                    case 0xE2:
+                    case 0xE3:
+                        EmitLoop(op);
+                        break;
+
+                    case 0xE8:
+                        // CALL Jv
+                        EmitPush(() => EmitConst(_next));
+                        EmitExit((ushort)(_next + Iv));
+                        break;
+
+                    case 0xE9:
+                        // JMP Jv
+                        EmitExit((ushort)(_next + Iv));
+                        break;
+
+                    case 0xEB:
+                        // JMP Jb
+                        EmitExit((ushort)(_next + (sbyte)Ib));
+                        break;
+                }
+            }
+
+            // Bail out if the write invalidated any decoded code
+            if (_wroteMemory && Classify(_d) != Kind.Branch)
+            {
+                var unchanged = _il.DefineLabel();
+                _il.Emit(OpCodes.Ldarg_0);
+                _il.Emit(OpCodes.Ldfld, _fieldDecodeCache);
+                _il.Emit(OpCodes.Ldfld, _fieldGeneration);
+                _il.Emit(OpCodes.Ldloc, _generation);
+                _il.Emit(OpCodes.Beq, unchanged);
+                EmitExit(_next);
+                _il.MarkLabel(unchanged);
+            }
+        }
+
+        static bool HasModRM(byte opCode)
+        {
+            if (opCode < 0x40)
+                return (opCode & 7) < 4;
+
+            switch (opCode)
+            {
+                case 0x69: case 0x6B:
+                case 0x80: case 0x81: case 0x82: case 0x83:
+                case 0x84: case 0x85: case 0x86: case 0x87:
+                case 0x88: case 0x89: case 0x8A: case 0x8B: case 0x8D:
+                case 0xC0: case 0xC1: case 0xC6: case 0xC7:
+                case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+                case 0xF6: case 0xF7: case 0xFE: case 0xFF:
+                    return true;
+            }
+
+            return false;
+        }
+
+        void EmitAlu(int aluOp, int form)
+        {
+            switch (form)
+            {
+                case 0: EmitAluE(aluOp, true, () => EmitLoadG(true)); break;
+                case 1: EmitAluE(aluOp, false, () => EmitLoadG(false)); break;
+                case 2: EmitAluG(aluOp, true); break;
+                case 3: EmitAluG(aluOp, false); break;
+
+                case 4:
+                    {
+                        // AL, Ib
+                        var method = _alu8[aluOp];
+                        if (aluOp == AluCmp)
+                            EmitDiscard(method, () => EmitLoadReg8(Reg8AL), () => EmitConst(Ib));
+                        else
+                            EmitStoreReg8(Reg8AL, () => EmitCall(method, () => EmitLoadReg8(Reg8AL), () => EmitConst(Ib)));
+                        break;
+                    }
+
+                case 5:
+                    {
+                        // AX, Iv
+                        var method = _alu16[aluOp];
+                        if (aluOp == AluCmp)
+                            EmitDiscard(method, () => EmitLoadReg16(Reg16AX), () => EmitConst(Iv));
+                        else
+                            EmitStoreReg16(Reg16AX, () => EmitCall(method, () => EmitLoadReg16(Reg16AX), () => EmitConst(Iv)));
+                        break;
+                    }
+            }
+        }
+
+        // E = E op value
+        void EmitAluE(int aluOp, bool is8, Action value)
+        {
+            var method = is8 ? _alu8[aluOp] : _alu16[aluOp];
+            if (aluOp == AluCmp)
+                EmitDiscard(method, () => EmitLoadE(is8), value);
+            else
+                EmitStoreE(is8, () => EmitCall(method, () => EmitLoadE(is8), value));
+        }
+
+        // G = G op E
+        void EmitAluG(int aluOp, bool is8)
+        {
+            var method = is8 ? _alu8[aluOp] : _alu16[aluOp];
+            if (aluOp == AluCmp)
+                EmitDiscard(method, () => EmitLoadG(is8), () => EmitLoadE(is8));
+            else
+                EmitStoreG(is8, () => EmitCall(method, () => EmitLoadG(is8), () => EmitLoadE(is8)));
+        }
+
+        void EmitShift(int reg, bool is8, Action count)
+        {
+            var method = is8 ? _shift8[reg] : _shift16[reg];
+            EmitStoreE(is8, () => EmitCall(method, () => EmitLoadE(is8), count));
+        }
+
+        void EmitGroup3(int reg, bool is8)
+        {
+            switch (reg)
+            {
+                case 0:
+                    // TEST E, I
+                    if (is8)
+                        EmitDiscard(_and8, () => EmitLoadE(true), () => EmitConst(Ib));
+                    else
+                        EmitDiscard(_and16, () => EmitLoadE(false), () => EmitConst(Iv));
+                    break;
+
+                case 2:
+                    EmitStoreE(is8, () => EmitCall(is8 ? _not8 : _not16, () => EmitLoadE(is8)));
+                    break;
+
+                case 3:
+                    EmitStoreE(is8, () => EmitCall(is8 ? _neg8 : _neg16, () => EmitLoadE(is8)));
+                    break;
+
+                case 4:
+                case 5:
+                case 6:
+                case 7:
+                    {
+                        // MUL/IMUL/DIV/IDIV
+                        var method = is8 ? _muldiv8[reg - 4] : _muldiv16[reg - 4];
+                        bool isDivide = reg >= 6;
+                        if (is8)
+                        {
+                            // ax = op(al or ax, Eb)
+                            EmitStoreReg16(Reg16AX, () => EmitCall(method, () =>
+                            {
+                                if (isDivide)
+                                    EmitLoadReg16(Reg16AX);
+                                else
+                                    EmitLoadReg8(Reg8AL);
+                            }, () => EmitLoadE(true)));
+                        }
+                        else
+                        {
+                            // dxax = op(ax or dxax, Ev)
+                            _il.Emit(OpCodes.Ldarg_0);
+                            EmitCall(method, () =>
+                            {
+                                if (isDivide)
+                                {
+                                    _il.Emit(OpCodes.Ldarg_0);
+                                    _il.Emit(OpCodes.Call, _getDxAx);
+                                }
+                                else
+                                {
+                                    EmitLoadReg16(Reg16AX);
+                                }
+                            }, () => EmitLoadE(false));
+                            _il.Emit(OpCodes.Call, _setDxAx);
+                        }
+                        break;
+                    }
+            }
+        }
+
+        void EmitJcc(int condition)
+        {
+            // Evaluate the base condition, odd conditions are the inverse
+            switch (condition >> 1)
+            {
+                case 0: EmitFlag(_getFlagO); break;
+                case 1: EmitFlag(_getFlagC); break;
+                case 2: EmitFlag(_getFlagZ); break;
+                case 3: EmitFlag(_getFlagC); EmitFlag(_getFlagZ); _il.Emit(OpCodes.Or); break;
+                case 4: EmitFlag(_getFlagS); break;
+                case 5: EmitFlag(_getFlagP); break;
+                case 6: EmitFlag(_getFlagS); EmitFlag(_getFlagO); _il.Emit(OpCodes.Xor); break;
+                case 7: EmitFlag(_getFlagZ); EmitFlag(_getFlagS); EmitFlag(_getFlagO); _il.Emit(OpCodes.Xor); _il.Emit(OpCodes.Or); break;
+            }
+
+            var notTaken = _il.DefineLabel();
+            _il.Emit((condition & 1) == 0 ? OpCodes.Brfalse : OpCodes.Brtrue, notTaken);
+            EmitExit((ushort)(_next + (sbyte)Ib));
+            _il.MarkLabel(notTaken);
+            EmitExit(_next);
+        }
+
+        void EmitLoop(int op)
+        {
+            var notTaken = _il.DefineLabel();
+
+            if (op == 0xE3)
+            {
+                // JCXZ
+                EmitLoadReg16(Reg16CX);
+                _il.Emit(OpCodes.Brtrue, notTaken);
+            }
+            else
+            {
+                // LOOPNZ/LOOPZ/LOOP
+                EmitAddReg16(Reg16CX, -1);
+                EmitLoadReg16(Reg16CX);
+                _il.Emit(OpCodes.Brfalse, notTaken);
+                if (op != 0xE2)
+                {
+                    EmitFlag(_getFlagZ);
+                    _il.Emit(op == 0xE0 ? OpCodes.Brtrue : OpCodes.Brfalse, notTaken);
+                }
+            }
+
+            EmitExit((ushort)(_next + (sbyte)Ib));
+            _il.MarkLabel(notTaken);
+            EmitExit(_next);
+        }
+
+        #endregion
+
+        #region Flag Liveness
+
+        const uint StatusFlags = EFlag.CF | EFlag.PF | EFlag.AF | EFlag.ZF | EFlag.SF | EFlag.OF;
+
+        // For each instruction, whether all the flags it sets are overwritten
+        // before anything looks at them.  Everything is live at the end of the
+        // block, before anything that might fault (the fault handler sees the
+        // flags) and after anything that writes memory (the block might exit
+        // early).
+        static bool[] FindDeadFlags(List<DecodedInstruction> instructions)
+        {
+            var dead = new bool[instructions.Count];
+            uint live = StatusFlags;
+            for (int i = instructions.Count - 1; i >= 0; i--)
+            {
+                var d = instructions[i];
+                bool mightFault = MightFault(d);
+                if (mightFault)
+                    live = StatusFlags;
+
+                uint uses, defines;
+                GetFlagEffects(d, out uses, out defines);
+                dead[i] = defines != 0 && (live & defines) == 0;
+
+                live = (live & ~defines) | uses;
+                if (mightFault)
+                    live = StatusFlags;
+            }
+            return dead;
+        }
+
+        static void GetFlagEffects(DecodedInstruction d, out uint uses, out uint defines)
+        {
+            int op = d.opCode;
+            int reg = (d.modRM >> 3) & 7;
+            uses = 0;
+            defines = 0;
+
+            // ALU ops (ADC and SBB also read the carry)
+            int aluOp = -1;
+            if (op < 0x40)
+                aluOp = (op >> 3) & 7;
+            else if (op >= 0x80 && op < 0x84)
+                aluOp = reg;
+            if (aluOp >= 0)
+            {
+                defines = StatusFlags;
+                if (aluOp == 2 || aluOp == 3)
+                    uses = EFlag.CF;
+                return;
+            }
+
+            // INC/DEC leave the carry alone
+            if ((op >= 0x40 && op < 0x50) || ((op == 0xFE || op == 0xFF) && reg < 2))
+            {
+                defines = StatusFlags & ~EFlag.CF;
+                return;
+            }
+
+            switch (op)
+            {
+                case 0x84: case 0x85: case 0xA8: case 0xA9:
+                    // TEST
+                    defines = StatusFlags;
+                    return;
+
+                case 0xF6: case 0xF7:
+                    if (reg == 0 || reg == 3)
+                    {
+                        // TEST/NEG
+                        defines = StatusFlags;
+                        return;
+                    }
+                    if (reg == 2)
+                        return;             // NOT
+                    break;
+
+                case 0xF5:
+                    // CMC
+                    uses = EFlag.CF;
+                    defines = EFlag.CF;
+                    return;
+
+                case 0xF8: case 0xF9:
+                    // CLC/STC
+                    defines = EFlag.CF;
+                    return;
+
+                case 0x69: case 0x6B:
+                case 0xC0: case 0xC1: case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+                    // Multiplies and shifts, not worth modelling
+                    break;
+
+                default:
+                    // Branches look at the flags, everything else leaves them alone
+                    if (Classify(d) == Kind.Branch)
+                        break;
+                    return;
+            }
+
+            uses = StatusFlags;
+        }
+
+        static bool MightFault(DecodedInstruction d)
+        {
+            int op = d.opCode;
+            int reg = (d.modRM >> 3) & 7;
+
+            // Memory operands (LEA doesn't access memory)
+            if (HasModRM(d.opCode) && (d.modRM & 0xC0) != 0xC0 && op != 0x8D)
+                return true;
+
+            // Stack and direct memory accesses
+            if ((op >= 0x50 && op < 0x60) || (op >= 0xA0 && op < 0xA4))
+                return true;
+
+            switch (op)
+            {
+                case 0x68: case 0x6A: case 0xC2: case 0xC3: case 0xE8:
+                    return true;
+
+                case 0xF6: case 0xF7:
+                    return reg >= 6;        // DIV/IDIV
+
+                case 0xFF:
+                    return reg == 2 || reg == 6;
+            }
+
+            return false;
+        }
+
+        // ALU methods that can be replaced by plain arithmetic when their
+        // flags are dead
+        enum FlagFreeOp
+        {
+            Add,
+            Or,
+            Adc,
+            Sbb,
+            And,
+            Sub,
+            Xor,
+            Inc,
+            Dec,
+            Neg,
+        }
+
+        static readonly Dictionary<MethodInfo, FlagFreeOp> _flagFreeOps = BuildFlagFreeOps();
+
+        static Dictionary<MethodInfo, FlagFreeOp> BuildFlagFreeOps()
+        {
+            var ops = new Dictionary<MethodInfo, FlagFreeOp>();
+            foreach (var size in new[] { "8", "16" })
+            {
+                foreach (FlagFreeOp op in Enum.GetValues(typeof(FlagFreeOp)))
+                {
+                    ops.Add(Method(op.ToString() + size), op);
+                }
+            }
+            return ops;
+        }
+
+        void EmitFlagFree(MethodInfo method, FlagFreeOp op, Action a, Action b)
+        {
+            switch (op)
+            {
+                case FlagFreeOp.Add: a(); b(); _il.Emit(OpCodes.Add); break;
+                case FlagFreeOp.Or: a(); b(); _il.Emit(OpCodes.Or); break;
+                case FlagFreeOp.And: a(); b(); _il.Emit(OpCodes.And); break;
+                case FlagFreeOp.Sub: a(); b(); _il.Emit(OpCodes.Sub); break;
+                case FlagFreeOp.Xor: a(); b(); _il.Emit(OpCodes.Xor); break;
+                case FlagFreeOp.Adc: a(); b(); _il.Emit(OpCodes.Add); EmitFlag(_getFlagC); _il.Emit(OpCodes.Add); break;
+                case FlagFreeOp.Sbb: a(); b(); _il.Emit(OpCodes.Sub); EmitFlag(_getFlagC); _il.Emit(OpCodes.Sub); break;
+                case FlagFreeOp.Inc: a(); _il.Emit(OpCodes.Ldc_I4_1); _il.Emit(OpCodes.Add); break;
+                case FlagFreeOp.Dec: a(); _il.Emit(OpCodes.Ldc_I4_1); _il.Emit(OpCodes.Sub); break;
+                case FlagFreeOp.Neg: _il.Emit(OpCodes.Ldc_I4_0); a(); _il.Emit(OpCodes.Sub); break;
+            }
+
+            _il.Emit(method.ReturnType == typeof(byte) ? OpCodes.Conv_U1 : OpCodes.Conv_U2);
+        }
+
+        #endregion
+
+        #region Operands
+
+        // Immediate operands (immediates always come last in the instruction)
+        byte Ib
+        {
+            get { return _d.bytes[_d.opCodeLength + _d.modRMLength]; }
+        }
+
+        ushort Iv
+        {
+            get
+            {
+                int pos = _d.opCodeLength + _d.modRMLength;
+                return (ushort)(_d.bytes[pos] | _d.bytes[pos + 1] << 8);
+            }
+        }
+
+        // seg:ofs = effective address of the ModRM memory operand
+        void EmitEffectiveAddress()
+        {
+            int rm = _d.modRM & 7;
+            bool direct = (_d.modRM & 0xC0) == 0 && rm == 6;
+
+            // Segment
+            RegSeg seg = _d.prefixSegment;
+            if (seg == RegSeg.None)
+                seg = (rm == 2 || rm == 3 || (rm == 6 && !direct)) ? RegSeg.SS : RegSeg.DS;
+            EmitLoadSeg(seg);
+            _il.Emit(OpCodes.Stloc, _seg);
+
+            // Offset
+            if (direct)
+            {
+                EmitConst(_d.displacement);
+            }
+            else
+            {
+                switch (rm)
+                {
+                    case 0: EmitLoadReg16(Reg16BX); EmitLoadReg16(Reg16SI); _il.Emit(OpCodes.Add); break;
+                    case 1: EmitLoadReg16(Reg16BX); EmitLoadReg16(Reg16DI); _il.Emit(OpCodes.Add); break;
+                    case 2: EmitLoadReg16(Reg16BP); EmitLoadReg16(Reg16SI); _il.Emit(OpCodes.Add); break;
+                    case 3: EmitLoadReg16(Reg16BP); EmitLoadReg16(Reg16DI); _il.Emit(OpCodes.Add); break;
+                    case 4: EmitLoadReg16(Reg16SI); break;
+                    case 5: EmitLoadReg16(Reg16DI); break;
+                    case 6: EmitLoadReg16(Reg16BP); break;
+                    case 7: EmitLoadReg16(Reg16BX); break;
+                }
+
+                if (_d.displacement != 0)
+                {
+                    EmitConst(_d.displacement);
+                    _il.Emit(OpCodes.Add);
+                }
+            }
+            _il.Emit(OpCodes.Stloc, _ofs);
+        }
+
+        void EmitLoadE(bool is8)
+        {
+            if ((_d.modRM & 0xC0) == 0xC0)
+            {
+                if (is8)
+                    EmitLoadReg8(_d.modRM & 7);
+                else
+                    EmitLoadReg16(_d.modRM & 7);
+                return;
+            }
+
+            _il.Emit(OpCodes.Ldarg_0);
+            _il.Emit(OpCodes.Ldloc, _seg);
+            _il.Emit(OpCodes.Ldloc, _ofs);
+            if (is8)
+                _il.Emit(OpCodes.Call, _readByte);
+            else
+                _il.Emit(OpCodes.Call, _readWord);
+        }
+
+        void EmitStoreE(bool is8, Action value)
+        {
+            if ((_d.modRM & 0xC0) == 0xC0)
+            {
+                if (is8)
+                    EmitStoreReg8(_d.modRM & 7, value);
+                else
+                    EmitStoreReg16(_d.modRM & 7, value);
+                return;
+            }
+
+            Action seg = () => _il.Emit(OpCodes.Ldloc, _seg);
+            Action ofs = () => _il.Emit(OpCodes.Ldloc, _ofs);
+            if (is8)
+                EmitWriteByte(seg, ofs, value);
+            else
+                EmitWriteWord(seg, ofs, value);
+        }
+
+        void EmitLoadG(bool is8)
+        {
+            if (is8)
+                EmitLoadReg8((_d.modRM >> 3) & 7);
+            else
+                EmitLoadReg16((_d.modRM >> 3) & 7);
+        }
+
+        void EmitStoreG(bool is8, Action value)
+        {
+            if (is8)
+                EmitStoreReg8((_d.modRM >> 3) & 7, value);
+            else
+                EmitStoreReg16((_d.modRM >> 3) & 7, value);
+        }
+
+        #endregion
+
+        #region IL Helpers
+
+        void EmitConst(int value)
+        {
+            _il.Emit(OpCodes.Ldc_I4, value);
+        }
+
+        void EmitLoadReg16(int reg)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            _il.Emit(OpCodes.Ldfld, _reg16[reg]);
+        }
+
+        void EmitStoreReg16(int reg, Action value)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            value();
+            _il.Emit(OpCodes.Stfld, _reg16[reg]);
+        }
+
+        void EmitAddReg16(int reg, int delta)
+        {
+            EmitStoreReg16(reg, () =>
+            {
+                EmitLoadReg16(reg);
+                EmitConst(delta);
+                _il.Emit(OpCodes.Add);
+            });
+        }
+
+        void EmitLoadReg8(int reg)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            _il.Emit(OpCodes.Call, _reg8Get[reg]);
+        }
+
+        void EmitStoreReg8(int reg, Action value)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            value();
+            _il.Emit(OpCodes.Call, _reg8Set[reg]);
+        }
+
+        void EmitLoadSeg(RegSeg seg)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            switch (seg)
+            {
+                case RegSeg.ES: _il.Emit(OpCodes.Ldfld, _fieldES); break;
+                case RegSeg.CS: _il.Emit(OpCodes.Call, _getCS); break;
+                case RegSeg.SS: _il.Emit(OpCodes.Ldfld, _fieldSS); break;
+                case RegSeg.DS: _il.Emit(OpCodes.Ldfld, _fieldDS); break;
+            }
+        }
+
+        void EmitFlag(MethodInfo getter)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            _il.Emit(OpCodes.Call, getter);
+        }
+
+        // Call an ALU method, leaving the result on the stack
+        void EmitCall(MethodInfo method, Action a, Action b = null)
+        {
+            // Nothing will look at the flags, just do the arithmetic
+            FlagFreeOp op;
+            if (_flagsDead && _flagFreeOps.TryGetValue(method, out op))
+            {
+                EmitFlagFree(method, op, a, b);
+                return;
+            }
+
+            _il.Emit(OpCodes.Ldarg_0);
+            a();
+            if (b != null)
+                b();
+            _il.Emit(OpCodes.Call, method);
+        }
+
+        // Call an ALU method for its effect on the flags only
+        void EmitDiscard(MethodInfo method, Action a, Action b)
+        {
+            EmitCall(method, a, b);
+            _il.Emit(OpCodes.Pop);
+        }
+
+        void EmitReadByte(Action seg, Action offset)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            seg();
+            offset();
+            _il.Emit(OpCodes.Call, _readByte);
+        }
+
+        void EmitReadWord(Action seg, Action offset)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            seg();
+            offset();
+            _il.Emit(OpCodes.Call, _readWord);
+        }
+
+        void EmitWriteByte(Action seg, Action offset, Action value)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            seg();
+            offset();
+            value();
+            _il.Emit(OpCodes.Call, _writeByte);
+            _wroteMemory = true;
+        }
+
+        void EmitWriteWord(Action seg, Action offset, Action value)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            seg();
+            offset();
+            value();
+            _il.Emit(OpCodes.Call, _writeWord);
+            _wroteMemory = true;
+        }
+
+        void EmitPush(Action value)
+        {
+            EmitAddReg16(Reg16SP, -2);
+            EmitWriteWord(() => EmitLoadSeg(RegSeg.SS), () => EmitLoadReg16(Reg16SP), value);
+        }
+
+        // Leave the block continuing at a known address
+        void EmitExit(ushort ip)
+        {
+            EmitExit(() => EmitConst(ip));
+        }
+
+        // Leave the block continuing at a computed address
+        void EmitExit(Action ip)
+        {
+            _il.Emit(OpCodes.Ldarg_0);
+            ip();
+            _il.Emit(OpCodes.Stfld, _fieldIp);
+            EmitConst(_executed);
+            _il.Emit(OpCodes.Ret);
+        }
+
+        #endregion
+
+        #region Reflection
+
+        const int Reg16AX = 0;
+        const int Reg16CX = 1;
+        const int Reg16SP = 4;
+        const int Reg16BX = 3;
+        const int Reg16BP = 5;
+        const int Reg16SI = 6;
+        const int Reg16DI = 7;
+        const int Reg8AL = 0;
+        const int Reg8CL = 1;
+        const int AluCmp = 7;
+
+        const BindingFlags AllInstance = BindingFlags.Instance | BindingFlags.Public | BindingFlags.NonPublic;
+
+        static FieldInfo Field(Type type, string name)
+        {
+            return type.GetField(name, AllInstance);
+        }
+
+        static MethodInfo Method(string name)
+        {
+            return typeof(ALU).GetMethod(name, AllInstance);
+        }
+
+        static MethodInfo Getter(string name)
+        {
+            return typeof(CPU).GetProperty(name).GetGetMethod(true);
+        }
+
+        static MethodInfo Setter(string name)
+        {
+            return typeof(CPU).GetProperty(name).GetSetMethod(true);
+        }
+
+        // Register fields and properties, indexed by their ModRM encoding
+        static readonly FieldInfo[] _reg16 = new[] { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" }.Select(x => Field(typeof(CPU), x)).ToArray();
+        static readonly MethodInfo[] _reg8Get = new[] { "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh" }.Select(x => Getter(x)).ToArray();
+        static readonly MethodInfo[] _reg8Set = new[] { "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh" }.Select(x => Setter(x)).ToArray();
+
+        static readonly FieldInfo _fieldES = Field(typeof(CPU), "es");
+        static readonly FieldInfo _fieldSS = Field(typeof(CPU), "ss");
+        static readonly FieldInfo _fieldDS = Field(typeof(CPU), "ds");
+        static readonly MethodInfo _getCS = Getter("cs");
+        static readonly FieldInfo _fieldIp = Field(typeof(CPU), "ip");
+        static readonly FieldInfo _fieldIpInstruction = Field(typeof(CPU), "_ipInstruction");
+        static readonly FieldInfo _fieldDidReturn = Field(typeof(CPU), "_didReturn");
+        static readonly FieldInfo _fieldDecodeCache = Field(typeof(CPU), "_decodeCache");
+        static readonly FieldInfo _fieldGeneration = Field(typeof(DecodeCache), "Generation");
+        static readonly FieldInfo _fieldFlagD = Field(typeof(ALU), "FlagD");
+        static readonly MethodInfo _getDxAx = Getter("dxax");
+        static readonly MethodInfo _setDxAx = Setter("dxax");
+
+        static readonly MethodInfo _getFlagO = typeof(ALU).GetProperty("FlagO").GetGetMethod();
+        static readonly MethodInfo _getFlagC = typeof(ALU).GetProperty("FlagC").GetGetMethod();
+        static readonly MethodInfo _setFlagC = typeof(ALU).GetProperty("FlagC").GetSetMethod();
+        static readonly MethodInfo _getFlagZ = typeof(ALU).GetProperty("FlagZ").GetGetMethod();
+        static readonly MethodInfo _getFlagS = typeof(ALU).GetProperty("FlagS").GetGetMethod();
+        static readonly MethodInfo _getFlagP = typeof(ALU).GetProperty("FlagP").GetGetMethod();
+
+        static readonly MethodInfo _readByte = typeof(CPU).GetMethod("ReadMemByte", AllInstance);
+        static readonly MethodInfo _writeByte = typeof(CPU).GetMethod("WriteMemByte", AllInstance);
+        static readonly MethodInfo _readWord = typeof(CPU).GetMethod("ReadMemWord", AllInstance);
+        static readonly MethodInfo _writeWord = typeof(CPU).GetMethod("WriteMemWord", AllInstance);
+
+        // ALU methods indexed by the opcode's operation (ADD OR ADC SBB AND SUB XOR CMP)
+        static readonly MethodInfo[] _alu8 = new[] { "Add8", "Or8", "Adc8", "Sbb8", "And8", "Sub8", "Xor8", "Sub8" }.Select(x => Method(x)).ToArray();
+        static readonly MethodInfo[] _alu16 = new[] { "Add16", "Or16", "Adc16", "Sbb16", "And16", "Sub16", "Xor16", "Sub16" }.Select(x => Method(x)).ToArray();
+
+        // Shifts indexed by the GRP2 reg field (6 is invalid)
+        static readonly MethodInfo[] _shift8 = new[] { "Rol8", "Ror8", "Rcl8", "Rcr8", "Shl8", "Shr8", null, "Sar8" }.Select(x => x == null ? null : Method(x)).ToArray();
+        static readonly MethodInfo[] _shift16 = new[] { "Rol16", "Ror16", "Rcl16", "Rcr16", "Shl16", "Shr16", null, "Sar16" }.Select(x => x == null ? null : Method(x)).ToArray();
+
+        // MUL IMUL DIV IDIV
+        static readonly MethodInfo[] _muldiv8 = new[] { "Mul8", "IMul8", "Div8", "IDiv8" }.Select(x => Method(x)).ToArray();
+        static readonly MethodInfo[] _muldiv16 = new[] { "Mul16", "IMul16", "Div16", "IDiv16" }.Select(x => Method(x)).ToArray();
+
+        static readonly MethodInfo _and8 = Method("And8");
+        static readonly MethodInfo _and16 = Method("And16");
+        static readonly MethodInfo _inc8 = Method("Inc8");
+        static readonly MethodInfo _dec8 = Method("Dec8");
+        static readonly MethodInfo _inc16 = Method("Inc16");
+        static readonly MethodInfo _dec16 = Method("Dec16");
+        static readonly MethodInfo _not8 = Method("Not8");
+        static readonly MethodInfo _not16 = Method("Not16");
+        static readonly MethodInfo _neg8 = Method("Neg8");
+        static readonly MethodInfo _neg16 = Method("Neg16");
+        static readonly MethodInfo _imul16 = Method("IMul16");
+        static readonly MethodInfo _cbw = Method("Cbw");
+        static readonly MethodInfo _cwd = Method("Cwd");
+
+        #endregion
+
+        // Translation state
+        ILGenerator _il;
+        LocalBuilder _generation;
+        LocalBuilder _seg;
+        LocalBuilder _ofs;
+        LocalBuilder _temp;
+        DecodedInstruction _d;              // Instruction being translated
+        ushort _address;                    // Its address
+        ushort _next;                       // Address of the following instruction
+        int _executed;                      // Instruction count if the block exits after this one
+        bool _wroteMemory;                  // Current instruction writes memory
+        bool _flagsDead;                    // Nothing looks at the flags it sets
+    }
+}
@@ -153,6 +153,8 @@ namespace Sharp86
             ss = 0;
             es = 0;
             EFlags = 0;
+            if (_fpu != null)
+                _fpu.Reset();
         }
 
         IMemoryBus _memoryBus;
@@ -164,6 +166,9 @@ namespace Sharp86
                 System.Diagnostics.Debug.Assert(_activeMemoryBus == null);
                 _memoryBus = value;
                 _activeMemoryBus = value;
+                _segmentViewProvider = value as ISegmentViewProvider;
+                _segmentViewTable = _segmentViewProvider != null ? new SegmentView[SegmentViewCount] : null;
+                UpdateSegmentViews();
             }
         }
 
@@ -171,15 +176,987 @@ namespace Sharp86
         public IMemoryBus ActiveMemoryBus
         {
             get { return _activeMemoryBus; }
-            set { _activeMemoryBus = value; }
+            set
+            {
+                _activeMemoryBus = value;
+                UpdateSegmentViews();
+            }
+        }
+
+        IPortBus _portBus;
+        public IPortBus PortBus
+        {
+            get { return _portBus; }
+            set { _portBus = value; }
+        }
+
+        #region Decode Cache
+        // When enabled, decoded instructions are cached per code selector and
+        // re-used until invalidated.  The memory bus owner must call one of the
+        // InvalidateDecodeCache methods whenever code memory is modified or a
+        // selector is re-assigned - so this is only suitable for buses where
+        // segments don't overlap (ie: protected mode style selectors)
+        DecodeCache _decodeCache;
+        public bool EnableDecodeCache
+        {
+            get { return _decodeCache != null; }
+            set
+            {
+                if (value == EnableDecodeCache)
+                    return;
+                _decodeCache = value ? new DecodeCache() : null;
+            }
+        }
+
+        public void InvalidateDecodeCache()
+        {
+            if (_decodeCache != null)
+                _decodeCache.Invalidate();
+        }
+
+        public void InvalidateDecodeCache(ushort selector)
+        {
+            if (_decodeCache != null)
+                _decodeCache.Invalidate(selector);
+        }
+
+        public void InvalidateDecodeCache(ushort selector, ushort offset)
+        {
+            if (_decodeCache != null)
+                _decodeCache.Invalidate(selector, offset);
+        }
+        #endregion
+
+        #region Segment Views
+        // When the memory bus implements ISegmentViewProvider, memory is read
+        // and written directly through a view of each selector's buffer.  Views
+        // are fetched on first use and kept until the bus invalidates them, so
+        // the cost is the same however often segment registers are reloaded.
+        // Views aren't used while the debugger has its own bus installed.
+        const int SegmentViewCount = 0x10000 >> 3;
+        static readonly SegmentView _noSegmentView = new SegmentView();
+        ISegmentViewProvider _segmentViewProvider;
+        SegmentView[] _segmentViewTable;    // Indexed by selector index
+        SegmentView[] _segmentViews;        // Same, but null when not in use
+
+        void UpdateSegmentViews()
+        {
+            _segmentViews = _activeMemoryBus == _memoryBus ? _segmentViewTable : null;
+        }
+
+        public void InvalidateSegmentViews()
+        {
+            if (_segmentViewTable != null)
+                Array.Clear(_segmentViewTable, 0, _segmentViewTable.Length);
+        }
+
+        public void InvalidateSegmentView(ushort selector)
+        {
+            if (_segmentViewTable != null)
+                _segmentViewTable[selector >> 3] = null;
+        }
+
+        [MethodImpl(MethodImplOptions.AggressiveInlining)]
+        SegmentView GetSegmentView(ushort seg)
+        {
+            var view = _segmentViews[seg >> 3];
+            if (view == null)
+            {
+                view = new SegmentView();
+                if (!_segmentViewProvider.GetSegmentView(seg, view))
+                    view = _noSegmentView;
+                _segmentViews[seg >> 3] = view;
+            }
+            return view;
+        }
+
+        [MethodImpl(MethodImplOptions.AggressiveInlining)]
+        internal byte ReadMemByte(ushort seg, ushort offset)
+        {
+            if (_segmentViews != null)
+            {
+                var view = GetSegmentView(seg);
+                if (offset < view.readLimit)
+                    return view.buffer[view.baseOffset + offset];
+            }
+            return _activeMemoryBus.ReadByte(seg, offset);
+        }
+
+        [MethodImpl(MethodImplOptions.AggressiveInlining)]
+        internal void WriteMemByte(ushort seg, ushort offset, byte value)
+        {
+            if (_segmentViews != null)
+            {
+                var view = GetSegmentView(seg);
+                if (offset < view.writeLimit)
+                {
+                    view.buffer[view.baseOffset + offset] = value;
+                    return;
+                }
+            }
+            _activeMemoryBus.WriteByte(seg, offset, value);
+        }
+
+        [MethodImpl(MethodImplOptions.AggressiveInlining)]
+        internal ushort ReadMemWord(ushort seg, ushort offset)
+        {
+            if (_segmentViews != null)
+            {
+                var view = GetSegmentView(seg);
+                if (offset + 1 < view.readLimit)
+                {
+                    // Indexing the high byte bounds checks the whole word
+                    unsafe
+                    {
+                        fixed (byte* p = &view.buffer[view.baseOffset + offset + 1])
+                        {
+                            return *(ushort*)(p - 1);
+                        }
+                    }
+                }
+            }
+            return _activeMemoryBus.ReadWord(seg, offset);
+        }
+
+        [MethodImpl(MethodImplOptions.AggressiveInlining)]
+        internal void WriteMemWord(ushort seg, ushort offset, ushort value)
+        {
+            if (_segmentViews != null)
+            {
+                var view = GetSegmentView(seg);
+                if (offset + 1 < view.writeLimit)
+                {
+                    unsafe
+                    {
+                        fixed (byte* p = &view.buffer[view.baseOffset + offset + 1])
+                        {
+                            *(ushort*)(p - 1) = value;
+                        }
+                    }
+                    return;
+                }
+            }
+            _activeMemoryBus.WriteWord(seg, offset, value);
+        }
+        #endregion
+
+        #region Bulk String Operations
+        // REP MOVS/STOS/SCAS/CMPS work directly on the segment view buffers
+        // when every element lies within the views, so nothing can fault part
+        // way through and the registers can be updated in one go.  Otherwise,
+        // or when a debugger or hook is attached, the caller falls back to
+        // running the instruction an element at a time.  Either way the whole
+        // instruction counts as one towards CpuTime.
+        [MethodImpl(MethodImplOptions.AggressiveInlining)]
+        bool CanRunBulk()
+        {
+            return _segmentViews != null && !_instrumented;
+        }
+
+        // Work out the first byte touched by count elements starting at offset
+        // and moving in the direction of FlagD.  Fails if the range wraps the
+        // segment or runs past limit.
+        bool GetStringRange(ushort offset, int count, int size, int limit, out int start)
+        {
+            int bytes = count * size;
+            start = FlagD ? offset - bytes + size : offset;
+            return start >= 0 && start + bytes <= limit;
+        }
+
+        [MethodImpl(MethodImplOptions.AggressiveInlining)]
+        static ushort ReadElement(byte[] buffer, int pos, int size)
+        {
+            return size == 1 ? buffer[pos] : (ushort)(buffer[pos] | buffer[pos + 1] << 8);
+        }
+
+        bool BulkMovs(int size)
+        {
+            if (!CanRunBulk())
+                return false;
+
+            int count = cx;
+            var src = GetSegmentView(ResolveSegmentPtr(RegSeg.DS));
+            var dst = GetSegmentView(es);
+            int srcStart, dstStart;
+            if (!GetStringRange(si, count, size, src.readLimit, out srcStart) ||
+                !GetStringRange(di, count, size, dst.writeLimit, out dstStart))
+                return false;
+
+            int bytes = count * size;
+            srcStart += src.baseOffset;
+            dstStart += dst.baseOffset;
+
+            if (src.buffer == dst.buffer && srcStart < dstStart + bytes && dstStart < srcStart + bytes)
+            {
+                // Overlapping, copy an element at a time so that code relying
+                // on the copy repeating a pattern gets the same result
+                var buffer = src.buffer;
+                int step = FlagD ? -size : size;
+                int s = src.baseOffset + si;
+                int d = dst.baseOffset + di;
+                for (int i = 0; i < count; i++)
+                {
+                    if (size == 1)
+                    {
+                        buffer[d] = buffer[s];
+                    }
+                    else
+                    {
+                        byte lo = buffer[s];
+                        byte hi = buffer[s + 1];
+                        buffer[d] = lo;
+                        buffer[d + 1] = hi;
+                    }
+                    s += step;
+                    d += step;
+                }
+            }
+            else
+            {
+                Buffer.BlockCopy(src.buffer, srcStart, dst.buffer, dstStart, bytes);
+            }
+
+            if (FlagD)
+                bytes = -bytes;
+            si = (ushort)(si + bytes);
+            di = (ushort)(di + bytes);
+            cx = 0;
+            return true;
+        }
+
+        bool BulkStos(int size)
+        {
+            if (!CanRunBulk())
+                return false;
+
+            int count = cx;
+            var dst = GetSegmentView(es);
+            int start;
+            if (!GetStringRange(di, count, size, dst.writeLimit, out start))
+                return false;
+
+            // Every element is the same so direction doesn't matter
+            var buffer = dst.buffer;
+            int bytes = count * size;
+            start += dst.baseOffset;
+            int end = start + bytes;
+            if (size == 1)
+            {
+                byte value = al;
+                for (int i = start; i < end; i++)
+                {
+                    buffer[i] = value;
+                }
+            }
+            else
+            {
+                byte lo = al;
+                byte hi = ah;
+                for (int i = start; i < end; i += 2)
+                {
+                    buffer[i] = lo;
+                    buffer[i + 1] = hi;
+                }
+            }
+
+            di = (ushort)(di + (FlagD ? -bytes : bytes));
+            cx = 0;
+            return true;
+        }
+
+        bool BulkScas(int size)
+        {
+            if (!CanRunBulk())
+                return false;
+
+            int count = cx;
+            var view = GetSegmentView(es);
+            int start;
+            if (!GetStringRange(di, count, size, view.readLimit, out start))
+                return false;
+
+            // Find the element the scan stops on (REPNE stops on a match, REPE
+            // on a mismatch) or the last one if it runs out
+            var buffer = view.buffer;
+            ushort value = size == 1 ? al : ax;
+            int step = FlagD ? -size : size;
+            int pos = view.baseOffset + di;
+            int executed;
+            if (size == 1 && _prefixRepNE && !FlagD)
+            {
+                int index = Array.IndexOf(buffer, al, pos, count);
+                executed = index < 0 ? count : index - pos + 1;
+                pos += executed - 1;
+            }
+            else
+            {
+                executed = 1;
+                while ((ReadElement(buffer, pos, size) == value) != _prefixRepNE && executed < count)
+                {
+                    pos += step;
+                    executed++;
+                }
+            }
+
+            // Flags are those of the last comparison
+            if (size == 1)
+                Sub8(al, buffer[pos]);
+            else
+                Sub16(ax, ReadElement(buffer, pos, 2));
+
+            di = (ushort)(di + step * executed);
+            cx = (ushort)(count - executed);
+            return true;
+        }
+
+        bool BulkCmps(int size)
+        {
+            if (!CanRunBulk())
+                return false;
+
+            int count = cx;
+            var src = GetSegmentView(ResolveSegmentPtr(RegSeg.DS));
+            var dst = GetSegmentView(es);
+            int srcStart, dstStart;
+            if (!GetStringRange(si, count, size, src.readLimit, out srcStart) ||
+                !GetStringRange(di, count, size, dst.readLimit, out dstStart))
+                return false;
+
+            var srcBuffer = src.buffer;
+            var dstBuffer = dst.buffer;
+            int step = FlagD ? -size : size;
+            int s = src.baseOffset + si;
+            int d = dst.baseOffset + di;
+            int executed = 1;
+            while ((ReadElement(srcBuffer, s, size) == ReadElement(dstBuffer, d, size)) != _prefixRepNE && executed < count)
+            {
+                s += step;
+                d += step;
+                executed++;
+            }
+
+            // Flags are those of the last comparison
+            if (size == 1)
+                Sub8(srcBuffer[s], dstBuffer[d]);
+            else
+                Sub16(ReadElement(srcBuffer, s, 2), ReadElement(dstBuffer, d, 2));
+
+            si = (ushort)(si + step * executed);
+            di = (ushort)(di + step * executed);
+            cx = (ushort)(count - executed);
+            return true;
+        }
+        #endregion
+
+        #region Floating Point
+        // When enabled the ESC opcodes (D8-DF) are executed by a native x87
+        // FPU, otherwise they raise invalid opcode the same as a machine
+        // without a coprocessor.  Memory operands are decoded here and moved
+        // in and out of the FPU, which only deals in doubles.
+        FPU _fpu;
+        public bool EnableFpu
+        {
+            get { return _fpu != null; }
+            set
+            {
+                if (value == EnableFpu)
+                    return;
+                _fpu = value ? new FPU() : null;
+            }
+        }
+
+        public FPU Fpu
+        {
+            get { return _fpu; }
+        }
+
+        uint ReadMemDWord(ushort seg, ushort offset)
+        {
+            return (uint)(ReadMemWord(seg, offset) | ReadMemWord(seg, (ushort)(offset + 2)) << 16);
+        }
+
+        void WriteMemDWord(ushort seg, ushort offset, uint value)
+        {
+            WriteMemWord(seg, offset, (ushort)value);
+            WriteMemWord(seg, (ushort)(offset + 2), (ushort)(value >> 16));
+        }
+
+        ulong ReadMemQWord(ushort seg, ushort offset)
+        {
+            return ReadMemDWord(seg, offset) | (ulong)ReadMemDWord(seg, (ushort)(offset + 4)) << 32;
+        }
+
+        void WriteMemQWord(ushort seg, ushort offset, ulong value)
+        {
+            WriteMemDWord(seg, offset, (uint)value);
+            WriteMemDWord(seg, (ushort)(offset + 4), (uint)(value >> 32));
+        }
+
+        double Read_Real32()
+        {
+            uint bits = ReadMemDWord(_modRMSeg, _modRMOffset);
+            unsafe
+            {
+                return *(float*)&bits;
+            }
+        }
+
+        void Write_Real32(double value)
+        {
+            float single = (float)value;
+            unsafe
+            {
+                WriteMemDWord(_modRMSeg, _modRMOffset, *(uint*)&single);
+            }
+        }
+
+        double Read_Real64()
+        {
+            return BitConverter.Int64BitsToDouble((long)ReadMemQWord(_modRMSeg, _modRMOffset));
+        }
+
+        void Write_Real64(double value)
+        {
+            WriteMemQWord(_modRMSeg, _modRMOffset, (ulong)BitConverter.DoubleToInt64Bits(value));
+        }
+
+        // TBYTE operands (extended real and packed BCD) as the low 8 bytes and high word
+        void Read_TByte(ushort offset, out ulong low, out ushort high)
+        {
+            low = ReadMemQWord(_modRMSeg, offset);
+            high = ReadMemWord(_modRMSeg, (ushort)(offset + 8));
+        }
+
+        void Write_TByte(ushort offset, ulong low, ushort high)
+        {
+            WriteMemQWord(_modRMSeg, offset, low);
+            WriteMemWord(_modRMSeg, (ushort)(offset + 8), high);
+        }
+
+        double Read_Real80(ushort offset)
+        {
+            ulong low;
+            ushort high;
+            Read_TByte(offset, out low, out high);
+            return FPU.FromExtended(low, high);
+        }
+
+        void Write_Real80(ushort offset, double value)
+        {
+            ulong low;
+            ushort high;
+            FPU.ToExtended(value, out low, out high);
+            Write_TByte(offset, low, high);
+        }
+
+        // FADD, FMUL, FCOM, FCOMP, FSUB, FSUBR, FDIV, FDIVR with a memory operand
+        void FpuArithmetic(int reg, double value)
+        {
+            switch (reg)
+            {
+                case 2:
+                    _fpu.Compare(value, false);
+                    break;
+
+                case 3:
+                    _fpu.Compare(value, false);
+                    _fpu.Pop();
+                    break;
+
+                default:
+                    _fpu.Arithmetic(reg, value);
+                    break;
+            }
+        }
+
+        // FLDENV/FSTENV, 16-bit protected mode layout
+        const int FpuEnvironmentSize = 14;
+
+        void LoadFpuEnvironment()
+        {
+            _fpu.ControlWord = ReadMemWord(_modRMSeg, _modRMOffset);
+            _fpu.StatusWord = ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 2));
+            _fpu.TagWord = ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 4));
+            _fpu.InstructionOffset = ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 6));
+            _fpu.InstructionSelector = ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 8));
+            _fpu.OperandOffset = ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 10));
+            _fpu.OperandSelector = ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 12));
+        }
+
+        void StoreFpuEnvironment()
+        {
+            WriteMemWord(_modRMSeg, _modRMOffset, _fpu.ControlWord);
+            WriteMemWord(_modRMSeg, (ushort)(_modRMOffset + 2), _fpu.StatusWord);
+            WriteMemWord(_modRMSeg, (ushort)(_modRMOffset + 4), _fpu.TagWord);
+            WriteMemWord(_modRMSeg, (ushort)(_modRMOffset + 6), _fpu.InstructionOffset);
+            WriteMemWord(_modRMSeg, (ushort)(_modRMOffset + 8), _fpu.InstructionSelector);
+            WriteMemWord(_modRMSeg, (ushort)(_modRMOffset + 10), _fpu.OperandOffset);
+            WriteMemWord(_modRMSeg, (ushort)(_modRMOffset + 12), _fpu.OperandSelector);
+        }
+
+        // FRSTOR/FSAVE, the environment followed by ST(0) to ST(7)
+        void LoadFpuState()
+        {
+            LoadFpuEnvironment();
+            for (int i = 0; i < 8; i++)
+            {
+                double value = Read_Real80((ushort)(_modRMOffset + FpuEnvironmentSize + i * 10));
+                _fpu.SetPhysicalRegister(_fpu.Top + i, value);
+            }
+        }
+
+        void StoreFpuState()
+        {
+            StoreFpuEnvironment();
+            for (int i = 0; i < 8; i++)
+            {
+                double value = _fpu.GetPhysicalRegister(_fpu.Top + i);
+                Write_Real80((ushort)(_modRMOffset + FpuEnvironmentSize + i * 10), value);
+            }
+            _fpu.Reset();
+        }
+
+        void ExecuteFpu(byte opCode)
+        {
+            if (_fpu == null)
+                throw new InvalidOpCodeException();
+
+            ReadModRM();
+            int reg = (_modRM >> 3) & 7;
+
+            if (_modRMIsPointer)
+                ExecuteFpuMemory(opCode, reg);
+            else
+                ExecuteFpuRegister(opCode, reg, _modRM & 7);
+        }
+
+        void ExecuteFpuMemory(byte opCode, int reg)
+        {
+            // The control instructions (D9 /4-7 and DD /4-7) don't update
+            // the last instruction and operand pointers
+            if (reg < 4 || (opCode != 0xD9 && opCode != 0xDD))
+            {
+                _fpu.InstructionSelector = cs;
+                _fpu.InstructionOffset = _ipInstruction;
+                _fpu.OperandSelector = _modRMSeg;
+                _fpu.OperandOffset = _modRMOffset;
+            }
+
+            switch (opCode)
+            {
+                case 0xD8:
+                    // m32real arithmetic
+                    FpuArithmetic(reg, Read_Real32());
+                    break;
+
+                case 0xD9:
+                    switch (reg)
+                    {
+                        case 0:
+                            // FLD m32real
+                            _fpu.Push(Read_Real32());
+                            break;
+
+                        case 2:
+                            // FST m32real
+                            Write_Real32(_fpu.Get(0));
+                            break;
+
+                        case 3:
+                            // FSTP m32real
+                            Write_Real32(_fpu.Get(0));
+                            _fpu.Pop();
+                            break;
+
+                        case 4:
+                            // FLDENV
+                            LoadFpuEnvironment();
+                            break;
+
+                        case 5:
+                            // FLDCW
+                            _fpu.ControlWord = ReadMemWord(_modRMSeg, _modRMOffset);
+                            break;
+
+                        case 6:
+                            // FSTENV
+                            StoreFpuEnvironment();
+                            break;
+
+                        case 7:
+                            // FSTCW
+                            WriteMemWord(_modRMSeg, _modRMOffset, _fpu.ControlWord);
+                            break;
+
+                        default:
+                            throw new InvalidOpCodeException();
+                    }
+                    break;
+
+                case 0xDA:
+                    // m32int arithmetic
+                    FpuArithmetic(reg, (int)ReadMemDWord(_modRMSeg, _modRMOffset));
+                    break;
+
+                case 0xDB:
+                    switch (reg)
+                    {
+                        case 0:
+                            // FILD m32int
+                            _fpu.Push((int)ReadMemDWord(_modRMSeg, _modRMOffset));
+                            break;
+
+                        case 2:
+                            // FIST m32int
+                            WriteMemDWord(_modRMSeg, _modRMOffset, (uint)_fpu.ToInteger(_fpu.Get(0), 2147483648.0));
+                            break;
+
+                        case 3:
+                            // FISTP m32int
+                            WriteMemDWord(_modRMSeg, _modRMOffset, (uint)_fpu.ToInteger(_fpu.Get(0), 2147483648.0));
+                            _fpu.Pop();
+                            break;
+
+                        case 5:
+                            // FLD m80real
+                            _fpu.Push(Read_Real80(_modRMOffset));
+                            break;
+
+                        case 7:
+                            // FSTP m80real
+                            Write_Real80(_modRMOffset, _fpu.Get(0));
+                            _fpu.Pop();
+                            break;
+
+                        default:
+                            throw new InvalidOpCodeException();
+                    }
+                    break;
+
+                case 0xDC:
+                    // m64real arithmetic
+                    FpuArithmetic(reg, Read_Real64());
+                    break;
+
+                case 0xDD:
+                    switch (reg)
+                    {
+                        case 0:
+                            // FLD m64real
+                            _fpu.Push(Read_Real64());
+                            break;
+
+                        case 2:
+                            // FST m64real
+                            Write_Real64(_fpu.Get(0));
+                            break;
+
+                        case 3:
+                            // FSTP m64real
+                            Write_Real64(_fpu.Get(0));
+                            _fpu.Pop();
+                            break;
+
+                        case 4:
+                            // FRSTOR
+                            LoadFpuState();
+                            break;
+
+                        case 6:
+                            // FSAVE
+                            StoreFpuState();
+                            break;
+
+                        case 7:
+                            // FSTSW m16
+                            WriteMemWord(_modRMSeg, _modRMOffset, _fpu.StatusWord);
+                            break;
+
+                        default:
+                            throw new InvalidOpCodeException();
+                    }
+                    break;
+
+                case 0xDE:
+                    // m16int arithmetic
+                    FpuArithmetic(reg, (short)ReadMemWord(_modRMSeg, _modRMOffset));
+                    break;
+
+                case 0xDF:
+                    switch (reg)
+                    {
+                        case 0:
+                            // FILD m16int
+                            _fpu.Push((short)ReadMemWord(_modRMSeg, _modRMOffset));
+                            break;
+
+                        case 2:
+                            // FIST m16int
+                            WriteMemWord(_modRMSeg, _modRMOffset, (ushort)_fpu.ToInteger(_fpu.Get(0), 32768.0));
+                            break;
+
+                        case 3:
+                            // FISTP m16int
+                            WriteMemWord(_modRMSeg, _modRMOffset, (ushort)_fpu.ToInteger(_fpu.Get(0), 32768.0));
+                            _fpu.Pop();
+                            break;
+
+                        case 4:
+                        {
+                            // FBLD m80bcd
+                            ulong low;
+                            ushort high;
+                            Read_TByte(_modRMOffset, out low, out high);
+                            _fpu.Push(FPU.FromBcd(low, high));
+                            break;
+                        }
+
+                        case 5:
+                            // FILD m64int
+                            _fpu.Push((long)ReadMemQWord(_modRMSeg, _modRMOffset));
+                            break;
+
+                        case 6:
+                        {
+                            // FBSTP m80bcd
+                            ulong low;
+                            ushort high;
+                            _fpu.ToBcd(_fpu.Get(0), out low, out high);
+                            Write_TByte(_modRMOffset, low, high);
+                            _fpu.Pop();
+                            break;
+                        }
+
+                        case 7:
+                            // FISTP m64int
+                            WriteMemQWord(_modRMSeg, _modRMOffset, (ulong)_fpu.ToInteger(_fpu.Get(0), 9223372036854775808.0));
+                            _fpu.Pop();
+                            break;
+
+                        default:
+                            throw new InvalidOpCodeException();
+                    }
+                    break;
+            }
+        }
+
+        void ExecuteFpuRegister(byte opCode, int reg, int i)
+        {
+            switch (opCode)
+            {
+                case 0xD8:
+                    // FADD..FDIVR ST(0), ST(i)
+                    switch (reg)
+                    {
+                        case 2:
+                            // FCOM ST(i)
+                            _fpu.Compare(_fpu.Get(i), false);
+                            break;
+
+                        case 3:
+                            // FCOMP ST(i)
+                            _fpu.Compare(_fpu.Get(i), false);
+                            _fpu.Pop();
+                            break;
+
+                        default:
+                            _fpu.Arithmetic(reg, 0, i);
+                            break;
+                    }
+                    break;
+
+                case 0xD9:
+                    switch (reg)
+                    {
+                        case 0:
+                            // FLD ST(i)
+                            _fpu.Push(_fpu.Get(i));
+                            break;
+
+                        case 1:
+                            // FXCH ST(i)
+                            _fpu.Exchange(i);
+                            break;
+
+                        case 2:
+                            // FNOP
+                            if (i != 0)
+                                throw new InvalidOpCodeException();
+                            break;
+
+                        case 4:
+                            switch (i)
+                            {
+                                case 0:
+                                    // FCHS
+                                case 1:
+                                    // FABS
+                                    _fpu.Execute(_modRM);
+                                    break;
+
+                                case 4:
+                                    // FTST
+                                    _fpu.Compare(0.0, false);
+                                    break;
+
+                                case 5:
+                                    // FXAM
+                                    _fpu.Examine();
+                                    break;
+
+                                default:
+                                    throw new InvalidOpCodeException();
+                            }
+                            break;
+
+                        case 5:
+                            // FLD1, FLDL2T, FLDL2E, FLDPI, FLDLG2, FLDLN2, FLDZ
+                            if (i == 7)
+                                throw new InvalidOpCodeException();
+                            _fpu.Push(FPU.Constants[i]);
+                            break;
+
+                        case 6:
+                            if (i == 6)
+                                _fpu.DecrementTop();        // FDECSTP
+                            else if (i == 7)
+                                _fpu.IncrementTop();        // FINCSTP
+                            else
+                                _fpu.Execute(_modRM);
+                            break;
+
+                        case 7:
+                            _fpu.Execute(_modRM);
+                            break;
+
+                        default:
+                            throw new InvalidOpCodeException();
+                    }
+                    break;
+
+                case 0xDA:
+                    // FUCOMPP
+                    if (_modRM != 0xE9)
+                        throw new InvalidOpCodeException();
+                    _fpu.Compare(_fpu.Get(1), true);
+                    _fpu.Pop();
+                    _fpu.Pop();
+                    break;
+
+                case 0xDB:
+                    switch (_modRM)
+                    {
+                        case 0xE0:
+                            // FENI (8087 only)
+                        case 0xE1:
+                            // FDISI (8087 only)
+                        case 0xE4:
+                            // FSETPM (287 only)
+                            break;
+
+                        case 0xE2:
+                            // FCLEX
+                            _fpu.ClearExceptions();
+                            break;
+
+                        case 0xE3:
+                            // FINIT
+                            _fpu.Reset();
+                            break;
+
+                        default:
+                            throw new InvalidOpCodeException();
+                    }
+                    break;
+
+                case 0xDC:
+                case 0xDE:
+                    // FADD..FDIV ST(i), ST(0) (and FADDP..FDIVP for DE)
+                    if (reg == 2 || reg == 3)
+                    {
+                        // FCOMPP
+                        if (opCode != 0xDE || _modRM != 0xD9)
+                            throw new InvalidOpCodeException();
+                        _fpu.Compare(_fpu.Get(1), false);
+                        _fpu.Pop();
+                        _fpu.Pop();
+                        break;
+                    }
+
+                    _fpu.Arithmetic(reg, i, i);
+                    if (opCode == 0xDE)
+                        _fpu.Pop();
+                    break;
+
+                case 0xDD:
+                    switch (reg)
+                    {
+                        case 0:
+                            // FFREE ST(i)
+                            _fpu.Free(i);
+                            break;
+
+                        case 2:
+                            // FST ST(i)
+                            _fpu.Set(i, _fpu.Get(0));
+                            break;
+
+                        case 3:
+                            // FSTP ST(i)
+                            _fpu.Set(i, _fpu.Get(0));
+                            _fpu.Pop();
+                            break;
+
+                        case 4:
+                            // FUCOM ST(i)
+                            _fpu.Compare(_fpu.Get(i), true);
+                            break;
+
+                        case 5:
+                            // FUCOMP ST(i)
+                            _fpu.Compare(_fpu.Get(i), true);
+                            _fpu.Pop();
+                            break;
+
+                        default:
+                            throw new InvalidOpCodeException();
+                    }
+                    break;
+
+                case 0xDF:
+                    // FSTSW AX
+                    if (_modRM != 0xE0)
+                        throw new InvalidOpCodeException();
+                    ax = _fpu.StatusWord;
+                    break;
+            }
+
+            if (opCode != 0xDB && opCode != 0xDF)
+            {
+                _fpu.InstructionSelector = cs;
+                _fpu.InstructionOffset = _ipInstruction;
+            }
         }
+        #endregion
 
-        IPortBus _portBus;
-        public IPortBus PortBus
+        #region Block Translation
+        // When enabled (turns on the decode cache too), frequently executed
+        // runs of instructions are compiled to IL and run directly.  Compiled
+        // blocks are bypassed while a debugger or instruction hook is attached.
+        BlockTranslator _blockTranslator;
+        public bool EnableBlockTranslation
         {
-            get { return _portBus; }
-            set { _portBus = value; }
+            get { return _blockTranslator != null; }
+            set
+            {
+                if (value == EnableBlockTranslation)
+                    return;
+                if (value)
+                    EnableDecodeCache = true;
+                _blockTranslator = value ? new BlockTranslator() : null;
+            }
         }
+        #endregion
 
         #region Segment Registers
         public ushort ss;
@@ -388,6 +1365,7 @@ namespace Sharp86
             set
             {
                 _debugger = value;
+                UpdateRunLoop();
             }
         }
         #endregion
@@ -405,6 +1383,7 @@ namespace Sharp86
         ushort _modRMSeg;
         ushort _modRMOffset;
         bool _modRMIsPointer;
+        DecodedInstruction _decoded;        // Current instruction if it came from the decode cache
 
         [MethodImpl(MethodImplOptions.AggressiveInlining)]
         void ReadModRM()
@@ -413,166 +1392,104 @@ namespace Sharp86
 
             // Remember we've read it
             _haveReadModRM = true;
-
-            // Read the mod RM byte
-            _modRM = _activeMemoryBus.ReadByte(cs, ip++);
             _modRMIsPointer = true;
 
-            ushort displacement;
+            ushort displacement = 0;
 
-            // Read displacement
-            switch (_modRM & 0xC0)
+            if (_decoded != null)
             {
-                case 0x00:
-                    // Mode 0
-                    switch (_modRM & 0x7)
-                    {
-                        case 0:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(bx + si);
-                            break;
-
-                        case 1:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(bx + di);
-                            break;
+                // Already decoded
+                _modRM = _decoded.modRM;
+                displacement = _decoded.displacement;
+                ip += _decoded.modRMLength;
+            }
+            else
+            {
+                // Read the mod RM byte
+                _modRM = ReadMemByte(cs, ip++);
 
-                        case 2:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
-                            _modRMOffset = (ushort)(bp + si);
-                            break;
+                // Read displacement
+                switch (_modRM & 0xC0)
+                {
+                    case 0x00:
+                        // Mode 0 (no displacement, except direct address)
+                        if ((_modRM & 0x07) == 6)
+                        {
+                            displacement = ReadMemWord(cs, ip);
+                            ip += 2;
+                        }
+                        break;
+
+                    case 0x40:
+                        // Mode 1 (1 byte displacement)
+                        displacement = (ushort)(sbyte)ReadMemByte(cs, ip++);
+                        break;
+
+                    case 0x80:
+                        // Mode 2 (2 byte displacement)
+                        displacement = ReadMemWord(cs, ip);
+                        ip += 2;
+                        break;
+                }
+            }
 
-                        case 3:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
-                            _modRMOffset = (ushort)(bp + di);
-                            break;
+            // Mode 3 (Register)
+            if ((_modRM & 0xC0) == 0xC0)
+            {
+                _modRMIsPointer = false;
+                return;
+            }
 
-                        case 4:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(si);
-                            break;
+            // Resolve the effective address
+            switch (_modRM & 0x7)
+            {
+                case 0:
+                    _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
+                    _modRMOffset = (ushort)(bx + si + displacement);
+                    break;
 
-                        case 5:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(di);
-                            break;
+                case 1:
+                    _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
+                    _modRMOffset = (ushort)(bx + di + displacement);
+                    break;
 
-                        case 6:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = _activeMemoryBus.ReadWord(cs, ip);
-                            ip += 2;
-                            break;
+                case 2:
+                    _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
+                    _modRMOffset = (ushort)(bp + si + displacement);
+                    break;
 
-                        case 7:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = bx;
-                            break;
-                    }
+                case 3:
+                    _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
+                    _modRMOffset = (ushort)(bp + di + displacement);
                     break;
 
-                case 0x40:
+                case 4:
+                    _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
+                    _modRMOffset = (ushort)(si + displacement);
+                    break;
 
-                    // Mode 1 (1 byte displacement)
-                    displacement = (ushort)(sbyte)_activeMemoryBus.ReadByte(cs, ip++);
+                case 5:
+                    _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
+                    _modRMOffset = (ushort)(di + displacement);
+                    break;
 
-                    // Mode 1
-                    switch (_modRM & 0x7)
+                case 6:
+                    if ((_modRM & 0xC0) == 0)
                     {
-                        case 0:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(bx + si + displacement);
-                            break;
-
-                        case 1:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(bx + di + displacement);
-                            break;
-
-                        case 2:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
-                            _modRMOffset = (ushort)(bp + si + displacement);
-                            break;
-
-                        case 3:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
-                            _modRMOffset = (ushort)(bp + di + displacement);
-                            break;
-
-                        case 4:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(si + displacement);
-                            break;
-
-                        case 5:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(di + displacement);
-                            break;
-
-                        case 6:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
-                            _modRMOffset = (ushort)(bp + displacement);
-                            break;
-
-                        case 7:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(bx + displacement);
-                            break;
+                        // Direct address
+                        _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
+                        _modRMOffset = displacement;
                     }
-                    break;
-
-                case 0x80:
-                    // Mode 2 (2 byte displacement)
-                    displacement = _activeMemoryBus.ReadWord(cs, ip);
-                    ip += 2;
-
-                    // Mode 1
-                    switch (_modRM & 0x7)
+                    else
                     {
-                        case 0:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(bx + si + displacement);
-                            break;
-
-                        case 1:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(bx + di + displacement);
-                            break;
-
-                        case 2:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
-                            _modRMOffset = (ushort)(bp + si + displacement);
-                            break;
-
-                        case 3:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
-                            _modRMOffset = (ushort)(bp + di + displacement);
-                            break;
-
-                        case 4:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(si + displacement);
-                            break;
-
-                        case 5:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(di + displacement);
-                            break;
-
-                        case 6:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
-                            _modRMOffset = (ushort)(bp + displacement);
-                            break;
-
-                        case 7:
-                            _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
-                            _modRMOffset = (ushort)(bx + displacement);
-                            break;
+                        _modRMSeg = ResolveSegmentPtr(RegSeg.SS);
+                        _modRMOffset = (ushort)(bp + displacement);
                     }
                     break;
 
-                case 0xC0:
-                    // Mode 3 (Register)
-                    _modRMIsPointer = false;
+                case 7:
+                    _modRMSeg = ResolveSegmentPtr(RegSeg.DS);
+                    _modRMOffset = (ushort)(bx + displacement);
                     break;
             }
         }
@@ -585,7 +1502,7 @@ namespace Sharp86
 
             if (_modRMIsPointer)
             {
-                return _activeMemoryBus.ReadByte(_modRMSeg, _modRMOffset);
+                return ReadMemByte(_modRMSeg, _modRMOffset);
             }
             else
             {
@@ -601,7 +1518,7 @@ namespace Sharp86
 
             if (_modRMIsPointer)
             {
-                return _activeMemoryBus.ReadWord(_modRMSeg, _modRMOffset);
+                return ReadMemWord(_modRMSeg, _modRMOffset);
             }
             else
             {
@@ -617,7 +1534,7 @@ namespace Sharp86
 
             if (_modRMIsPointer)
             {
-                _activeMemoryBus.WriteByte(_modRMSeg, _modRMOffset, value);
+                WriteMemByte(_modRMSeg, _modRMOffset, value);
             }
             else
             {
@@ -633,7 +1550,7 @@ namespace Sharp86
 
             if (_modRMIsPointer)
             {
-                _activeMemoryBus.WriteWord(_modRMSeg, _modRMOffset, value);
+                WriteMemWord(_modRMSeg, _modRMOffset, value);
             }
             else
             {
@@ -699,13 +1616,35 @@ namespace Sharp86
         [MethodImpl(MethodImplOptions.AggressiveInlining)]
         byte Read_Ib()
         {
-            return _activeMemoryBus.ReadByte(cs, ip++);
+            // Fetch from the decoded instruction if we have it
+            if (_decoded != null)
+            {
+                int pos = (ushort)(ip - _ipInstruction);
+                if (pos < _decoded.length)
+                {
+                    ip++;
+                    return _decoded.bytes[pos];
+                }
+            }
+
+            return ReadMemByte(cs, ip++);
         }
 
         [MethodImpl(MethodImplOptions.AggressiveInlining)]
         ushort Read_Iv()
         {
-            var val = _activeMemoryBus.ReadWord(cs, ip);
+            // Fetch from the decoded instruction if we have it
+            if (_decoded != null)
+            {
+                int pos = (ushort)(ip - _ipInstruction);
+                if (pos + 1 < _decoded.length)
+                {
+                    ip += 2;
+                    return (ushort)(_decoded.bytes[pos] | _decoded.bytes[pos + 1] << 8);
+                }
+            }
+
+            var val = ReadMemWord(cs, ip);
             ip += 2;
             return val;
         }
@@ -722,7 +1661,7 @@ namespace Sharp86
             // Read new location
             try
             {
-                return _activeMemoryBus.ReadWord(idt, (ushort)(interruptNumber * 4 + 2)) != 0;
+                return ReadMemWord(idt, (ushort)(interruptNumber * 4 + 2)) != 0;
             }
             catch
             {
@@ -741,8 +1680,8 @@ namespace Sharp86
         public virtual void RaiseInterrupt(byte interruptNumber)
         {
             // Read new location
-            ushort newcs = _activeMemoryBus.ReadWord(idt, (ushort)(interruptNumber * 4 + 2));
-            ushort newip = _activeMemoryBus.ReadWord(idt, (ushort)(interruptNumber * 4));
+            ushort newcs = ReadMemWord(idt, (ushort)(interruptNumber * 4 + 2));
+            ushort newip = ReadMemWord(idt, (ushort)(interruptNumber * 4));
 
             if (newcs == 0 && newip == 0)
             {
@@ -751,11 +1690,11 @@ namespace Sharp86
 
             // Save state
             sp -= 2;
-            _activeMemoryBus.WriteWord(ss, sp, EFlags);
+            WriteMemWord(ss, sp, EFlags);
             sp -= 2;
-            _activeMemoryBus.WriteWord(ss, sp, cs);
+            WriteMemWord(ss, sp, cs);
             sp -= 2;
-            _activeMemoryBus.WriteWord(ss, sp, ip);
+            WriteMemWord(ss, sp, ip);
 
             // Clear interrupt flag
             FlagI = false;
@@ -908,10 +1847,53 @@ namespace Sharp86
         public Action InstructionHook
         {
             get { return _instructionHook; }
-            set { _instructionHook = value; }
+            set
+            {
+                _instructionHook = value;
+                UpdateRunLoop();
+            }
+        }
+
+        // The run loop is specialised on one of these so the JIT can drop all
+        // debugger and hook support from the loop used when neither is attached
+        interface IRunPolicy
+        {
+            bool Instrumented { get; }
+        }
+
+        struct InstrumentedRunPolicy : IRunPolicy
+        {
+            public bool Instrumented { get { return true; } }
+        }
+
+        struct ProductionRunPolicy : IRunPolicy
+        {
+            public bool Instrumented { get { return false; } }
+        }
+
+        bool _instrumented;
+
+        void UpdateRunLoop()
+        {
+            bool instrumented = _debugger != null || _instructionHook != null;
+            if (instrumented == _instrumented)
+                return;
+
+            // Attached or detached part way through a run frame, end the frame
+            // so the next one starts in the right loop
+            _instrumented = instrumented;
+            AbortRunFrame();
         }
 
         public void RunInternal()
+        {
+            if (_instrumented)
+                RunInternal<InstrumentedRunPolicy>();
+            else
+                RunInternal<ProductionRunPolicy>();
+        }
+
+        void RunInternal<TPolicy>() where TPolicy : struct, IRunPolicy
         {
             // Not if halted
             if (_halt)
@@ -927,21 +1909,24 @@ namespace Sharp86
                     // Update CPU time
                     CpuTime++;
 
-                    _instructionHook?.Invoke();
-
-                    // Notify debugger
-                    if (_debugger != null)
+                    if (default(TPolicy).Instrumented)
                     {
-                        System.Diagnostics.Debug.Assert(!_inDebugger);
+                        _instructionHook?.Invoke();
 
-                        _inDebugger = true;
-                        if (!_debugger.OnStep())
+                        // Notify debugger
+                        if (_debugger != null)
                         {
+                            System.Diagnostics.Debug.Assert(!_inDebugger);
+
+                            _inDebugger = true;
+                            if (!_debugger.OnStep())
+                            {
+                                _inDebugger = false;
+                                //                    _executing = false;
+                                return;
+                            }
                             _inDebugger = false;
-                            //                    _executing = false;
-                            return;
                         }
-                        _inDebugger = false;
                     }
 
                     _didReturn = false;
@@ -956,13 +1941,47 @@ namespace Sharp86
                     _prefixSegment = RegSeg.None;
                     _haveReadModRM = false;
                     ushort temp;
+                    byte opCode;
+
+                    // Use the decode cache (unless the debugger is watching the bus)
+                    _decoded = null;
+                    if (_decodeCache != null && _activeMemoryBus == _memoryBus)
+                    {
+                        _decoded = _decodeCache.Lookup(_memoryBus, cs, ip);
+                        if (_decoded != null)
+                        {
+                            // Hot code runs as a compiled block
+                            if (_blockTranslator != null && !default(TPolicy).Instrumented)
+                            {
+                                if (_decoded.block == null && ++_decoded.executionCount == BlockTranslator.HotThreshold)
+                                    _decoded.block = _blockTranslator.Translate(_decodeCache, _memoryBus, cs, ip);
+
+                                var block = _decoded.block;
+                                if (block != null && block.instructionCount <= _instructions + 1)
+                                {
+                                    int executed = block.function(this);
+                                    _instructions -= executed - 1;
+                                    CpuTime += (ulong)(executed - 1);
+                                    goto instructionExecuted;
+                                }
+                            }
 
+                            _prefixRepEither = _decoded.prefixRepEither;
+                            _prefixRepNE = _decoded.prefixRepNE;
+                            _prefixSegment = _decoded.prefixSegment;
+                            opCode = _decoded.opCode;
+                            ip += _decoded.opCodeLength;
+                            goto opCodeDecoded;
+                        }
+                    }
 
                     prefixHandled:      // will jump back to here after decoding an instruction prefix
 
                     _m1 = true;
-                    byte opCode = _activeMemoryBus.ReadByte(cs, ip++);
+                    opCode = ReadMemByte(cs, ip++);
                     _m1 = false;
+
+                    opCodeDecoded:
                     //Console.Out.Write("OPCODE HEX : " + opCode.ToString("X2"));
                     switch (opCode)
                     {
@@ -999,12 +2018,12 @@ namespace Sharp86
                         case 0x06:
                             // PUSH ES
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, es);
+                            WriteMemWord(ss, sp, es);
                             break;
 
                         case 0x07:
                             // POP ES
-                            es = _activeMemoryBus.ReadWord(ss, sp);
+                            es = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
@@ -1041,7 +2060,7 @@ namespace Sharp86
                         case 0x0E:
                             // PUSH cs
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, cs);
+                            WriteMemWord(ss, sp, cs);
                             break;
 
                         case 0x0F:
@@ -1080,12 +2099,12 @@ namespace Sharp86
                         case 0x16:
                             // PUSH SS
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, ss);
+                            WriteMemWord(ss, sp, ss);
                             break;
 
                         case 0x17:
                             // POP SS
-                            ss = _activeMemoryBus.ReadWord(ss, sp);
+                            ss = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
@@ -1122,12 +2141,12 @@ namespace Sharp86
                         case 0x1E:
                             // PUSH ds
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, ds);
+                            WriteMemWord(ss, sp, ds);
                             break;
 
                         case 0x1F:
                             // POP ds
-                            ds = _activeMemoryBus.ReadWord(ss, sp);
+                            ds = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
@@ -1372,116 +2391,116 @@ namespace Sharp86
                         case 0x50:
                             // PUSH AX
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, ax);
+                            WriteMemWord(ss, sp, ax);
                             break;
 
                         case 0x51:
                             // PUSH CX
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, cx);
+                            WriteMemWord(ss, sp, cx);
                             break;
 
                         case 0x52:
                             // PUSH DX
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, dx);
+                            WriteMemWord(ss, sp, dx);
                             break;
 
                         case 0x53:
                             // PUSH BX
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, bx);
+                            WriteMemWord(ss, sp, bx);
                             break;
 
                         case 0x54:
                             // PUSH SP
                             temp = sp;
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, temp);
+                            WriteMemWord(ss, sp, temp);
                             break;
 
                         case 0x55:
                             // PUSH BP
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, bp);
+                            WriteMemWord(ss, sp, bp);
                             break;
 
                         case 0x56:
                             // PUSH SI
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, si);
+                            WriteMemWord(ss, sp, si);
                             break;
 
                         case 0x57:
                             // PUSH DI
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, di);
+                            WriteMemWord(ss, sp, di);
                             break;
 
                         case 0x58:
                             // POP AX
-                            ax = _activeMemoryBus.ReadWord(ss, sp);
+                            ax = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
                         case 0x59:
-                            cx = _activeMemoryBus.ReadWord(ss, sp);
+                            cx = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
                         case 0x5A:
-                            dx = _activeMemoryBus.ReadWord(ss, sp);
+                            dx = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
                         case 0x5B:
-                            bx = _activeMemoryBus.ReadWord(ss, sp);
+                            bx = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
                         case 0x5C:
-                            sp = _activeMemoryBus.ReadWord(ss, sp);
+                            sp = ReadMemWord(ss, sp);
                             break;
 
                         case 0x5D:
-                            bp = _activeMemoryBus.ReadWord(ss, sp);
+                            bp = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
                         case 0x5E:
-                            si = _activeMemoryBus.ReadWord(ss, sp);
+                            si = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
                         case 0x5F:
-                            di = _activeMemoryBus.ReadWord(ss, sp);
+                            di = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
                         case 0x60:
                             // PUSHA
-                            _activeMemoryBus.WriteWord(ss, (ushort)(sp - 2), ax);
-                            _activeMemoryBus.WriteWord(ss, (ushort)(sp - 4), cx);
-                            _activeMemoryBus.WriteWord(ss, (ushort)(sp - 6), dx);
-                            _activeMemoryBus.WriteWord(ss, (ushort)(sp - 8), bx);
-                            _activeMemoryBus.WriteWord(ss, (ushort)(sp - 10), sp);
-                            _activeMemoryBus.WriteWord(ss, (ushort)(sp - 12), bp);
-                            _activeMemoryBus.WriteWord(ss, (ushort)(sp - 14), si);
-                            _activeMemoryBus.WriteWord(ss, (ushort)(sp - 16), di);
+                            WriteMemWord(ss, (ushort)(sp - 2), ax);
+                            WriteMemWord(ss, (ushort)(sp - 4), cx);
+                            WriteMemWord(ss, (ushort)(sp - 6), dx);
+                            WriteMemWord(ss, (ushort)(sp - 8), bx);
+                            WriteMemWord(ss, (ushort)(sp - 10), sp);
+                            WriteMemWord(ss, (ushort)(sp - 12), bp);
+                            WriteMemWord(ss, (ushort)(sp - 14), si);
+                            WriteMemWord(ss, (ushort)(sp - 16), di);
                             sp -= 16;
                             break;
 
                         case 0x61:
                             // PUSHA
                             sp += 16;
-                            ax = _activeMemoryBus.ReadWord(ss, (ushort)(sp - 2));
-                            cx = _activeMemoryBus.ReadWord(ss, (ushort)(sp - 4));
-                            dx = _activeMemoryBus.ReadWord(ss, (ushort)(sp - 6));
-                            bx = _activeMemoryBus.ReadWord(ss, (ushort)(sp - 8));
-                            //sp = _activeMemoryBus.ReadWord(ss, (ushort)(sp - 10));
-                            bp = _activeMemoryBus.ReadWord(ss, (ushort)(sp - 12));
-                            si = _activeMemoryBus.ReadWord(ss, (ushort)(sp - 14));
-                            di = _activeMemoryBus.ReadWord(ss, (ushort)(sp - 16));
+                            ax = ReadMemWord(ss, (ushort)(sp - 2));
+                            cx = ReadMemWord(ss, (ushort)(sp - 4));
+                            dx = ReadMemWord(ss, (ushort)(sp - 6));
+                            bx = ReadMemWord(ss, (ushort)(sp - 8));
+                            //sp = ReadMemWord(ss, (ushort)(sp - 10));
+                            bp = ReadMemWord(ss, (ushort)(sp - 12));
+                            si = ReadMemWord(ss, (ushort)(sp - 14));
+                            di = ReadMemWord(ss, (ushort)(sp - 16));
                             break;
 
                         case 0x62:
@@ -1491,8 +2510,8 @@ namespace Sharp86
                                 throw new InvalidOpCodeException();
 
                             // Read bounds
-                            short lowerBound = (short)_activeMemoryBus.ReadWord(_modRMSeg, _modRMOffset);
-                            short upperBound = (short)_activeMemoryBus.ReadWord(_modRMSeg, (ushort)(_modRMOffset + 2));
+                            short lowerBound = (short)ReadMemWord(_modRMSeg, _modRMOffset);
+                            short upperBound = (short)ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 2));
 
                             // Read array index
                             short arrayIndex = (short)Read_Gv();
@@ -1514,7 +2533,7 @@ namespace Sharp86
                         case 0x68:
                             // Push Iv
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, Read_Iv());
+                            WriteMemWord(ss, sp, Read_Iv());
                             break;
 
                         case 0x69:
@@ -1525,7 +2544,7 @@ namespace Sharp86
                         case 0x6A:
                             // PUSH Ib
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, (ushort)(sbyte)Read_Ib());
+                            WriteMemWord(ss, sp, (ushort)(sbyte)Read_Ib());
                             break;
 
                         case 0x6B:
@@ -1540,7 +2559,7 @@ namespace Sharp86
                             {
                                 do
                                 {
-                                    _activeMemoryBus.WriteByte(es, di, _portBus.ReadPortByte(dx));
+                                    WriteMemByte(es, di, _portBus.ReadPortByte(dx));
                                     if (FlagD)
                                     {
                                         di--;
@@ -1560,7 +2579,7 @@ namespace Sharp86
                                 // INSW
                                 do
                                 {
-                                    _activeMemoryBus.WriteWord(es, di, _portBus.ReadPortWord(dx));
+                                    WriteMemWord(es, di, _portBus.ReadPortWord(dx));
                                     if (FlagD)
                                     {
                                         di -= 2;
@@ -1580,7 +2599,7 @@ namespace Sharp86
                             {
                                 do
                                 {
-                                    _portBus.WritePortByte(dx, _activeMemoryBus.ReadByte(ds, si));
+                                    _portBus.WritePortByte(dx, ReadMemByte(ds, si));
                                     if (FlagD)
                                     {
                                         si--;
@@ -1600,7 +2619,7 @@ namespace Sharp86
                             {
                                 do
                                 {
-                                    _portBus.WritePortWord(dx, _activeMemoryBus.ReadWord(ds, si));
+                                    _portBus.WritePortWord(dx, ReadMemWord(ds, si));
                                     if (FlagD)
                                     {
                                         si -= 2;
@@ -1869,7 +2888,7 @@ namespace Sharp86
 
                         case 0x8F:
                             // POP Ev
-                            Write_Ev(_activeMemoryBus.ReadWord(ss, sp));
+                            Write_Ev(ReadMemWord(ss, sp));
                             sp += 2;
                             break;
 
@@ -1945,17 +2964,15 @@ namespace Sharp86
                                 // CALL Ap
 
                                 // Read target address
-                                temp = _activeMemoryBus.ReadWord(cs, ip);
-                                ip += 2;
+                                temp = Read_Iv();
 
-                                var newcs = _activeMemoryBus.ReadWord(cs, ip);
-                                ip += 2;
+                                var newcs = Read_Iv();
 
                                 // Push current ip
                                 sp -= 2;
-                                _activeMemoryBus.WriteWord(ss, sp, cs);
+                                WriteMemWord(ss, sp, cs);
                                 sp -= 2;
-                                _activeMemoryBus.WriteWord(ss, sp, ip);
+                                WriteMemWord(ss, sp, ip);
 
                                 // Jump
                                 ip = temp;
@@ -1971,12 +2988,12 @@ namespace Sharp86
                         case 0x9C:
                             // PUSHF
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, EFlags);
+                            WriteMemWord(ss, sp, EFlags);
                             break;
 
                         case 0x9D:
                             // POPF
-                            EFlags = _activeMemoryBus.ReadWord(ss, sp);
+                            EFlags = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
@@ -1992,40 +3009,39 @@ namespace Sharp86
 
                         case 0xA0:
                             // MOV al, [Ob]
-                            temp = _activeMemoryBus.ReadWord(cs, ip);
-                            ip += 2;
-                            al = _activeMemoryBus.ReadByte(ResolveSegmentPtr(RegSeg.DS), temp);
+                            temp = Read_Iv();
+                            al = ReadMemByte(ResolveSegmentPtr(RegSeg.DS), temp);
                             break;
 
                         case 0xA1:
                             // MOV ax, [Ov]
-                            temp = _activeMemoryBus.ReadWord(cs, ip);
-                            ip += 2;
-                            ax = _activeMemoryBus.ReadWord(ResolveSegmentPtr(RegSeg.DS), temp);
+                            temp = Read_Iv();
+                            ax = ReadMemWord(ResolveSegmentPtr(RegSeg.DS), temp);
                             break;
 
                         case 0xA2:
                             // MOV [Ob], al
-                            temp = _activeMemoryBus.ReadWord(cs, ip);
-                            ip += 2;
-                            _activeMemoryBus.WriteByte(ResolveSegmentPtr(RegSeg.DS), temp, al);
+                            temp = Read_Iv();
+                            WriteMemByte(ResolveSegmentPtr(RegSeg.DS), temp, al);
                             break;
 
                         case 0xA3:
                             // MOV [Ob], ax
-                            temp = _activeMemoryBus.ReadWord(cs, ip);
-                            ip += 2;
-                            _activeMemoryBus.WriteWord(ResolveSegmentPtr(RegSeg.DS), temp, ax);
+                            temp = Read_Iv();
+                            WriteMemWord(ResolveSegmentPtr(RegSeg.DS), temp, ax);
                             break;
 
                         case 0xA4:
                             // MOVSB
                             if (cx != 0 || !_prefixRepEither)
                             {
+                                if (_prefixRepEither && BulkMovs(1))
+                                    break;
+
                                 temp = ResolveSegmentPtr(RegSeg.DS);
                                 do
                                 {
-                                    _activeMemoryBus.WriteByte(es, di, _activeMemoryBus.ReadByte(temp, si));
+                                    WriteMemByte(es, di, ReadMemByte(temp, si));
                                     if (FlagD)
                                     {
                                         di--;
@@ -2044,11 +3060,14 @@ namespace Sharp86
                         case 0xA5:
                             if (cx != 0 || !_prefixRepEither)
                             {
+                                if (_prefixRepEither && BulkMovs(2))
+                                    break;
+
                                 // MOVSB
                                 temp = ResolveSegmentPtr(RegSeg.DS);
                                 do
                                 {
-                                    _activeMemoryBus.WriteWord(es, di, _activeMemoryBus.ReadWord(temp, si));
+                                    WriteMemWord(es, di, ReadMemWord(temp, si));
                                     if (FlagD)
                                     {
                                         di -= 2;
@@ -2067,11 +3086,14 @@ namespace Sharp86
                         case 0xA6:
                             if (cx != 0 || !_prefixRepEither)
                             {
+                                if (_prefixRepEither && BulkCmps(1))
+                                    break;
+
                                 // CMPSB
                                 temp = ResolveSegmentPtr(RegSeg.DS);
                                 do
                                 {
-                                    Sub8(_activeMemoryBus.ReadByte(ResolveSegmentPtr(RegSeg.DS), si), _activeMemoryBus.ReadByte(es, di));
+                                    Sub8(ReadMemByte(ResolveSegmentPtr(RegSeg.DS), si), ReadMemByte(es, di));
                                     if (FlagD)
                                     {
                                         di -= 1;
@@ -2092,10 +3114,13 @@ namespace Sharp86
                             // CMPSB
                             if (cx != 0 || !_prefixRepEither)
                             {
+                                if (_prefixRepEither && BulkCmps(2))
+                                    break;
+
                                 temp = ResolveSegmentPtr(RegSeg.DS);
                                 do
                                 {
-                                    Sub16(_activeMemoryBus.ReadWord(ResolveSegmentPtr(RegSeg.DS), si), _activeMemoryBus.ReadWord(es, di));
+                                    Sub16(ReadMemWord(ResolveSegmentPtr(RegSeg.DS), si), ReadMemWord(es, di));
                                     if (FlagD)
                                     {
                                         di -= 2;
@@ -2124,10 +3149,13 @@ namespace Sharp86
                         case 0xAA:
                             if (cx != 0 || !_prefixRepEither)
                             {
+                                if (_prefixRepEither && BulkStos(1))
+                                    break;
+
                                 // STOSB
                                 do
                                 {
-                                    _activeMemoryBus.WriteByte(es, di, al);
+                                    WriteMemByte(es, di, al);
                                     if (FlagD)
                                     {
                                         di--;
@@ -2144,10 +3172,13 @@ namespace Sharp86
                         case 0xAB:
                             if (cx != 0 || !_prefixRepEither)
                             {
+                                if (_prefixRepEither && BulkStos(2))
+                                    break;
+
                                 // STOSW
                                 do
                                 {
-                                    _activeMemoryBus.WriteWord(es, di, ax);
+                                    WriteMemWord(es, di, ax);
                                     if (FlagD)
                                     {
                                         di -= 2;
@@ -2169,7 +3200,7 @@ namespace Sharp86
                                 temp = ResolveSegmentPtr(RegSeg.DS);
                                 do
                                 {
-                                    al = _activeMemoryBus.ReadByte(temp, si);
+                                    al = ReadMemByte(temp, si);
                                     if (FlagD)
                                     {
                                         si--;
@@ -2190,7 +3221,7 @@ namespace Sharp86
                                 temp = ResolveSegmentPtr(RegSeg.DS);
                                 do
                                 {
-                                    ax = _activeMemoryBus.ReadWord(temp, si);
+                                    ax = ReadMemWord(temp, si);
                                     if (FlagD)
                                     {
                                         si -= 2;
@@ -2207,10 +3238,13 @@ namespace Sharp86
                         case 0xAE:
                             if (cx != 0 || !_prefixRepEither)
                             {
+                                if (_prefixRepEither && BulkScas(1))
+                                    break;
+
                                 // SCASB
                                 do
                                 {
-                                    Sub8(al, _activeMemoryBus.ReadByte(es, di));
+                                    Sub8(al, ReadMemByte(es, di));
                                     if (FlagD)
                                     {
                                         di -= 1;
@@ -2228,9 +3262,12 @@ namespace Sharp86
                             // SCASW
                             if (cx != 0 || !_prefixRepEither)
                             {
+                                if (_prefixRepEither && BulkScas(2))
+                                    break;
+
                                 do
                                 {
-                                    Sub16(ax, _activeMemoryBus.ReadWord(es, di));
+                                    Sub16(ax, ReadMemWord(es, di));
                                     if (FlagD)
                                     {
                                         di -= 2;
@@ -2360,14 +3397,14 @@ namespace Sharp86
                         case 0xC2:
                             // RET Iw
                             temp = Read_Iv();
-                            ip = _activeMemoryBus.ReadWord(ss, sp);
+                            ip = ReadMemWord(ss, sp);
                             sp += (ushort)(temp + 2);
                             _didReturn = true;
                             break;
 
                         case 0xC3:
                             // RET
-                            ip = _activeMemoryBus.ReadWord(ss, sp);
+                            ip = ReadMemWord(ss, sp);
                             sp += 2;
                             _didReturn = true;
                             break;
@@ -2379,7 +3416,7 @@ namespace Sharp86
                                 throw new InvalidOpCodeException();
 
                             Write_Gv(Read_Ev());
-                            es = _activeMemoryBus.ReadWord(_modRMSeg, (ushort)(_modRMOffset + 2));
+                            es = ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 2));
                             break;
 
                         case 0xC5:
@@ -2389,7 +3426,7 @@ namespace Sharp86
                                 throw new InvalidOpCodeException();
 
                             Write_Gv(Read_Ev());
-                            ds = _activeMemoryBus.ReadWord(_modRMSeg, (ushort)(_modRMOffset + 2));
+                            ds = ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 2));
                             break;
 
                         case 0xC6:
@@ -2411,7 +3448,7 @@ namespace Sharp86
 
                             // Push bp
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, bp);
+                            WriteMemWord(ss, sp, bp);
 
                             if (nestingLevel == 0)
                             {
@@ -2424,11 +3461,11 @@ namespace Sharp86
                                 {
                                     bp -= 2;
                                     sp -= 2;
-                                    _activeMemoryBus.WriteWord(ss, sp, _activeMemoryBus.ReadWord(ss, bp));
+                                    WriteMemWord(ss, sp, ReadMemWord(ss, bp));
                                 }
 
                                 sp -= 2;
-                                _activeMemoryBus.WriteWord(ss, sp, temp);
+                                WriteMemWord(ss, sp, temp);
 
                                 bp = temp;
                             }
@@ -2439,7 +3476,7 @@ namespace Sharp86
                         case 0xC9:
                             // LEAVE
                             sp = bp;
-                            bp = _activeMemoryBus.ReadWord(ss, sp);
+                            bp = ReadMemWord(ss, sp);
                             sp += 2;
                             break;
 
@@ -2447,9 +3484,9 @@ namespace Sharp86
                             // RETF Iv
                             temp = Read_Iv();
 
-                            ip = _activeMemoryBus.ReadWord(ss, sp);
+                            ip = ReadMemWord(ss, sp);
                             sp += 2;
-                            cs = _activeMemoryBus.ReadWord(ss, sp);
+                            cs = ReadMemWord(ss, sp);
                             sp += 2;
 
                             sp += temp;
@@ -2458,9 +3495,9 @@ namespace Sharp86
 
                         case 0xCB:
                             // RETF
-                            ip = _activeMemoryBus.ReadWord(ss, sp);
+                            ip = ReadMemWord(ss, sp);
                             sp += 2;
-                            cs = _activeMemoryBus.ReadWord(ss, sp);
+                            cs = ReadMemWord(ss, sp);
                             sp += 2;
                             _didReturn = true;
                             break;
@@ -2488,11 +3525,11 @@ namespace Sharp86
 
                         case 0xCF:
                             // IRET
-                            ip = _activeMemoryBus.ReadWord(ss, sp);
+                            ip = ReadMemWord(ss, sp);
                             sp += 2;
-                            cs = _activeMemoryBus.ReadWord(ss, sp);
+                            cs = ReadMemWord(ss, sp);
                             sp += 2;
-                            EFlags = _activeMemoryBus.ReadWord(ss, sp);
+                            EFlags = ReadMemWord(ss, sp);
                             sp += 2;
                             _didReturn = true;
                             break;
@@ -2577,7 +3614,7 @@ namespace Sharp86
 
                         case 0xD7:
                             // XLAT
-                            al = _activeMemoryBus.ReadByte(ResolveSegmentPtr(RegSeg.DS), (ushort)(bx + al));
+                            al = ReadMemByte(ResolveSegmentPtr(RegSeg.DS), (ushort)(bx + al));
                             break;
 
                         case 0xD8:
@@ -2588,8 +3625,9 @@ namespace Sharp86
                         case 0xDD:
                         case 0xDE:
                         case 0xDF:
-                            // -
-                            throw new InvalidOpCodeException();
+                            // ESC (x87)
+                            ExecuteFpu(opCode);
+                            break;
 
                         case 0xE0:
                             // LOOPNZ Jb
@@ -2654,7 +3692,7 @@ namespace Sharp86
 
                             // Push current ip
                             sp -= 2;
-                            _activeMemoryBus.WriteWord(ss, sp, ip);
+                            WriteMemWord(ss, sp, ip);
 
                             // Jump
                             ip += temp;
@@ -2823,7 +3861,7 @@ namespace Sharp86
                                         // NEAR CALL Ev
                                         ushort proc = Read_Ev();
                                         sp -= 2;
-                                        _activeMemoryBus.WriteWord(ss, sp, ip);
+                                        WriteMemWord(ss, sp, ip);
                                         ip = proc;
                                         break;
                                     }
@@ -2832,12 +3870,12 @@ namespace Sharp86
                                         // FAR CALL M
                                         if (!_modRMIsPointer)
                                             throw new InvalidOpCodeException(); ;
-                                        ushort proc = _activeMemoryBus.ReadWord(_modRMSeg, _modRMOffset);
-                                        ushort seg = _activeMemoryBus.ReadWord(_modRMSeg, (ushort)(_modRMOffset + 2));
+                                        ushort proc = ReadMemWord(_modRMSeg, _modRMOffset);
+                                        ushort seg = ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 2));
                                         sp -= 2;
-                                        _activeMemoryBus.WriteWord(ss, sp, cs);
+                                        WriteMemWord(ss, sp, cs);
                                         sp -= 2;
-                                        _activeMemoryBus.WriteWord(ss, sp, ip);
+                                        WriteMemWord(ss, sp, ip);
                                         ip = proc;
                                         cs = seg;
                                         break;
@@ -2853,8 +3891,8 @@ namespace Sharp86
                                         // FAR JMP M
                                         if (!_modRMIsPointer)
                                             throw new InvalidOpCodeException(); ;
-                                        ip = _activeMemoryBus.ReadWord(_modRMSeg, _modRMOffset);
-                                        cs = _activeMemoryBus.ReadWord(_modRMSeg, (ushort)(_modRMOffset + 2));
+                                        ip = ReadMemWord(_modRMSeg, _modRMOffset);
+                                        cs = ReadMemWord(_modRMSeg, (ushort)(_modRMOffset + 2));
                                         break;
                                     }
 
@@ -2863,7 +3901,7 @@ namespace Sharp86
                                         // PUSH
                                         temp = Read_Ev();
                                         sp -= 2;
-                                        _activeMemoryBus.WriteWord(ss, sp, temp);
+                                        WriteMemWord(ss, sp, temp);
                                         break;
                                     }
 
@@ -2872,6 +3910,8 @@ namespace Sharp86
                             break;
                     }
 
+                    instructionExecuted:
+
                     // If interrupts are enabled and we have a pending hardward interrupt, then raise it now
                     if (FlagI && _pendingHardwareInterrupt.HasValue)
                     {
@@ -0,0 +1,305 @@
+﻿/*
+Sharp86 - 8086 Emulator
+Copyright (C) 2017-2018 Topten Software.
+
+Sharp86 is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Sharp86 is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Sharp86.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+using System;
+using System.Runtime.CompilerServices;
+
+namespace Sharp86
+{
+    // An instruction that has been decoded once and can be executed again
+    // without re-reading it from the memory bus
+    class DecodedInstruction
+    {
+        public byte[] bytes;                // Raw instruction bytes (immediates are fetched from here)
+        public byte length;                 // Total length including prefixes
+        public byte opCodeLength;           // Prefixes plus the opcode byte
+        public byte opCode;
+        public bool prefixRepEither;
+        public bool prefixRepNE;
+        public RegSeg prefixSegment;
+        public byte modRM;
+        public byte modRMLength;            // ModRM byte plus displacement
+        public ushort displacement;
+        public int executionCount;          // Times executed (until a block is compiled)
+        public CompiledBlock block;         // Compiled block starting at this instruction
+
+        // Marker for instructions that can't be cached (eg: cross a page boundary)
+        public static readonly DecodedInstruction Uncacheable = new DecodedInstruction();
+    }
+
+    // Cache of decoded instructions, keyed by code selector and offset.
+    //
+    // Each selector has a table of 256 byte pages, each page holding the
+    // instructions that start in it. Instructions that straddle a page
+    // boundary are never cached, so a write to an address only ever needs
+    // to discard the page containing it.
+    class DecodeCache
+    {
+        const int MaxInstructionLength = 15;
+        public const int PageShift = 8;
+        const int PageSize = 1 << PageShift;
+        const int PageCount = 0x10000 >> PageShift;
+
+        DecodedInstruction[][][] _selectors = new DecodedInstruction[0x10000][][];
+
+        // Bumped on every invalidation so running compiled blocks can tell
+        // when code has been modified underneath them
+        public int Generation;
+
+        [MethodImpl(MethodImplOptions.AggressiveInlining)]
+        public DecodedInstruction Lookup(IMemoryBus bus, ushort cs, ushort ip)
+        {
+            var pages = _selectors[cs];
+            if (pages != null)
+            {
+                var page = pages[ip >> PageShift];
+                if (page != null)
+                {
+                    var entry = page[ip & (PageSize - 1)];
+                    if (entry != null)
+                        return entry == DecodedInstruction.Uncacheable ? null : entry;
+                }
+            }
+
+            return Add(bus, cs, ip);
+        }
+
+        DecodedInstruction Add(IMemoryBus bus, ushort cs, ushort ip)
+        {
+            // Decode it
+            DecodedInstruction entry;
+            try
+            {
+                entry = Decode(bus, cs, ip);
+            }
+            catch (CPUException)
+            {
+                // Let the normal execution path raise the fault
+                return null;
+            }
+
+            // Store it
+            var pages = _selectors[cs];
+            if (pages == null)
+            {
+                pages = new DecodedInstruction[PageCount][];
+                _selectors[cs] = pages;
+            }
+
+            var page = pages[ip >> PageShift];
+            if (page == null)
+            {
+                page = new DecodedInstruction[PageSize];
+                pages[ip >> PageShift] = page;
+            }
+
+            page[ip & (PageSize - 1)] = entry;
+
+            return entry == DecodedInstruction.Uncacheable ? null : entry;
+        }
+
+        public void Invalidate()
+        {
+            Generation++;
+            Array.Clear(_selectors, 0, _selectors.Length);
+        }
+
+        public void Invalidate(ushort selector)
+        {
+            Generation++;
+            _selectors[selector] = null;
+        }
+
+        public void Invalidate(ushort selector, ushort offset)
+        {
+            Generation++;
+            var pages = _selectors[selector];
+            if (pages != null)
+                pages[offset >> PageShift] = null;
+        }
+
+        #region Instruction Formats
+
+        const byte FormatModRM = 0x80;
+        const byte FormatImmediateMask = 0x07;
+
+        // For each opcode, whether it has a ModRM byte and how many bytes of
+        // immediate data follow it (F6/F7 are special cased in Decode)
+        static byte[] _formats = BuildFormats();
+
+        static byte[] BuildFormats()
+        {
+            var formats = new byte[256];
+
+            // ALU ops: Eb,Gb  Ev,Gv  Gb,Eb  Gv,Ev  AL,Ib  eAX,Iv
+            for (int op = 0x00; op < 0x40; op += 8)
+            {
+                formats[op + 0] = FormatModRM;
+                formats[op + 1] = FormatModRM;
+                formats[op + 2] = FormatModRM;
+                formats[op + 3] = FormatModRM;
+                formats[op + 4] = 1;
+                formats[op + 5] = 2;
+            }
+
+            formats[0x62] = FormatModRM;            // BOUND
+            formats[0x68] = 2;                      // PUSH Iv
+            formats[0x69] = FormatModRM | 2;        // IMUL Gv,Ev,Iv
+            formats[0x6A] = 1;                      // PUSH Ib
+            formats[0x6B] = FormatModRM | 1;        // IMUL Gv,Ev,Ib
+
+            for (int op = 0x70; op < 0x80; op++)
+                formats[op] = 1;                    // Jcc Jb
+
+            formats[0x80] = FormatModRM | 1;        // GRP1 Eb,Ib
+            formats[0x81] = FormatModRM | 2;        // GRP1 Ev,Iv
+            formats[0x82] = FormatModRM | 1;        // GRP1 Eb,Ib
+            formats[0x83] = FormatModRM | 1;        // GRP1 Ev,Ib
+
+            for (int op = 0x84; op < 0x90; op++)
+                formats[op] = FormatModRM;          // TEST, XCHG, MOV, LEA, POP Ev
+
+            formats[0x9A] = 4;                      // CALL Ap
+
+            for (int op = 0xA0; op < 0xA4; op++)
+                formats[op] = 2;                    // MOV AL/AX <-> [Ov]
+
+            formats[0xA8] = 1;                      // TEST AL,Ib
+            formats[0xA9] = 2;                      // TEST eAX,Iv
+
+            for (int op = 0xB0; op < 0xB8; op++)
+                formats[op] = 1;                    // MOV r8,Ib
+            for (int op = 0xB8; op < 0xC0; op++)
+                formats[op] = 2;                    // MOV r16,Iv
+
+            formats[0xC0] = FormatModRM | 1;        // GRP2 Eb,Ib
+            formats[0xC1] = FormatModRM | 1;        // GRP2 Ev,Ib
+            formats[0xC2] = 2;                      // RET Iw
+            formats[0xC4] = FormatModRM;            // LES
+            formats[0xC5] = FormatModRM;            // LDS
+            formats[0xC6] = FormatModRM | 1;        // MOV Eb,Ib
+            formats[0xC7] = FormatModRM | 2;        // MOV Ev,Iv
+            formats[0xC8] = 3;                      // ENTER Iw,Ib
+            formats[0xCA] = 2;                      // RETF Iw
+            formats[0xCD] = 1;                      // INT Ib
+
+            for (int op = 0xD0; op < 0xD4; op++)
+                formats[op] = FormatModRM;          // GRP2 by 1 or CL
+            formats[0xD4] = 1;                      // AAM
+            formats[0xD5] = 1;                      // AAD
+            for (int op = 0xD8; op < 0xE0; op++)
+                formats[op] = FormatModRM;          // ESC
+
+            for (int op = 0xE0; op < 0xE8; op++)
+                formats[op] = 1;                    // LOOPcc, JCXZ, IN/OUT Ib
+            formats[0xE8] = 2;                      // CALL Jv
+            formats[0xE9] = 2;                      // JMP Jv
+            formats[0xEA] = 4;                      // JMP Ap
+            formats[0xEB] = 1;                      // JMP Jb
+
+            formats[0xF6] = FormatModRM;            // GRP3a Eb
+            formats[0xF7] = FormatModRM;            // GRP3b Ev
+            formats[0xFE] = FormatModRM;            // GRP4 Eb
+            formats[0xFF] = FormatModRM;            // GRP5 Ev
+
+            return formats;
+        }
+
+        static DecodedInstruction Decode(IMemoryBus bus, ushort cs, ushort ip)
+        {
+            var entry = new DecodedInstruction();
+            entry.prefixSegment = RegSeg.None;
+
+            // Prefixes
+            int pos = 0;
+            while (true)
+            {
+                if (pos >= MaxInstructionLength)
+                    return DecodedInstruction.Uncacheable;
+
+                byte b = bus.ReadByte(cs, (ushort)(ip + pos++));
+                switch (b)
+                {
+                    case 0x26: entry.prefixSegment = RegSeg.ES; continue;
+                    case 0x2E: entry.prefixSegment = RegSeg.CS; continue;
+                    case 0x36: entry.prefixSegment = RegSeg.SS; continue;
+                    case 0x3E: entry.prefixSegment = RegSeg.DS; continue;
+                    case 0xF0: continue;
+                    case 0xF2: entry.prefixRepEither = true; entry.prefixRepNE = true; continue;
+                    case 0xF3: entry.prefixRepEither = true; entry.prefixRepNE = false; continue;
+                }
+
+                entry.opCode = b;
+                break;
+            }
+            entry.opCodeLength = (byte)pos;
+
+            // ModRM and displacement
+            var format = _formats[entry.opCode];
+            if ((format & FormatModRM) != 0)
+            {
+                entry.modRM = bus.ReadByte(cs, (ushort)(ip + pos++));
+                switch (entry.modRM & 0xC0)
+                {
+                    case 0x00:
+                        if ((entry.modRM & 0x07) == 6)
+                        {
+                            entry.displacement = bus.ReadWord(cs, (ushort)(ip + pos));
+                            pos += 2;
+                        }
+                        break;
+
+                    case 0x40:
+                        entry.displacement = (ushort)(sbyte)bus.ReadByte(cs, (ushort)(ip + pos++));
+                        break;
+
+                    case 0x80:
+                        entry.displacement = bus.ReadWord(cs, (ushort)(ip + pos));
+                        pos += 2;
+                        break;
+                }
+                entry.modRMLength = (byte)(pos - entry.opCodeLength);
+            }
+
+            // Immediates
+            int immediateBytes = format & FormatImmediateMask;
+            if ((entry.opCode == 0xF6 || entry.opCode == 0xF7) && (entry.modRM & 0x38) < 0x10)
+            {
+                // TEST Eb,Ib / TEST Ev,Iv
+                immediateBytes = entry.opCode == 0xF6 ? 1 : 2;
+            }
+            pos += immediateBytes;
+
+            // Must fit within one page and not wrap the segment
+            if (pos > MaxInstructionLength || ip + pos > 0x10000 || (ip >> PageShift) != ((ip + pos - 1) >> PageShift))
+                return DecodedInstruction.Uncacheable;
+
+            // Capture the raw bytes
+            entry.length = (byte)pos;
+            entry.bytes = new byte[pos];
+            for (int i = 0; i < pos; i++)
+            {
+                entry.bytes[i] = bus.ReadByte(cs, (ushort)(ip + i));
+            }
+
+            return entry;
+        }
+
+        #endregion
+    }
+}
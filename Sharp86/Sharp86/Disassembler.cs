@@ -495,6 +495,135 @@ namespace Sharp86
             throw new NotImplementedException();
         }
 
+        static string[] _fpuArithmeticNames = new string[]
+        {
+            "fadd", "fmul", "fcom", "fcomp", "fsub", "fsubr", "fdiv", "fdivr",
+        };
+
+        // Memory forms, by opcode (D8-DF) and reg field.  Each entry is
+        // the mnemonic and operand size, null for invalid encodings.
+        static string[,] _fpuMemoryOps = new string[,]
+        {
+            { null, null, null, null, null, null, null, null },
+            { "fld dword", null, "fst dword", "fstp dword", "fldenv", "fldcw word", "fstenv", "fstcw word" },
+            { null, null, null, null, null, null, null, null },
+            { "fild dword", null, "fist dword", "fistp dword", null, "fld tbyte", null, "fstp tbyte" },
+            { null, null, null, null, null, null, null, null },
+            { "fld qword", null, "fst qword", "fstp qword", "frstor", null, "fsave", "fstsw word" },
+            { null, null, null, null, null, null, null, null },
+            { "fild word", null, "fist word", "fistp word", "fbld tbyte", "fild qword", "fbstp tbyte", "fistp qword" },
+        };
+
+        // D9 E0-FF
+        static string[] _fpuD9Names = new string[]
+        {
+            "fchs", "fabs", null, null, "ftst", "fxam", null, null,
+            "fld1", "fldl2t", "fldl2e", "fldpi", "fldlg2", "fldln2", "fldz", null,
+            "f2xm1", "fyl2x", "fptan", "fpatan", "fxtract", "fprem1", "fdecstp", "fincstp",
+            "fprem", "fyl2xp1", "fsqrt", "fsincos", "frndint", "fscale", "fsin", "fcos",
+        };
+
+        string ReadFpu(byte opCode)
+        {
+            ReadModRM();
+            int reg = (_modRM >> 3) & 7;
+            int i = _modRM & 7;
+
+            if (_modRMIsPointer)
+            {
+                string op;
+                switch (opCode)
+                {
+                    case 0xD8: op = _fpuArithmeticNames[reg] + " dword"; break;
+                    case 0xDA: op = "fi" + _fpuArithmeticNames[reg].Substring(1) + " dword"; break;
+                    case 0xDC: op = _fpuArithmeticNames[reg] + " qword"; break;
+                    case 0xDE: op = "fi" + _fpuArithmeticNames[reg].Substring(1) + " word"; break;
+                    default: op = _fpuMemoryOps[opCode - 0xD8, reg]; break;
+                }
+
+                if (op == null)
+                    throw new InvalidOpCodeException();
+
+                int space = op.IndexOf(' ');
+                if (space < 0)
+                    return string.Format("{0} {1}[{2}]", op, _modRMSeg, _modRMOffset);
+                return string.Format("{0} {1} ptr {2}[{3}]", op.Substring(0, space), op.Substring(space + 1), _modRMSeg, _modRMOffset);
+            }
+
+            switch (opCode)
+            {
+                case 0xD8:
+                    return string.Format("{0} st,st({1})", _fpuArithmeticNames[reg], i);
+
+                case 0xD9:
+                    switch (reg)
+                    {
+                        case 0: return string.Format("fld st({0})", i);
+                        case 1: return string.Format("fxch st({0})", i);
+                        case 2:
+                            if (i == 0)
+                                return "fnop";
+                            break;
+                        case 3:
+                            break;
+                        default:
+                            if (_fpuD9Names[_modRM - 0xE0] != null)
+                                return _fpuD9Names[_modRM - 0xE0];
+                            break;
+                    }
+                    break;
+
+                case 0xDA:
+                    if (_modRM == 0xE9)
+                        return "fucompp";
+                    break;
+
+                case 0xDB:
+                    switch (_modRM)
+                    {
+                        case 0xE0: return "feni";
+                        case 0xE1: return "fdisi";
+                        case 0xE2: return "fclex";
+                        case 0xE3: return "finit";
+                        case 0xE4: return "fsetpm";
+                    }
+                    break;
+
+                case 0xDC:
+                case 0xDE:
+                {
+                    if (reg == 2 || reg == 3)
+                    {
+                        if (opCode == 0xDE && _modRM == 0xD9)
+                            return "fcompp";
+                        break;
+                    }
+
+                    // The register forms swap sub/subr and div/divr
+                    string name = _fpuArithmeticNames[reg >= 4 ? reg ^ 1 : reg];
+                    return string.Format("{0}{1} st({2}),st", name, opCode == 0xDE ? "p" : "", i);
+                }
+
+                case 0xDD:
+                    switch (reg)
+                    {
+                        case 0: return string.Format("ffree st({0})", i);
+                        case 2: return string.Format("fst st({0})", i);
+                        case 3: return string.Format("fstp st({0})", i);
+                        case 4: return string.Format("fucom st({0})", i);
+                        case 5: return string.Format("fucomp st({0})", i);
+                    }
+                    break;
+
+                case 0xDF:
+                    if (_modRM == 0xE0)
+                        return "fstsw ax";
+                    break;
+            }
+
+            throw new InvalidOpCodeException();
+        }
+
         public string Read(ushort csIn, ushort ipIn)
         {
             cs = csIn;
@@ -1174,8 +1303,8 @@ namespace Sharp86
                     case 0xDD:
                     case 0xDE:
                     case 0xDF:
-                        // -
-                        throw new InvalidOpCodeException();
+                        // ESC (x87)
+                        return ReadFpu(opCode);
 
                     case 0xE0:
                         // LOOPNZ Jb
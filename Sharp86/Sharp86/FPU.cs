@@ -0,0 +1,859 @@
+﻿/*
+Sharp86 - 8086 Emulator
+Copyright (C) 2017-2018 Topten Software.
+
+Sharp86 is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Sharp86 is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Sharp86.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+using System;
+
+namespace Sharp86
+{
+    // Bits of the x87 status word
+    public class FPUStatus
+    {
+        public const ushort IE = 1 << 0;            // Invalid operation
+        public const ushort DE = 1 << 1;            // Denormalized operand
+        public const ushort ZE = 1 << 2;            // Zero divide
+        public const ushort OE = 1 << 3;            // Overflow
+        public const ushort UE = 1 << 4;            // Underflow
+        public const ushort PE = 1 << 5;            // Precision
+        public const ushort SF = 1 << 6;            // Stack fault
+        public const ushort ES = 1 << 7;            // Error summary
+        public const ushort C0 = 1 << 8;
+        public const ushort C1 = 1 << 9;
+        public const ushort C2 = 1 << 10;
+        public const ushort TopMask = 7 << 11;
+        public const ushort C3 = 1 << 14;
+        public const ushort B = 1 << 15;            // Busy
+
+        public const ushort ExceptionMask = IE | DE | ZE | OE | UE | PE;
+        public const ushort ConditionMask = C0 | C1 | C2 | C3;
+    }
+
+    // x87 floating point unit
+    //
+    // Registers are held as .NET doubles rather than 80-bit extended reals,
+    // so results carry 53 bits of precision (as if the precision control
+    // was set to double) and the exponent range is that of a double.  Values
+    // are only widened to 80-bit when stored as a TBYTE.
+    //
+    // Exceptions are always handled as if masked - the flags are set in the
+    // status word and the masked response (NaN, infinity, integer indefinite)
+    // is delivered.  The FPU itself knows nothing about memory, the CPU
+    // decodes the ESC opcodes and moves operands in and out.
+    public class FPU
+    {
+        public FPU()
+        {
+            Reset();
+        }
+
+        // The "real indefinite" QNaN the x87 produces for invalid operations
+        public static readonly double Indefinite = BitConverter.Int64BitsToDouble(unchecked((long)0xFFF8000000000000UL));
+
+        #region Registers
+        double[] _regs = new double[8];
+        int _empty;                 // Bit per physical register, set when the register is empty
+        int _top;
+        ushort _status;             // Status word, excluding the TOP field
+
+        public ushort ControlWord;
+
+        // Last instruction and operand pointers, as saved by FSTENV/FSAVE
+        public ushort InstructionSelector;
+        public ushort InstructionOffset;
+        public ushort OperandSelector;
+        public ushort OperandOffset;
+
+        // FINIT
+        public void Reset()
+        {
+            ControlWord = 0x037F;
+            _status = 0;
+            _top = 0;
+            _empty = 0xFF;
+            InstructionSelector = 0;
+            InstructionOffset = 0;
+            OperandSelector = 0;
+            OperandOffset = 0;
+        }
+
+        // FCLEX
+        public void ClearExceptions()
+        {
+            _status &= unchecked((ushort)~(FPUStatus.ExceptionMask | FPUStatus.SF | FPUStatus.ES | FPUStatus.B));
+        }
+
+        public ushort StatusWord
+        {
+            get
+            {
+                return (ushort)(_status | (_top << 11));
+            }
+            set
+            {
+                _status = (ushort)(value & ~FPUStatus.TopMask);
+                _top = (value >> 11) & 7;
+            }
+        }
+
+        // Two bits per physical register: 0 = valid, 1 = zero, 2 = special, 3 = empty
+        public ushort TagWord
+        {
+            get
+            {
+                int tags = 0;
+                for (int i = 0; i < 8; i++)
+                {
+                    int tag;
+                    if ((_empty & (1 << i)) != 0)
+                        tag = 3;
+                    else if (_regs[i] == 0)
+                        tag = 1;
+                    else if (double.IsNaN(_regs[i]) || double.IsInfinity(_regs[i]))
+                        tag = 2;
+                    else
+                        tag = 0;
+                    tags |= tag << (i * 2);
+                }
+                return (ushort)tags;
+            }
+            set
+            {
+                _empty = 0;
+                for (int i = 0; i < 8; i++)
+                {
+                    if (((value >> (i * 2)) & 3) == 3)
+                        _empty |= 1 << i;
+                }
+            }
+        }
+
+        public int Top
+        {
+            get { return _top; }
+        }
+
+        // Physical register access (FSAVE/FRSTOR and the debugger)
+        public double GetPhysicalRegister(int index)
+        {
+            return _regs[index & 7];
+        }
+
+        public void SetPhysicalRegister(int index, double value)
+        {
+            _regs[index & 7] = value;
+        }
+
+        public bool IsEmpty(int i)
+        {
+            return (_empty & (1 << ((_top + i) & 7))) != 0;
+        }
+
+        // ST(i)
+        public double Get(int i)
+        {
+            int reg = (_top + i) & 7;
+            if ((_empty & (1 << reg)) != 0)
+            {
+                Underflow();
+                return Indefinite;
+            }
+            return _regs[reg];
+        }
+
+        public void Set(int i, double value)
+        {
+            int reg = (_top + i) & 7;
+            _regs[reg] = value;
+            _empty &= ~(1 << reg);
+        }
+
+        public void Push(double value)
+        {
+            _top = (_top - 1) & 7;
+            if ((_empty & (1 << _top)) == 0)
+            {
+                // Stack overflow
+                Raise(FPUStatus.IE | FPUStatus.SF | FPUStatus.C1);
+                value = Indefinite;
+            }
+            _regs[_top] = value;
+            _empty &= ~(1 << _top);
+        }
+
+        public double Pop()
+        {
+            double value = Get(0);
+            _empty |= 1 << _top;
+            _top = (_top + 1) & 7;
+            return value;
+        }
+
+        // FFREE
+        public void Free(int i)
+        {
+            _empty |= 1 << ((_top + i) & 7);
+        }
+
+        // FXCH
+        public void Exchange(int i)
+        {
+            double a = Get(0);
+            double b = Get(i);
+            Set(0, b);
+            Set(i, a);
+        }
+
+        // FINCSTP/FDECSTP
+        public void IncrementTop()
+        {
+            _top = (_top + 1) & 7;
+        }
+
+        public void DecrementTop()
+        {
+            _top = (_top - 1) & 7;
+        }
+
+        void Underflow()
+        {
+            _status &= unchecked((ushort)~FPUStatus.C1);
+            Raise(FPUStatus.IE | FPUStatus.SF);
+        }
+
+        void Raise(ushort flags)
+        {
+            _status |= flags;
+
+            // Unmasked exceptions set the error summary
+            if ((flags & ~ControlWord & FPUStatus.ExceptionMask) != 0)
+                _status |= FPUStatus.ES | FPUStatus.B;
+        }
+
+        void SetConditionCodes(ushort codes)
+        {
+            _status = (ushort)((_status & ~FPUStatus.ConditionMask) | codes);
+        }
+        #endregion
+
+        #region Arithmetic
+        // Two operand arithmetic, operation is the reg field of the D8 group:
+        // 0 = add, 1 = mul, 4 = sub (a-b), 5 = subr (b-a), 6 = div (a/b), 7 = divr (b/a)
+        // An empty operand delivers the indefinite, whatever the other operand.
+
+        // ST(0) = ST(0) op value
+        public void Arithmetic(int operation, double value)
+        {
+            if (IsEmpty(0))
+            {
+                Underflow();
+                Set(0, Indefinite);
+                return;
+            }
+
+            Set(0, Calculate(operation, _regs[_top], value));
+        }
+
+        // ST(dest) = ST(0) op ST(i), where dest is either 0 or i
+        public void Arithmetic(int operation, int dest, int i)
+        {
+            if (IsEmpty(0) || IsEmpty(i))
+            {
+                Underflow();
+                Set(dest, Indefinite);
+                return;
+            }
+
+            Set(dest, Calculate(operation, _regs[_top], _regs[(_top + i) & 7]));
+        }
+
+        double Calculate(int operation, double a, double b)
+        {
+            if (double.IsNaN(a) && double.IsNaN(b))
+                return SelectNaN(a, b);
+
+            double result;
+            switch (operation)
+            {
+                case 0: result = a + b; break;
+                case 1: result = a * b; break;
+                case 4: result = a - b; break;
+                case 5: result = b - a; break;
+                case 6: result = Divide(a, b); break;
+                case 7: result = Divide(b, a); break;
+                default: throw new InvalidOpCodeException();
+            }
+
+            return CheckResult(result, a, b);
+        }
+
+        // When both operands are NaNs the x87 returns the one with the
+        // larger significand, or the positive one if they're the same (SSE,
+        // and so .NET, would return the first)
+        static double SelectNaN(double a, double b)
+        {
+            long sa = BitConverter.DoubleToInt64Bits(a) & 0x000FFFFFFFFFFFFFL;
+            long sb = BitConverter.DoubleToInt64Bits(b) & 0x000FFFFFFFFFFFFFL;
+            if (sa != sb)
+                return sa > sb ? a : b;
+            return BitConverter.DoubleToInt64Bits(a) >= 0 ? a : b;
+        }
+
+        double Divide(double dividend, double divisor)
+        {
+            if (divisor == 0 && dividend != 0 && !double.IsNaN(dividend) && !double.IsInfinity(dividend))
+                Raise(FPUStatus.ZE);
+            return dividend / divisor;
+        }
+
+        // Flag invalid operations (NaN from non-NaN operands) and overflow
+        // (infinity from finite, non-zero operands)
+        double CheckResult(double result, double a, double b)
+        {
+            if (double.IsNaN(result))
+            {
+                if (!double.IsNaN(a) && !double.IsNaN(b))
+                {
+                    Raise(FPUStatus.IE);
+                    return Indefinite;
+                }
+            }
+            else if (double.IsInfinity(result) && IsFiniteNonZero(a) && IsFiniteNonZero(b))
+            {
+                Raise(FPUStatus.OE | FPUStatus.PE);
+            }
+            return result;
+        }
+
+        double CheckResult(double result, double a)
+        {
+            return CheckResult(result, a, 1.0);
+        }
+
+        static bool IsFiniteNonZero(double value)
+        {
+            return value != 0 && !double.IsNaN(value) && !double.IsInfinity(value);
+        }
+
+        // FCOM/FUCOM, sets C3,C2,C0 for ST(0) compared to value
+        public void Compare(double value, bool unordered)
+        {
+            double st0 = Get(0);
+            if (double.IsNaN(st0) || double.IsNaN(value))
+            {
+                if (!unordered)
+                    Raise(FPUStatus.IE);
+                SetConditionCodes(FPUStatus.C3 | FPUStatus.C2 | FPUStatus.C0);
+            }
+            else if (st0 > value)
+                SetConditionCodes(0);
+            else if (st0 < value)
+                SetConditionCodes(FPUStatus.C0);
+            else
+                SetConditionCodes(FPUStatus.C3);
+        }
+
+        // FXAM
+        public void Examine()
+        {
+            ushort codes = 0;
+            int reg = _top;
+            double value = _regs[reg];
+
+            if (BitConverter.DoubleToInt64Bits(value) < 0)
+                codes |= FPUStatus.C1;
+
+            if ((_empty & (1 << reg)) != 0)
+                codes |= FPUStatus.C3 | FPUStatus.C0;
+            else if (double.IsNaN(value))
+                codes |= FPUStatus.C0;
+            else if (double.IsInfinity(value))
+                codes |= FPUStatus.C2 | FPUStatus.C0;
+            else if (value == 0)
+                codes |= FPUStatus.C3;
+            else
+                codes |= FPUStatus.C2;
+
+            SetConditionCodes(codes);
+        }
+
+        // Round to an integral value per the control word's rounding control
+        public double RoundToInteger(double value)
+        {
+            switch ((ControlWord >> 10) & 3)
+            {
+                case 0: return Math.Round(value, MidpointRounding.ToEven);
+                case 1: return Math.Floor(value);
+                case 2: return Math.Ceiling(value);
+                default: return Math.Truncate(value);
+            }
+        }
+
+        // FIST/FISTP conversion.  Out of range values (valid range is
+        // -limit <= x < limit) store the integer indefinite, which is also
+        // the most negative value of the integer type
+        public long ToInteger(double value, double limit)
+        {
+            double rounded = RoundToInteger(value);
+            if (!(rounded >= -limit && rounded < limit))
+            {
+                Raise(FPUStatus.IE);
+                return (long)-limit;
+            }
+            if (rounded != value)
+                Raise(FPUStatus.PE);
+            return (long)rounded;
+        }
+
+        // Single operand ops of the D9 E0-FF group that work on ST(0) (and ST(1))
+        public void Execute(byte op)
+        {
+            if (IsEmpty(0) || (UsesST1(op) && IsEmpty(1)))
+            {
+                StackUnderflow(op);
+                return;
+            }
+
+            if (PushesResult(op) && !IsEmpty(7))
+            {
+                // Stack overflow, the operation isn't performed
+                if (op != 0xF4)
+                    _status &= unchecked((ushort)~FPUStatus.C2);
+                Set(0, Indefinite);
+                Push(Indefinite);
+                return;
+            }
+
+            double st0 = Get(0);
+            switch (op)
+            {
+                case 0xE0:
+                    // FCHS
+                    Set(0, -st0);
+                    break;
+
+                case 0xE1:
+                    // FABS
+                    Set(0, Math.Abs(st0));
+                    break;
+
+                case 0xF0:
+                    // F2XM1
+                    Set(0, CheckResult(Math.Pow(2, st0) - 1, st0));
+                    break;
+
+                case 0xF1:
+                {
+                    // FYL2X
+                    double st1 = Get(1);
+                    if (st0 == 0 && !double.IsNaN(st1) && st1 != 0)
+                        Raise(FPUStatus.ZE);
+                    Pop();
+                    Set(0, CheckResult(st1 * (Math.Log(st0) * Log2E), st0, st1));
+                    break;
+                }
+
+                case 0xF2:
+                {
+                    // FPTAN (a NaN result is pushed in place of the 1.0)
+                    if (!InTrigRange(st0))
+                        break;
+                    double tan = CheckResult(Math.Tan(st0), st0);
+                    Set(0, tan);
+                    Push(double.IsNaN(tan) ? tan : 1.0);
+                    break;
+                }
+
+                case 0xF3:
+                {
+                    // FPATAN
+                    double st1 = Get(1);
+                    Pop();
+                    Set(0, Math.Atan2(st1, st0));
+                    break;
+                }
+
+                case 0xF4:
+                    // FXTRACT
+                    Extract(st0);
+                    break;
+
+                case 0xF5:
+                    // FPREM1
+                    PartialRemainder(st0, Get(1), true);
+                    break;
+
+                case 0xF8:
+                    // FPREM
+                    PartialRemainder(st0, Get(1), false);
+                    break;
+
+                case 0xF9:
+                {
+                    // FYL2XP1
+                    double st1 = Get(1);
+                    Pop();
+                    Set(0, CheckResult(st1 * (Log1P(st0) * Log2E), st0, st1));
+                    break;
+                }
+
+                case 0xFA:
+                    // FSQRT
+                    Set(0, CheckResult(Math.Sqrt(st0), st0));
+                    break;
+
+                case 0xFB:
+                    // FSINCOS
+                    if (!InTrigRange(st0))
+                        break;
+                    Set(0, CheckResult(Math.Sin(st0), st0));
+                    Push(CheckResult(Math.Cos(st0), st0));
+                    break;
+
+                case 0xFC:
+                    // FRNDINT
+                    Set(0, RoundToInteger(st0));
+                    break;
+
+                case 0xFD:
+                {
+                    // FSCALE
+                    double scale = Math.Truncate(Get(1));
+                    if (double.IsNaN(scale))
+                        Set(0, scale);
+                    else
+                        Set(0, CheckResult(Scale(st0, (int)Math.Max(-100000, Math.Min(100000, scale))), st0));
+                    break;
+                }
+
+                case 0xFE:
+                    // FSIN
+                    if (InTrigRange(st0))
+                        Set(0, CheckResult(Math.Sin(st0), st0));
+                    break;
+
+                case 0xFF:
+                    // FCOS
+                    if (InTrigRange(st0))
+                        Set(0, CheckResult(Math.Cos(st0), st0));
+                    break;
+
+                default:
+                    throw new InvalidOpCodeException();
+            }
+        }
+
+        static bool UsesST1(byte op)
+        {
+            switch (op)
+            {
+                case 0xF1: case 0xF3: case 0xF5: case 0xF8: case 0xF9: case 0xFD:
+                    return true;
+            }
+            return false;
+        }
+
+        static bool PushesResult(byte op)
+        {
+            return op == 0xF2 || op == 0xF4 || op == 0xFB;
+        }
+
+        // Masked response to an empty operand is the indefinite in place of
+        // the result, rather than the result of operating on the indefinite
+        void StackUnderflow(byte op)
+        {
+            Underflow();
+
+            switch (op)
+            {
+                case 0xF5: case 0xF8: case 0xFE: case 0xFF:
+                    // FPREM1, FPREM, FSIN, FCOS
+                    _status &= unchecked((ushort)~FPUStatus.C2);
+                    Set(0, Indefinite);
+                    break;
+
+                case 0xF1: case 0xF3: case 0xF9:
+                    // FYL2X, FPATAN, FYL2XP1 pop
+                    _empty |= 1 << _top;
+                    _top = (_top + 1) & 7;
+                    Set(0, Indefinite);
+                    break;
+
+                case 0xF2: case 0xF4: case 0xFB:
+                    // FPTAN, FXTRACT, FSINCOS push
+                    if (op != 0xF4)
+                        _status &= unchecked((ushort)~FPUStatus.C2);
+                    Set(0, Indefinite);
+                    Push(Indefinite);
+                    break;
+
+                default:
+                    Set(0, Indefinite);
+                    break;
+            }
+        }
+
+        const double Log2E = 1.4426950408889634;
+
+        public static readonly double[] Constants = new double[]
+        {
+            1.0,                    // FLD1
+            3.3219280948873622,     // FLDL2T
+            Log2E,                  // FLDL2E
+            Math.PI,                // FLDPI
+            0.30102999566398120,    // FLDLG2
+            0.69314718055994531,    // FLDLN2
+            0.0,                    // FLDZ
+        };
+
+        // Operands of FSIN, FCOS, FPTAN and FSINCOS must be less than 2^63,
+        // if not C2 is set and the operand left alone (infinity is invalid)
+        bool InTrigRange(double value)
+        {
+            if (Math.Abs(value) < 9223372036854775808.0 || double.IsNaN(value) || double.IsInfinity(value))
+            {
+                _status &= unchecked((ushort)~FPUStatus.C2);
+                return true;
+            }
+
+            _status |= FPUStatus.C2;
+            return false;
+        }
+
+        static double Log1P(double value)
+        {
+            // Compensates for the rounding of 1 + value when value is tiny
+            double u = 1 + value;
+            if (u == 1)
+                return value;
+            return Math.Log(u) * value / (u - 1);
+        }
+
+        void PartialRemainder(double dividend, double divisor, bool ieee)
+        {
+            if (divisor == 0 || double.IsInfinity(dividend) || double.IsNaN(dividend) || double.IsNaN(divisor))
+            {
+                Raise(double.IsNaN(dividend) || double.IsNaN(divisor) ? (ushort)0 : FPUStatus.IE);
+                _status &= unchecked((ushort)~FPUStatus.C2);
+                if (double.IsNaN(dividend) && double.IsNaN(divisor))
+                    Set(0, SelectNaN(dividend, divisor));
+                else
+                    Set(0, double.IsNaN(dividend) ? dividend : double.IsNaN(divisor) ? divisor : Indefinite);
+                return;
+            }
+
+            // Doubles reduce in one step so C2 (incomplete) is never set, the
+            // low three bits of the quotient are returned in C0, C3, C1
+            double remainder = ieee ? Math.IEEERemainder(dividend, divisor) : dividend % divisor;
+            double quotient = Math.Abs(Math.Round((dividend - remainder) / divisor));
+            int q = double.IsInfinity(quotient) ? 0 : (int)(quotient % 8);
+
+            ushort codes = 0;
+            if ((q & 4) != 0)
+                codes |= FPUStatus.C0;
+            if ((q & 2) != 0)
+                codes |= FPUStatus.C3;
+            if ((q & 1) != 0)
+                codes |= FPUStatus.C1;
+            SetConditionCodes(codes);
+
+            Set(0, remainder);
+        }
+
+        void Extract(double value)
+        {
+            if (double.IsNaN(value))
+            {
+                Push(value);
+                return;
+            }
+
+            if (value == 0)
+            {
+                Raise(FPUStatus.ZE);
+                Set(0, double.NegativeInfinity);
+                Push(value);
+                return;
+            }
+
+            if (double.IsInfinity(value))
+            {
+                Set(0, double.PositiveInfinity);
+                Push(value);
+                return;
+            }
+
+            int exponent = GetExponent(value);
+            Set(0, exponent);
+            Push(Scale(value, -exponent));
+        }
+
+        // Unbiased binary exponent of a finite, non-zero value
+        static int GetExponent(double value)
+        {
+            long bits = BitConverter.DoubleToInt64Bits(value);
+            int exponent = (int)((bits >> 52) & 0x7FF);
+            if (exponent == 0)
+            {
+                // Denormal
+                return GetExponent(value * TwoPow64) - 64;
+            }
+            return exponent - 1023;
+        }
+
+        const double TwoPow64 = 18446744073709551616.0;
+
+        // value * 2^exponent, done in steps so the powers of two stay in range
+        public static double Scale(double value, int exponent)
+        {
+            while (exponent > 1000)
+            {
+                value *= PowerOfTwo(1000);
+                exponent -= 1000;
+            }
+            while (exponent < -1000)
+            {
+                value *= PowerOfTwo(-1000);
+                exponent += 1000;
+            }
+            return value * PowerOfTwo(exponent);
+        }
+
+        static double PowerOfTwo(int exponent)
+        {
+            return BitConverter.Int64BitsToDouble((long)(exponent + 1023) << 52);
+        }
+        #endregion
+
+        #region Memory Formats
+        // 80-bit extended real, as a 64-bit significand (with explicit integer
+        // bit) and the sign and 15-bit exponent
+        public static double FromExtended(ulong significand, ushort signExponent)
+        {
+            bool negative = (signExponent & 0x8000) != 0;
+            int exponent = signExponent & 0x7FFF;
+            double value;
+
+            if (exponent == 0x7FFF)
+            {
+                if ((significand << 1) == 0)
+                {
+                    value = double.PositiveInfinity;
+                }
+                else
+                {
+                    // NaN, keep the top of the payload
+                    long bits = 0x7FF0000000000000L | (long)((significand << 1) >> 12);
+                    if ((bits & 0x000FFFFFFFFFFFFFL) == 0)
+                        bits |= 0x0008000000000000L;
+                    value = BitConverter.Int64BitsToDouble(bits);
+                }
+            }
+            else if (significand == 0)
+            {
+                value = 0;
+            }
+            else
+            {
+                // Denormals have an exponent of 1 - bias, same as exponent 1
+                value = Scale((double)significand, Math.Max(exponent, 1) - 16383 - 63);
+            }
+
+            return negative ? -value : value;
+        }
+
+        public static void ToExtended(double value, out ulong significand, out ushort signExponent)
+        {
+            long bits = BitConverter.DoubleToInt64Bits(value);
+            int exponent = (int)((bits >> 52) & 0x7FF);
+            ulong fraction = (ulong)bits & 0x000FFFFFFFFFFFFFUL;
+            ushort sign = (ushort)(bits < 0 ? 0x8000 : 0);
+
+            if (exponent == 0x7FF)
+            {
+                // Infinity or NaN
+                significand = 0x8000000000000000UL | (fraction << 11);
+                signExponent = (ushort)(sign | 0x7FFF);
+            }
+            else if (exponent == 0)
+            {
+                if (fraction == 0)
+                {
+                    // Zero
+                    significand = 0;
+                    signExponent = sign;
+                }
+                else
+                {
+                    // Double denormals are normal in extended precision
+                    exponent = 1;
+                    while ((fraction & 0x0010000000000000UL) == 0)
+                    {
+                        fraction <<= 1;
+                        exponent--;
+                    }
+                    significand = fraction << 11;
+                    signExponent = (ushort)(sign | (exponent - 1023 + 16383));
+                }
+            }
+            else
+            {
+                significand = 0x8000000000000000UL | (fraction << 11);
+                signExponent = (ushort)(sign | (exponent - 1023 + 16383));
+            }
+        }
+
+        // 80-bit packed BCD, 18 digits in the low 9 bytes and the sign in the top bit
+        public static double FromBcd(ulong low, ushort high)
+        {
+            long value = 0;
+            for (int i = 8; i >= 0; i--)
+            {
+                int b = i == 8 ? (high & 0xFF) : (int)((low >> (i * 8)) & 0xFF);
+                value = value * 100 + (b >> 4) * 10 + (b & 0x0F);
+            }
+
+            return (high & 0x8000) != 0 ? -(double)value : value;
+        }
+
+        public void ToBcd(double value, out ulong low, out ushort high)
+        {
+            double rounded = RoundToInteger(value);
+            if (!(Math.Abs(rounded) < 1e18))
+            {
+                // Packed BCD indefinite
+                Raise(FPUStatus.IE);
+                low = 0xC000000000000000UL;
+                high = 0xFFFF;
+                return;
+            }
+
+            ulong magnitude = (ulong)Math.Abs(rounded);
+            low = 0;
+            high = (ushort)(BitConverter.DoubleToInt64Bits(rounded) < 0 ? 0x8000 : 0);
+            for (int i = 0; i < 9; i++)
+            {
+                ulong b = (magnitude % 10) | ((magnitude / 10 % 10) << 4);
+                magnitude /= 100;
+                if (i == 8)
+                    high |= (ushort)b;
+                else
+                    low |= b << (i * 8);
+            }
+        }
+        #endregion
+    }
+}
@@ -29,6 +29,27 @@ namespace Sharp86
         bool IsExecutableSelector(ushort seg);
     }
 
+    // Direct access to the memory behind a selector (see ISegmentViewProvider)
+    public class SegmentView
+    {
+        public byte[] buffer;
+        public int baseOffset;              // Position of offset 0 in buffer
+        public int readLimit;               // Offsets below this can be read directly
+        public int writeLimit;              // Offsets below this can be written directly
+    }
+
+    // Optionally implemented by memory buses that can let the CPU read and
+    // write a selector's memory directly instead of through ReadByte/WriteByte.
+    // Return false to leave all access to the selector on the bus (eg: not
+    // present).  Anything not covered by the view's limits (faults, writes
+    // to code, writes that need extra work) also goes through the bus.  Views
+    // are held per selector index (the RPL bits are ignored) until the bus
+    // calls CPU.InvalidateSegmentView.
+    public interface ISegmentViewProvider
+    {
+        bool GetSegmentView(ushort seg, SegmentView view);
+    }
+
     public interface IPortBus
     {
         byte ReadPortByte(ushort port);
@@ -0,0 +1,157 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using Sharp86;
+
+namespace Sharp86UnitTests
+{
+    // Throughput measurements rather than tests - they're in the "Benchmark"
+    // category so normal runs can leave them out (eg: vstest.console
+    // /TestCaseFilter:"TestCategory!=Benchmark") and the rates are written
+    // to the test output.
+    [TestClass]
+    public class BenchmarkTests : CPUUnitTests
+    {
+        public TestContext TestContext { get; set; }
+
+        const int Passes = 16;
+
+        // Byte checksum over the whole of segment 0, five instructions per
+        // byte.  Runs one pass to warm up (JIT, decode cache and block
+        // compilation) and then times the rest.
+        void checksum_loop(string mode)
+        {
+            for (int i = 0; i < 0x10000; i++)
+            {
+                WriteByte(0, (ushort)i, (byte)(i * 7));
+            }
+
+            emit("label1:");
+            emit("mov al, [si]");
+            emit("add bx, ax");
+            emit("adc dx, 0");
+            emit("inc si");
+            emit("loop label1");
+            emit("hlt");
+
+            var sw = new Stopwatch();
+            ulong startTime = 0;
+            for (int pass = 0; pass <= Passes; pass++)
+            {
+                if (pass == 1)
+                {
+                    startTime = CpuTime;
+                    sw.Start();
+                }
+
+                Halted = false;
+                ip = 0x100;
+                ax = 0;
+                bx = 0;
+                dx = 0;
+                si = 0;
+                cx = 0;
+                if (pass == 0)
+                    step();
+                while (!Halted)
+                {
+                    Run(100000);
+                }
+            }
+            sw.Stop();
+
+            // The code lives in the segment too so is part of the sum
+            uint sum = 0;
+            for (int i = 0; i < 0x10000; i++)
+            {
+                sum += ReadByte(0, (ushort)i);
+            }
+            Assert.AreEqual(bx, (ushort)sum);
+            Assert.AreEqual(dx, (ushort)(sum >> 16));
+            Assert.AreEqual(CpuTime - startTime, (ulong)Passes * (0x10000 * 5 + 1));
+
+            TestContext.WriteLine("{0}: {1:F1} MIPS", mode, (CpuTime - startTime) / sw.Elapsed.TotalSeconds / 1e6);
+        }
+
+        // Multiply-add through the x87, four FPU instructions and a loop per
+        // iteration
+        [TestMethod]
+        [TestCategory("Benchmark")]
+        public void benchmark_fpu()
+        {
+            EnableFpu = true;
+
+            var constants = new double[] { 1.5, 0.999, 0.25 };
+            for (int i = 0; i < constants.Length; i++)
+            {
+                var bytes = BitConverter.GetBytes(constants[i]);
+                for (int j = 0; j < bytes.Length; j++)
+                    WriteByte(0, (ushort)(0x1000 + i * 8 + j), bytes[j]);
+            }
+
+            emit("label1:");
+            emit("fld qword [0x1000]");
+            emit("fmul qword [0x1008]");
+            emit("fadd qword [0x1010]");
+            emit("fstp qword [0x1018]");
+            emit("loop label1");
+            emit("hlt");
+
+            var sw = new Stopwatch();
+            ulong startTime = 0;
+            for (int pass = 0; pass <= Passes; pass++)
+            {
+                if (pass == 1)
+                {
+                    startTime = CpuTime;
+                    sw.Start();
+                }
+
+                Halted = false;
+                ip = 0x100;
+                cx = 0;
+                if (pass == 0)
+                    step();
+                while (!Halted)
+                {
+                    Run(100000);
+                }
+            }
+            sw.Stop();
+
+            Assert.AreEqual(Fpu.Top, 0);
+            Assert.AreEqual(CpuTime - startTime, (ulong)Passes * (0x10000 * 5 + 1));
+
+            TestContext.WriteLine("FPU: {0:F1}M x87 instructions/sec", (double)Passes * 0x10000 * 4 / sw.Elapsed.TotalSeconds / 1e6);
+        }
+
+        [TestMethod]
+        [TestCategory("Benchmark")]
+        public void benchmark_interpreter()
+        {
+            EnableBlockTranslation = false;
+            EnableDecodeCache = false;
+            checksum_loop("Interpreter");
+        }
+
+        [TestMethod]
+        [TestCategory("Benchmark")]
+        public void benchmark_decode_cache()
+        {
+            EnableBlockTranslation = false;
+            EnableDecodeCache = true;
+            checksum_loop("Decode cache");
+        }
+
+        [TestMethod]
+        [TestCategory("Benchmark")]
+        public void benchmark_block_translation()
+        {
+            EnableBlockTranslation = true;
+            checksum_loop("Block translation");
+        }
+    }
+}
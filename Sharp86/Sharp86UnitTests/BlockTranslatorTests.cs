@@ -0,0 +1,150 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using Sharp86;
+
+namespace Sharp86UnitTests
+{
+    [TestClass]
+    public class BlockTranslatorTests : CPUUnitTests
+    {
+        // Compiled blocks only run when the run frame has room for them
+        // so run in big chunks rather than single stepping
+        void runToHalt()
+        {
+            step();
+            while (!Halted)
+            {
+                Run(1000);
+            }
+        }
+
+        [TestMethod]
+        public void block_translation_loop()
+        {
+            EnableBlockTranslation = true;
+
+            for (int i = 0; i < 256; i++)
+            {
+                WriteByte(0, (ushort)(0x1000 + i), (byte)i);
+            }
+
+            ax = 0;
+            bx = 0;
+            dx = 0;
+            si = 0x1000;
+            cx = 256;
+            emit("label1:");
+            emit("mov al, [si]");
+            emit("add bx, ax");
+            emit("adc dx, 0");
+            emit("inc si");
+            emit("loop label1");
+            emit("hlt");
+            runToHalt();
+
+            Assert.AreEqual(bx, 255 * 256 / 2);
+            Assert.AreEqual(dx, 0);
+            Assert.AreEqual(si, 0x1100);
+            Assert.AreEqual(cx, 0);
+
+            // Every instruction still counted
+            Assert.AreEqual(CpuTime, (ulong)(256 * 5 + 1));
+        }
+
+        [TestMethod]
+        public void block_translation_invalidate()
+        {
+            EnableBlockTranslation = true;
+
+            bx = 0;
+            cx = 100;
+            emit("label1:");
+            emit("mov ax, 1");
+            emit("add bx, ax");
+            emit("loop label1");
+            emit("hlt");
+            runToHalt();
+            Assert.AreEqual(bx, 100);
+
+            // Patch the immediate, the compiled block must go with the page
+            WriteWord(0, 0x101, 2);
+            InvalidateDecodeCache(0, 0x101);
+
+            Halted = false;
+            bx = 0;
+            cx = 100;
+            ip = 0x100;
+            runToHalt();
+            Assert.AreEqual(bx, 200);
+        }
+
+        [TestMethod]
+        public void block_translation_fault()
+        {
+            EnableBlockTranslation = true;
+
+            // Divides by 100, 99, 98 ... until divide by zero faults part
+            // way through a compiled block
+            bx = 100;
+            cx = 0;
+            emit("label1:");
+            emit("mov ax, 100");
+            emit("xor dx, dx");
+            emit("inc cx");
+            emit("div bx");
+            emit("dec bx");
+            emit("jmp label1");
+
+            try
+            {
+                step();
+                Run(10000);
+                Assert.Fail("Expected divide by zero");
+            }
+            catch (DivideByZeroException)
+            {
+            }
+
+            // ip is left pointing at the faulting instruction
+            Assert.AreEqual(ip, 0x106);
+            Assert.AreEqual(cx, 101);
+            Assert.AreEqual(bx, 0);
+        }
+
+        [TestMethod]
+        public void block_translation_fault_flags()
+        {
+            EnableBlockTranslation = true;
+
+            // The xor's flags are dead (the sub overwrites them) but the sub's
+            // must still be set when the div faults
+            bx = 100;
+            cx = 0;
+            emit("label1:");
+            emit("mov ax, 100");
+            emit("xor dx, dx");
+            emit("sub cx, 1");
+            emit("div bx");
+            emit("dec bx");
+            emit("jmp label1");
+
+            try
+            {
+                step();
+                Run(10000);
+                Assert.Fail("Expected divide by zero");
+            }
+            catch (DivideByZeroException)
+            {
+            }
+
+            Assert.AreEqual(cx, 0xFF9B);
+            Assert.IsTrue(FlagS);
+            Assert.IsFalse(FlagZ);
+            Assert.IsFalse(FlagC);
+        }
+    }
+}
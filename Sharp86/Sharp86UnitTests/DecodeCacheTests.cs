@@ -0,0 +1,86 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using Sharp86;
+
+namespace Sharp86UnitTests
+{
+    [TestClass]
+    public class DecodeCacheTests : CPUUnitTests
+    {
+        [TestMethod]
+        public void decode_cache_loop()
+        {
+            EnableDecodeCache = true;
+
+            // Sum a table of words, second time round everything comes from the cache
+            for (int i = 0; i < 8; i++)
+            {
+                WriteWord(0, (ushort)(0x400 + i * 2), (ushort)(i + 1));
+            }
+
+            ax = 0;
+            si = 0;
+            cx = 8;
+            emit("label1:");
+            emit("add ax, [es:si+0x400]");
+            emit("add si, 2");
+            emit("loop label1");
+            run();
+
+            Assert.AreEqual(ax, 36);
+            Assert.AreEqual(si, 16);
+            Assert.AreEqual(cx, 0);
+        }
+
+        [TestMethod]
+        public void decode_cache_invalidate()
+        {
+            EnableDecodeCache = true;
+
+            emit("mov ax, 1");
+            step();
+            Assert.AreEqual(ax, 1);
+
+            // Patch the immediate and run it again
+            WriteWord(0, 0x101, 2);
+            ip = 0x100;
+            step();
+            Assert.AreEqual(ax, 1);
+
+            InvalidateDecodeCache(0, 0x101);
+            ip = 0x100;
+            step();
+            Assert.AreEqual(ax, 2);
+        }
+
+        [TestMethod]
+        public void decode_cache_rep_prefix()
+        {
+            EnableDecodeCache = true;
+
+            for (int i = 0; i < 6; i++)
+            {
+                WriteByte(0, (ushort)(0x400 + i), (byte)(0x10 + i));
+            }
+
+            si = 0x400;
+            di = 0x500;
+            cx = 3;
+            emit("rep movsb");
+            run();
+
+            // Again, from the cache
+            cx = 3;
+            ip = 0x100;
+            run();
+
+            Assert.AreEqual(si, 0x406);
+            Assert.AreEqual(di, 0x506);
+            Assert.AreEqual(cx, 0);
+            Assert.AreEqual(ReadByte(0, 0x505), 0x15);
+        }
+    }
+}
@@ -0,0 +1,269 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using Sharp86;
+
+namespace Sharp86UnitTests
+{
+    [TestClass]
+    public class FPUTests : CPUUnitTests
+    {
+        public FPUTests()
+        {
+            EnableFpu = true;
+        }
+
+        void WriteDouble(ushort offset, double value)
+        {
+            var bytes = BitConverter.GetBytes(value);
+            for (int i = 0; i < bytes.Length; i++)
+                WriteByte(0, (ushort)(offset + i), bytes[i]);
+        }
+
+        double ReadDouble(ushort offset)
+        {
+            var bytes = new byte[8];
+            for (int i = 0; i < bytes.Length; i++)
+                bytes[i] = ReadByte(0, (ushort)(offset + i));
+            return BitConverter.ToDouble(bytes, 0);
+        }
+
+        [TestMethod]
+        public void fpu_add_double()
+        {
+            WriteDouble(0x1000, 1.25);
+            WriteDouble(0x1008, 2.5);
+            emit("fld qword [0x1000]");
+            emit("fadd qword [0x1008]");
+            emit("fstp qword [0x1010]");
+            run();
+
+            Assert.AreEqual(ReadDouble(0x1010), 3.75);
+            Assert.AreEqual(Fpu.Top, 0);
+            Assert.AreEqual(Fpu.TagWord, 0xFFFF);
+            Assert.AreEqual(Fpu.StatusWord & FPUStatus.ExceptionMask, 0);
+        }
+
+        [TestMethod]
+        public void fpu_register_arithmetic()
+        {
+            WriteDouble(0x1000, 10);
+            WriteDouble(0x1008, 4);
+            emit("fld qword [0x1000]");
+            emit("fld qword [0x1008]");
+            emit("fsubr st1, st0");             // st1 = st0 - st1
+            emit("fdivp st1, st0");             // st1 = st1 / st0, pop
+            emit("fstp qword [0x1010]");
+            run();
+
+            Assert.AreEqual(ReadDouble(0x1010), -1.5);
+            Assert.AreEqual(Fpu.Top, 0);
+        }
+
+        [TestMethod]
+        public void fpu_integer_rounding()
+        {
+            WriteWord(0, 0x1000, 7);
+            WriteWord(0, 0x1002, 2);
+            WriteWord(0, 0x1004, 0x0F7F);       // Round toward zero
+            emit("fild word [0x1000]");
+            emit("fidiv word [0x1002]");
+            emit("fistp word [0x1010]");        // 3.5 rounds to even
+            emit("fild word [0x1000]");
+            emit("fchs");
+            emit("fidiv word [0x1002]");
+            emit("fldcw [0x1004]");
+            emit("fistp word [0x1012]");        // -3.5 chops
+            run();
+
+            Assert.AreEqual(ReadWord(0, 0x1010), 4);
+            Assert.AreEqual(ReadWord(0, 0x1012), 0xFFFD);
+            Assert.AreEqual(Fpu.StatusWord & FPUStatus.PE, FPUStatus.PE);
+        }
+
+        [TestMethod]
+        public void fpu_integer_overflow()
+        {
+            WriteDouble(0x1000, 40000);
+            emit("fld qword [0x1000]");
+            emit("fistp word [0x1010]");
+            run();
+
+            // Masked invalid operation stores the integer indefinite
+            Assert.AreEqual(ReadWord(0, 0x1010), 0x8000);
+            Assert.AreEqual(Fpu.StatusWord & FPUStatus.IE, FPUStatus.IE);
+        }
+
+        [TestMethod]
+        public void fpu_compare_branch()
+        {
+            emit("fld1");
+            emit("fldz");
+            emit("fcompp");                     // 0 < 1 sets C0
+            emit("fstsw ax");
+            emit("sahf");
+            emit("jb label1");
+            emit("mov bx, 2");
+            emit("jmp label2");
+            emit("label1:");
+            emit("mov bx, 1");
+            emit("label2:");
+            run();
+
+            Assert.AreEqual(bx, 1);
+            Assert.AreEqual(ax & (FPUStatus.C0 | FPUStatus.C2 | FPUStatus.C3), FPUStatus.C0);
+            Assert.AreEqual(Fpu.Top, 0);
+        }
+
+        [TestMethod]
+        public void fpu_sqrt_and_trig()
+        {
+            WriteDouble(0x1000, 2);
+            WriteWord(0, 0x1008, 6);
+            emit("fld qword [0x1000]");
+            emit("fsqrt");
+            emit("fstp qword [0x1010]");
+            emit("fldpi");
+            emit("fidiv word [0x1008]");
+            emit("fsin");
+            emit("fstp qword [0x1018]");
+            run();
+
+            Assert.AreEqual(ReadDouble(0x1010), Math.Sqrt(2));
+            Assert.AreEqual(ReadDouble(0x1018), 0.5, 1e-15);
+        }
+
+        [TestMethod]
+        public void fpu_stack_underflow()
+        {
+            emit("fld1");
+            emit("fadd st0, st1");              // st1 is empty
+            emit("fstp qword [0x1010]");
+            run();
+
+            Assert.AreEqual(BitConverter.DoubleToInt64Bits(ReadDouble(0x1010)), BitConverter.DoubleToInt64Bits(FPU.Indefinite));
+            Assert.AreEqual(Fpu.StatusWord & (FPUStatus.IE | FPUStatus.SF | FPUStatus.C1), FPUStatus.IE | FPUStatus.SF);
+        }
+
+        [TestMethod]
+        public void fpu_stack_overflow()
+        {
+            for (int i = 0; i < 8; i++)
+                emit("fld1");
+            emit("fldz");                       // wraps onto a full register
+            run();
+
+            Assert.AreEqual(BitConverter.DoubleToInt64Bits(Fpu.Get(0)), BitConverter.DoubleToInt64Bits(FPU.Indefinite));
+            Assert.AreEqual(Fpu.StatusWord & (FPUStatus.IE | FPUStatus.SF | FPUStatus.C1), FPUStatus.IE | FPUStatus.SF | FPUStatus.C1);
+            Assert.AreEqual(Fpu.TagWord, 0x8000);         // Only the indefinite in ST0 is special
+        }
+
+        [TestMethod]
+        public void fpu_exchange()
+        {
+            emit("fld1");
+            emit("fldz");
+            emit("fxch");
+            emit("fstp qword [0x1010]");
+            emit("fstp qword [0x1018]");
+            run();
+
+            Assert.AreEqual(ReadDouble(0x1010), 1.0);
+            Assert.AreEqual(ReadDouble(0x1018), 0.0);
+        }
+
+        [TestMethod]
+        public void fpu_extended_round_trip()
+        {
+            emit("fldpi");
+            emit("fstp tword [0x1000]");
+            emit("fld tword [0x1000]");
+            emit("fstp qword [0x1010]");
+            run();
+
+            Assert.AreEqual(ReadWord(0, 0x1008), 0x4000);
+            Assert.AreEqual(ReadWord(0, 0x1006), 0xC90F);
+            Assert.AreEqual(ReadDouble(0x1010), Math.PI);
+        }
+
+        [TestMethod]
+        public void fpu_bcd_round_trip()
+        {
+            // -1234567
+            var bcd = new byte[] { 0x67, 0x45, 0x23, 0x01, 0, 0, 0, 0, 0, 0x80 };
+            for (int i = 0; i < bcd.Length; i++)
+                WriteByte(0, (ushort)(0x1000 + i), bcd[i]);
+
+            emit("fbld tword [0x1000]");
+            emit("fst qword [0x1020]");
+            emit("fbstp tword [0x1010]");
+            run();
+
+            Assert.AreEqual(ReadDouble(0x1020), -1234567.0);
+            for (int i = 0; i < bcd.Length; i++)
+                Assert.AreEqual(ReadByte(0, (ushort)(0x1010 + i)), bcd[i]);
+        }
+
+        [TestMethod]
+        public void fpu_save_restore()
+        {
+            emit("fld1");
+            emit("fldpi");
+            emit("fnsave [0x1000]");
+            step();
+            step();
+            step();
+
+            // FSAVE reinitializes the FPU
+            Assert.AreEqual(Fpu.TagWord, 0xFFFF);
+            Assert.AreEqual(Fpu.ControlWord, 0x037F);
+
+            emit("frstor [0x1000]");
+            emit("fstp qword [0x1100]");
+            emit("fstp qword [0x1108]");
+            run();
+
+            Assert.AreEqual(ReadDouble(0x1100), Math.PI);
+            Assert.AreEqual(ReadDouble(0x1108), 1.0);
+        }
+
+        [TestMethod]
+        public void fpu_no_coprocessor()
+        {
+            EnableFpu = false;
+            emit("fld1");
+
+            try
+            {
+                step();
+                Assert.Fail("Expected InvalidOpCodeException");
+            }
+            catch (InvalidOpCodeException)
+            {
+            }
+        }
+
+        [TestMethod]
+        public void fpu_loop()
+        {
+            WriteDouble(0x1000, 1.5);
+            WriteDouble(0x1008, 0.999);
+            WriteDouble(0x1010, 0.25);
+
+            cx = 0x4000;
+            emit("label1:");
+            emit("fld qword [0x1000]");
+            emit("fmul qword [0x1008]");
+            emit("fadd qword [0x1010]");
+            emit("fstp qword [0x1018]");
+            emit("loop label1");
+            run();
+
+            Assert.AreEqual(ReadDouble(0x1018), 1.5 * 0.999 + 0.25);
+            Assert.AreEqual(Fpu.Top, 0);
+            Assert.AreEqual(cx, 0);
+        }
+    }
+}
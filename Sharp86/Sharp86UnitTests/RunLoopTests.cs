@@ -0,0 +1,67 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using Sharp86;
+
+namespace Sharp86UnitTests
+{
+    [TestClass]
+    public class RunLoopTests : CPUUnitTests
+    {
+        [TestMethod]
+        public void run_loop_hook_attach_detach()
+        {
+            int hookCalls = 0;
+
+            cx = 10;
+            emit("label1:");
+            emit("inc ax");
+            emit("loop label1");
+            emit("hlt");
+
+            // Instrumented loop calls the hook for every instruction
+            InstructionHook = () => hookCalls++;
+            step();
+            Run(3);
+            Assert.AreEqual(hookCalls, 4);
+
+            // Production loop doesn't
+            InstructionHook = null;
+            Run(4);
+            Assert.AreEqual(hookCalls, 4);
+            Assert.AreEqual(CpuTime, 8UL);
+            Assert.AreEqual(cx, 6);
+        }
+
+        [TestMethod]
+        public void run_loop_hook_detached_mid_frame()
+        {
+            int hookCalls = 0;
+
+            cx = 10;
+            emit("label1:");
+            emit("inc ax");
+            emit("loop label1");
+            emit("hlt");
+
+            // Changing the hook from within a run frame ends the frame so the
+            // next one starts in the other loop
+            InstructionHook = () =>
+            {
+                hookCalls++;
+                if (hookCalls == 2)
+                    InstructionHook = null;
+            };
+            step();
+            Run(100);
+            Assert.AreEqual(hookCalls, 2);
+            Assert.AreEqual(CpuTime, 2UL);
+
+            Run(100);
+            Assert.AreEqual(hookCalls, 2);
+            Assert.AreEqual(cx, 0);
+        }
+    }
+}
@@ -0,0 +1,140 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using Sharp86;
+
+namespace Sharp86UnitTests
+{
+    [TestClass]
+    public class SegmentViewTests : CPUUnitTests, ISegmentViewProvider
+    {
+        // Segment 0x1000 gets a view of its own buffer (rather than the bus
+        // memory) so the tests can see which path each access took
+        byte[] _view = new byte[0x100];
+
+        public bool GetSegmentView(ushort seg, SegmentView view)
+        {
+            if (seg != 0x1000)
+                return false;
+
+            view.buffer = _view;
+            view.baseOffset = 0;
+            view.readLimit = 0x80;
+            view.writeLimit = 0x40;
+            return true;
+        }
+
+        [TestMethod]
+        public void segment_view_limits()
+        {
+            _view[0x10] = 0x11;
+            _view[0x11] = 0x22;
+            _view[0x7F] = 0x77;
+            WriteWord(0x1000, 0x90, 0x5678);
+            WriteByte(0x1000, 0x7F, 0x99);
+
+            ds = 0x1000;
+            emit("mov ax, [0x10]");             // from the view
+            emit("mov bx, [0x90]");             // past the read limit, from the bus
+            emit("mov cx, [0x7F]");             // straddles the read limit, from the bus
+            emit("mov byte [0x20], 0x33");      // to the view
+            emit("mov byte [0x50], 0x44");      // past the write limit, to the bus
+            run();
+
+            Assert.AreEqual(ax, 0x2211);
+            Assert.AreEqual(bx, 0x5678);
+            Assert.AreEqual(cx, 0x0099);
+            Assert.AreEqual(_view[0x20], 0x33);
+            Assert.AreEqual(ReadByte(0x1000, 0x20), 0);
+            Assert.AreEqual(_view[0x50], 0);
+            Assert.AreEqual(ReadByte(0x1000, 0x50), 0x44);
+        }
+
+        [TestMethod]
+        public void segment_view_invalidate()
+        {
+            _view[0x10] = 1;
+
+            ds = 0x1000;
+            emit("mov al, [0x10]");
+            step();
+            Assert.AreEqual(al, 1);
+
+            // Memory moved, but the old view is still held...
+            _view = new byte[0x100];
+            _view[0x10] = 2;
+            ip = 0x100;
+            step();
+            Assert.AreEqual(al, 1);
+
+            // ...until invalidated
+            InvalidateSegmentView(0x1000);
+            ip = 0x100;
+            step();
+            Assert.AreEqual(al, 2);
+        }
+
+        [TestMethod]
+        public void segment_view_rep_movsb_overlap()
+        {
+            _view[0x10] = 0x55;
+
+            // Copying one byte up repeats the first byte, same as real hardware
+            ds = 0x1000;
+            es = 0x1000;
+            si = 0x10;
+            di = 0x11;
+            cx = 8;
+            emit("rep movsb");
+            run();
+
+            for (int i = 0; i < 9; i++)
+            {
+                Assert.AreEqual(_view[0x10 + i], 0x55);
+            }
+            Assert.AreEqual(si, 0x18);
+            Assert.AreEqual(di, 0x19);
+            Assert.AreEqual(cx, 0);
+        }
+
+        [TestMethod]
+        public void segment_view_repne_scasb()
+        {
+            _view[0x25] = 0x42;
+
+            es = 0x1000;
+            di = 0x20;
+            cx = 0x10;
+            al = 0x42;
+            emit("repne scasb");
+            run();
+
+            Assert.AreEqual(di, 0x26);
+            Assert.AreEqual(cx, 0x0A);
+            Assert.IsTrue(FlagZ);
+        }
+
+        [TestMethod]
+        public void segment_view_rep_stosw_past_limit()
+        {
+            // Runs past the write limit so goes an element at a time, with
+            // the last two words going to the bus
+            es = 0x1000;
+            di = 0x3C;
+            cx = 4;
+            ax = 0x1234;
+            emit("rep stosw");
+            run();
+
+            Assert.AreEqual(_view[0x3C], 0x34);
+            Assert.AreEqual(_view[0x3F], 0x12);
+            Assert.AreEqual(_view[0x40], 0);
+            Assert.AreEqual(ReadWord(0x1000, 0x40), 0x1234);
+            Assert.AreEqual(ReadWord(0x1000, 0x42), 0x1234);
+            Assert.AreEqual(di, 0x44);
+            Assert.AreEqual(cx, 0);
+        }
+    }
+}
@@ -27,7 +27,7 @@ using Sharp86;
 
 namespace Win3muCore
 {
-    public class Machine : CPU, DosApi.ISite, IMemoryBus
+    public class Machine : CPU, DosApi.ISite, IMemoryBus, ISegmentViewProvider
     {
         public Machine()
         {
@@ -80,16 +80,6 @@ namespace Win3muCore
             _moduleManager.LoadModule(new Sound());
 
             _disassembler = new Disassembler(this);
-
-            this.InstructionHook = () =>
-            {
-                if (logExecution)
-                {
-                    _disassembled = null;
-                    Log.WriteLine(_variableResolver.ResolveTokenizedString(_logExecutionFormat));
-                }
-            };
-
         }
 
         void UnhandledException(object sender, UnhandledExceptionEventArgs args)
@@ -215,6 +205,9 @@ namespace Win3muCore
                 _pathMapper.Prepare(mountPoints);
                 _dos.EnableApiLogging = logApiCalls;
                 _dos.EnableFileLogging = logFileOperations;
+                EnableDecodeCache = enableDecodeCache;
+                EnableBlockTranslation = enableDecodeCache && enableBlockTranslation;
+                EnableFpu = enableNativeFpu;
 
                 // Log configuration
                 Log.WriteLine("Configuration:");
@@ -244,8 +237,20 @@ namespace Win3muCore
                         _debugger.Break();
                 }
 
-                // Setup execution logging
+                // Setup execution logging (only hooked when it might be used
+                // since any hook keeps the CPU on its slower instrumented loop)
                 _logExecutionFormat = VariableResolver.TokenizeString(logExecutionFormat);
+                if (logExecution || enableDebugger)
+                {
+                    this.InstructionHook = () =>
+                    {
+                        if (logExecution)
+                        {
+                            _disassembled = null;
+                            Log.WriteLine(_variableResolver.ResolveTokenizedString(_logExecutionFormat));
+                        }
+                    };
+                }
 
                 // Map the program name to 8.3 name
                 var programName16 = _pathMapper.MapHostToGuest(programName, false);
@@ -325,6 +330,15 @@ namespace Win3muCore
         [Json("breakOnLoad")]
         public bool breakOnLoad;
 
+        [Json("enableDecodeCache")]
+        public bool enableDecodeCache = true;
+
+        [Json("enableBlockTranslation")]
+        public bool enableBlockTranslation = true;
+
+        [Json("enableNativeFpu")]
+        public bool enableNativeFpu = true;
+
         [Json("consoleLogger")]
         public bool consoleLogger;
 
@@ -457,10 +471,10 @@ namespace Win3muCore
                 this.ax = this.ss;
 
                 // Process until the sys return thunk is invoked
+                // (the sys ret handler aborts the run frame so this doesn't overshoot)
                 while (_sysRetDepth >= sysCallDepthAtCall)
                 {
-                    // Hrm - this isn't too efficient but will do for now.
-                    Run(1);
+                    Run(1000000);
                 }
 
                 if (logExecution)
@@ -522,6 +536,10 @@ namespace Win3muCore
         {
             _globalHeap.WriteByte(seg, offset, value);
         }
+        public bool GetSegmentView(ushort seg, SegmentView view)
+        {
+            return _globalHeap.GetSegmentView(seg, view);
+        }
         #endregion
 
         #region System Heap
@@ -598,6 +616,7 @@ namespace Win3muCore
                 {
                     // Mark the end of the system ret call
                     _sysRetDepth--;
+                    AbortRunFrame();
                     return;
                 }
 
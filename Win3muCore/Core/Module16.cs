@@ -454,6 +454,11 @@ namespace Win3muCore
 
                         case RelocationType.OSFixUp:
                         {
+                            // With a coprocessor the floating point instructions
+                            // are left as is (same as Windows does when WF_80x87 is set)
+                            if (machine.enableNativeFpu)
+                                break;
+
                             var fpOpCode = data.ReadWord(reloc.offset);
                             byte triByteTable = 0;
                             var replace = MapFPOpCodeToWin87EmInt(fpOpCode, ref triByteTable);
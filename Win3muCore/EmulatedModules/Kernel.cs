@@ -38,7 +38,10 @@ namespace Win3muCore
                 case 0x00B2:
                     // __WINFLAGS
                     // Under XP, WOW returns 0x4c29
-                    return 0xFFFF0000 | Win16.WF_PMODE | Win16.WF_CPU286 | Win16.WF_STANDARD | Win16.WF_PAGING;
+                    uint flags = 0xFFFF0000 | Win16.WF_PMODE | Win16.WF_CPU286 | Win16.WF_STANDARD | Win16.WF_PAGING;
+                    if (_machine.enableNativeFpu)
+                        flags |= Win16.WF_80x87;
+                    return flags;
 
                 case 0x0071:
                     // __AHSHIFT
@@ -1037,9 +1040,9 @@ namespace Win3muCore
                 return 0;
 
             var newSel = _machine.GlobalHeap.AllocSelector(string.Format("CS to DS alias for 0x{0:X4}", wSelector), 1);
-            newSel.allocation = sel.allocation;
             newSel.isCode = false;
             newSel.readOnly = false;
+            _machine.GlobalHeap.SetAllocation(newSel, sel.allocation);
 
             return newSel.selector;
         }
@@ -1075,11 +1078,7 @@ namespace Win3muCore
                 return 0;
 
             // Presto Chango
-            selDest.isCode = !selSrc.isCode;
-            selDest.readOnly = !selSrc.isCode;
-
-            // Return the new selector
-            return selDest.selector;
+            return _machine.GlobalHeap.SetSelectorAttributes(dest, !selSrc.isCode, !selSrc.isCode);
         }
 
         // 00B2 - __WINFLAGS
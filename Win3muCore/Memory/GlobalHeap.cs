@@ -39,7 +39,7 @@ namespace Win3muCore
         - 0x0008 - 0x7ff8 - 64k Segments (total 256Mb)
         - 0x8000 - 0xFFF8 - > 64k Segments
     */
-    public class GlobalHeap : IMemoryBus
+    public class GlobalHeap : IMemoryBus, ISegmentViewProvider
     {
         public GlobalHeap(Machine machine)
         {
@@ -55,6 +55,7 @@ namespace Win3muCore
         private Machine _machine;
         private RangeAllocator<Selector> _selectorAllocator = new RangeAllocator<Selector>(8192);
         private Selector[] _pageMap = new Selector[8192];
+        private SegmentView[] _segmentViews = new SegmentView[8192];
 
         public class Allocation
         {
@@ -70,6 +71,7 @@ namespace Win3muCore
             }
             public ushort flags;
             public byte[] buffer;
+            public List<Selector> selectors = new List<Selector>();     // Selectors mapping this allocation (including aliases)
             public LocalHeap localHeap;
             public string filename;
             public uint fileoffset;
@@ -120,6 +122,9 @@ namespace Win3muCore
                 _pageMap[(sel.selectorIndex + i)] = sel;
             }
 
+            // Drop any "not present" views of the selector
+            InvalidateSegmentViews(sel, pages);
+
             if (_machine.logGlobalAllocations)
             {
                 Log.WriteLine("Allocated selector: 0x{0:X4} ({1} pages)", sel.selector, pages);
@@ -150,6 +155,11 @@ namespace Win3muCore
                 _pageMap[sel.selectorIndex + i] = null;
             }
 
+            // Selector might be re-used for different code
+            InvalidateDecodeCache(sel, pages);
+            InvalidateSegmentViews(sel, pages);
+            SetAllocation(sel, null);
+
             if (_machine.logGlobalAllocations)
             {
                 Log.WriteLine("Freed selector: 0x{0:X4} ({1} pages)", sel.selector, pages);
@@ -181,7 +191,7 @@ namespace Win3muCore
             var sel = AllocSelector(name, pages);
 
             // Create the allocation entry
-            sel.allocation = new Allocation(data, Flags);
+            SetAllocation(sel, new Allocation(data, Flags));
 
             // Return the handle
             return sel.selector;
@@ -202,7 +212,7 @@ namespace Win3muCore
             var sel = AllocSelector(name, pages);
 
             // Create the allocation entry
-            sel.allocation = new Allocation(bytes, Flags);
+            SetAllocation(sel, new Allocation(bytes, Flags));
 
             // Return the handle
             return sel.selector;
@@ -228,6 +238,10 @@ namespace Win3muCore
                 sel.allocation.flags = flags;
                 sel.allocation.buffer = newBuffer;
 
+                // Aliases share the allocation so can't just drop this selector's view
+                InvalidateDecodeCache(sel.allocation);
+                InvalidateAllSegmentViews();
+
                 return handle;
             }
 
@@ -305,9 +319,36 @@ namespace Win3muCore
             sel.isCode = code;
             sel.readOnly = readOnly;
 
+            // Other selectors sharing the allocation may now be writing to code
+            InvalidateDecodeCache(sel);
+            InvalidateSegmentViews(sel.allocation);
+
             return sel.selector;
         }
 
+        // Attach an allocation to a selector.  Aliases attach the allocation of
+        // the selector they alias so writes through any of them can be matched
+        // to code in the others.
+        public void SetAllocation(Selector sel, Allocation allocation)
+        {
+            if (sel.allocation == allocation)
+                return;
+
+            if (sel.allocation != null)
+            {
+                sel.allocation.selectors.Remove(sel);
+                InvalidateSegmentViews(sel.allocation);
+            }
+
+            sel.allocation = allocation;
+
+            if (allocation != null)
+            {
+                allocation.selectors.Add(sel);
+                InvalidateSegmentViews(allocation);
+            }
+        }
+
         public HeapPointer GetHeapPointer(uint ptr, bool forWrite)
         {
             return new HeapPointer(this, ptr, forWrite);
@@ -332,6 +373,10 @@ namespace Win3muCore
             if (sel == null)
                 return null;
 
+            // Writing to code (eg: thunks)?
+            if (forWrite)
+                InvalidateDecodeCache(sel.allocation);
+
             // Return the buffer
             return sel.allocation.buffer;
         }
@@ -346,6 +391,10 @@ namespace Win3muCore
                 return null;
             }
 
+            // Writing to code?
+            if (forWrite)
+                InvalidateDecodeCache(sel.allocation);
+
             // Work out offset in buffer
             offset = ((ptr.Hiword() >> 3) - sel.selectorIndex) << 16 | ptr.Loword();
 
@@ -387,54 +436,191 @@ namespace Win3muCore
             return CreateLocalHeap(globalHandle, 0, maxSize);
         }
 
-        #region IMemoryBus
-        public bool IsExecutableSelector(ushort seg)
+        #region Decode Cache
+        // The CPU caches decoded instructions by code selector so anything that
+        // changes the code behind a selector needs to discard them.  Both the
+        // code (RPL 2) and data (RPL 3) forms of the selector are discarded
+        // since PrestoChangoSelector can switch between them.
+        //
+        // Writes are matched to code by allocation rather than by selector so
+        // that writes through any alias of a code segment are seen, whether
+        // or not the alias was created with AllocCStoDSAlias.
+        void InvalidateDecodeCache(Selector sel, int pages = 1)
         {
-            var alloc = GetSelector(seg);
-            if (alloc == null)
-                return false;
+            for (int i = 0; i < pages; i++)
+            {
+                ushort selector = (ushort)((sel.selectorIndex + i) << 3);
+                for (int rpl = 0; rpl < 8; rpl++)
+                {
+                    _machine.InvalidateDecodeCache((ushort)(selector | rpl));
+                }
+            }
+        }
 
-            return alloc.isCode;
+        // Discard all code in an allocation
+        void InvalidateDecodeCache(Allocation allocation)
+        {
+            foreach (var sel in allocation.selectors)
+            {
+                if (sel.isCode)
+                    InvalidateDecodeCache(sel, SelectorPages(sel));
+            }
         }
 
-        public byte ReadByte(ushort seg, ushort offset)
+        // Discard code at an offset in an allocation
+        void InvalidateDecodeCache(Allocation allocation, int bufferOffset)
         {
-            var sel = GetSelector(seg);
+            foreach (var sel in allocation.selectors)
+            {
+                if (!sel.isCode)
+                    continue;
 
-            try
+                if ((bufferOffset >> 16) >= SelectorPages(sel))
+                    continue;
+
+                ushort selector = (ushort)((sel.selectorIndex + (bufferOffset >> 16)) << 3);
+                for (int rpl = 0; rpl < 8; rpl++)
+                {
+                    _machine.InvalidateDecodeCache((ushort)(selector | rpl), (ushort)bufferOffset);
+                }
+            }
+        }
+
+        static bool ContainsCode(Allocation allocation)
+        {
+            foreach (var sel in allocation.selectors)
             {
-                return sel.allocation.buffer[((seg >> 3) - sel.selectorIndex) << 16 | offset];
+                if (sel.isCode)
+                    return true;
             }
-            catch (NullReferenceException)
+            return false;
+        }
+
+        // Number of 64K selectors mapped by a selector (aliases only map the first)
+        int SelectorPages(Selector sel)
+        {
+            int pages = 0;
+            while (sel.selectorIndex + pages < _pageMap.Length && _pageMap[sel.selectorIndex + pages] == sel)
+                pages++;
+            return pages;
+        }
+        #endregion
+
+        #region Segment Views
+        // Both ReadByte/WriteByte and the CPU access memory through views of
+        // each selector's buffer, so anything that changes the buffer or
+        // attributes behind a selector needs to discard them.
+        void InvalidateSegmentViews(Selector sel, int pages = 1)
+        {
+            for (int i = 0; i < pages; i++)
             {
-                throw new Sharp86.SegmentNotPresentException(seg);
+                _segmentViews[sel.selectorIndex + i] = null;
+                _machine.InvalidateSegmentView((ushort)((sel.selectorIndex + i) << 3));
             }
-            catch (IndexOutOfRangeException)
+        }
+
+        void InvalidateSegmentViews(Allocation allocation)
+        {
+            foreach (var sel in allocation.selectors)
             {
-                throw new Sharp86.GeneralProtectionFaultException(seg, offset, true);
+                InvalidateSegmentViews(sel, SelectorPages(sel));
             }
         }
 
-        public void WriteByte(ushort seg, ushort offset, byte value)
+        void InvalidateAllSegmentViews()
         {
-            var sel = GetSelector(seg);
+            Array.Clear(_segmentViews, 0, _segmentViews.Length);
+            _machine.InvalidateSegmentViews();
+        }
 
-            try
-            {
-                if (sel.readOnly || sel.isCode)
-                    throw new Sharp86.GeneralProtectionFaultException(seg, offset, false);
+        // Shared view for selectors with no memory behind them
+        static readonly SegmentView _notPresentView = new SegmentView();
+
+        // Views are built on first access rather than when the selector is
+        // allocated since the allocation is attached afterwards
+        SegmentView GetSegmentView(int selectorIndex)
+        {
+            var view = _segmentViews[selectorIndex];
+            if (view != null)
+                return view;
 
-                // Write byte
-                sel.allocation.buffer[((seg >> 3) - sel.selectorIndex) << 16 | offset] = value;
+            var sel = _pageMap[selectorIndex];
+            if (sel == null || sel.allocation == null || sel.allocation.buffer == null)
+            {
+                view = _notPresentView;
             }
-            catch (NullReferenceException)
+            else
             {
-                throw new Sharp86.SegmentNotPresentException(seg);
+                view = new SegmentView();
+                view.buffer = sel.allocation.buffer;
+                view.baseOffset = (selectorIndex - sel.selectorIndex) << 16;
+                view.readLimit = Math.Max(0, Math.Min(0x10000, view.buffer.Length - view.baseOffset));
+
+                // Writes that fault or need to invalidate decoded code take the slow path
+                view.writeLimit = (sel.readOnly || sel.isCode || ContainsCode(sel.allocation)) ? 0 : view.readLimit;
             }
-            catch (IndexOutOfRangeException)
+
+            _segmentViews[selectorIndex] = view;
+            return view;
+        }
+
+        public bool GetSegmentView(ushort seg, SegmentView view)
+        {
+            var source = GetSegmentView(seg >> 3);
+            if (source == _notPresentView)
+                return false;
+
+            view.buffer = source.buffer;
+            view.baseOffset = source.baseOffset;
+            view.readLimit = source.readLimit;
+            view.writeLimit = source.writeLimit;
+            return true;
+        }
+        #endregion
+
+        #region IMemoryBus
+        public bool IsExecutableSelector(ushort seg)
+        {
+            var alloc = GetSelector(seg);
+            if (alloc == null)
+                return false;
+
+            return alloc.isCode;
+        }
+
+        public byte ReadByte(ushort seg, ushort offset)
+        {
+            var view = GetSegmentView(seg >> 3);
+            if (offset < view.readLimit)
+                return view.buffer[view.baseOffset + offset];
+
+            if (view == _notPresentView)
+                throw new Sharp86.SegmentNotPresentException(seg);
+
+            throw new Sharp86.GeneralProtectionFaultException(seg, offset, true);
+        }
+
+        public void WriteByte(ushort seg, ushort offset, byte value)
+        {
+            var view = GetSegmentView(seg >> 3);
+            if (offset < view.writeLimit)
             {
-                throw new Sharp86.GeneralProtectionFaultException(seg, offset, false);
+                view.buffer[view.baseOffset + offset] = value;
+                return;
             }
+
+            if (view == _notPresentView)
+                throw new Sharp86.SegmentNotPresentException(seg);
+
+            var sel = GetSelector(seg);
+            if (offset >= view.readLimit || sel.readOnly || sel.isCode)
+                throw new Sharp86.GeneralProtectionFaultException(seg, offset, false);
+
+            // Write byte
+            view.buffer[view.baseOffset + offset] = value;
+
+            // Writing code through a data alias?
+            InvalidateDecodeCache(sel.allocation, view.baseOffset + offset);
         }
         #endregion
 
@@ -0,0 +1,112 @@
+﻿/*
+Win3mu - Windows 3 Emulator
+Copyright (C) 2017 Topten Software.
+
+Win3mu is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Win3mu is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Win3mu.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading.Tasks;
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using Win3muCore;
+
+namespace Win3muCoreUnitTests
+{
+    // Throughput of GlobalHeap memory access - in the "Benchmark" category so
+    // normal runs can leave them out, with the timings written to the test
+    // output.
+    [TestClass]
+    public class GlobalHeapBenchmarks
+    {
+        public TestContext TestContext { get; set; }
+
+        // Machine sets up process wide handle maps so only one can be created
+        static Machine _machine;
+        static GlobalHeap Heap
+        {
+            get
+            {
+                if (_machine == null)
+                    _machine = new Machine();
+                return _machine.GlobalHeap;
+            }
+        }
+
+        [TestMethod]
+        [TestCategory("Benchmark")]
+        public void benchmark_global_heap_read()
+        {
+            var heap = Heap;
+            var sel = heap.Alloc("Benchmark", 0, 0x1000);
+
+            const int reads = 100000000;
+            int sum = 0;
+            var sw = Stopwatch.StartNew();
+            for (int i = 0; i < reads; i++)
+            {
+                sum += heap.ReadByte(sel, (ushort)(i & 0xFFF));
+            }
+            sw.Stop();
+            heap.Free(sel);
+
+            Assert.AreEqual(sum, 0);
+            TestContext.WriteLine("In range reads: {0:F2} ns", sw.Elapsed.TotalMilliseconds * 1e6 / reads);
+        }
+
+        [TestMethod]
+        [TestCategory("Benchmark")]
+        public void benchmark_global_heap_fault()
+        {
+            var heap = Heap;
+            var sel = heap.Alloc("Benchmark", 0, 0x1000);
+            var freed = heap.Alloc("Benchmark", 0, 0x1000);
+            heap.Free(freed);
+
+            const int faults = 20000;
+            int gpCount = 0;
+            int npCount = 0;
+            var sw = Stopwatch.StartNew();
+            for (int i = 0; i < faults; i++)
+            {
+                try
+                {
+                    heap.ReadByte(sel, 0x2000);
+                }
+                catch (Sharp86.GeneralProtectionFaultException)
+                {
+                    gpCount++;
+                }
+
+                try
+                {
+                    heap.ReadByte(freed, 0);
+                }
+                catch (Sharp86.SegmentNotPresentException)
+                {
+                    npCount++;
+                }
+            }
+            sw.Stop();
+            heap.Free(sel);
+
+            Assert.AreEqual(gpCount, faults);
+            Assert.AreEqual(npCount, faults);
+            TestContext.WriteLine("Faulting reads: {0:F0} ns", sw.Elapsed.TotalMilliseconds * 1e6 / (2 * faults));
+        }
+    }
+}
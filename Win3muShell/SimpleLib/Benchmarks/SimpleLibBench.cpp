@@ -0,0 +1,1072 @@
+//////////////////////////////////////////////////////////////////////////
+// SimpleLibBench.cpp - microbenchmarks for SimpleLib containers
+//
+// Usage:
+//		SimpleLibBench [--benchmark_filter=<substring>]
+//					   [--benchmark_format=console|json]
+//					   [--benchmark_out=<file>]
+//					   [--benchmark_min_time=<seconds>]
+//					   [--benchmark_list_tests]
+//
+// Output (console and JSON) uses the same layout as Google Benchmark so its
+// tools (eg: compare.py) can be used to diff two runs.
+
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include "../SimpleLib.h"
+
+using namespace Simple;
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Harness
+
+// Stop the optimizer throwing away results
+template <class T>
+inline void DoNotOptimize(const T& val)
+{
+#if defined(__GNUC__)
+	asm volatile("" : : "r,m"(val) : "memory");
+#else
+	static volatile const void* s_pSink;
+	s_pSink=&val;
+#endif
+}
+
+class CBenchState
+{
+public:
+	CBenchState(int64_t iIterations, int64_t iArg) :
+		m_iIterations(iIterations),
+		m_iArg(iArg),
+		m_iItems(0),
+		m_iBytes(0),
+		m_iRemaining(iIterations),
+		m_bStarted(false),
+		m_dblRealTime(0),
+		m_dblCpuTime(0)
+	{
+	}
+
+	// while (state.KeepRunning()) { ... }
+	bool KeepRunning()
+	{
+		if (!m_bStarted)
+		{
+			m_bStarted=true;
+			ResumeTiming();
+		}
+		if (m_iRemaining-- > 0)
+			return true;
+		PauseTiming();
+		return false;
+	}
+
+	// Exclude setup work from the timing
+	void PauseTiming()
+	{
+		m_dblRealTime+=std::chrono::duration<double>(std::chrono::steady_clock::now()-m_tRealStart).count();
+		m_dblCpuTime+=double(clock()-m_tCpuStart)/CLOCKS_PER_SEC;
+	}
+	void ResumeTiming()
+	{
+		m_tRealStart=std::chrono::steady_clock::now();
+		m_tCpuStart=clock();
+	}
+
+	int64_t GetArg() const { return m_iArg; }
+	int64_t GetIterations() const { return m_iIterations; }
+	void SetItemsProcessed(int64_t iItems) { m_iItems=iItems; }
+	void SetBytesProcessed(int64_t iBytes) { m_iBytes=iBytes; }
+
+	int64_t	m_iIterations;
+	int64_t	m_iArg;
+	int64_t	m_iItems;
+	int64_t	m_iBytes;
+	int64_t	m_iRemaining;
+	bool	m_bStarted;
+	double	m_dblRealTime;		// Seconds
+	double	m_dblCpuTime;
+	std::chrono::steady_clock::time_point	m_tRealStart;
+	clock_t									m_tCpuStart;
+};
+
+typedef void (*PFNBENCHMARK)(CBenchState& state);
+
+struct BENCHMARK
+{
+	const char*		pszName;
+	PFNBENCHMARK	pfn;
+	int64_t			iArg;
+};
+
+struct BENCHRESULT
+{
+	CAnsiString	strName;
+	int64_t		iIterations;
+	double		dblRealTime;	// ns per iteration
+	double		dblCpuTime;
+	double		dblItemsPerSecond;
+	double		dblBytesPerSecond;
+};
+
+// Run with increasing iteration counts until it takes at least dblMinTime
+inline BENCHRESULT RunBenchmark(const BENCHMARK& b, double dblMinTime)
+{
+	int64_t iIterations=1;
+	while (true)
+	{
+		CBenchState state(iIterations, b.iArg);
+		b.pfn(state);
+
+		if (state.m_dblRealTime>=dblMinTime || iIterations>=1000000000)
+		{
+			BENCHRESULT r;
+			r.strName=b.iArg ? Format("%s/%lli", b.pszName, (long long)b.iArg) : CAnsiString(b.pszName);
+			r.iIterations=iIterations;
+			r.dblRealTime=state.m_dblRealTime*1e9/iIterations;
+			r.dblCpuTime=state.m_dblCpuTime*1e9/iIterations;
+			r.dblItemsPerSecond=state.m_iItems && state.m_dblRealTime>0 ? state.m_iItems/state.m_dblRealTime : 0;
+			r.dblBytesPerSecond=state.m_iBytes && state.m_dblRealTime>0 ? state.m_iBytes/state.m_dblRealTime : 0;
+			return r;
+		}
+
+		// Estimate how many iterations are needed, with some headroom
+		double dblScale=state.m_dblRealTime>0 ? dblMinTime*1.4/state.m_dblRealTime : 10;
+		if (dblScale>10)
+			dblScale=10;
+		if (dblScale<2)
+			dblScale=2;
+		iIterations=(int64_t)(iIterations*dblScale);
+	}
+}
+
+// Cheap repeatable random numbers so each run sees the same data
+inline unsigned int BenchRand(unsigned int& nSeed)
+{
+	nSeed=nSeed*1664525+1013904223;
+	return nSeed>>8;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CVector
+
+static void BM_VectorAdd(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	while (state.KeepRunning())
+	{
+		CVector<int> vec;
+		for (int i=0; i<iCount; i++)
+			vec.Add(i);
+		DoNotOptimize(vec.GetBuffer());
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_VectorAddArena(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CArena arena;
+	while (state.KeepRunning())
+	{
+		CArenaScope scope(arena);
+		{
+			CVector<int, SValue, int, SArena> vec;
+			for (int i=0; i<iCount; i++)
+				vec.Add(i);
+			DoNotOptimize(vec.GetBuffer());
+		}
+		arena.FreeAll();
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void FillRandom(CVector<int>& vec, int iCount)
+{
+	unsigned int nSeed=12345;
+	vec.RemoveAll();
+	for (int i=0; i<iCount; i++)
+		vec.Add((int)BenchRand(nSeed));
+}
+
+static int SIMPLECDECL CompareInt(const int& a, const int& b)
+{
+	return a<b ? -1 : a>b ? 1 : 0;
+}
+
+static int SIMPLECDECL CompareIntCrt(const void* a, const void* b)
+{
+	return CompareInt(*(const int*)a, *(const int*)b);
+}
+
+static void BM_VectorSortCrtQsort(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int> vec;
+	while (state.KeepRunning())
+	{
+		state.PauseTiming();
+		FillRandom(vec, iCount);
+		state.ResumeTiming();
+		qsort(vec.GetBuffer(), vec.GetSize(), sizeof(int), CompareIntCrt);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_VectorQuickSort(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int> vec;
+	while (state.KeepRunning())
+	{
+		state.PauseTiming();
+		FillRandom(vec, iCount);
+		state.ResumeTiming();
+		vec.QuickSort();
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_VectorQuickSortFn(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int> vec;
+	while (state.KeepRunning())
+	{
+		state.PauseTiming();
+		FillRandom(vec, iCount);
+		state.ResumeTiming();
+		vec.QuickSort(CompareInt);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_VectorRadixSort(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int> vec;
+	while (state.KeepRunning())
+	{
+		state.PauseTiming();
+		FillRandom(vec, iCount);
+		state.ResumeTiming();
+		vec.RadixSort();
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_VectorParallelSort(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int> vec;
+	while (state.KeepRunning())
+	{
+		state.PauseTiming();
+		FillRandom(vec, iCount);
+		state.ResumeTiming();
+		vec.ParallelSort(0);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_VectorQuickSearch(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int> vec;
+	FillRandom(vec, iCount);
+	vec.QuickSort();
+	unsigned int nSeed=999;
+	while (state.KeepRunning())
+	{
+		int iPos;
+		DoNotOptimize(vec.QuickSearch((int)BenchRand(nSeed), iPos));
+	}
+	state.SetItemsProcessed(state.GetIterations());
+}
+
+static void BM_SortedVectorAdd(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int> vecSource;
+	FillRandom(vecSource, iCount);
+	while (state.KeepRunning())
+	{
+		CSortedVector<int> vec;
+		for (int i=0; i<iCount; i++)
+			vec.Add(vecSource[i]);
+		DoNotOptimize(vec.GetSize());
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_SortedVectorBulkAdd(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int> vecSource;
+	FillRandom(vecSource, iCount);
+	while (state.KeepRunning())
+	{
+		CSortedVector<int> vec;
+		vec.Add(vecSource.GetBuffer(), iCount);
+		DoNotOptimize(vec.GetSize());
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CString
+
+static void BM_StringAppend(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	while (state.KeepRunning())
+	{
+		CAnsiString str;
+		for (int i=0; i<iCount; i++)
+			str+="abcdefgh";
+		DoNotOptimize(str.sz());
+	}
+	state.SetBytesProcessed(state.GetIterations()*iCount*8);
+}
+
+static void BM_StringCopy(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CUniString str(L"The quick brown fox jumps over the lazy dog");
+	CVector<CUniString> vec;
+	while (state.KeepRunning())
+	{
+		for (int i=0; i<iCount; i++)
+			vec.Add(str);
+		vec.RemoveAll();
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static CUniString MakeHaystack(int iLength)
+{
+	CUniString str;
+	unsigned int nSeed=42;
+	for (int i=0; i<iLength; i++)
+		str+=(wchar_t)('a'+BenchRand(nSeed)%26);
+	return str;
+}
+
+static void BM_StringFind(CBenchState& state)
+{
+	CUniString str=MakeHaystack((int)state.GetArg());
+	while (state.KeepRunning())
+	{
+		DoNotOptimize(str.Find(L"NOTFOUND"));
+	}
+	state.SetBytesProcessed(state.GetIterations()*str.GetLength()*sizeof(wchar_t));
+}
+
+static void BM_StringFindI(CBenchState& state)
+{
+	CUniString str=MakeHaystack((int)state.GetArg());
+	while (state.KeepRunning())
+	{
+		DoNotOptimize(str.FindI(L"NOTFOUND"));
+	}
+	state.SetBytesProcessed(state.GetIterations()*str.GetLength()*sizeof(wchar_t));
+}
+
+static void BM_StringFindAnsi(CBenchState& state)
+{
+	CAnsiString str=w2a(MakeHaystack((int)state.GetArg()));
+	while (state.KeepRunning())
+	{
+		DoNotOptimize(str.Find("NOTFOUND"));
+	}
+	state.SetBytesProcessed(state.GetIterations()*str.GetLength());
+}
+
+// Caseless compare of the whole string against an upper cased copy
+static void BM_StringEqualI(CBenchState& state)
+{
+	CUniString str=MakeHaystack((int)state.GetArg());
+	CUniString strUpper=str.ToUpper();
+	while (state.KeepRunning())
+	{
+		DoNotOptimize(str.StartsWithI(strUpper));
+	}
+	state.SetBytesProcessed(state.GetIterations()*str.GetLength()*sizeof(wchar_t));
+}
+
+static void BM_StringToUpper(CBenchState& state)
+{
+	CUniString str=MakeHaystack((int)state.GetArg());
+	while (state.KeepRunning())
+	{
+		CUniString strUpper=str.ToUpper();
+		DoNotOptimize(strUpper.sz());
+	}
+	state.SetBytesProcessed(state.GetIterations()*str.GetLength()*sizeof(wchar_t));
+}
+
+static void BM_StringFormat(CBenchState& state)
+{
+	int i=0;
+	while (state.KeepRunning())
+	{
+		CAnsiString str=Format("Module %s handle %i at %x", "KERNEL", i, i*16);
+		DoNotOptimize(str.sz());
+		i++;
+	}
+	state.SetItemsProcessed(state.GetIterations());
+}
+
+static void BM_StringCFormat(CBenchState& state)
+{
+	int i=0;
+	while (state.KeepRunning())
+	{
+		CAnsiString str=CFormat<char>() << "Module " << "KERNEL" << " handle " << i << " at " << FormatHex(i*16);
+		DoNotOptimize(str.sz());
+		i++;
+	}
+	state.SetItemsProcessed(state.GetIterations());
+}
+
+static void BM_StringA2W(CBenchState& state)
+{
+	CAnsiString str=w2a(MakeHaystack((int)state.GetArg()));
+	while (state.KeepRunning())
+	{
+		CUniString strW=a2w(str);
+		DoNotOptimize(strW.sz());
+	}
+	state.SetBytesProcessed(state.GetIterations()*str.GetLength());
+}
+
+static void BM_StringW2A(CBenchState& state)
+{
+	CUniString str=MakeHaystack((int)state.GetArg());
+	while (state.KeepRunning())
+	{
+		CAnsiString strA=w2a(str);
+		DoNotOptimize(strA.sz());
+	}
+	state.SetBytesProcessed(state.GetIterations()*str.GetLength());
+}
+
+static void BM_StringCT2T(CBenchState& state)
+{
+	CAnsiString str=w2a(MakeHaystack((int)state.GetArg()));
+	while (state.KeepRunning())
+	{
+		CT2T<wchar_t, char> strW(str);
+		DoNotOptimize(strW.sz());
+	}
+	state.SetBytesProcessed(state.GetIterations()*str.GetLength());
+}
+
+static void BM_StringPoolIntern(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<CAnsiString> vecNames;
+	unsigned int nSeed=7;
+	for (int i=0; i<iCount; i++)
+		vecNames.Add(Format("MODULE%i", BenchRand(nSeed)%(iCount/2+1)));
+
+	while (state.KeepRunning())
+	{
+		CStringPool<char, SCaseInsensitive> pool;
+		for (int i=0; i<iCount; i++)
+			DoNotOptimize(pool.Intern(vecNames[i]));
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Maps - insert, find and iterate for each map type
+
+template <class TMap>
+static void BenchMapInsert(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	while (state.KeepRunning())
+	{
+		TMap map;
+		unsigned int nSeed=1;
+		for (int i=0; i<iCount; i++)
+			map.Add((int)BenchRand(nSeed), i);
+		DoNotOptimize(map.GetSize());
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+template <class TMap>
+static void BenchMapFind(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	TMap map;
+	unsigned int nSeed=1;
+	for (int i=0; i<iCount; i++)
+		map.Add((int)BenchRand(nSeed), i);
+
+	int i=0;
+	while (state.KeepRunning())
+	{
+		// Alternate hits and misses
+		if ((i & 1023)==0)
+			nSeed=1;
+		int iValue=0;
+		DoNotOptimize(map.Find((int)BenchRand(nSeed)+(i & 1), iValue));
+		i++;
+	}
+	state.SetItemsProcessed(state.GetIterations());
+}
+
+template <class TMap>
+static void BenchMapIterate(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	TMap map;
+	unsigned int nSeed=1;
+	for (int i=0; i<iCount; i++)
+		map.Add((int)BenchRand(nSeed), i);
+
+	while (state.KeepRunning())
+	{
+		int iTotal=0;
+		for (int i=0; i<map.GetSize(); i++)
+			iTotal+=map[i].Value;
+		DoNotOptimize(iTotal);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+template <class TMap>
+static void BenchMapRangeFor(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	TMap map;
+	unsigned int nSeed=1;
+	for (int i=0; i<iCount; i++)
+		map.Add((int)BenchRand(nSeed), i);
+
+	while (state.KeepRunning())
+	{
+		int iTotal=0;
+		for (auto kp : map)
+			iTotal+=kp.Value;
+		DoNotOptimize(iTotal);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+// CMap and CIndex have no LowerBound so binary search on position, which is
+// what a caller of either would have to do for a range query
+template <typename TMap>
+static int MapLowerBound(TMap& map, int Key)
+{
+	int iLow=0;
+	int iHigh=map.GetSize();
+	while (iLow<iHigh)
+	{
+		int iMid=(iLow+iHigh)/2;
+		if (map[iMid].Key<Key)
+			iLow=iMid+1;
+		else
+			iHigh=iMid;
+	}
+	return iLow;
+}
+
+static int MapLowerBound(CBTreeMap<int,int>& map, int Key)
+{
+	return map.LowerBound(Key);
+}
+
+// Range query - find the first key >= a random key and walk the next 64 in order
+template <typename TMap>
+static void BenchMapRangeScan(CBenchState& state)
+{
+	const int iScan=64;
+	int iCount=(int)state.GetArg();
+	TMap map;
+	unsigned int nSeed=1;
+	for (int i=0; i<iCount; i++)
+		map.Add((int)BenchRand(nSeed), i);
+
+	nSeed=7;
+	while (state.KeepRunning())
+	{
+		int iPos=MapLowerBound(map, (int)BenchRand(nSeed));
+		int iEnd=iPos+iScan<map.GetSize() ? iPos+iScan : map.GetSize();
+		int iTotal=0;
+		for (int i=iPos; i<iEnd; i++)
+			iTotal+=map[i].Value;
+		DoNotOptimize(iTotal);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iScan);
+}
+
+static void BM_MapInsert(CBenchState& state)			{ BenchMapInsert<CMap<int,int> >(state); }
+static void BM_MapFind(CBenchState& state)				{ BenchMapFind<CMap<int,int> >(state); }
+static void BM_MapIterate(CBenchState& state)			{ BenchMapIterate<CMap<int,int> >(state); }
+static void BM_MapRangeFor(CBenchState& state)			{ BenchMapRangeFor<CMap<int,int> >(state); }
+static void BM_MapRangeScan(CBenchState& state)			{ BenchMapRangeScan<CMap<int,int> >(state); }
+static void BM_HashMapInsert(CBenchState& state)		{ BenchMapInsert<CHashMap<int,int> >(state); }
+static void BM_HashMapFind(CBenchState& state)			{ BenchMapFind<CHashMap<int,int> >(state); }
+static void BM_HashMapIterate(CBenchState& state)		{ BenchMapIterate<CHashMap<int,int> >(state); }
+static void BM_HashMapRangeFor(CBenchState& state)		{ BenchMapRangeFor<CHashMap<int,int> >(state); }
+static void BM_IndexInsert(CBenchState& state)			{ BenchMapInsert<CIndex<int,int> >(state); }
+static void BM_IndexFind(CBenchState& state)			{ BenchMapFind<CIndex<int,int> >(state); }
+static void BM_IndexIterate(CBenchState& state)			{ BenchMapIterate<CIndex<int,int> >(state); }
+static void BM_IndexRangeScan(CBenchState& state)		{ BenchMapRangeScan<CIndex<int,int> >(state); }
+static void BM_BTreeMapInsert(CBenchState& state)		{ BenchMapInsert<CBTreeMap<int,int> >(state); }
+static void BM_BTreeMapFind(CBenchState& state)			{ BenchMapFind<CBTreeMap<int,int> >(state); }
+static void BM_BTreeMapIterate(CBenchState& state)		{ BenchMapIterate<CBTreeMap<int,int> >(state); }
+static void BM_BTreeMapRangeScan(CBenchState& state)	{ BenchMapRangeScan<CBTreeMap<int,int> >(state); }
+
+static void BM_IndexBulkAdd(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int> vecKeys;
+	FillRandom(vecKeys, iCount);
+	CVector<int> vecValues;
+	vecValues.SetSize(iCount, 0);
+	while (state.KeepRunning())
+	{
+		CIndex<int,int> index;
+		index.Add(vecKeys.GetBuffer(), vecValues.GetBuffer(), iCount);
+		DoNotOptimize(index.GetSize());
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Intrusive containers
+
+struct CCacheItem
+{
+	int						m_iID;
+	CHashChain<CCacheItem>	m_HashChain;
+	CChain<CCacheItem>		m_Chain;
+};
+
+static void BM_LruCacheFindAdd(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+
+	// Items recycled through the cache so there's no allocation in the loop
+	CVector<CCacheItem*, SOwnedPtr> vecItems;
+	for (int i=0; i<iCount*2; i++)
+		vecItems.Add(new CCacheItem());
+
+	CLruCache<CCacheItem, int, &CCacheItem::m_iID> cache(iCount);
+	unsigned int nSeed=3;
+	int iNext=0;
+	while (state.KeepRunning())
+	{
+		int iID=(int)(BenchRand(nSeed)%(iCount*2));
+		if (!cache.Find(iID))
+		{
+			// Reuse the least recently used item once full
+			CCacheItem* pItem=cache.GetSize()<iCount ? vecItems[iNext++] : cache.Detach(cache.GetLeastRecent());
+			pItem->m_iID=iID;
+			cache.Add(pItem);
+		}
+	}
+	cache.RemoveAll();
+	state.SetItemsProcessed(state.GetIterations());
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CPlex, queues and grids
+
+static void BM_PlexAllocFree(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int*> vecItems;
+	vecItems.SetSize(iCount, NULL);
+	CPlex<int> plex;
+	while (state.KeepRunning())
+	{
+		for (int i=0; i<iCount; i++)
+			vecItems.ReplaceAt(i, plex.Alloc());
+		for (int i=0; i<iCount; i++)
+			plex.Free(vecItems[i]);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_MallocFree(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	CVector<int*> vecItems;
+	vecItems.SetSize(iCount, NULL);
+	while (state.KeepRunning())
+	{
+		for (int i=0; i<iCount; i++)
+			vecItems.ReplaceAt(i, (int*)malloc(sizeof(int)));
+		for (int i=0; i<iCount; i++)
+			free(vecItems[i]);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_RingBuffer(CBenchState& state)
+{
+	int iBatch=(int)state.GetArg();
+	CRingBuffer<int> ring(iBatch);
+	while (state.KeepRunning())
+	{
+		for (int i=0; i<iBatch; i++)
+			ring.Enqueue(i);
+		int iTotal=0;
+		for (int i=0; i<iBatch; i++)
+			iTotal+=ring.Dequeue();
+		DoNotOptimize(iTotal);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iBatch);
+}
+
+static void BM_MpmcQueue(CBenchState& state)
+{
+	int iBatch=(int)state.GetArg();
+	CMpmcQueue<int> queue(iBatch);
+	while (state.KeepRunning())
+	{
+		for (int i=0; i<iBatch; i++)
+			queue.Enqueue(i);
+		int iTotal=0;
+		int iValue=0;
+		for (int i=0; i<iBatch; i++)
+		{
+			queue.Dequeue(iValue);
+			iTotal+=iValue;
+		}
+		DoNotOptimize(iTotal);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iBatch);
+}
+
+static void BM_MpmcQueueThreaded(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	while (state.KeepRunning())
+	{
+		CMpmcQueue<int> queue(1024);
+		std::thread producer([&queue, iCount]()
+		{
+			for (int i=0; i<iCount; i++)
+			{
+				while (!queue.Enqueue(i))
+					std::this_thread::yield();
+			}
+		});
+
+		int iValue=0;
+		for (int i=0; i<iCount; i++)
+		{
+			while (!queue.Dequeue(iValue))
+				std::this_thread::yield();
+		}
+		producer.join();
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_WorkStealingDeque(CBenchState& state)
+{
+	int iBatch=(int)state.GetArg();
+	CWorkStealingDeque<int> deque;
+	while (state.KeepRunning())
+	{
+		for (int i=0; i<iBatch; i++)
+			deque.Push(i);
+		int iTotal=0;
+		int iValue=0;
+		for (int i=0; i<iBatch; i++)
+		{
+			deque.Pop(iValue);
+			iTotal+=iValue;
+		}
+		DoNotOptimize(iTotal);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iBatch);
+}
+
+// Owner pushes and pops while a second thread steals from the other end
+static void BM_WorkStealingDequeThreaded(CBenchState& state)
+{
+	int iCount=(int)state.GetArg();
+	while (state.KeepRunning())
+	{
+		CWorkStealingDeque<int> deque;
+		std::atomic<int> iReceived(0);
+		std::thread thief([&deque, &iReceived, iCount]()
+		{
+			int iValue=0;
+			while (iReceived.load(std::memory_order_relaxed)<iCount)
+			{
+				if (deque.Steal(iValue))
+					iReceived.fetch_add(1, std::memory_order_relaxed);
+				else
+					std::this_thread::yield();
+			}
+		});
+
+		int iValue=0;
+		for (int i=0; i<iCount; i++)
+		{
+			deque.Push(i);
+			if ((i&1) && deque.Pop(iValue))
+				iReceived.fetch_add(1, std::memory_order_relaxed);
+		}
+		while (deque.Pop(iValue))
+			iReceived.fetch_add(1, std::memory_order_relaxed);
+		thief.join();
+	}
+	state.SetItemsProcessed(state.GetIterations()*iCount);
+}
+
+static void BM_GridRowScan(CBenchState& state)
+{
+	int iSize=(int)state.GetArg();
+	CGrid<int> grid;
+	for (int i=0; i<iSize; i++)
+		grid.InsertColumn(0, 1);
+	for (int i=0; i<iSize; i++)
+		grid.InsertRow(0, 1);
+	while (state.KeepRunning())
+	{
+		int iTotal=0;
+		for (int y=0; y<iSize; y++)
+			for (int x=0; x<iSize; x++)
+				iTotal+=grid[x][y];
+		DoNotOptimize(iTotal);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iSize*iSize);
+}
+
+static void BM_FlatGridRowScan(CBenchState& state)
+{
+	int iSize=(int)state.GetArg();
+	CFlatGrid<int> grid(iSize, iSize);
+	while (state.KeepRunning())
+	{
+		int iTotal=0;
+		for (int y=0; y<iSize; y++)
+		{
+			int* pRow=grid.GetRow(y);
+			for (int x=0; x<iSize; x++)
+				iTotal+=pRow[x];
+		}
+		DoNotOptimize(iTotal);
+	}
+	state.SetItemsProcessed(state.GetIterations()*iSize*iSize);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Benchmark table
+
+static const BENCHMARK g_Benchmarks[]=
+{
+	{ "BM_VectorAdd",				BM_VectorAdd,				1024 },
+	{ "BM_VectorAdd",				BM_VectorAdd,				1<<20 },
+	{ "BM_VectorAddArena",			BM_VectorAddArena,			1024 },
+	{ "BM_VectorSortCrtQsort",		BM_VectorSortCrtQsort,		1<<16 },
+	{ "BM_VectorQuickSort",			BM_VectorQuickSort,			1<<16 },
+	{ "BM_VectorQuickSortFn",		BM_VectorQuickSortFn,		1<<16 },
+	{ "BM_VectorRadixSort",			BM_VectorRadixSort,			1<<16 },
+	{ "BM_VectorParallelSort",		BM_VectorParallelSort,		1<<20 },
+	{ "BM_VectorQuickSearch",		BM_VectorQuickSearch,		1<<16 },
+	{ "BM_SortedVectorAdd",			BM_SortedVectorAdd,			4096 },
+	{ "BM_SortedVectorBulkAdd",		BM_SortedVectorBulkAdd,		4096 },
+
+	{ "BM_StringAppend",			BM_StringAppend,			1024 },
+	{ "BM_StringCopy",				BM_StringCopy,				1024 },
+	{ "BM_StringFind",				BM_StringFind,				4096 },
+	{ "BM_StringFindI",				BM_StringFindI,				4096 },
+	{ "BM_StringFindAnsi",			BM_StringFindAnsi,			4096 },
+	{ "BM_StringEqualI",			BM_StringEqualI,			4096 },
+	{ "BM_StringToUpper",			BM_StringToUpper,			4096 },
+	{ "BM_StringFormat",			BM_StringFormat,			0 },
+	{ "BM_StringCFormat",			BM_StringCFormat,			0 },
+	{ "BM_StringA2W",				BM_StringA2W,				4096 },
+	{ "BM_StringW2A",				BM_StringW2A,				4096 },
+	{ "BM_StringCT2T",				BM_StringCT2T,				64 },
+	{ "BM_StringPoolIntern",		BM_StringPoolIntern,		4096 },
+
+	{ "BM_MapInsert",				BM_MapInsert,				4096 },
+	{ "BM_MapFind",					BM_MapFind,					4096 },
+	{ "BM_MapIterate",				BM_MapIterate,				4096 },
+	{ "BM_MapRangeFor",				BM_MapRangeFor,				4096 },
+	{ "BM_MapRangeScan",			BM_MapRangeScan,			4096 },
+	{ "BM_HashMapInsert",			BM_HashMapInsert,			4096 },
+	{ "BM_HashMapFind",				BM_HashMapFind,				4096 },
+	{ "BM_HashMapIterate",			BM_HashMapIterate,			4096 },
+	{ "BM_HashMapRangeFor",			BM_HashMapRangeFor,			4096 },
+	{ "BM_IndexInsert",				BM_IndexInsert,				4096 },
+	{ "BM_IndexBulkAdd",			BM_IndexBulkAdd,			4096 },
+	{ "BM_IndexFind",				BM_IndexFind,				4096 },
+	{ "BM_IndexIterate",			BM_IndexIterate,			4096 },
+	{ "BM_IndexRangeScan",			BM_IndexRangeScan,			4096 },
+	{ "BM_BTreeMapInsert",			BM_BTreeMapInsert,			4096 },
+	{ "BM_BTreeMapFind",			BM_BTreeMapFind,			4096 },
+	{ "BM_BTreeMapIterate",			BM_BTreeMapIterate,			4096 },
+	{ "BM_BTreeMapRangeScan",		BM_BTreeMapRangeScan,		4096 },
+	{ "BM_LruCacheFindAdd",			BM_LruCacheFindAdd,			1024 },
+
+	{ "BM_PlexAllocFree",			BM_PlexAllocFree,			1024 },
+	{ "BM_MallocFree",				BM_MallocFree,				1024 },
+	{ "BM_RingBuffer",				BM_RingBuffer,				1024 },
+	{ "BM_MpmcQueue",				BM_MpmcQueue,				1024 },
+	{ "BM_MpmcQueueThreaded",		BM_MpmcQueueThreaded,		1<<16 },
+	{ "BM_WorkStealingDeque",		BM_WorkStealingDeque,		1024 },
+	{ "BM_WorkStealingDequeThreaded",	BM_WorkStealingDequeThreaded,	1<<16 },
+	{ "BM_GridRowScan",				BM_GridRowScan,				256 },
+	{ "BM_FlatGridRowScan",			BM_FlatGridRowScan,			256 },
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Output
+
+static void WriteConsole(FILE* pFile, const CVector<BENCHRESULT*, SOwnedPtr>& vecResults)
+{
+	fprintf(pFile, "%-40s %15s %15s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+	fprintf(pFile, "%s\n", Repeat("-", 85).sz());
+	for (int i=0; i<vecResults.GetSize(); i++)
+	{
+		BENCHRESULT* r=vecResults[i];
+		fprintf(pFile, "%-40s %12.0f ns %12.0f ns %12lli", r->strName.sz(), r->dblRealTime, r->dblCpuTime, (long long)r->iIterations);
+		if (r->dblBytesPerSecond>0)
+			fprintf(pFile, " bytes_per_second=%.4gM/s", r->dblBytesPerSecond/(1024*1024));
+		if (r->dblItemsPerSecond>0)
+			fprintf(pFile, " items_per_second=%.4gM/s", r->dblItemsPerSecond/1e6);
+		fprintf(pFile, "\n");
+	}
+}
+
+static void WriteJson(FILE* pFile, const char* pszExecutable, const CVector<BENCHRESULT*, SOwnedPtr>& vecResults)
+{
+	char szDate[64];
+	time_t t=time(NULL);
+	strftime(szDate, sizeof(szDate), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "  \"context\": {\n");
+	fprintf(pFile, "    \"date\": \"%s\",\n", szDate);
+	fprintf(pFile, "    \"executable\": \"%s\",\n", pszExecutable);
+	fprintf(pFile, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+#ifdef NDEBUG
+	fprintf(pFile, "    \"library_build_type\": \"release\"\n");
+#else
+	fprintf(pFile, "    \"library_build_type\": \"debug\"\n");
+#endif
+	fprintf(pFile, "  },\n");
+	fprintf(pFile, "  \"benchmarks\": [\n");
+	for (int i=0; i<vecResults.GetSize(); i++)
+	{
+		BENCHRESULT* r=vecResults[i];
+		fprintf(pFile, "    {\n");
+		fprintf(pFile, "      \"name\": \"%s\",\n", r->strName.sz());
+		fprintf(pFile, "      \"run_name\": \"%s\",\n", r->strName.sz());
+		fprintf(pFile, "      \"run_type\": \"iteration\",\n");
+		fprintf(pFile, "      \"iterations\": %lli,\n", (long long)r->iIterations);
+		fprintf(pFile, "      \"real_time\": %.4f,\n", r->dblRealTime);
+		fprintf(pFile, "      \"cpu_time\": %.4f,\n", r->dblCpuTime);
+		fprintf(pFile, "      \"time_unit\": \"ns\"");
+		if (r->dblBytesPerSecond>0)
+			fprintf(pFile, ",\n      \"bytes_per_second\": %.4f", r->dblBytesPerSecond);
+		if (r->dblItemsPerSecond>0)
+			fprintf(pFile, ",\n      \"items_per_second\": %.4f", r->dblItemsPerSecond);
+		fprintf(pFile, "\n    }%s\n", i+1<vecResults.GetSize() ? "," : "");
+	}
+	fprintf(pFile, "  ]\n");
+	fprintf(pFile, "}\n");
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// main
+
+int main(int argc, char* argv[])
+{
+	CAnsiString strFilter;
+	CAnsiString strOut;
+	bool bJson=false;
+	bool bList=false;
+	double dblMinTime=0.5;
+
+	for (int i=1; i<argc; i++)
+	{
+		CAnsiString strArg(argv[i]);
+		if (strArg.StartsWith("--benchmark_filter="))
+			strFilter=strArg.Mid(19);
+		else if (strArg.Compare("--benchmark_format=json")==0)
+			bJson=true;
+		else if (strArg.Compare("--benchmark_format=console")==0)
+			bJson=false;
+		else if (strArg.StartsWith("--benchmark_out="))
+			strOut=strArg.Mid(16);
+		else if (strArg.StartsWith("--benchmark_min_time="))
+			dblMinTime=atof(strArg.Mid(21));
+		else if (strArg.Compare("--benchmark_list_tests")==0)
+			bList=true;
+		else
+		{
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	CVector<BENCHRESULT*, SOwnedPtr> vecResults;
+	for (int i=0; i<(int)_countof(g_Benchmarks); i++)
+	{
+		const BENCHMARK& b=g_Benchmarks[i];
+		CAnsiString strName=b.iArg ? Format("%s/%lli", b.pszName, (long long)b.iArg) : CAnsiString(b.pszName);
+		if (!strFilter.IsEmpty() && strName.Find(strFilter)<0)
+			continue;
+
+		if (bList)
+		{
+			printf("%s\n", strName.sz());
+			continue;
+		}
+
+		vecResults.Add(new BENCHRESULT(RunBenchmark(b, dblMinTime)));
+		if (!bJson)
+		{
+			// Show progress as we go
+			BENCHRESULT* r=vecResults[vecResults.GetSize()-1];
+			fprintf(stderr, "%-40s %12.0f ns\n", r->strName.sz(), r->dblRealTime);
+		}
+	}
+
+	if (bList)
+		return 0;
+
+	if (bJson)
+		WriteJson(stdout, argv[0], vecResults);
+	else
+		WriteConsole(stdout, vecResults);
+
+	if (!strOut.IsEmpty())
+	{
+		FILE* pFile=fopen(strOut, "w");
+		if (!pFile)
+		{
+			fprintf(stderr, "Failed to open %s\n", strOut.sz());
+			return 1;
+		}
+		WriteJson(pFile, argv[0], vecResults);
+		fclose(pFile);
+	}
+
+	return 0;
+}
@@ -28,7 +28,7 @@ namespace Simple
 
 template <class T, class TKey>
 int slxFind(TKey key, const T* lo, const T* hi,
-					int (__cdecl *pfnCompare)(const T& a, TKey b))
+					int (SIMPLECDECL *pfnCompare)(const T& a, TKey b))
 {
     const T* pos = lo;
 	while (pos<hi)
@@ -46,9 +46,10 @@ int slxFind(TKey key, const T* lo, const T* hi,
 
 // Perform a simple linear search on an array
 // Assumes items are sorted and early aborts
-template <class T, class TKey>
+// (pfnCompare can be a function pointer or a comparison functor)
+template <class T, class TKey, class TCompare>
 bool slxLinearSearch(TKey key, const T* lo, const T* hi,
-					int (__cdecl *pfnCompare)(const T& a, TKey b), int& iPosition)
+					TCompare pfnCompare, int& iPosition)
 {
     const T* pos = lo;
 	while (pos<=hi)
@@ -78,9 +79,9 @@ bool slxLinearSearch(TKey key, const T* lo, const T* hi,
 }
 
 // Perform a binary search on an array
-template <class T, class TKey>
+template <class T, class TKey, class TCompare>
 bool slxQuickSearch(TKey key, const T* base, int iSize,
-				int (__cdecl *pfnCompare)(const T& a, TKey b), int& iPosition)
+				TCompare pfnCompare, int& iPosition)
 {
 	if (iSize<1)
 	{
@@ -130,7 +131,7 @@ bool slxQuickSearch(TKey key, const T* base, int iSize,
 
 template <class T, class TKey>
 int slxFindEx(TKey key, void* c, const T* lo, const T* hi,
-					int (__cdecl *pfnCompare)(void* c, const T& a, TKey b))
+					int (SIMPLECDECL *pfnCompare)(void* c, const T& a, TKey b))
 {
     const T* pos = lo;
 	while (pos<hi)
@@ -150,7 +151,7 @@ int slxFindEx(TKey key, void* c, const T* lo, const T* hi,
 // Assumes items are sorted and early aborts
 template <class T, class TKey>
 bool slxLinearSearchEx(TKey key, void* c, const T* lo, const T* hi,
-					int (__cdecl *pfnCompare)(void* c, const T& a, TKey b), int& iPosition)
+					int (SIMPLECDECL *pfnCompare)(void* c, const T& a, TKey b), int& iPosition)
 {
     const T* pos = lo;
 	while (pos<=hi)
@@ -182,7 +183,7 @@ bool slxLinearSearchEx(TKey key, void* c, const T* lo, const T* hi,
 // Perform a binary search on an array
 template <class T, class TKey>
 bool slxQuickSearchEx(TKey key, void* c, const T* base, int iSize,
-				int (__cdecl *pfnCompare)(void* c, const T& a, TKey b), int& iPosition)
+				int (SIMPLECDECL *pfnCompare)(void* c, const T& a, TKey b), int& iPosition)
 {
 	if (iSize<1)
 	{
@@ -232,2955 +233,5895 @@ bool slxQuickSearchEx(TKey key, void* c, const T* base, int iSize,
 
 
 /////////////////////////////////////////////////////////////////////////////
-// Implementation of CString
+// Sort helpers
+//
+// Elements are relocated with memcpy rather than copy constructed/assigned,
+// same assumption CVector already makes when it memmoves its buffer.  Nothing
+// is ever compared from a temporary copy - only in place in the array.
 
-// Constructor
+// Comparison functor calling a compare function
 template <class T>
-CString<T>::CString()
+class SCompareFn
 {
-	SetHeader(NULL);
-}
+public:
+	SCompareFn(int (SIMPLECDECL *pfnCompare)(const T& a, const T& b)) : m_pfnCompare(pfnCompare) {}
+	int operator()(const T& a, const T& b) const { return m_pfnCompare(a, b); }
+	int (SIMPLECDECL *m_pfnCompare)(const T& a, const T& b);
+};
 
-// Constructor
+// Comparison functor calling a compare function with context
 template <class T>
-CString<T>::CString(const CString<T>& Other)
+class SCompareFnEx
 {
-	m_psz=Other.m_psz;
-	if (m_psz)
-	{
-		GetHeader()->m_iRef++;
-	}
-}
+public:
+	SCompareFnEx(int (SIMPLECDECL *pfnCompare)(void* ctx, const T& a, const T& b), void* ctx) : m_pfnCompare(pfnCompare), m_ctx(ctx) {}
+	int operator()(const T& a, const T& b) const { return m_pfnCompare(m_ctx, a, b); }
+	int (SIMPLECDECL *m_pfnCompare)(void* ctx, const T& a, const T& b);
+	void* m_ctx;
+};
 
-// Constructor
-template <class T>
-CString<T>::CString(const CAnyString& Other)
+// Comparison functor calling a semantics class's Compare (inlinable)
+template <class TSem>
+class SCompareSem
 {
-	SetHeader(NULL);
-	Assign(Other.As<T>());
-}
+public:
+	template <class T1, class T2>
+	int operator()(const T1& a, const T2& b) const { return TSem::Compare(a, b); }
+};
 
-// Constructor
 template <class T>
-CString<T>::CString(const T* psz, int iLen)
+inline void slxSwap(T* a, T* b)
 {
-	SetHeader(NULL);
-	Assign(psz, iLen);
+	char temp[sizeof(T)];
+	memcpy(temp, (void*)a, sizeof(T));
+	memcpy((void*)a, (void*)b, sizeof(T));
+	memcpy((void*)b, temp, sizeof(T));
 }
 
-// Destructor
-template <class T>
-CString<T>::~CString()
+// Insertion sort [lo,hi)
+template <class T, class TCompare>
+void slxInsertionSort(T* lo, T* hi, const TCompare& cmp)
 {
-	Empty();
-}
+	for (T* p=lo+1; p<hi; p++)
+	{
+		// Find where it goes
+		T* q=p;
+		while (q>lo && cmp(*p, *(q-1))<0)
+			q--;
 
-// Assignment operator
-template <class T>
-CString<T>& CString<T>::operator=(const CString<T>& Other)
-{
-	Assign(Other);
-	return *this;
+		if (q==p)
+			continue;
+
+		// Rotate it into place
+		char temp[sizeof(T)];
+		memcpy(temp, (void*)p, sizeof(T));
+		memmove((void*)(q+1), (void*)q, (p-q)*sizeof(T));
+		memcpy((void*)q, temp, sizeof(T));
+	}
 }
 
-// Assignment operator
-template <class T>
-CString<T>& CString<T>::operator=(const T* psz)
+// Heap sort [lo,hi) - introsort's fallback when partitioning goes badly
+template <class T, class TCompare>
+void slxSiftDown(T* base, int iRoot, int iSize, const TCompare& cmp)
 {
-	Assign(psz,-1);
-	return *this;
+	while (true)
+	{
+		int iChild=iRoot*2+1;
+		if (iChild>=iSize)
+			return;
+		if (iChild+1<iSize && cmp(base[iChild], base[iChild+1])<0)
+			iChild++;
+		if (cmp(base[iRoot], base[iChild])>=0)
+			return;
+		slxSwap(base+iRoot, base+iChild);
+		iRoot=iChild;
+	}
 }
 
-
-// T* operator
-template <class T>
-CString<T>::operator const T* () const
+template <class T, class TCompare>
+void slxHeapSort(T* lo, T* hi, const TCompare& cmp)
 {
-	return m_psz;
+	int iSize=int(hi-lo);
+	for (int i=iSize/2-1; i>=0; i--)
+		slxSiftDown(lo, i, iSize, cmp);
+	for (int i=iSize-1; i>0; i--)
+	{
+		slxSwap(lo, lo+i);
+		slxSiftDown(lo, 0, i, cmp);
+	}
 }
 
-// Return NULL terminated string (use when passing to vararg functions under gcc)
-template <class T>
-const T* CString<T>::sz() const
+// Introsort [lo,hi) - median of three quicksort, heap sort if recursion gets
+// too deep, insertion sort for small partitions
+template <class T, class TCompare>
+void slxIntroSortLoop(T* lo, T* hi, int iDepth, const TCompare& cmp)
 {
-	return m_psz;
+	while (hi-lo>16)
+	{
+		if (iDepth--==0)
+		{
+			slxHeapSort(lo, hi, cmp);
+			return;
+		}
+
+		// Median of three, pivot ends up in *lo
+		T* last=hi-1;
+		T* mid=lo+(hi-lo)/2;
+		if (cmp(*mid, *lo)<0)
+			slxSwap(mid, lo);
+		if (cmp(*last, *lo)<0)
+			slxSwap(last, lo);
+		if (cmp(*last, *mid)<0)
+			slxSwap(last, mid);
+		slxSwap(lo, mid);
+
+		// Partition - both scans stop on elements equal to the pivot which
+		// keeps runs of duplicates balanced
+		T* i=lo+1;
+		T* j=last;
+		while (true)
+		{
+			while (i<=j && cmp(*i, *lo)<0)
+				i++;
+			while (i<=j && cmp(*lo, *j)<0)
+				j--;
+			if (i>=j)
+				break;
+			slxSwap(i, j);
+			i++;
+			j--;
+		}
+		slxSwap(lo, j);
+
+		// Recurse into the smaller side, loop on the larger
+		if (j-lo < hi-(j+1))
+		{
+			slxIntroSortLoop(lo, j, iDepth, cmp);
+			lo=j+1;
+		}
+		else
+		{
+			slxIntroSortLoop(j+1, hi, iDepth, cmp);
+			hi=j;
+		}
+	}
+
+	slxInsertionSort(lo, hi, cmp);
 }
 
-// FreeExtra
-template <class T>
-void CString<T>::FreeExtra()
+template <class T, class TCompare>
+void slxIntroSort(T* base, int iSize, const TCompare& cmp)
 {
-	// Get header, quit if none
-	CHeader* pHeader=GetHeader();
-	if (!pHeader)
+	if (iSize<2)
 		return;
 
-	// Work out length if invalid
-	if (pHeader->m_iLength<0)
-		pHeader->m_iLength=len(m_psz);
+	int iDepth=0;
+	for (int i=iSize; i>1; i>>=1)
+		iDepth+=2;
 
-	// Get new buffer if shared...
-	if (pHeader->m_iRef>1)
-		GetBuffer(pHeader->m_iLength+1);
+	slxIntroSortLoop(base, base+iSize, iDepth, cmp);
+}
 
-	// If using excessive memory, shrink...
-	if (pHeader->m_iLength+16<pHeader->m_iMemSize)
+// Merge two sorted runs into pDest (relocating, stable - ties taken from a first)
+template <class T, class TCompare>
+void slxMerge(T* a, int na, T* b, int nb, T* pDest, const TCompare& cmp)
+{
+	T* aEnd=a+na;
+	T* bEnd=b+nb;
+	while (a<aEnd && b<bEnd)
 	{
-		// Work out new length
-		int iNewBufSize=pHeader->m_iLength+1;
+		if (cmp(*b, *a)<0)
+			memcpy((void*)pDest++, (void*)b++, sizeof(T));
+		else
+			memcpy((void*)pDest++, (void*)a++, sizeof(T));
+	}
+	memcpy((void*)pDest, (void*)a, (aEnd-a)*sizeof(T));
+	pDest+=aEnd-a;
+	memcpy((void*)pDest, (void*)b, (bEnd-b)*sizeof(T));
+}
 
-		// Reallocate
-		pHeader=(CHeader*)realloc(pHeader, sizeof(CHeader)+sizeof(T)*iNewBufSize);
-		if (!pHeader)
-			return;
+// Stable merge sort - insertion sort on short runs then merge passes
+// ping-ponging through a temporary buffer
+template <class T, class TCompare>
+void slxStableSort(T* base, int iSize, const TCompare& cmp)
+{
+	const int iRun=16;
+	for (int i=0; i<iSize; i+=iRun)
+		slxInsertionSort(base+i, base+(i+iRun<iSize ? i+iRun : iSize), cmp);
 
-		// Store new size...
-		pHeader->m_iMemSize=iNewBufSize;
+	if (iSize<=iRun)
+		return;
 
-		// Store new mem pointer
-		SetHeader(pHeader);
+	T* pTemp=(T*)malloc(sizeof(T)*iSize);
+	T* pSrc=base;
+	T* pDest=pTemp;
+	for (int iWidth=iRun; iWidth<iSize; iWidth*=2)
+	{
+		for (int i=0; i<iSize; i+=iWidth*2)
+		{
+			int iMid=i+iWidth<iSize ? i+iWidth : iSize;
+			int iEnd=i+iWidth*2<iSize ? i+iWidth*2 : iSize;
+			slxMerge(pSrc+i, iMid-i, pSrc+iMid, iEnd-iMid, pDest+i, cmp);
+		}
+
+		T* pSwap=pSrc;
+		pSrc=pDest;
+		pDest=pSwap;
 	}
+
+	if (pSrc!=base)
+		memcpy((void*)base, (void*)pSrc, sizeof(T)*iSize);
+
+	free(pTemp);
 }
 
-// GetBuffer
+// LSD radix sort on the keys provided by SRadixKey<T>, one byte per pass.
+// Passes where every element has the same byte are skipped.
 template <class T>
-T* CString<T>::GetBuffer(int iBufSize)
+void slxRadixSort(T* base, int iSize)
 {
-	CHeader* pHeader=GetHeader();
+	typedef typename SRadixKey<T>::TKey TKey;
+	const int iPasses=sizeof(TKey);
 
-	if (iBufSize<0)
-	{
-		iBufSize=pHeader->m_iLength;
-		if (iBufSize<0)
-			iBufSize=GetLength()+1;
-	}
+	if (iSize<2)
+		return;
 
-	// Copy on write...
-	if (pHeader && pHeader->m_iRef>1)
+	// Histogram every byte in one go
+	int counts[sizeof(TKey)][256];
+	memset(counts, 0, sizeof(counts));
+	for (int i=0; i<iSize; i++)
 	{
+		TKey key=SRadixKey<T>::Key(base[i]);
+		for (int iPass=0; iPass<iPasses; iPass++)
+			counts[iPass][(key >> (iPass*8)) & 0xFF]++;
+	}
 
-		// Allocate new header
-		pHeader=(CHeader*)malloc(sizeof(CHeader)+sizeof(T)*iBufSize);
-		if (!pHeader)
-			return NULL;
-
-		// Copy from original string
-		memcpy(pHeader, GetHeader(), sizeof(CHeader)+sizeof(T)*min(GetHeader()->m_iMemSize, iBufSize));
-
-		// Release original string
-		GetHeader()->m_iRef--;
+	T* pTemp=(T*)malloc(sizeof(T)*iSize);
+	T* pSrc=base;
+	T* pDest=pTemp;
 
-		// Setup new header
-		pHeader->m_iMemSize=iBufSize;
-		pHeader->m_iRef=1;
-		pHeader->m_iLength=-1;
-		SetHeader(pHeader);
+	for (int iPass=0; iPass<iPasses; iPass++)
+	{
+		int* pCounts=counts[iPass];
+		int iShift=iPass*8;
 
-		// Done
-		return m_psz;
-	}
+		// Skip if all the same
+		if (pCounts[(SRadixKey<T>::Key(pSrc[0]) >> iShift) & 0xFF]==iSize)
+			continue;
 
-	// Check if need to resize
-	if (pHeader && iBufSize<=pHeader->m_iMemSize)
+		// Counts to offsets
+		int iOffset=0;
+		for (int i=0; i<256; i++)
 		{
-		pHeader->m_iLength=-1;
-		return m_psz;
+			int iCount=pCounts[i];
+			pCounts[i]=iOffset;
+			iOffset+=iCount;
 		}
 
-	// Alloc/Grow buffer...
-	if (pHeader)
+		// Scatter
+		for (int i=0; i<iSize; i++)
 		{
-		pHeader=(CHeader*)realloc(pHeader, sizeof(CHeader)+sizeof(T)*iBufSize);
-		if (!pHeader)
-			return NULL;
-		}
-	else
-		{
-		pHeader=(CHeader*)malloc(sizeof(CHeader)+sizeof(T)*iBufSize);
-		if (!pHeader)
-			return NULL;
+			int iBucket=(SRadixKey<T>::Key(pSrc[i]) >> iShift) & 0xFF;
+			memcpy((void*)&pDest[pCounts[iBucket]++], (void*)&pSrc[i], sizeof(T));
 		}
 
-	// Store new buffer
-	SetHeader(pHeader);
-	pHeader->m_iMemSize=iBufSize;
-	pHeader->m_sz[iBufSize]=0;
-	pHeader->m_iRef=1;
+		T* pSwap=pSrc;
+		pSrc=pDest;
+		pDest=pSwap;
+	}
 
-	// Invalidate length
-	pHeader->m_iLength=-1;
+	// Odd number of passes?
+	if (pSrc!=base)
+		memcpy((void*)base, (void*)pSrc, sizeof(T)*iSize);
 
-	// Done!
-	return m_psz;
+	free(pTemp);
 }
 
-// GrowBuffer
-template <class T>
-T* CString<T>::GrowBuffer(int iNewSize)
-{
-	// If no buffer allocate at requested size
-	if (!m_psz)
-		return GetBuffer(iNewSize);
-
-	// Copy on write?
-	if (GetHeader()->m_iRef>1)
-		return GetBuffer(iNewSize);
-
-	// Quit if already big enough
-	if (iNewSize<=GetHeader()->m_iMemSize)
-		return m_psz;
-
-	// Instead of just growing by a little bit, double the buffer size
-	// (to save lots of tiny reallocs when appending)
-	int iDoubleSize=GetHeader()->m_iMemSize*2;
-	if (iDoubleSize>iNewSize)
-		iNewSize=iDoubleSize;
-
-	// Resize the buffer, but maintain the current length
-	int iLen=GetHeader()->m_iLength;
-	GetBuffer(iNewSize);
-	GetHeader()->m_iLength=iLen;
-
-	return m_psz;
-}
+#ifdef SIMPLELIB_HAS_THREADS
 
-// operator[]
-template <class T>
-const T& CString<T>::operator[] (int iPos)
+// Sort chunks on separate threads then merge them in parallel rounds
+template <class T, class TCompare>
+void slxParallelSort(T* base, int iSize, const TCompare& cmp, int iThreads)
 {
-	ASSERT(m_psz);
-	ASSERT(iPos>=0 && iPos<GetHeader()->m_iMemSize);
-	if (GetHeader()->m_iRef>1)
+	if (iThreads<=0)
+		iThreads=(int)std::thread::hardware_concurrency();
+
+	// Not worth it?
+	if (iThreads<2 || iSize<16384)
 	{
-		GetBuffer(-1);
+		slxIntroSort(base, iSize, cmp);
+		return;
 	}
-	return m_psz[iPos];
-}
 
-// Empty
-template <class T>
-void CString<T>::Empty()
-{
-	if (!m_psz)
-		return;
+	// Chunk boundaries
+	int iChunks=iThreads;
+	CVector<int> vecBounds;
+	for (int i=0; i<=iChunks; i++)
+		vecBounds.Add(int((long long)iSize*i/iChunks));
 
-	if (GetHeader()->m_iRef>1)
+	// Sort each chunk
+	std::thread* pThreads=new std::thread[iChunks];
+	for (int i=0; i<iChunks; i++)
 	{
-		GetHeader()->m_iRef--;
+		T* pChunk=base+vecBounds[i];
+		int iCount=vecBounds[i+1]-vecBounds[i];
+		pThreads[i]=std::thread([=, &cmp]() { slxIntroSort(pChunk, iCount, cmp); });
 	}
-	else
+	for (int i=0; i<iChunks; i++)
+		pThreads[i].join();
+
+	// Merge pairs of runs until there's only one, ping-ponging between buffers
+	T* pTemp=(T*)malloc(sizeof(T)*iSize);
+	T* pSrc=base;
+	T* pDest=pTemp;
+	while (vecBounds.GetSize()>2)
 	{
-		free(GetHeader());
+		CVector<int> vecNewBounds;
+		int iThread=0;
+		for (int i=0; i+1<vecBounds.GetSize(); i+=2)
+		{
+			vecNewBounds.Add(vecBounds[i]);
+			int iStart=vecBounds[i];
+			if (i+2<vecBounds.GetSize())
+			{
+				// Merge a pair
+				int iMid=vecBounds[i+1];
+				int iEnd=vecBounds[i+2];
+				pThreads[iThread++]=std::thread([=, &cmp]() {
+					slxMerge(pSrc+iStart, iMid-iStart, pSrc+iMid, iEnd-iMid, pDest+iStart, cmp);
+				});
+			}
+			else
+			{
+				// Odd one out, just copy it across
+				memcpy((void*)(pDest+iStart), (void*)(pSrc+iStart), (vecBounds[i+1]-iStart)*sizeof(T));
+			}
+		}
+		vecNewBounds.Add(iSize);
+
+		for (int i=0; i<iThread; i++)
+			pThreads[i].join();
+
+		vecBounds.Swap(vecNewBounds);
+		T* pSwap=pSrc;
+		pSrc=pDest;
+		pDest=pSwap;
 	}
-	m_psz=NULL;
-}
 
-// IsEmpty
-template <class T>
-bool CString<T>::IsEmpty() const
-{
-	return GetLength()==0;
+	if (pSrc!=base)
+		memcpy((void*)base, (void*)pSrc, sizeof(T)*iSize);
+
+	free(pTemp);
+	delete [] pThreads;
 }
 
-// len
-template <class T>
-int CString<T>::len(const T* psz)
-{
-	if (!psz)
-		return 0;
+#endif	// SIMPLELIB_HAS_THREADS
 
-	const T* p=psz;
-	while (p[0])
-		p++;
 
-	return int(p-psz);
-}
+/////////////////////////////////////////////////////////////////////////////
+// String kernels - substring search, ASCII case folding and case insensitive
+//					compare used by CString.
+//
+// The SIMD versions work a register at a time on runs of plain ASCII and
+// hand anything else (non-ASCII characters, short tails) to the scalar
+// SChar<T> routines, so results match the scalar versions exactly provided
+// the current locale folds a-z/A-Z the usual way.
 
-// copy
-template <class T>
-void CString<T>::copy(T* pszDest, const T* pszSrc, int iLen)
+// Scalar substring search
+template <class T, bool bCaseless>
+int slxStrFindScalar(const T* hay, int hayLen, const T* needle, int needleLen, int startOffset)
 {
-	memcpy(pszDest, pszSrc, sizeof(T)*iLen);
+	int stopPos=hayLen-needleLen;
+	for (int i=startOffset; i<=stopPos; i++)
+	{
+		if (bCaseless)
+		{
+			if (SChar<T>::CompareI(hay+i, needle, needleLen)==0)
+				return i;
+		}
+		else
+		{
+			if (SChar<T>::Compare(hay+i, needle, needleLen)==0)
+				return i;
+		}
+	}
+	return -1;
 }
 
+#ifdef SIMPLELIB_SSE2
 
-
-template <class T>
-bool CString<T>::Assign(const CString<T>& Other)
+// Index of lowest set bit
+inline int slxBitScan(unsigned int mask)
 {
-	Empty();
-	m_psz=Other.m_psz;
-	if (m_psz)
-		GetHeader()->m_iRef++;
-	return true;
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
 }
 
-// Assign
+// Is character plain 7-bit ASCII
 template <class T>
-bool CString<T>::Assign(const TAlt* psz, int iLen)
+inline bool slxIsAscii(T ch)
 {
-	return Assign(t2t<T,TAlt>(psz,iLen));
+	return (ch & ~0x7F)==0;
 }
 
-// Assign
+// Upper case a single ASCII character
 template <class T>
-bool CString<T>::Assign(const T* psz, int iLen)
+inline T slxAsciiUpper(T ch)
 {
-	// Clear old value
-	Empty();
+	return (ch>='a' && ch<='z') ? T(ch-0x20) : ch;
+}
 
-	// Quit if NULL string
-	if (!psz)
-		return true;
+// Register operations for SSE2.  Element width is picked from sizeof(T)
+// and the switches fold away at compile time.
+class SSimdSse2
+{
+public:
+	typedef __m128i V;
+	enum { Bytes=16 };
+	static unsigned int FullMask() { return 0xFFFF; }
 
-	// Auto length?
-	if (iLen<0)
-		iLen=len(psz);
+	static V Load(const void* p) { return _mm_loadu_si128((const __m128i*)p); }
+	static void Store(void* p, V v) { _mm_storeu_si128((__m128i*)p, v); }
+	static unsigned int Mask(V v) { return (unsigned int)_mm_movemask_epi8(v); }
+	static V And(V a, V b) { return _mm_and_si128(a, b); }
+	static V Or(V a, V b) { return _mm_or_si128(a, b); }
+	static V Zero() { return _mm_setzero_si128(); }
 
-	if (!GetBuffer(iLen))
-		return false;
-
-	// Copy new value in
-	copy(m_psz, psz, iLen);
-	m_psz[iLen]=L'\0';
-
-	// Store new text size
-	GetHeader()->m_iLength=iLen;
+	template <class T>
+	static V Splat(T ch)
+	{
+		switch (sizeof(T))
+		{
+			case 1: return _mm_set1_epi8((char)ch);
+			case 2: return _mm_set1_epi16((short)ch);
+		}
+		return _mm_set1_epi32((int)ch);
+	}
+	template <class T>
+	static V CmpEq(V a, V b)
+	{
+		switch (sizeof(T))
+		{
+			case 1: return _mm_cmpeq_epi8(a, b);
+			case 2: return _mm_cmpeq_epi16(a, b);
+		}
+		return _mm_cmpeq_epi32(a, b);
+	}
+	template <class T>
+	static V CmpGt(V a, V b)
+	{
+		switch (sizeof(T))
+		{
+			case 1: return _mm_cmpgt_epi8(a, b);
+			case 2: return _mm_cmpgt_epi16(a, b);
+		}
+		return _mm_cmpgt_epi32(a, b);
+	}
+	template <class T>
+	static V Sub(V a, V b)
+	{
+		switch (sizeof(T))
+		{
+			case 1: return _mm_sub_epi8(a, b);
+			case 2: return _mm_sub_epi16(a, b);
+		}
+		return _mm_sub_epi32(a, b);
+	}
+	template <class T>
+	static V Add(V a, V b)
+	{
+		switch (sizeof(T))
+		{
+			case 1: return _mm_add_epi8(a, b);
+			case 2: return _mm_add_epi16(a, b);
+		}
+		return _mm_add_epi32(a, b);
+	}
+};
 
-	return true;
-}
+#ifdef SIMPLELIB_AVX2
 
-// GetLength
-template <class T>
-int CString<T>::GetLength() const
+// Register operations for AVX2
+class SSimdAvx2
 {
-	CHeader* pHeader=GetHeader();
-	if (!pHeader)
-		return 0;
-	if (pHeader->m_iLength<0)
-		pHeader->m_iLength=len(m_psz);
-	return pHeader->m_iLength;
-}
+public:
+	typedef __m256i V;
+	enum { Bytes=32 };
+	static unsigned int FullMask() { return 0xFFFFFFFF; }
 
+	static V Load(const void* p) { return _mm256_loadu_si256((const __m256i*)p); }
+	static void Store(void* p, V v) { _mm256_storeu_si256((__m256i*)p, v); }
+	static unsigned int Mask(V v) { return (unsigned int)_mm256_movemask_epi8(v); }
+	static V And(V a, V b) { return _mm256_and_si256(a, b); }
+	static V Or(V a, V b) { return _mm256_or_si256(a, b); }
+	static V Zero() { return _mm256_setzero_si256(); }
 
-// Replace
-template <class T>
-bool CString<T>::Replace(int iPos, int iOldLen, const T* psz, int iNewLen)
-{
-	// Quit if nothing to do
-	if (!iOldLen && !iNewLen)
-		return true;
-
-	// Auto length?
-	if (iNewLen<0)
+	template <class T>
+	static V Splat(T ch)
+	{
+		switch (sizeof(T))
 		{
-		iNewLen = psz ? len(psz) : 0;
+			case 1: return _mm256_set1_epi8((char)ch);
+			case 2: return _mm256_set1_epi16((short)ch);
+		}
+		return _mm256_set1_epi32((int)ch);
+	}
+	template <class T>
+	static V CmpEq(V a, V b)
+	{
+		switch (sizeof(T))
+		{
+			case 1: return _mm256_cmpeq_epi8(a, b);
+			case 2: return _mm256_cmpeq_epi16(a, b);
+		}
+		return _mm256_cmpeq_epi32(a, b);
+	}
+	template <class T>
+	static V CmpGt(V a, V b)
+	{
+		switch (sizeof(T))
+		{
+			case 1: return _mm256_cmpgt_epi8(a, b);
+			case 2: return _mm256_cmpgt_epi16(a, b);
+		}
+		return _mm256_cmpgt_epi32(a, b);
+	}
+	template <class T>
+	static V Sub(V a, V b)
+	{
+		switch (sizeof(T))
+		{
+			case 1: return _mm256_sub_epi8(a, b);
+			case 2: return _mm256_sub_epi16(a, b);
+		}
+		return _mm256_sub_epi32(a, b);
+	}
+	template <class T>
+	static V Add(V a, V b)
+	{
+		switch (sizeof(T))
+		{
+			case 1: return _mm256_add_epi8(a, b);
+			case 2: return _mm256_add_epi16(a, b);
 		}
+		return _mm256_add_epi32(a, b);
+	}
+};
 
-	// Append?
-	if (iPos<0)
-		iPos=GetLength();
+typedef SSimdAvx2 SSimd;
 
-	// Check position in range
-	ASSERT(iPos<=GetLength());
+#else
 
-	// Replace entire RHS?
-	if (iOldLen<0)
-		iOldLen=GetLength()-iPos;
+typedef SSimdSse2 SSimd;
 
-	// Check in range
-	ASSERT(iPos + iOldLen <= GetLength());
+#endif
 
-	// Work out new required size
-	int iNewTextSize = GetLength() + iNewLen - iOldLen;
-	ASSERT(iNewTextSize>=0);
+// Bit mask (one bit per byte, as per movemask) of non-ASCII lanes
+template <class TOps, class T>
+inline unsigned int slxSimdNonAscii(typename TOps::V v)
+{
+	typename TOps::V hi=TOps::And(v, TOps::template Splat<T>(T(~0x7F)));
+	return TOps::Mask(TOps::template CmpEq<T>(hi, TOps::Zero())) ^ TOps::FullMask();
+}
 
-	int iLength=GetLength();
+// Add (bUpper=false) or subtract (bUpper=true) 0x20 on lanes holding ASCII letters
+//  of the opposite case
+template <class TOps, class T, bool bUpper>
+inline typename TOps::V slxSimdFold(typename TOps::V v)
+{
+	T chFirst=bUpper ? 'a' : 'A';
+	T chLast=bUpper ? 'z' : 'Z';
+	typename TOps::V inRange=TOps::And(
+			TOps::template CmpGt<T>(v, TOps::template Splat<T>(T(chFirst-1))),
+			TOps::template CmpGt<T>(TOps::template Splat<T>(T(chLast+1)), v));
+	typename TOps::V delta=TOps::And(inRange, TOps::template Splat<T>(T(0x20)));
+	return bUpper ? TOps::template Sub<T>(v, delta) : TOps::template Add<T>(v, delta);
+}
 
-	// Reallocate buffer
-	if (!GrowBuffer(iNewTextSize))
-		return false;
+// Substring search.  Uses the first and last characters of the needle to
+// filter candidate positions a register at a time, then verifies each
+// candidate.  For caseless search, non-ASCII characters in the haystack are
+// always treated as candidates and left to SChar<T>::CompareI.
+template <class TOps, class T, bool bCaseless>
+int slxSimdStrFind(const T* hay, int hayLen, const T* needle, int needleLen, int startOffset)
+{
+	typedef typename TOps::V V;
+	const int iLanes=TOps::Bytes/sizeof(T);
+	const unsigned int laneMask=(1u<<sizeof(T))-1;
 
-	// Move trailing characters
-	int iTrailingChars = iLength - (iPos + iOldLen);
-	if (iTrailingChars && iOldLen!=iNewLen)
+	T chFirst=needle[0];
+	T chLast=needle[needleLen-1];
+	if (bCaseless)
+	{
+		// Non-ASCII needle ends might fold to ASCII, let the scalar version handle it
+		if (!slxIsAscii(chFirst) || !slxIsAscii(chLast))
+			return slxStrFindScalar<T,bCaseless>(hay, hayLen, needle, needleLen, startOffset);
+		chFirst=slxAsciiUpper(chFirst);
+		chLast=slxAsciiUpper(chLast);
+	}
+
+	V vFirst=TOps::template Splat<T>(chFirst);
+	V vLast=TOps::template Splat<T>(chLast);
+
+	int stopPos=hayLen-needleLen;
+	int i=startOffset;
+	for (; i+iLanes-1<=stopPos; i+=iLanes)
+	{
+		V a=TOps::Load(hay+i);
+		V b=TOps::Load(hay+i+needleLen-1);
+
+		unsigned int mask;
+		if (bCaseless)
 		{
-		memmove(m_psz + iPos + iNewLen, m_psz + iPos + iOldLen, iTrailingChars * sizeof(T));
+			unsigned int maskA=TOps::Mask(TOps::template CmpEq<T>(slxSimdFold<TOps,T,true>(a), vFirst)) | slxSimdNonAscii<TOps,T>(a);
+			unsigned int maskB=TOps::Mask(TOps::template CmpEq<T>(slxSimdFold<TOps,T,true>(b), vLast)) | slxSimdNonAscii<TOps,T>(b);
+			mask=maskA & maskB;
+		}
+		else
+		{
+			mask=TOps::Mask(TOps::And(TOps::template CmpEq<T>(a, vFirst), TOps::template CmpEq<T>(b, vLast)));
 		}
 
-	// Copy new characters
-	if (iNewLen)
+		while (mask)
 		{
-		memcpy(m_psz + iPos, psz, iNewLen * sizeof(T));
+			int bit=slxBitScan(mask);
+			int pos=i+bit/(int)sizeof(T);
+			if (bCaseless)
+			{
+				if (SChar<T>::CompareI(hay+pos, needle, needleLen)==0)
+					return pos;
+			}
+			else
+			{
+				if (memcmp(hay+pos, needle, needleLen*sizeof(T))==0)
+					return pos;
+			}
+			mask&=~(laneMask<<bit);
 		}
+	}
 
-	// Update size/position
-	m_psz[iNewTextSize]=L'\0';
-	GetHeader()->m_iLength=iNewTextSize;
-	return true;
+	// Remaining positions
+	return slxStrFindScalar<T,bCaseless>(hay, hayLen, needle, needleLen, i);
 }
 
-// Append
-template <class T>
-bool CString<T>::Append(const T* psz, int iLen)
+// Caseless compare of exactly iLen characters
+template <class TOps, class T>
+bool slxSimdStrEqualI(const T* a, const T* b, int iLen)
 {
-	return Replace(GetLength(), 0, psz, iLen);
-}
+	typedef typename TOps::V V;
+	const int iLanes=TOps::Bytes/sizeof(T);
 
-// Append
-template <class T>
-bool CString<T>::Append(T ch)
-{
-	return Append(&ch, 1);
-}
+	int i=0;
+	for (; i+iLanes<=iLen; i+=iLanes)
+	{
+		V va=TOps::Load(a+i);
+		V vb=TOps::Load(b+i);
 
-// Insert
-template <class T>
-bool CString<T>::Insert(int iPos, const T* psz, int iLen)
-{
-	return Replace(iPos, 0, psz, iLen);
-}
+		// Non-ASCII?  Leave the rest to the scalar version
+		if (slxSimdNonAscii<TOps,T>(va) | slxSimdNonAscii<TOps,T>(vb))
+			break;
 
-// Delete
-template <class T>
-bool CString<T>::Delete(int iPos, int iLen)
-{
-	return Replace(iPos, iLen, NULL, 0);
-}
+		V eq=TOps::template CmpEq<T>(slxSimdFold<TOps,T,true>(va), slxSimdFold<TOps,T,true>(vb));
+		if (TOps::Mask(eq)!=TOps::FullMask())
+			return false;
+	}
 
-// operator+=
-template <class T>
-CString<T>& CString<T>::operator+=(const T* psz)
-{
-	Append(psz);
-	return *this;
+	return i==iLen || SChar<T>::CompareI(a+i, b+i, iLen-i)==0;
 }
 
-// operator+=
-template <class T>
-CString<T>& CString<T>::operator+=(T ch)
+// In place case conversion of a NULL terminated string
+template <class TOps, class T, bool bUpper>
+void slxSimdStrConvertCase(T* psz)
 {
-	Append(ch);
-	return *this;
-}
+	typedef typename TOps::V V;
+	const int iLanes=TOps::Bytes/sizeof(T);
 
-template <class T>
-CString<T> CString<T>::ToUpper()
-{
-	if (!m_psz)
-		return NULL;
+	int iLen=SChar<T>::Length(psz);
+	int i=0;
+	for (; i+iLanes<=iLen; i+=iLanes)
+	{
+		V v=TOps::Load(psz+i);
+		if (slxSimdNonAscii<TOps,T>(v))
+			break;
+		TOps::Store(psz+i, slxSimdFold<TOps,T,bUpper>(v));
+	}
 
-	CString<T> copy(*this);
-	SChar<T>::ToUpper(copy.GetBuffer(-1));
-	return copy;
+	// Tail and anything non-ASCII goes through the locale aware version
+	if (i<iLen)
+	{
+		if (bUpper)
+			SChar<T>::ToUpper(psz+i);
+		else
+			SChar<T>::ToLower(psz+i);
+	}
 }
 
+#endif	// SIMPLELIB_SSE2
+
 template <class T>
-CString<T> CString<T>::ToLower()
+int slxStrFind(const T* hay, int hayLen, const T* needle, int needleLen, int startOffset)
 {
-	if (!m_psz)
-		return NULL;
-
-	CString<T> copy(*this);
-	SChar<T>::ToLower(copy.GetBuffer(-1));
-	return copy;
+#ifdef SIMPLELIB_SSE2
+	return slxSimdStrFind<SSimd,T,false>(hay, hayLen, needle, needleLen, startOffset);
+#else
+	return slxStrFindScalar<T,false>(hay, hayLen, needle, needleLen, startOffset);
+#endif
 }
 
 template <class T>
-int CString<T>::Compare(const T* psz)
+int slxStrFindI(const T* hay, int hayLen, const T* needle, int needleLen, int startOffset)
 {
-	return ::Compare(*this, psz);
+#ifdef SIMPLELIB_SSE2
+	return slxSimdStrFind<SSimd,T,true>(hay, hayLen, needle, needleLen, startOffset);
+#else
+	return slxStrFindScalar<T,true>(hay, hayLen, needle, needleLen, startOffset);
+#endif
 }
 
 template <class T>
-CString<T> CString<T>::Left(int iCount)
+bool slxStrEqualI(const T* a, const T* b, int iLen)
 {
-	return Simple::Left<T>(*this, iCount);
+#ifdef SIMPLELIB_SSE2
+	return slxSimdStrEqualI<SSimd,T>(a, b, iLen);
+#else
+	return SChar<T>::CompareI(a, b, iLen)==0;
+#endif
 }
 
 template <class T>
-CString<T> CString<T>::Right(int iCount)
+void slxStrToUpper(T* psz)
 {
-	return Simple::Right<T>(*this, iCount);
+#ifdef SIMPLELIB_SSE2
+	slxSimdStrConvertCase<SSimd,T,true>(psz);
+#else
+	SChar<T>::ToUpper(psz);
+#endif
 }
 
 template <class T>
-CString<T> CString<T>::SubStr(int iFrom, int iCount)
+void slxStrToLower(T* psz)
 {
-	return Simple::SubStr<T>(m_psz, iFrom, iCount);
+#ifdef SIMPLELIB_SSE2
+	slxSimdStrConvertCase<SSimd,T,false>(psz);
+#else
+	SChar<T>::ToLower(psz);
+#endif
 }
 
-template <class T>
-CString<T> CString<T>::Mid(int iFrom, int iCount)
+
+/////////////////////////////////////////////////////////////////////////////
+// String conversion kernels
+
+// slxHidePointer - returns p, but stops the optimiser tracking which array
+// it points into
+inline const void* slxHidePointer(const void* p)
 {
-	return Simple::SubStr<T>(m_psz, iFrom, iCount);
+#if defined(__GNUC__)
+	__asm__("" : "+r"(p));
+#endif
+	return p;
 }
 
-template <class T>
-int CString<T>::Find(const T* psz, int startOffset = 0)
+// slxAsciiToWide
+inline int slxAsciiToWide(const char* psz, wchar_t* pszDest, int iLen)
 {
-	if (psz == NULL)
-		return -1;
-
-	// Get search string length
-	int srcLen = SChar<T>::Length(psz);
-	if (srcLen == 0)
-		return startOffset;
+	int i=0;
 
-	// Find it
-	int stopPos = GetLength() - srcLen;
-	for (int i = startOffset; i <= stopPos; i++)
+#ifdef SIMPLELIB_SSE2
+	// The loop bounds keep every load inside the string, but once inlined
+	// GCC can't see that and warns (-Warray-bounds) about short literals
+	const char* pszVec=(const char*)slxHidePointer(psz);
+	const __m128i zero=_mm_setzero_si128();
+	for (; i+16<=iLen; i+=16)
 	{
-		if (SChar<T>::Compare(m_psz + i, psz, srcLen) == 0)
-			return i;
+		__m128i v=_mm_loadu_si128((const __m128i*)(pszVec+i));
+		if (_mm_movemask_epi8(v))
+			break;
+
+		__m128i lo=_mm_unpacklo_epi8(v, zero);
+		__m128i hi=_mm_unpackhi_epi8(v, zero);
+		if (sizeof(wchar_t)==2)
+		{
+			_mm_storeu_si128((__m128i*)(pszDest+i), lo);
+			_mm_storeu_si128((__m128i*)(pszDest+i+8), hi);
+		}
+		else
+		{
+			_mm_storeu_si128((__m128i*)(pszDest+i), _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128((__m128i*)(pszDest+i+4), _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128((__m128i*)(pszDest+i+8), _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128((__m128i*)(pszDest+i+12), _mm_unpackhi_epi16(hi, zero));
+		}
 	}
+#endif
 
-	return -1;
+	for (; i<iLen && (unsigned char)psz[i]<0x80; i++)
+		pszDest[i]=(wchar_t)psz[i];
+
+	return i;
 }
 
-template <class T>
-int CString<T>::FindI(const T* psz, int startOffset = 0)
+// slxWideToAscii
+inline int slxWideToAscii(const wchar_t* psz, char* pszDest, int iLen)
 {
-	if (psz == NULL)
-		return -1;
+	int i=0;
 
-	// Get search string length
-	int srcLen = SChar<T>::Length(psz);
-	if (srcLen == 0)
-		return startOffset;
-
-	// Find it
-	int stopPos = GetLength() - srcLen;
-	for (int i = startOffset; i <= stopPos; i++)
+#ifdef SIMPLELIB_SSE2
+	// See slxAsciiToWide
+	const wchar_t* pszVec=(const wchar_t*)slxHidePointer(psz);
+	const __m128i zero=_mm_setzero_si128();
+	if (sizeof(wchar_t)==2)
 	{
-		if (SChar<T>::CompareI(m_psz + i, psz, srcLen) == 0)
-			return i;
+		const __m128i mask=_mm_set1_epi16((short)0xFF80);
+		for (; i+16<=iLen; i+=16)
+		{
+			__m128i a=_mm_loadu_si128((const __m128i*)(pszVec+i));
+			__m128i b=_mm_loadu_si128((const __m128i*)(pszVec+i+8));
+			__m128i hibits=_mm_and_si128(_mm_or_si128(a, b), mask);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(hibits, zero))!=0xFFFF)
+				break;
+			_mm_storeu_si128((__m128i*)(pszDest+i), _mm_packus_epi16(a, b));
+		}
+	}
+	else
+	{
+		const __m128i mask=_mm_set1_epi32((int)0xFFFFFF80);
+		for (; i+16<=iLen; i+=16)
+		{
+			__m128i a=_mm_loadu_si128((const __m128i*)(pszVec+i));
+			__m128i b=_mm_loadu_si128((const __m128i*)(pszVec+i+4));
+			__m128i c=_mm_loadu_si128((const __m128i*)(pszVec+i+8));
+			__m128i d=_mm_loadu_si128((const __m128i*)(pszVec+i+12));
+			__m128i hibits=_mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), mask);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(hibits, zero))!=0xFFFF)
+				break;
+			_mm_storeu_si128((__m128i*)(pszDest+i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+		}
 	}
+#endif
 
-	return -1;
+	for (; i<iLen && (unsigned int)psz[i]<0x80; i++)
+		pszDest[i]=(char)psz[i];
+
+	return i;
 }
 
-template <class T>
-CString<T> CString<T>::Replace(const T* find, const T* replace, int maxReplacements = -1, int startOffset = 0)
+// slxMbToWide
+inline int slxMbToWide(const char* psz, int iLen, wchar_t* pszDest, int cchDest)
 {
-	int findLen = SChar<T>::Length(find);
-	int replaceLen = SChar<T>::Length(replace);
-
-	CString<T> strNew = *this;
-
+	int iSrc=0;
+	int iDest=0;
+	mbstate_t state;
+	memset(&state, 0, sizeof(state));
 	while (true)
 	{
-		// Find it
-		int foundPos = strNew.Find(find, startOffset);
-		if (foundPos < 0)
-			break;
-
-		// Replace it
-		strNew.Replace(foundPos, findLen, replace, replaceLen);
-
-		// Continue searching after
-		startOffset = foundPos + replaceLen;
+		// Copy run of ASCII
+		int iRun=min(iLen-iSrc, cchDest-1-iDest);
+		int iAscii=slxAsciiToWide(psz+iSrc, pszDest+iDest, iRun);
+		iSrc+=iAscii;
+		iDest+=iAscii;
 
-		// Limit replacements
-		maxReplacements--;
-		if (maxReplacements == 0)
+		if (iSrc>=iLen)
 			break;
+		if (iDest>=cchDest-1)
+			return -1;
+
+		// Convert one multibyte character, invalid bytes convert to '?'
+		wchar_t ch;
+		size_t nBytes=mbrtowc(&ch, psz+iSrc, iLen-iSrc, &state);
+		if (nBytes==0)
+		{
+			// Embedded NULL
+			nBytes=1;
+		}
+		else if (nBytes==(size_t)-1 || nBytes==(size_t)-2)
+		{
+			memset(&state, 0, sizeof(state));
+			ch=L'?';
+			nBytes=1;
+		}
+		pszDest[iDest++]=ch;
+		iSrc+=(int)nBytes;
 	}
 
-	return strNew;
+	pszDest[iDest]=L'\0';
+	return iDest;
 }
 
-template <class T>
-CString<T> CString<T>::ReplaceI(const T* find, const T* replace, int maxReplacements = -1, int startOffset = 0)
+// slxWideToMb
+inline int slxWideToMb(const wchar_t* psz, int iLen, char* pszDest, int cchDest)
 {
-	int findLen = SChar<T>::Length(find);
-	int replaceLen = SChar<T>::Length(replace);
-
-	CString<T> strNew = *this;
-
+	int iSrc=0;
+	int iDest=0;
+	mbstate_t state;
+	memset(&state, 0, sizeof(state));
 	while (true)
 	{
-		// Find it
-		int foundPos = strNew.FindI(find, startOffset);
-		if (foundPos < 0)
+		// Copy run of ASCII
+		int iRun=min(iLen-iSrc, cchDest-1-iDest);
+		int iAscii=slxWideToAscii(psz+iSrc, pszDest+iDest, iRun);
+		iSrc+=iAscii;
+		iDest+=iAscii;
+
+		if (iSrc>=iLen)
 			break;
+		if (iDest>=cchDest-1)
+			return -1;
 
-		// Replace it
-		strNew.Replace(foundPos, findLen, replace, replaceLen);
+		// Convert one character, unrepresentable characters convert to '?'
+		char sz[MB_LEN_MAX];
+		int iBytes=(int)wcrtomb(sz, psz[iSrc], &state);
+		if (iBytes<0)
+		{
+			memset(&state, 0, sizeof(state));
+			sz[0]='?';
+			iBytes=1;
+		}
+		if (iDest+iBytes>cchDest-1)
+			return -1;
+		memcpy(pszDest+iDest, sz, iBytes);
+		iDest+=iBytes;
+		iSrc++;
+	}
 
-		// Continue searching after
-		startOffset = foundPos + replaceLen;
+	pszDest[iDest]='\0';
+	return iDest;
+}
 
-		// Limit replacements
-		maxReplacements--;
-		if (maxReplacements == 0)
+// Code page 1252 characters 0x80-0x9F (everything else maps straight to Latin-1).
+// 0x81, 0x8D, 0x8F, 0x90 and 0x9D are unassigned and pass through unchanged,
+// same as .NET's Windows-1252 encoding.
+template <int iDummy=0>
+struct CCp1252Holder
+{
+	static const unsigned short m_wTable[32];
+};
+template <int iDummy> const unsigned short CCp1252Holder<iDummy>::m_wTable[32]=
+{
+	0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+	0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+};
+
+// slxCp1252ToWide
+inline int slxCp1252ToWide(const char* psz, int iLen, wchar_t* pszDest, int cchDest)
+{
+	if (iLen>=cchDest)
+		return -1;
+
+	int i=0;
+	while (true)
+	{
+		i+=slxAsciiToWide(psz+i, pszDest+i, iLen-i);
+		if (i>=iLen)
 			break;
+
+		unsigned char ch=(unsigned char)psz[i];
+		pszDest[i]=(ch>=0x80 && ch<0xA0) ? (wchar_t)CCp1252Holder<>::m_wTable[ch-0x80] : (wchar_t)ch;
+		i++;
 	}
 
-	return strNew;
+	pszDest[iLen]=L'\0';
+	return iLen;
 }
 
-template <class T>
-bool CString<T>::StartsWith(const T* find)
+// slxWideToCp1252
+inline int slxWideToCp1252(const wchar_t* psz, int iLen, char* pszDest, int cchDest)
 {
-	if (m_psz == NULL)
-		return false;
-	return SChar<T>::Compare(m_psz, find, SChar<T>::Length(find)) == 0;
+	if (iLen>=cchDest)
+		return -1;
+
+	int i=0;
+	while (true)
+	{
+		i+=slxWideToAscii(psz+i, pszDest+i, iLen-i);
+		if (i>=iLen)
+			break;
+
+		unsigned int ch=(unsigned int)psz[i];
+		char chOut='?';
+		if (ch>=0xA0 && ch<=0xFF)
+		{
+			chOut=(char)ch;
+		}
+		else
+		{
+			for (int j=0; j<32; j++)
+			{
+				if (CCp1252Holder<>::m_wTable[j]==ch)
+				{
+					chOut=(char)(0x80+j);
+					break;
+				}
+			}
+		}
+		pszDest[i++]=chOut;
+	}
+
+	pszDest[iLen]='\0';
+	return iLen;
 }
 
-template <class T>
-bool CString<T>::StartsWithI(const T* find)
+// slxConvertString - overloads used by CT2T
+inline int slxConvertString(const char* psz, int iLen, wchar_t* pszDest, int cchDest)
 {
-	if (m_psz == NULL)
-		return false;
-	return SChar<T>::CompareI(m_psz, find, SChar<T>::Length(find)) == 0;
+	return slxMbToWide(psz, iLen, pszDest, cchDest);
 }
 
-template <class T>
-bool CString<T>::EndsWith(const T* find)
+inline int slxConvertString(const wchar_t* psz, int iLen, char* pszDest, int cchDest)
 {
-	int findLen = SChar<T>::Length(find);
-	int startPos = GetLength() - findLen;
-	if (startPos < 0)
-		return false;
-	return SChar<T>::Compare(m_psz + startPos, find, findLen) == 0;
+	return slxWideToMb(psz, iLen, pszDest, cchDest);
 }
 
-template <class T>
-bool CString<T>::EndsWithI(const T* find)
+inline int slxConvertString(const char* psz, int iLen, char* pszDest, int cchDest)
 {
-	int findLen = SChar<T>::Length(find);
-	int startPos = GetLength() - findLen;
-	if (startPos < 0)
-		return false;
-	return SChar<T>::CompareI(m_psz + startPos, find, findLen) == 0;
+	if (iLen>=cchDest)
+		return -1;
+	memcpy(pszDest, psz, iLen);
+	pszDest[iLen]='\0';
+	return iLen;
+}
+
+inline int slxConvertString(const wchar_t* psz, int iLen, wchar_t* pszDest, int cchDest)
+{
+	if (iLen>=cchDest)
+		return -1;
+	memcpy(pszDest, psz, iLen*sizeof(wchar_t));
+	pszDest[iLen]=L'\0';
+	return iLen;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
-// CAnyString
+// CAllocStats
 
-inline CAnyString::CAnyString(const char* psz, int iLen)
+#ifdef SIMPLELIB_ALLOC_STATS
+
+#ifndef SIMPLELIB_ALLOC_STATS_NO_REPORT
+struct CAllocStatsReport
 {
-	m_strA.Assign(psz, iLen);
-}
-inline CAnyString::CAnyString(const wchar_t* psz, int iLen)
+	~CAllocStatsReport()
+	{
+		CAllocStats::ReportLeaks(stderr);
+	}
+};
+#endif
+
+// Counters live in a template so they can be defined in the header.  Everything
+// here is zero initialized before any constructors run so containers in static
+// objects are counted too.
+template <int iDummy=0>
+struct CAllocStatsHolder
 {
-	m_strW.Assign(psz, iLen);
-}
-inline CAnyString::CAnyString(const CAnsiString& str)
+#ifdef SIMPLELIB_HAS_ATOMIC
+	typedef std::atomic<int64_t> TCounter;
+#else
+	typedef int64_t TCounter;
+#endif
+
+	struct COUNTERS
+	{
+		TCounter	iAllocs;
+		TCounter	iReallocs;
+		TCounter	iFrees;
+		TCounter	iBytesTotal;
+		TCounter	iBytesCurrent;
+		TCounter	iBytesPeak;
+	};
+
+	static COUNTERS m_Counters[CAllocStats::catMax];
+#ifndef SIMPLELIB_ALLOC_STATS_NO_REPORT
+	static CAllocStatsReport m_Report;
+#endif
+
+	static void AddBytes(COUNTERS& c, int64_t cb)
+	{
+		int64_t iCurrent=(c.iBytesCurrent+=cb);
+		c.iBytesTotal+=cb;
+
+#ifdef SIMPLELIB_HAS_ATOMIC
+		int64_t iPeak=c.iBytesPeak.load();
+		while (iCurrent>iPeak && !c.iBytesPeak.compare_exchange_weak(iPeak, iCurrent))
+		{
+		}
+#else
+		if (iCurrent>c.iBytesPeak)
+			c.iBytesPeak=iCurrent;
+#endif
+	}
+};
+template <int iDummy> typename CAllocStatsHolder<iDummy>::COUNTERS CAllocStatsHolder<iDummy>::m_Counters[CAllocStats::catMax];
+#ifndef SIMPLELIB_ALLOC_STATS_NO_REPORT
+template <int iDummy> CAllocStatsReport CAllocStatsHolder<iDummy>::m_Report;
+#endif
+
+// OnAlloc
+inline void CAllocStats::OnAlloc(int iCategory, size_t cb)
 {
-	m_strA=str;
+	ASSERT(iCategory>=0 && iCategory<catMax);
+
+#ifndef SIMPLELIB_ALLOC_STATS_NO_REPORT
+	// Referencing the report object is what gets it instantiated
+	(void)&CAllocStatsHolder<>::m_Report;
+#endif
+
+	CAllocStatsHolder<>::COUNTERS& c=CAllocStatsHolder<>::m_Counters[iCategory];
+	c.iAllocs++;
+	CAllocStatsHolder<>::AddBytes(c, (int64_t)cb);
 }
-inline CAnyString::CAnyString(const CUniString& str)
+
+// OnRealloc
+inline void CAllocStats::OnRealloc(int iCategory, size_t cbOld, size_t cbNew)
 {
-	m_strW=str;
+	ASSERT(iCategory>=0 && iCategory<catMax);
+
+	CAllocStatsHolder<>::COUNTERS& c=CAllocStatsHolder<>::m_Counters[iCategory];
+	c.iReallocs++;
+	if (cbNew>cbOld)
+		CAllocStatsHolder<>::AddBytes(c, (int64_t)(cbNew-cbOld));
+	else
+		c.iBytesCurrent-=(int64_t)(cbOld-cbNew);
 }
-inline CAnyString::CAnyString(const CAnyString& other)
+
+// OnFree
+inline void CAllocStats::OnFree(int iCategory, size_t cb)
 {
-	m_strW=other.m_strW;
-	m_strA=other.m_strA;
-}
-inline CAnyString::operator const char*() const
-{ 
-	return As<char>();
+	ASSERT(iCategory>=0 && iCategory<catMax);
+
+	CAllocStatsHolder<>::COUNTERS& c=CAllocStatsHolder<>::m_Counters[iCategory];
+	c.iFrees++;
+	c.iBytesCurrent-=(int64_t)cb;
 }
-inline CAnyString::operator const wchar_t*() const
+
+// Get
+inline ALLOCSTATS CAllocStats::Get(int iCategory)
 {
-	return As<wchar_t>();
+	ASSERT(iCategory>=0 && iCategory<catMax);
+
+	CAllocStatsHolder<>::COUNTERS& c=CAllocStatsHolder<>::m_Counters[iCategory];
+
+	ALLOCSTATS stats;
+	stats.iAllocs=c.iAllocs;
+	stats.iReallocs=c.iReallocs;
+	stats.iFrees=c.iFrees;
+	stats.iBytesTotal=c.iBytesTotal;
+	stats.iBytesCurrent=c.iBytesCurrent;
+	stats.iBytesPeak=c.iBytesPeak;
+	return stats;
 }
 
+// GetCategoryName
+inline const char* CAllocStats::GetCategoryName(int iCategory)
+{
+	switch (iCategory)
+	{
+		case catVector:		return "CVector";
+		case catString:		return "CString";
+		case catPlex:		return "CPlex";
+		case catHashMap:	return "CHashMap";
+	}
+	return "?";
+}
 
+// Reset - clears everything except current bytes, which live allocations
+// will still be subtracting from
+inline void CAllocStats::Reset()
+{
+	for (int i=0; i<catMax; i++)
+	{
+		CAllocStatsHolder<>::COUNTERS& c=CAllocStatsHolder<>::m_Counters[i];
+		int64_t iCurrent=c.iBytesCurrent;
+		int64_t iLive=c.iAllocs-c.iFrees;
+		c.iAllocs=iLive;
+		c.iFrees=0;
+		c.iReallocs=0;
+		c.iBytesTotal=iCurrent;
+		c.iBytesPeak=iCurrent;
+	}
+}
 
-/////////////////////////////////////////////////////////////////////////////
-// Substring functions
+// Dump
+inline void CAllocStats::Dump(FILE* pFile)
+{
+	fprintf(pFile, "%-10s %12s %12s %12s %14s %14s %14s\n", "", "allocs", "reallocs", "frees", "bytes", "current", "peak");
+	for (int i=0; i<catMax; i++)
+	{
+		ALLOCSTATS s=Get(i);
+		fprintf(pFile, "%-10s %12lld %12lld %12lld %14lld %14lld %14lld\n", GetCategoryName(i),
+				(long long)s.iAllocs, (long long)s.iReallocs, (long long)s.iFrees,
+				(long long)s.iBytesTotal, (long long)s.iBytesCurrent, (long long)s.iBytesPeak);
+	}
+}
 
-// Mid
-template <class T>
-CString<T> Mid(const T* psz, int iStart, int iLength)
+// ReportLeaks - returns true if anything is still allocated
+inline bool CAllocStats::ReportLeaks(FILE* pFile)
 {
-	if (!psz)
-		return NULL;
+	bool bLeaks=false;
+	for (int i=0; i<catMax; i++)
+	{
+		ALLOCSTATS s=Get(i);
+		if (s.iAllocs==s.iFrees && s.iBytesCurrent==0)
+			continue;
 
-	int iLen=CString<T>::len(psz);
+		fprintf(pFile, "SimpleLib: %lld %s allocation(s) outstanding, %lld bytes\n",
+				(long long)(s.iAllocs-s.iFrees), GetCategoryName(i), (long long)s.iBytesCurrent);
+		bLeaks=true;
+	}
+	return bLeaks;
+}
 
-	if (iStart>iLen)
-		return NULL;
+#endif	// SIMPLELIB_ALLOC_STATS
 
-	if (iStart<0)
-		iStart=iLen+iStart;
 
-	if (iLength<0)
-		iLength=iLen-iStart;
+/////////////////////////////////////////////////////////////////////////////
+// CArena
 
-	if (iStart+iLength>iLen)
-		iLength=iLen-iStart;
+template <int iDummy=0>
+struct CArenaCurrentHolder
+{
+	static SIMPLELIB_THREADLOCAL CArena* m_pCurrent;
+};
+template <int iDummy> SIMPLELIB_THREADLOCAL CArena* CArenaCurrentHolder<iDummy>::m_pCurrent=NULL;
 
-	return CString<T>(psz+iStart, iLength);
+// Constructor
+inline CArena::CArena(size_t cbBlockSize) :
+	m_pHead(NULL),
+	m_cbBlockSize(cbBlockSize),
+	m_cbUsed(0)
+{
 }
 
-template <class T>
-CString<T> SubStr(const T* psz, int iStart, int iLength)
+// Destructor
+inline CArena::~CArena()
 {
-	return Mid<T>(psz, iStart, iLength);
+	ASSERT(CArenaCurrentHolder<>::m_pCurrent!=this && "Arena destroyed while still current");
+	FreeAll();
 }
 
-// Left
-template <class T>
-CString<T> Left(const T* psz, int iLength)
+// Allocate a new block with room for at least cbMin bytes of allocations
+inline CArena::BLOCK* CArena::NewBlock(size_t cbMin)
 {
-	return Mid(psz, 0, iLength);
+	size_t cbSize=m_cbBlockSize;
+	if (cbSize<cbMin)
+		cbSize=cbMin;
+
+	BLOCK* pBlock=(BLOCK*)malloc(sizeof(BLOCK)+cbSize);
+	if (!pBlock)
+		return NULL;
+	pBlock->info.pNext=m_pHead;
+	pBlock->info.cbSize=cbSize;
+	pBlock->info.cbUsed=0;
+	m_pHead=pBlock;
+	return pBlock;
 }
 
-// Right
-template <class T>
-CString<T> Right(const T* psz, int iLength)
+// Alloc
+inline void* CArena::Alloc(size_t cb)
 {
-	if (!psz)
-		return NULL;
+	// Round up to keep every allocation aligned
+	size_t cbTotal=sizeof(ALLOCHDR) + ((cb+sizeof(ALLOCHDR)-1) & ~(sizeof(ALLOCHDR)-1));
 
-	int iLen=CString<T>::len(psz);
+	BLOCK* pBlock=m_pHead;
+	if (!pBlock || pBlock->info.cbSize-pBlock->info.cbUsed<cbTotal)
+	{
+		pBlock=NewBlock(cbTotal);
+		if (!pBlock)
+			return NULL;
+	}
 
-	if (iLength>iLen)
-		iLength=iLen;
+	ALLOCHDR* pHdr=reinterpret_cast<ALLOCHDR*>(reinterpret_cast<char*>(pBlock+1)+pBlock->info.cbUsed);
+	pHdr->info.pArena=this;
+	pHdr->info.cbSize=cbTotal-sizeof(ALLOCHDR);
+	pBlock->info.cbUsed+=cbTotal;
+	m_cbUsed+=cbTotal;
 
-	return CString<T>(psz+iLen-iLength);
+	return pHdr+1;
 }
 
-template <class T>
-CString<T> Repeat(const T* psz, int iCount)
+// Realloc - grows in place when p was the last allocation
+inline void* CArena::Realloc(void* p, size_t cb)
 {
-	int iElementLen=CString<T>::len(psz);
+	if (!p)
+		return Alloc(cb);
 
-	if (iCount==0 || iElementLen==0)
-		return SChar<T>::EmptyString();
+	ALLOCHDR* pHdr=reinterpret_cast<ALLOCHDR*>(p)-1;
+	ASSERT(pHdr->info.pArena==this);
 
+	// Shrinking (or same size)?
+	if (cb<=pHdr->info.cbSize)
+		return p;
 
-	CString<T> strBuf;
-	T* pszStart=strBuf.GetBuffer(iElementLen*iCount);
+	// Last allocation in the current block with room to grow?  (there's no
+	// current block if the arena has been freed since p was allocated)
+	size_t cbNew=(cb+sizeof(ALLOCHDR)-1) & ~(sizeof(ALLOCHDR)-1);
+	BLOCK* pBlock=m_pHead;
+	if (pBlock &&
+		reinterpret_cast<char*>(p)+pHdr->info.cbSize==reinterpret_cast<char*>(pBlock+1)+pBlock->info.cbUsed &&
+		pBlock->info.cbUsed-pHdr->info.cbSize+cbNew<=pBlock->info.cbSize)
+	{
+		pBlock->info.cbUsed+=cbNew-pHdr->info.cbSize;
+		m_cbUsed+=cbNew-pHdr->info.cbSize;
+		pHdr->info.cbSize=cbNew;
+		return p;
+	}
 
-	T* p=pszStart;
+	// Copy to a new allocation (leaving p alone on failure, same as realloc)
+	void* pNew=Alloc(cb);
+	if (!pNew)
+		return NULL;
+	memcpy(pNew, p, pHdr->info.cbSize);
+	return pNew;
+}
 
-	memcpy(p, psz, sizeof(T)*iElementLen);
-	p+=iElementLen;
+// Free - only reclaims the memory if p was the last allocation
+inline void CArena::Free(void* p)
+{
+	if (!p)
+		return;
 
-	int iDone=1;
-	while (iDone*2<=iCount)
-	{
-		memcpy(p, pszStart, (p-pszStart)*sizeof(T));
-		p+=p-pszStart;
-		iDone*=2;
-	}
+	ALLOCHDR* pHdr=reinterpret_cast<ALLOCHDR*>(p)-1;
+	ASSERT(pHdr->info.pArena==this);
 
-	if (iDone<iCount)
+	BLOCK* pBlock=m_pHead;
+	if (pBlock && reinterpret_cast<char*>(p)+pHdr->info.cbSize==reinterpret_cast<char*>(pBlock+1)+pBlock->info.cbUsed)
 	{
-		memcpy(p, pszStart, (iCount-iDone)*iElementLen*sizeof(T));
-		p+=(iCount-iDone)*iElementLen;
+		size_t cbTotal=sizeof(ALLOCHDR)+pHdr->info.cbSize;
+		pBlock->info.cbUsed-=cbTotal;
+		m_cbUsed-=cbTotal;
 	}
-	
-	return strBuf;
 }
 
-
-inline bool IsEmptyString(const wchar_t* psz)
+// FreeAll
+inline void CArena::FreeAll()
 {
-	return psz==NULL || psz[0]==L'\0';
+	BLOCK* pBlock=m_pHead;
+	while (pBlock)
+	{
+		BLOCK* pNext=pBlock->info.pNext;
+		free(pBlock);
+		pBlock=pNext;
+	}
+	m_pHead=NULL;
+	m_cbUsed=0;
 }
 
-inline bool IsEmptyString(const char* psz)
+// GetBytesUsed
+inline size_t CArena::GetBytesUsed() const
 {
-	return psz==NULL || psz[0]=='\0';
+	return m_cbUsed;
 }
 
-inline bool IsEqualString(const wchar_t* p1, const wchar_t* p2)
+// GetCurrent
+inline CArena* CArena::GetCurrent()
 {
-	return p1==p2 || (p1!=NULL && p2!=NULL && Compare(p1, p2)==0);
+	return CArenaCurrentHolder<>::m_pCurrent;
 }
 
-inline bool IsEqualString(const char* p1, const char* p2)
+// FromPointer
+inline CArena* CArena::FromPointer(void* p)
 {
-	return p1==p2 || (p1!=NULL && p2!=NULL && Compare(p1, p2)==0);
+	return (reinterpret_cast<ALLOCHDR*>(p)-1)->info.pArena;
 }
 
-inline bool IsEqualStringI(const wchar_t* p1, const wchar_t* p2)
+// Constructor
+inline CArenaScope::CArenaScope(CArena& arena)
 {
-	return p1==p2 || (p1!=NULL && p2!=NULL && CompareI(p1, p2)==0);
+	m_pPrev=CArenaCurrentHolder<>::m_pCurrent;
+	CArenaCurrentHolder<>::m_pCurrent=&arena;
 }
 
-inline bool IsEqualStringI(const char* p1, const char* p2)
+// Destructor
+inline CArenaScope::~CArenaScope()
 {
-	return p1==p2 || (p1!=NULL && p2!=NULL && CompareI(p1, p2)==0);
+	CArenaCurrentHolder<>::m_pCurrent=m_pPrev;
 }
 
 
-
-
-
-
 /////////////////////////////////////////////////////////////////////////////
-// CString Format functions
-
-#ifdef _MSC_VER
-
-#if (_MSC_VER < 1300)
+// Implementation of CString
 
-template <>
-inline CString<wchar_t> Format(const wchar_t* format, va_list args)
+// Constructor
+template <class T, class TAlloc>
+CString<T,TAlloc>::CString()
 {
-    int iLen = 1024;
+	SetHeader(NULL);
+}
 
-	CString<wchar_t> buf;
-    while (_vsnwprintf( buf.GetBuffer(iLen), iLen, format, args )<0)
-		iLen*=2;
-
-	return buf;
+// Constructor
+template <class T, class TAlloc>
+CString<T,TAlloc>::CString(const CString<T,TAlloc>& Other)
+{
+#ifdef SIMPLELIB_STRING_ATOMIC_REFCOUNT
+	// Resolve the length before sharing so other threads never write the header
+	Other.GetLength();
+#endif
+	m_psz=Other.m_psz;
+	if (m_psz)
+	{
+		AddRef(GetHeader());
+	}
 }
 
-
-
-// VC6 Ansi Format
-template <>
-inline CString<char> Format(const char* format, va_list args)
+// Constructor
+template <class T, class TAlloc>
+CString<T,TAlloc>::CString(const CAnyString& Other)
 {
-    int iLen = 1024;
-
-	CString<char> buf;
-    while (_vsnprintf( buf.GetBuffer(iLen), iLen, format, args )<0)
-		iLen*=2;
+	SetHeader(NULL);
+	Assign(Other.As<T>());
+}
 
-	return buf;
+// Constructor
+template <class T, class TAlloc>
+CString<T,TAlloc>::CString(const T* psz, int iLen)
+{
+	SetHeader(NULL);
+	Assign(psz, iLen);
 }
 
-#elif (_MSC_VER < 1400)
+// Destructor
+template <class T, class TAlloc>
+CString<T,TAlloc>::~CString()
+{
+	Empty();
+}
 
-// VS03 Unicode Format
-template <>
-inline CString<wchar_t> Format(const wchar_t* format, va_list args)
+// InitRef - setup reference count of a newly allocated header
+template <class T, class TAlloc>
+inline void CString<T,TAlloc>::InitRef(CHeader* pHeader)
 {
-    int iLen = _vscwprintf(format, args)+1;
+#ifdef SIMPLELIB_STRING_ATOMIC_REFCOUNT
+	new ((void*)&pHeader->m_iRef) std::atomic<int>(1);
+#else
+	pHeader->m_iRef=1;
+#endif
+}
 
-	CString<wchar_t> buf;
-    _vsnwprintf( buf.GetBuffer(iLen), iLen, format, args);
+// AddRef
+template <class T, class TAlloc>
+inline void CString<T,TAlloc>::AddRef(CHeader* pHeader)
+{
+#ifdef SIMPLELIB_STRING_ATOMIC_REFCOUNT
+	pHeader->m_iRef.fetch_add(1, std::memory_order_relaxed);
+#else
+	pHeader->m_iRef++;
+#endif
+}
 
-	return buf;
+// ReleaseRef
+template <class T, class TAlloc>
+inline bool CString<T,TAlloc>::ReleaseRef(CHeader* pHeader)
+{
+#ifdef SIMPLELIB_STRING_ATOMIC_REFCOUNT
+	return pHeader->m_iRef.fetch_sub(1, std::memory_order_acq_rel)==1;
+#else
+	return --pHeader->m_iRef==0;
+#endif
 }
 
-// VS03 Ansi Format
-template <>
-inline CString<char> Format(const char* format, va_list args)
+// IsShared
+template <class T, class TAlloc>
+inline bool CString<T,TAlloc>::IsShared(CHeader* pHeader)
 {
-    int iLen = _vscprintf(format, args)+1;
+#ifdef SIMPLELIB_STRING_ATOMIC_REFCOUNT
+	return pHeader->m_iRef.load(std::memory_order_acquire)>1;
+#else
+	return pHeader->m_iRef>1;
+#endif
+}
 
-	CString<char> buf;
-    _vsnprintf( buf.GetBuffer(iLen), iLen, format, args );
+// Assignment operator
+template <class T, class TAlloc>
+CString<T,TAlloc>& CString<T,TAlloc>::operator=(const CString<T,TAlloc>& Other)
+{
+	Assign(Other);
+	return *this;
+}
 
-	return buf;
+// Assignment operator
+template <class T, class TAlloc>
+CString<T,TAlloc>& CString<T,TAlloc>::operator=(const T* psz)
+{
+	Assign(psz,-1);
+	return *this;
 }
 
-#else
 
-// VS05 Unicode Format
-template <>
-inline CString<wchar_t> Format(const wchar_t* format, va_list args)
+// T* operator
+template <class T, class TAlloc>
+CString<T,TAlloc>::operator const T* () const
 {
-    int iLen = _vscwprintf(format, args)+1;
-
-	CString<wchar_t> buf;
-    _vswprintf_p( buf.GetBuffer(iLen), iLen, format, args);
-	return buf;
+	return m_psz;
 }
 
+// Return NULL terminated string (use when passing to vararg functions under gcc)
+template <class T, class TAlloc>
+const T* CString<T,TAlloc>::sz() const
+{
+	return m_psz;
+}
 
-// VS05 Ansi Format
-template <>
-inline CString<char> Format(const char* format, va_list args)
+// FreeExtra
+template <class T, class TAlloc>
+void CString<T,TAlloc>::FreeExtra()
 {
-    int iLen = _vscprintf(format, args)+1;
+	// Get header, quit if none
+	CHeader* pHeader=GetHeader();
+	if (!pHeader)
+		return;
 
-	CString<char> buf;
-    _vsprintf_p( buf.GetBuffer(iLen), iLen, format, args);
+	// Work out length if invalid
+	if (pHeader->m_iLength<0)
+		pHeader->m_iLength=len(m_psz);
 
-	return buf;
-}
+	// Get new buffer if shared...
+	if (IsShared(pHeader))
+	{
+		GetBuffer(pHeader->m_iLength+1);
+		pHeader=GetHeader();
+	}
 
-#endif	// VS05
+	// If using excessive memory, shrink...
+	if (pHeader->m_iLength+16<pHeader->m_iMemSize)
+	{
+		// Work out new length
+		int iNewBufSize=pHeader->m_iLength+1;
 
-#else	// MSVC
+		// Reallocate
+#ifdef SIMPLELIB_ALLOC_STATS
+		int iOldBufSize=pHeader->m_iMemSize;
+#endif
+		pHeader=(CHeader*)TAlloc::Realloc(pHeader, sizeof(CHeader)+sizeof(T)*iNewBufSize);
+		if (!pHeader)
+			return;
+		SIMPLELIB_STAT_REALLOC(CAllocStats::catString, sizeof(CHeader)+sizeof(T)*iOldBufSize, sizeof(CHeader)+sizeof(T)*iNewBufSize);
 
-// Normalize MSVC format specifiers to standard C++
-//		%[n]s -> %[n]ls
-//		%[n]S -> %[n]hs
-//		%c -> %lc
-//		%C -> %hc
-//      %I64 -> %ll
+		// Store new size...
+		pHeader->m_iMemSize=iNewBufSize;
 
-inline CUniString MsvcToGccFormatSpec(const wchar_t* p)
+		// Store new mem pointer
+		SetHeader(pHeader);
+	}
+}
+
+// GetBuffer
+template <class T, class TAlloc>
+T* CString<T,TAlloc>::GetBuffer(int iBufSize)
 {
-	CUniString str;
-	while (p[0])
+	CHeader* pHeader=GetHeader();
+
+	if (iBufSize<0)
 	{
-		if (p[0]!='%')
-		{
-			str+=*p++;
-			continue;
-		}
+		iBufSize=pHeader ? pHeader->m_iLength : 0;
+		if (iBufSize<0)
+			iBufSize=GetLength()+1;
+	}
 
-		// Copy the %
-		str+=*p++;
+	// Copy on write...
+	if (pHeader && IsShared(pHeader))
+	{
+		CHeader* pOldHeader=pHeader;
 
-		// % Literal
-		if (p[0]=='%')
-		{
-			str+=*p++;
-			continue;
-		}
+		// Allocate new header
+		pHeader=(CHeader*)TAlloc::Alloc(sizeof(CHeader)+sizeof(T)*iBufSize);
+		if (!pHeader)
+			return NULL;
+		SIMPLELIB_STAT_ALLOC(CAllocStats::catString, sizeof(CHeader)+sizeof(T)*iBufSize);
 
-		// Ignore flags, precision and width
-		while ((p[0]>='0' && p[0]<='9') || p[0]=='+' || p[0]=='-' || p[0]==' ' || p[0]=='#' || p[0]=='.' || p[0]=='*')
-		{
-			str+=*p++;
-		}
+		// Copy from original string
+		memcpy(pHeader->m_sz, pOldHeader->m_sz, sizeof(T)*(min(pOldHeader->m_iMemSize, iBufSize)+1));
+		if (iBufSize>pOldHeader->m_iMemSize)
+			pHeader->m_sz[iBufSize]=0;
 
-		// String
-		if (p[0]=='s')
-		{
-			str+=L"ls";
-			p++;
-		}
-		else if (p[0]=='S')
-		{
-			str+=L"hs";
-			p++;
-		}
-		else if (p[0]=='c')
+		// Release original string (other references may have gone meanwhile)
+		if (ReleaseRef(pOldHeader))
 		{
-			str+=L"lc";
-			p++;
+			SIMPLELIB_STAT_FREE(CAllocStats::catString, sizeof(CHeader)+sizeof(T)*pOldHeader->m_iMemSize);
+			TAlloc::Free(pOldHeader);
 		}
-		else if (p[0]=='C')
+
+		// Setup new header
+		pHeader->m_iMemSize=iBufSize;
+		InitRef(pHeader);
+		pHeader->m_iLength=-1;
+		SetHeader(pHeader);
+
+		// Done
+		return m_psz;
+	}
+
+	// Check if need to resize
+	if (pHeader && iBufSize<=pHeader->m_iMemSize)
 		{
-			str+=L"hc";
-			p++;
+		pHeader->m_iLength=-1;
+		return m_psz;
 		}
-		else if (p[0]=='I' && p[1]=='6' && p[2]=='4')
+
+	// Alloc/Grow buffer...
+	if (pHeader)
 		{
-			str+=L"ll";
-			p+=3;
+#ifdef SIMPLELIB_ALLOC_STATS
+		int iOldBufSize=pHeader->m_iMemSize;
+#endif
+		pHeader=(CHeader*)TAlloc::Realloc(pHeader, sizeof(CHeader)+sizeof(T)*iBufSize);
+		if (!pHeader)
+			return NULL;
+		SIMPLELIB_STAT_REALLOC(CAllocStats::catString, sizeof(CHeader)+sizeof(T)*iOldBufSize, sizeof(CHeader)+sizeof(T)*iBufSize);
 		}
-		else
+	else
 		{
-			str+=*p++;
+		pHeader=(CHeader*)TAlloc::Alloc(sizeof(CHeader)+sizeof(T)*iBufSize);
+		if (!pHeader)
+			return NULL;
+		SIMPLELIB_STAT_ALLOC(CAllocStats::catString, sizeof(CHeader)+sizeof(T)*iBufSize);
 		}
-	}
-	return str;
-}
-
-// GNU/SUN Unicode Format
-template <>
-inline CString<wchar_t> Format(const wchar_t* format, va_list args)
-{
-	CUniString strNormalized=Simple::MsvcToGccFormatSpec(format);
-	int iLen=5;
-	while (true)
-	{
-		CString<wchar_t> buf;
-		if (vswprintf(buf.GetBuffer(iLen), iLen+1, strNormalized.sz(), args)>=0)
-			return buf;
-		iLen*=2;
-	}
-}
-
 
-// GNU/SUN Ansi Format
-template <>
-inline CString<char> Format(const char* format, va_list args)
-{
-	// Sun compiler core dumps if passing null as first param to vsnprintf, so pass short
-	// buffer to calculate length
-	char tmp[2];
-	va_list args2;
-	va_copy(args2, args);
-    int iLen = vsnprintf(tmp, _countof(tmp), format, args2);
-	va_end(args2);
+	// Store new buffer
+	SetHeader(pHeader);
+	pHeader->m_iMemSize=iBufSize;
+	pHeader->m_sz[iBufSize]=0;
+	InitRef(pHeader);
 
-	// Now do the actual formatting...
-	CString<char> buf;
-    vsnprintf( buf.GetBuffer(iLen), iLen+1, format, args);
+	// Invalidate length
+	pHeader->m_iLength=-1;
 
-	return buf;
+	// Done!
+	return m_psz;
 }
 
-#endif	// !MSVC
-
-template <>
-inline CString<wchar_t> Format(const wchar_t* format, ...)
+// GrowBuffer
+template <class T, class TAlloc>
+T* CString<T,TAlloc>::GrowBuffer(int iNewSize)
 {
-    va_list  args;
-    va_start(args, format);
-
-	CString<wchar_t> strRetv=Format(format, args);
-
-	va_end(args);
-
-	return strRetv;
-}
-
-template <>
-inline CString<char> Format(const char* format, ...)
-{
-    va_list  args;
-    va_start(args, format);
-
-	CString<char> strRetv=Format(format, args);
-
-	va_end(args);
-
-	return strRetv;
-}
+	// If no buffer allocate at requested size
+	if (!m_psz)
+		return GetBuffer(iNewSize);
 
+	// Copy on write?
+	if (IsShared(GetHeader()))
+		return GetBuffer(iNewSize);
 
+	// Quit if already big enough
+	if (iNewSize<=GetHeader()->m_iMemSize)
+		return m_psz;
 
-/////////////////////////////////////////////////////////////////////////////
-// Implementation of CVector
+	// Instead of just growing by a little bit, double the buffer size
+	// (to save lots of tiny reallocs when appending)
+	int iDoubleSize=GetHeader()->m_iMemSize*2;
+	if (iDoubleSize>iNewSize)
+		iNewSize=iDoubleSize;
 
-#define VECDATAPTR(x) (void*)(((char*)m_pData) + sizeof(m_pData[0])*(x))
+	// Resize the buffer, but maintain the current length
+	int iLen=GetHeader()->m_iLength;
+	GetBuffer(iNewSize);
+	GetHeader()->m_iLength=iLen;
 
-// Constructor
-template <class T, class TSem, class TArg>
-CVector<T,TSem,TArg>::CVector()
-{
-	m_pData=NULL;
-	m_iSize=0;
-	m_iMemSize=0;
+	return m_psz;
 }
 
-// Destructor
-template <class T, class TSem, class TArg>
-CVector<T,TSem,TArg>::~CVector()
+// operator[] - read only so doesn't need to unshare the buffer
+template <class T, class TAlloc>
+const T& CString<T,TAlloc>::operator[] (int iPos)
 {
-	RemoveAll();
-	if (m_pData)
-		free(m_pData);
+	ASSERT(m_psz);
+	ASSERT(iPos>=0 && iPos<GetHeader()->m_iMemSize);
+	return m_psz[iPos];
 }
 
-// Reallocate memory
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::GrowTo(int iRequiredSize)
+// Empty
+template <class T, class TAlloc>
+void CString<T,TAlloc>::Empty()
 {
-	// Quit if already big enough
-	if (iRequiredSize<=m_iMemSize)
+	if (!m_psz)
 		return;
 
-	// Work out how big to make it
-	int iNewSize=iRequiredSize*2;
-	if (iNewSize<16)
-		iNewSize=16;
-
-	if (m_pData)
-	{
-		// Reallocate memory
-		ASSERT(m_iMemSize!=0);
-		m_pData=(T*)realloc(m_pData, iNewSize*sizeof(T));
-	}
-	else
+	if (ReleaseRef(GetHeader()))
 	{
-		// Allocate memory
-		ASSERT(m_iMemSize==0);
-		m_pData=(T*)malloc(iNewSize*sizeof(T));
+		SIMPLELIB_STAT_FREE(CAllocStats::catString, sizeof(CHeader)+sizeof(T)*GetHeader()->m_iMemSize);
+		TAlloc::Free(GetHeader());
 	}
-
-	// Store new sizes
-	m_iMemSize=iNewSize;
+	m_psz=NULL;
 }
 
-// Set size...
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::SetSize(int iRequiredSize, const TArg& val)
+// IsEmpty
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::IsEmpty() const
 {
-	GrowTo(iRequiredSize);
-	while (GetSize()<iRequiredSize)
-		Add(val);
-	while (GetSize()>iRequiredSize)
-		Pop();
+	return GetLength()==0;
 }
 
-// Release extra memory
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::FreeExtra()
+// len
+template <class T, class TAlloc>
+int CString<T,TAlloc>::len(const T* psz)
 {
-	// Quit if no extra memory allocated
-	if (m_iMemSize==m_iSize)
-		return;
+	if (!psz)
+		return 0;
 
-	// Free or realloc memory...
-	if (m_iSize==0)
-	{
-		free(m_pData);
-		m_pData=NULL;
-	}
-	else
-	{
-		m_pData=(T*)realloc(m_pData, m_iSize*sizeof(T));
-	}
+	const T* p=psz;
+	while (p[0])
+		p++;
 
-	// Store new memory size
-	m_iMemSize=m_iSize;
+	return int(p-psz);
 }
 
-// InsertAt
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::InsertAt(int iPosition, const T& val)
+// copy
+template <class T, class TAlloc>
+void CString<T,TAlloc>::copy(T* pszDest, const T* pszSrc, int iLen)
 {
-	InsertAtInternal(iPosition, &val, 1);
+	memcpy(pszDest, pszSrc, sizeof(T)*iLen);
 }
 
-template <class T, class TSem, class TArg> template <class TSem2, class TArg2>
-void CVector<T,TSem,TArg>::Add(CVector<T, TSem2, TArg2>& vec)
-{
-	InsertAtInternal(GetSize(), vec.GetBuffer(), vec.GetSize());
-}
 
-template <class T, class TSem, class TArg> template <class TSem2, class TArg2>
-void CVector<T,TSem,TArg>::InsertAt(int iPosition, CVector<T, TSem2, TArg2>& vec)
-{
-	InsertAtInternal(iPosition, vec.GetBuffer(), vec.GetSize());
-}
 
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::Swap(CVector<T, TSem, TArg>& other)
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::Assign(const CString<T,TAlloc>& Other)
 {
-	int tempSize = m_iSize;
-	m_iSize = other.m_iSize;
-	other.m_iSize = tempSize;
-
-	int tempMemSize = m_iMemSize;
-	m_iMemSize = other.m_iMemSize;
-	other.m_iMemSize = tempMemSize;
+#ifdef SIMPLELIB_STRING_ATOMIC_REFCOUNT
+	Other.GetLength();
+#endif
 
-	T* tempData = m_pData;
-	m_pData = other.m_pData;
-	other.m_pData = tempData;
+	// Reference the other string before releasing ours (in case they're the same)
+	CHeader* pHeader=Other.GetHeader();
+	if (pHeader)
+		AddRef(pHeader);
+	Empty();
+	SetHeader(pHeader);
+	return true;
 }
 
+// Assign
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::Assign(const TAlt* psz, int iLen)
+{
+	return Assign(t2t<T,TAlt>(psz,iLen));
+}
 
-// ReplaceAt
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::ReplaceAt(int iPosition, const T& val)
+// Assign
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::Assign(const T* psz, int iLen)
 {
-	ASSERT(iPosition>=0 && iPosition<GetSize());
+	// Clear old value
+	Empty();
 
-	TSem::OnRemove(m_pData[iPosition], this);
+	// Quit if NULL string
+	if (!psz)
+		return true;
 
-	Destructor(m_pData+iPosition);
+	// Auto length?
+	if (iLen<0)
+		iLen=len(psz);
 
-	Constructor(m_pData+iPosition, TSem::OnAdd(val, this));
-}
+	if (!GetBuffer(iLen))
+		return false;
 
-// Swap
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::Swap(int iPosA, int iPosB)
-{
-	ASSERT(iPosA>=0 && iPosA<GetSize());
-	ASSERT(iPosB>=0 && iPosB<GetSize());
+	// Copy new value in
+	copy(m_psz, psz, iLen);
+	m_psz[iLen]=L'\0';
 
-	// Redundant?
-	if (iPosA==iPosB)
-		return;
+	// Store new text size
+	GetHeader()->m_iLength=iLen;
 
-	// Swap it
-	T temp=m_pData[iPosA];
-	Destructor(m_pData+iPosA);
-	Constructor(m_pData+iPosA, m_pData[iPosB]);
-	Destructor(m_pData+iPosB);
-	Constructor(m_pData+iPosB, temp);
+	return true;
 }
 
-// Move
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::Move(int iFrom, int iTo)
+// GetLength
+template <class T, class TAlloc>
+int CString<T,TAlloc>::GetLength() const
 {
-	ASSERT(iFrom>=0 && iFrom<GetSize());
-	ASSERT(iTo>=0 && iTo<GetSize());
-
-	// Redundant?
-	if (iFrom==iTo)
-		return;
-
-	T temp=m_pData[iFrom];
-	Destructor(m_pData+iFrom);
-	if (iTo<iFrom)
-	{
-		memmove(VECDATAPTR(iTo+1), VECDATAPTR(iTo), (iFrom-iTo)*sizeof(T));
-	}
-	else
-	{
-		memmove(VECDATAPTR(iFrom), VECDATAPTR(iFrom+1), (iTo-iFrom)*sizeof(T));
-	}
-	Constructor(m_pData+iTo, temp);
+	CHeader* pHeader=GetHeader();
+	if (!pHeader)
+		return 0;
+	if (pHeader->m_iLength<0)
+		pHeader->m_iLength=len(m_psz);
+	return pHeader->m_iLength;
 }
 
-// Insert at a position
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::InsertAtInternal(int iPosition, const T* pVal, int iCount)
+
+// Replace
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::Replace(int iPos, int iOldLen, const T* psz, int iNewLen)
 {
-	if (iCount<1)
-		return;
+	// Quit if nothing to do
+	if (!iOldLen && !iNewLen)
+		return true;
 
-	ASSERT(iPosition>=0);
-	ASSERT(iPosition<=GetSize());
+	// Auto length?
+	if (iNewLen<0)
+		{
+		iNewLen = psz ? len(psz) : 0;
+		}
 
-	// Make sure have room
-	GrowTo(m_iSize+iCount);
+	// Append?
+	if (iPos<0)
+		iPos=GetLength();
 
-	// Shuffle memory
-	if (iPosition<m_iSize)
-		memmove(VECDATAPTR(iPosition+iCount), VECDATAPTR(iPosition), (m_iSize-iPosition)*sizeof(T));
+	// Check position in range
+	ASSERT(iPos<=GetLength());
 
-	// Store pointer
-	for (int i=0; i<iCount; i++)
-	{
-		Constructor(m_pData+iPosition+i, TSem::OnAdd(*(pVal+i), this));
-	}
+	// Replace entire RHS?
+	if (iOldLen<0)
+		iOldLen=GetLength()-iPos;
 
-	// Update size
-	m_iSize+=iCount;
-}
+	// Check in range
+	ASSERT(iPos + iOldLen <= GetLength());
 
-// Add
-template <class T, class TSem, class TArg>
-inline int CVector<T,TSem,TArg>::Add(const T& val)
-{
-	// Grow if necessary
-	if (m_iSize+1>m_iMemSize)
-		GrowTo(m_iSize+1);
+	// Work out new required size
+	int iNewTextSize = GetLength() + iNewLen - iOldLen;
+	ASSERT(iNewTextSize>=0);
 
-	Constructor(m_pData+m_iSize, TSem::OnAdd(val, this));
-	m_iSize++;
-	return m_iSize-1;
-}
+	int iLength=GetLength();
 
-// Remove a particular item
-template <class T, class TSem, class TArg>
-int CVector<T,TSem,TArg>::Remove(const TArg& val)
-{
-	int iPos=Find(val);
-	if (iPos>=0)
-		RemoveAt(iPos);
-	return iPos;
-}
-
-// RemoveAt
-template <class T, class TSem, class TArg>
-inline void CVector<T,TSem,TArg>::RemoveAt(int iPosition)
-{
-	ASSERT(iPosition>=0);
-	ASSERT(iPosition<GetSize());
+	// Reallocate buffer
+	if (!GrowBuffer(iNewTextSize))
+		return false;
 
-	TSem::OnRemove(m_pData[iPosition], this);
-	Destructor(m_pData+iPosition);
+	// Move trailing characters
+	int iTrailingChars = iLength - (iPos + iOldLen);
+	if (iTrailingChars && iOldLen!=iNewLen)
+		{
+		memmove(m_psz + iPos + iNewLen, m_psz + iPos + iOldLen, iTrailingChars * sizeof(T));
+		}
 
-	// Shuffle memory
-	if (iPosition<GetSize()-1)
-		memmove(VECDATAPTR(iPosition), VECDATAPTR(iPosition+1), (m_iSize-iPosition-1)*sizeof(T));
+	// Copy new characters
+	if (iNewLen)
+		{
+		memcpy(m_psz + iPos, psz, iNewLen * sizeof(T));
+		}
 
-	// Update size
-	m_iSize--;
+	// Update size/position
+	m_psz[iNewTextSize]=L'\0';
+	GetHeader()->m_iLength=iNewTextSize;
+	return true;
 }
 
-// RemoveAt
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::RemoveAt(int iPosition, int iCount)
+// Append
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::Append(const T* psz, int iLen)
 {
-	// Quit if nothing to do!
-	if (iCount==0)
-		return;
-
-	ASSERT(iPosition>=0);
-	ASSERT(iPosition<GetSize());
-	ASSERT(iPosition+iCount-1<GetSize());
-	ASSERT(m_iSize-iCount>=0);
-
-	for (int i=0; i<iCount; i++)
-	{
-		TSem::OnRemove(m_pData[iPosition+i], this);
-		Destructor(m_pData+iPosition+i);
-	}
-
-	// Shuffle emory
-	if (iPosition+iCount<GetSize())
-		memmove(VECDATAPTR(iPosition), VECDATAPTR(iPosition+iCount), (m_iSize-iPosition-iCount)*sizeof(T));
-
-	// Update size
-	m_iSize-=iCount;
+	return Replace(GetLength(), 0, psz, iLen);
 }
 
-// DetachAt
-template <class T, class TSem, class TArg>
-inline T CVector<T,TSem,TArg>::DetachAt(int iPosition)
+// Append
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::Append(T ch)
 {
-	ASSERT(iPosition>=0);
-	ASSERT(iPosition<GetSize());
-
-	T temp=GetAt(iPosition);
-
-	TSem::OnDetach(m_pData[iPosition], this);
-	Destructor(m_pData+iPosition);
-
-	// Shuffle memory
-	if (iPosition<GetSize()-1)
-		memmove(VECDATAPTR(iPosition), VECDATAPTR(iPosition+1), (m_iSize-iPosition-1)*sizeof(T));
-
-	// Update size
-	m_iSize--;
-
-	return temp;
+	return Append(&ch, 1);
 }
 
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::Detach(const TArg& val)
+// Insert
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::Insert(int iPos, const T* psz, int iLen)
 {
-	int iIndex=Find(val);
-	ASSERT(iIndex>=0);
-	DetachAt(iIndex);
+	return Replace(iPos, 0, psz, iLen);
 }
 
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::DetachAll()
+// Delete
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::Delete(int iPos, int iLen)
 {
-	for (int i=GetSize()-1; i>=0; i--)
-		DetachAt(i);
+	return Replace(iPos, iLen, NULL, 0);
 }
 
-
-// RemoveAll
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::RemoveAll()
+// operator+=
+template <class T, class TAlloc>
+CString<T,TAlloc>& CString<T,TAlloc>::operator+=(const T* psz)
 {
-	if (m_iSize)
-	{
-		RemoveAt(0, m_iSize);
-		m_iSize=0;
-//		FreeExtra();		// Removed as performance enhancement when frequent adding/remove all
-	}
+	Append(psz);
+	return *this;
 }
 
-// GetAt
-template <class T, class TSem, class TArg>
-inline T& CVector<T,TSem,TArg>::GetAt(int iPosition) const
+// operator+=
+template <class T, class TAlloc>
+CString<T,TAlloc>& CString<T,TAlloc>::operator+=(T ch)
 {
-	ASSERT(iPosition>=0);
-	ASSERT(iPosition<GetSize());
-
-	return m_pData[iPosition];
+	Append(ch);
+	return *this;
 }
 
-// operator[]
-template <class T, class TSem, class TArg>
-inline T& CVector<T,TSem,TArg>::operator[](int iPosition) const
+template <class T, class TAlloc>
+CString<T,TAlloc> CString<T,TAlloc>::ToUpper()
 {
-	return GetAt(iPosition);
+	CString<T,TAlloc> copy(*this);
+	if (m_psz)
+		slxStrToUpper(copy.GetBuffer(-1));
+	return copy;
 }
 
-// GetBuffer
-template <class T, class TSem, class TArg>
-inline T* CVector<T,TSem,TArg>::GetBuffer() const
+template <class T, class TAlloc>
+CString<T,TAlloc> CString<T,TAlloc>::ToLower()
 {
-	return m_pData;
+	CString<T,TAlloc> copy(*this);
+	if (m_psz)
+		slxStrToLower(copy.GetBuffer(-1));
+	return copy;
 }
 
-// GetSize
-template <class T, class TSem, class TArg>
-inline int CVector<T,TSem,TArg>::GetSize() const
+template <class T, class TAlloc>
+int CString<T,TAlloc>::Compare(const T* psz)
 {
-	return m_iSize;
+	return ::Compare(*this, psz);
 }
 
-// Find (linear)
-template <class T, class TSem, class TArg>
-int CVector<T,TSem,TArg>::Find(const TArg& val, int iStartAfter) const
+template <class T, class TAlloc>
+CString<T,TAlloc> CString<T,TAlloc>::Left(int iCount)
 {
-	// Find an item
-	for (int i=iStartAfter+1; i<m_iSize; i++)
-	{
-		if (TSem::Compare(m_pData[i], val)==0)
-			return i;
-	}
-
-	// Not found
-	return -1;
+	return Mid(0, iCount);
 }
 
-
-// QuickSort
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::QuickSort()
+template <class T, class TAlloc>
+CString<T,TAlloc> CString<T,TAlloc>::Right(int iCount)
 {
-	QuickSort(TSem::Compare);
-}
-
-typedef int (__cdecl *PFNQSORTCOMPARE)(const void*, const void*);
+	if (!m_psz)
+		return NULL;
 
+	int iLen=GetLength();
 
-// QuickSort
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::QuickSort(int (__cdecl *pfnCompare)(const T& a, const T& b))
-{
-	if (IsEmpty())
-		return;
+	if (iCount>iLen)
+		iCount=iLen;
 
-	qsort(m_pData, m_iSize, sizeof(T), (PFNQSORTCOMPARE)pfnCompare);
+	return _CString(m_psz+iLen-iCount, iCount);
 }
 
-
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-
-extern "C"
+template <class T, class TAlloc>
+CString<T,TAlloc> CString<T,TAlloc>::SubStr(int iFrom, int iCount)
 {
-typedef int (*PFNQSORTCOMPAREEX)(void*, const void*, const void*);
+	return Mid(iFrom, iCount);
 }
-// QuickSort
-template <class T, class TSem, class TArg>
-void CVector<T,TSem,TArg>::QuickSort(int (__cdecl *pfnCompare)(void* ctx, const T& a, const T& b), void* ctx)
-{
-	if (IsEmpty())
-		return;
 
-	qsort_s(m_pData, m_iSize, sizeof(T), (PFNQSORTCOMPAREEX)pfnCompare, ctx);
-}
+template <class T, class TAlloc>
+CString<T,TAlloc> CString<T,TAlloc>::Mid(int iFrom, int iCount)
+{
+	// Same rules as the free Mid function, but keeps this string's allocator
+	if (!m_psz)
+		return NULL;
 
-#endif
+	int iLen=GetLength();
 
-// QuickSearch
-template <class T, class TSem, class TArg>
-bool CVector<T,TSem,TArg>::QuickSearch(const TArg& key, int& iPosition) const
-{
-	return QuickSearch(key, TSem::Compare, iPosition);
-}
+	if (iFrom>iLen)
+		return NULL;
 
+	if (iFrom<0)
+		iFrom=iLen+iFrom;
 
-// QuickSearch
-template <class T, class TSem, class TArg>
-bool CVector<T,TSem,TArg>::QuickSearch(const TArg& key, int (__cdecl *pfnCompare)(const T& a, const TArg& b), int& iPosition) const
-{
-	return Simple::slxQuickSearch<T,const TArg&>(key, m_pData, m_iSize, pfnCompare, iPosition);
-}
+	if (iCount<0)
+		iCount=iLen-iFrom;
 
-// QuickSearchEx
-template <class T, class TSem, class TArg>
-bool CVector<T,TSem,TArg>::QuickSearch(const TArg& key, void* ctx, int (__cdecl *pfnCompare)(void* ctx, const T& a, const TArg& b), int& iPosition) const
-{
-	return Simple::slxQuickSearchEx<T,const TArg&>(key, ctx, m_pData, m_iSize, pfnCompare, iPosition);
-}
+	if (iFrom+iCount>iLen)
+		iCount=iLen-iFrom;
 
-template <class T, class TSem, class TArg> template <class TKey>
-bool CVector<T,TSem,TArg>::QuickSearchKey(TKey key, int (__cdecl *pfnCompare)(const T& a, TKey b), int& iPosition) const
-{
-	return slxQuickSearch<T, TKey>(key, GetBuffer(), GetSize(), pfnCompare, iPosition);
+	return _CString(m_psz+iFrom, iCount);
 }
 
-template <class T, class TSem, class TArg> template <class TKey>
-bool CVector<T,TSem,TArg>::QuickSearchKey(TKey key, void* ctx, int (__cdecl *pfnCompare)(void* ctx, const T& a, TKey b), int& iPosition) const
+template <class T, class TAlloc>
+int CString<T,TAlloc>::Find(const T* psz, int startOffset)
 {
-	return slxQuickSearchEx<T, TKey>(key, ctx, GetBuffer(), GetSize(), pfnCompare, iPosition);
-}
+	if (psz == NULL)
+		return -1;
 
+	// Get search string length
+	int srcLen = SChar<T>::Length(psz);
+	if (srcLen == 0)
+		return startOffset;
 
-template <class T, class TSem, class TArg> template <class TKey>
-int CVector<T,TSem,TArg>::FindKey(TKey key, int (__cdecl *pfnCompare)(const T& a, TKey b), int iStartAfter) const
-{
-	return slxFind(key, GetBuffer()+iStartAfter+1, GetBuffer()+GetSize(), pfnCompare);
+	// Find it
+	return slxStrFind(m_psz, GetLength(), psz, srcLen, startOffset);
 }
 
-template <class T, class TSem, class TArg> template <class TKey>
-int CVector<T,TSem,TArg>::FindKey(TKey key, void* ctx, int (__cdecl *pfnCompare)(void* ctx, const T& a, TKey b), int iStartAfter) const
+template <class T, class TAlloc>
+int CString<T,TAlloc>::FindI(const T* psz, int startOffset)
 {
-	return slxFindEx(key, ctx, GetBuffer()+iStartAfter+1, GetBuffer()+GetSize(), pfnCompare);
-}
+	if (psz == NULL)
+		return -1;
 
+	// Get search string length
+	int srcLen = SChar<T>::Length(psz);
+	if (srcLen == 0)
+		return startOffset;
 
-// IsEmpty
-template <class T, class TSem, class TArg>
-inline bool CVector<T,TSem,TArg>::IsEmpty() const
-{
-	return GetSize()==0;
+	// Find it
+	return slxStrFindI(m_psz, GetLength(), psz, srcLen, startOffset);
 }
 
-// Push
-template <class T, class TSem, class TArg>
-inline void CVector<T,TSem,TArg>::Push(const TArg& val)
+template <class T, class TAlloc>
+CString<T,TAlloc> CString<T,TAlloc>::Replace(const T* find, const T* replace, int maxReplacements, int startOffset)
 {
-	Add(val);
-}
+	int findLen = SChar<T>::Length(find);
+	int replaceLen = SChar<T>::Length(replace);
 
-// Pop
-template <class T, class TSem, class TArg>
-inline bool CVector<T,TSem,TArg>::Pop(T& val)
-{
-	if (m_iSize==0)
-		return false;
+	CString<T,TAlloc> strNew = *this;
 
-	// Update size
-	m_iSize--;
+	while (true)
+	{
+		// Find it
+		int foundPos = strNew.Find(find, startOffset);
+		if (foundPos < 0)
+			break;
 
-	val=m_pData[m_iSize];
+		// Replace it
+		strNew.Replace(foundPos, findLen, replace, replaceLen);
 
-	TSem::OnDetach(m_pData[m_iSize], this);
-	Destructor(m_pData+m_iSize);
+		// Continue searching after
+		startOffset = foundPos + replaceLen;
 
-	return true;
-}
+		// Limit replacements
+		maxReplacements--;
+		if (maxReplacements == 0)
+			break;
+	}
 
-// Pop
-template <class T, class TSem, class TArg>
-inline T CVector<T,TSem,TArg>::Pop()
-{
-	ASSERT(!IsEmpty());
-	return DetachAt(GetSize()-1);
+	return strNew;
 }
 
-// Top
-template <class T, class TSem, class TArg>
-inline T& CVector<T,TSem,TArg>::Top() const
+template <class T, class TAlloc>
+CString<T,TAlloc> CString<T,TAlloc>::ReplaceI(const T* find, const T* replace, int maxReplacements, int startOffset)
 {
-	ASSERT(!IsEmpty());
-	return GetAt(GetSize()-1);
-}
+	int findLen = SChar<T>::Length(find);
+	int replaceLen = SChar<T>::Length(replace);
 
-// Top
-template <class T, class TSem, class TArg>
-inline bool CVector<T,TSem,TArg>::Top(T& val) const
-{
-	if (IsEmpty())
-		return false;
-	val=Top();
-	return true;
+	CString<T,TAlloc> strNew = *this;
+
+	while (true)
+	{
+		// Find it
+		int foundPos = strNew.FindI(find, startOffset);
+		if (foundPos < 0)
+			break;
+
+		// Replace it
+		strNew.Replace(foundPos, findLen, replace, replaceLen);
+
+		// Continue searching after
+		startOffset = foundPos + replaceLen;
+
+		// Limit replacements
+		maxReplacements--;
+		if (maxReplacements == 0)
+			break;
+	}
+
+	return strNew;
 }
 
-// Enqueue
-template <class T, class TSem, class TArg>
-inline void CVector<T,TSem,TArg>::Enqueue(const TArg& val)
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::StartsWith(const T* find)
 {
-	Add(val);
+	if (m_psz == NULL)
+		return false;
+	return SChar<T>::Compare(m_psz, find, SChar<T>::Length(find)) == 0;
 }
 
-// Dequeue
-template <class T, class TSem, class TArg>
-inline T CVector<T,TSem,TArg>::Dequeue()
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::StartsWithI(const T* find)
 {
-	ASSERT(!IsEmpty());
-	return DetachAt(0);
+	if (m_psz == NULL)
+		return false;
+	int findLen = SChar<T>::Length(find);
+	if (GetLength() < findLen)
+		return false;
+	return slxStrEqualI(m_psz, find, findLen);
 }
 
-// Dequeue
-template <class T, class TSem, class TArg>
-inline bool CVector<T,TSem,TArg>::Dequeue(T& val)
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::EndsWith(const T* find)
 {
-	if (IsEmpty())
+	int findLen = SChar<T>::Length(find);
+	int startPos = GetLength() - findLen;
+	if (startPos < 0)
 		return false;
-
-	val=Dequeue();
-	return true;
+	return SChar<T>::Compare(m_psz + startPos, find, findLen) == 0;
 }
 
-// Peek
-template <class T, class TSem, class TArg>
-inline T& CVector<T,TSem,TArg>::Peek() const
+template <class T, class TAlloc>
+bool CString<T,TAlloc>::EndsWithI(const T* find)
 {
-	ASSERT(!IsEmpty());
-	return GetAt(0);
+	int findLen = SChar<T>::Length(find);
+	int startPos = GetLength() - findLen;
+	if (startPos < 0)
+		return false;
+	return slxStrEqualI(m_psz + startPos, find, findLen);
 }
 
-// Peek
-template <class T, class TSem, class TArg>
-inline bool CVector<T,TSem,TArg>::Peek(T& val) const
+
+/////////////////////////////////////////////////////////////////////////////
+// CAnyString
+
+inline CAnyString::CAnyString(const char* psz, int iLen)
 {
-	if (IsEmpty())
-		return false;
-	val=Peek();
-	return true;
+	m_strA.Assign(psz, iLen);
+}
+inline CAnyString::CAnyString(const wchar_t* psz, int iLen)
+{
+	m_strW.Assign(psz, iLen);
+}
+inline CAnyString::CAnyString(const CAnsiString& str)
+{
+	m_strA=str;
+}
+inline CAnyString::CAnyString(const CUniString& str)
+{
+	m_strW=str;
+}
+inline CAnyString::CAnyString(const CAnyString& other)
+{
+	m_strW=other.m_strW;
+	m_strA=other.m_strA;
+}
+inline CAnyString::operator const char*() const
+{ 
+	return As<char>();
+}
+inline CAnyString::operator const wchar_t*() const
+{
+	return As<wchar_t>();
 }
 
 
-#undef VECDATAPTR
 
 /////////////////////////////////////////////////////////////////////////////
-// CSortedVector implementation
+// Substring functions
 
-// Constructor
-template <class T, class TSem, class TArg>
-CSortedVector<T,TSem,TArg>::CSortedVector()
+// Mid
+template <class T>
+CString<T> Mid(const T* psz, int iStart, int iLength)
 {
-	m_pfnCompare=NULL;
-	m_bAllowDuplicates=true;
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-	m_ctx=NULL;
-	m_pfnCompareEx=NULL;
-#endif
+	if (!psz)
+		return NULL;
 
-	// Setup default sort order
-	Resort(NULL, true);
-};
+	int iLen=CString<T>::len(psz);
 
-// Destructor
-template <class T, class TSem, class TArg>
-CSortedVector<T,TSem,TArg>::~CSortedVector()
-{
-};
+	if (iStart>iLen)
+		return NULL;
 
-// Add
-template <class T, class TSem, class TArg>
-int CSortedVector<T,TSem,TArg>::Add(const TArg& val)
-{
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-	if (m_pfnCompareEx)
-	{
-		int iPos;
-		if (m_vec.QuickSearch(val, m_ctx, m_pfnCompareEx, iPos))
-		{
-			if (!m_bAllowDuplicates)
-				return -1-iPos;		// position of existing item = -retv-1;
+	if (iStart<0)
+		iStart=iLen+iStart;
 
-			// Insert duplicate after existing entries...
-			while (iPos<GetSize() && m_pfnCompareEx(m_ctx, val, GetAt(iPos))==0)
-				iPos++;
-		}
+	if (iLength<0)
+		iLength=iLen-iStart;
 
-		m_vec.InsertAt(iPos, val);
-		return iPos;
-	}
+	if (iStart+iLength>iLen)
+		iLength=iLen-iStart;
 
-#endif
-	int iPos;
-	if (m_vec.QuickSearch(val, m_pfnCompare, iPos))
-	{
-		if (!m_bAllowDuplicates)
-			return -1-iPos;		// position of existing item = -retv-1;
+	return CString<T>(psz+iStart, iLength);
+}
 
-		// Insert duplicate after existing entries...
-		while (iPos<GetSize() && m_pfnCompare(val, GetAt(iPos))==0)
-			iPos++;
-	}
+template <class T>
+CString<T> SubStr(const T* psz, int iStart, int iLength)
+{
+	return Mid<T>(psz, iStart, iLength);
+}
 
-	m_vec.InsertAt(iPos, val);
-	return iPos;
+// Left
+template <class T>
+CString<T> Left(const T* psz, int iLength)
+{
+	return Mid(psz, 0, iLength);
 }
 
-// GetSize
-template <class T, class TSem, class TArg>
-int CSortedVector<T,TSem,TArg>::GetSize() const
+// Right
+template <class T>
+CString<T> Right(const T* psz, int iLength)
 {
-	return m_vec.GetSize();
+	if (!psz)
+		return NULL;
+
+	int iLen=CString<T>::len(psz);
+
+	if (iLength>iLen)
+		iLength=iLen;
+
+	return CString<T>(psz+iLen-iLength);
 }
 
-// Remove
-template <class T, class TSem, class TArg>
-int CSortedVector<T,TSem,TArg>::Remove(const TArg& val)
+template <class T>
+CString<T> Repeat(const T* psz, int iCount)
 {
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-	if (m_pfnCompareEx)
+	int iElementLen=CString<T>::len(psz);
+
+	if (iCount==0 || iElementLen==0)
+		return SChar<T>::EmptyString();
+
+
+	CString<T> strBuf;
+	T* pszStart=strBuf.GetBuffer(iElementLen*iCount);
+
+	T* p=pszStart;
+
+	memcpy(p, psz, sizeof(T)*iElementLen);
+	p+=iElementLen;
+
+	int iDone=1;
+	while (iDone*2<=iCount)
 	{
-		int iPos;
-		m_vec.QuickSearch(val, m_ctx, m_pfnCompareEx, iPos);
-		if (iPos>=0)
-			RemoveAt(iPos);
-		return -1;
+		memcpy(p, pszStart, (p-pszStart)*sizeof(T));
+		p+=p-pszStart;
+		iDone*=2;
 	}
-#endif
 
-	int iPos;
-	m_vec.QuickSearch(val, m_pfnCompare, iPos);
-	if (iPos>=0)
-		RemoveAt(iPos);
-	return -1;
+	if (iDone<iCount)
+	{
+		memcpy(p, pszStart, (iCount-iDone)*iElementLen*sizeof(T));
+		p+=(iCount-iDone)*iElementLen;
+	}
+	
+	return strBuf;
 }
 
-// RemoveAt
-template <class T, class TSem, class TArg>
-void CSortedVector<T,TSem,TArg>::RemoveAt(int iPosition)
+
+inline bool IsEmptyString(const wchar_t* psz)
 {
-	m_vec.RemoveAt(iPosition);
+	return psz==NULL || psz[0]==L'\0';
 }
 
-// DetachAt
-template <class T, class TSem, class TArg>
-T CSortedVector<T,TSem,TArg>::DetachAt(int iPosition)
+inline bool IsEmptyString(const char* psz)
 {
-	return m_vec.DetachAt(iPosition);
+	return psz==NULL || psz[0]=='\0';
 }
 
-// RemoveAll
-template <class T, class TSem, class TArg>
-void CSortedVector<T,TSem,TArg>::RemoveAll()
+inline bool IsEqualString(const wchar_t* p1, const wchar_t* p2)
 {
-	m_vec.RemoveAll();
+	return p1==p2 || (p1!=NULL && p2!=NULL && Compare(p1, p2)==0);
 }
 
-// GetAt
-template <class T, class TSem, class TArg>
-const T& CSortedVector<T,TSem,TArg>::GetAt(int iPosition) const
+inline bool IsEqualString(const char* p1, const char* p2)
 {
-	return m_vec.GetAt(iPosition);
+	return p1==p2 || (p1!=NULL && p2!=NULL && Compare(p1, p2)==0);
 }
 
-// operator[]
-template <class T, class TSem, class TArg>
-const T& CSortedVector<T,TSem,TArg>::operator[](int iPosition) const
+inline bool IsEqualStringI(const wchar_t* p1, const wchar_t* p2)
 {
-	return m_vec.GetAt(iPosition);
+	return p1==p2 || (p1!=NULL && p2!=NULL && CompareI(p1, p2)==0);
 }
 
-// GetBuffer
-template <class T, class TSem, class TArg>
-const T* CSortedVector<T,TSem,TArg>::GetBuffer() const
+inline bool IsEqualStringI(const char* p1, const char* p2)
 {
-	return m_vec.GetBuffer();
+	return p1==p2 || (p1!=NULL && p2!=NULL && CompareI(p1, p2)==0);
 }
 
-// IsEmpty
-template <class T, class TSem, class TArg>
-bool CSortedVector<T,TSem,TArg>::IsEmpty() const
-{
-	return GetSize()==0;
-}
 
-// QuickSearch
-template <class T, class TSem, class TArg>
-bool CSortedVector<T,TSem,TArg>::QuickSearch(const TArg& key, int& iPosition) const
-{
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-	if (m_pfnCompareEx)
-		return m_vec.QuickSearch(key, m_ctx, m_pfnCompareEx, iPosition);
-#endif
 
-	return m_vec.QuickSearch(key, m_pfnCompare, iPosition);
-}
 
-// Find (uses linear search)
-template <class T, class TSem, class TArg>
-int CSortedVector<T,TSem,TArg>::Find(const TArg& val, int iStartAfter) const
-{
-	return m_vec.Find(val, iStartAfter);
-}
 
-// Find (uses quick search but matches prototype of CVector::Find
-template <class T, class TSem, class TArg>
-int CSortedVector<T,TSem,TArg>::Find(const TArg& key) const
-{
-	// Quick search doesn't work if duplicates are allowed.
-	if (m_bAllowDuplicates)
-	{
-		return Find(key, -1);
-	}
 
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-	if (m_pfnCompareEx)
-	{
-		int iPos;
-		if (m_vec.QuickSearch(key, m_ctx, m_pfnCompareEx, iPos))
-			return iPos;
-		else
-			return -1;
-	}
-#endif
+/////////////////////////////////////////////////////////////////////////////
+// CString Format functions
 
-	int iPos;
-	if (m_vec.QuickSearch(key, m_pfnCompare, iPos))
-		return iPos;
-	else
-		return -1;
-}
+#ifdef _MSC_VER
 
-// Resort the vertor. Specify NULL for pfnCompare to use TSem::Compare
-template <class T, class TSem, class TArg>
-void CSortedVector<T,TSem,TArg>::Resort(int (__cdecl *pfnCompare)(const T& a, const T& b), bool bAllowDuplicates)
+#if (_MSC_VER < 1300)
+
+template <>
+inline CString<wchar_t> Format(const wchar_t* format, va_list args)
 {
-	// If turning off allow duplicates, verify vector is empty
-	ASSERT(!m_bAllowDuplicates || bAllowDuplicates || IsEmpty());
+    int iLen = 1024;
 
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-	m_pfnCompareEx=NULL;
-#endif
-	m_bAllowDuplicates=bAllowDuplicates;
-	if (pfnCompare!=NULL)
-		m_pfnCompare=pfnCompare;
-	else
-#ifdef _MSC_VER
-		m_pfnCompare=TSem::Compare<T>;
-#else
-		m_pfnCompare=TSem::Compare;
-#endif
-	m_vec.QuickSort(m_pfnCompare);
+	CString<wchar_t> buf;
+    while (_vsnwprintf( buf.GetBuffer(iLen), iLen, format, args )<0)
+		iLen*=2;
+
+	return buf;
 }
 
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-// Resort the vertor with Ex comparer
-template <class T, class TSem, class TArg>
-void CSortedVector<T,TSem,TArg>::Resort(void* ctx, int (__cdecl *pfnCompare)(void* ctx, const T& a, const T& b), bool bAllowDuplicates)
-{
-	// If turning off allow duplicates, verify vector is empty
-	ASSERT(!m_bAllowDuplicates || bAllowDuplicates || IsEmpty());
 
-	m_pfnCompare=NULL;
-	m_pfnCompareEx=pfnCompare;
-	m_ctx=ctx;
-	m_bAllowDuplicates=bAllowDuplicates;
-	m_vec.QuickSort(m_pfnCompareEx, m_ctx);
-}
-#endif
 
+// VC6 Ansi Format
+template <>
+inline CString<char> Format(const char* format, va_list args)
+{
+    int iLen = 1024;
 
+	CString<char> buf;
+    while (_vsnprintf( buf.GetBuffer(iLen), iLen, format, args )<0)
+		iLen*=2;
 
-/////////////////////////////////////////////////////////////////////////////
-// CGrid
+	return buf;
+}
 
-// Constructor
-template <class T, class TSem, class TArg>
-CGrid<T,TSem,TArg>::CGrid(int iWidth, int iHeight) :
-	m_iHeight(iHeight)
-{
-	SetSize(iWidth, iHeight);
-};
+#elif (_MSC_VER < 1400)
 
-// SetSize
-template <class T, class TSem, class TArg>
-void CGrid<T,TSem,TArg>::SetSize(int iWidth, int iHeight, const TArg& val)
+// VS03 Unicode Format
+template <>
+inline CString<wchar_t> Format(const wchar_t* format, va_list args)
 {
-	// Adjust width of existing rows
-	for (int i=0; i<m_Columns.GetSize(); i++)
-	{
-		m_Columns[i]->SetSize(iHeight, val);
-	}
+    int iLen = _vscwprintf(format, args)+1;
 
-	// Create new rows
-	while (iWidth>m_Columns.GetSize())
-	{
-		m_Columns.Add(new CColumn(iWidth, val));
-	}
+	CString<wchar_t> buf;
+    _vsnwprintf( buf.GetBuffer(iLen), iLen, format, args);
 
-	// Delete extra rows
-	while (iWidth<m_Columns.GetSize())
-	{
-		m_Columns.Pop();
-	}
+	return buf;
 }
 
-template <class T, class TSem, class TArg>
-void CGrid<T,TSem,TArg>::InsertColumn(int iPosition, const TArg& val)
+// VS03 Ansi Format
+template <>
+inline CString<char> Format(const char* format, va_list args)
 {
-	m_Columns.InsertAt(iPosition, new CColumn(m_iHeight, val));
-}
+    int iLen = _vscprintf(format, args)+1;
 
-template <class T, class TSem, class TArg>
-void CGrid<T,TSem,TArg>::RemoveColumn(int iPosition)
-{
-	m_Columns.RemoveAt(iPosition);
-}
+	CString<char> buf;
+    _vsnprintf( buf.GetBuffer(iLen), iLen, format, args );
 
-template <class T, class TSem, class TArg>
-void CGrid<T,TSem,TArg>::InsertRow(int iPosition, const TArg& val)
-{
-	for (int i=0; i<m_Columns.GetSize(); i++)
-	{
-		m_Columns[i]->InsertAt(iPosition, val);
-	}
-	m_iHeight++;
+	return buf;
 }
 
-template <class T, class TSem, class TArg>
-void CGrid<T,TSem,TArg>::RemoveRow(int iPosition)
-{
-	for (int i=0; i<m_Columns.GetSize(); i++)
-	{
-		m_Columns[i]->RemoveAt(iPosition);
-	}
-	m_iHeight--;
-}
+#else
 
-template <class T, class TSem, class TArg>
-void CGrid<T,TSem,TArg>::RemoveAll()
+// VS05 Unicode Format
+template <>
+inline CString<wchar_t> Format(const wchar_t* format, va_list args)
 {
-	m_Columns.RemoveAll();
-	m_iHeight=0;
-}
+    int iLen = _vscwprintf(format, args)+1;
 
-template <class T, class TSem, class TArg>
-int CGrid<T,TSem,TArg>::GetWidth()
-{
-	return m_Columns.GetSize();
+	CString<wchar_t> buf;
+    _vswprintf_p( buf.GetBuffer(iLen), iLen, format, args);
+	return buf;
 }
 
-template <class T, class TSem, class TArg>
-int CGrid<T,TSem,TArg>::GetHeight()
-{
-	return m_iHeight;
-}
 
-template <class T, class TSem, class TArg>
-typename CGrid<T,TSem,TArg>::CColumn& CGrid<T,TSem,TArg>::operator[](int x)
+// VS05 Ansi Format
+template <>
+inline CString<char> Format(const char* format, va_list args)
 {
-	return *m_Columns[x];
+    int iLen = _vscprintf(format, args)+1;
+
+	CString<char> buf;
+    _vsprintf_p( buf.GetBuffer(iLen), iLen, format, args);
+
+	return buf;
 }
 
+#endif	// VS05
 
-/////////////////////////////////////////////////////////////////////////////
-// CLinkedList
+#else	// MSVC
 
-#ifndef _SIMPLELIB_NO_LINKEDLIST_MULTICHAIN
-#define template_linkedlist template <class T, class TSem, CChain<T> T::* pMember>
-#define CLinkedList_template CLinkedList<T,TSem,pMember>
-#define chainmember(x) ((x)->*pMember)
-#else
-#define template_linkedlist template <class T, class TSem>
-#define CLinkedList_template CLinkedList<T,TSem>
-#define chainmember(x) ((x)->m_Chain)
-#endif
+// Normalize MSVC format specifiers to standard C++
+//		%[n]s -> %[n]ls
+//		%[n]S -> %[n]hs
+//		%c -> %lc
+//		%C -> %hc
+//      %I64 -> %ll
 
-template_linkedlist
-CLinkedList_template::CLinkedList()
+inline CUniString MsvcToGccFormatSpec(const wchar_t* p)
 {
-	m_pFirst=NULL;
-	m_pCurrent=NULL;
-	m_iSize=0;
-	m_iIterPos=-1;
-	m_pIterElem=NULL;
-}
+	CUniString str;
+	while (p[0])
+	{
+		if (p[0]!='%')
+		{
+			str+=*p++;
+			continue;
+		}
 
-template_linkedlist
-CLinkedList_template::~CLinkedList()
-{
-	RemoveAll();
-}
+		// Copy the %
+		str+=*p++;
 
-template_linkedlist
-void CLinkedList_template::Prepend(T* p)
-{
-#ifdef _DEBUG
-	ASSERT(chainmember(p).m_pPrev==NULL);
-	ASSERT(chainmember(p).m_pNext==NULL);
-	ASSERT(!Contains(p));
-#endif
-
-	// Semantics...
-	TSem::OnAdd(p, this);
+		// % Literal
+		if (p[0]=='%')
+		{
+			str+=*p++;
+			continue;
+		}
 
-	if (m_pFirst)
+		// Ignore flags, precision and width
+		while ((p[0]>='0' && p[0]<='9') || p[0]=='+' || p[0]=='-' || p[0]==' ' || p[0]=='#' || p[0]=='.' || p[0]=='*')
 		{
-		// Save the last element pointer
-		chainmember(p).m_pPrev=chainmember(m_pFirst).m_pPrev;
+			str+=*p++;
+		}
 
-		// Link the old first to the new first...
-		chainmember(m_pFirst).m_pPrev=p;
+		// String
+		if (p[0]=='s')
+		{
+			str+=L"ls";
+			p++;
 		}
-	else
+		else if (p[0]=='S')
 		{
-		// Set the last element as the new element
-		chainmember(p).m_pPrev=p;
+			str+=L"hs";
+			p++;
 		}
+		else if (p[0]=='c')
+		{
+			str+=L"lc";
+			p++;
+		}
+		else if (p[0]=='C')
+		{
+			str+=L"hc";
+			p++;
+		}
+		else if (p[0]=='I' && p[1]=='6' && p[2]=='4')
+		{
+			str+=L"ll";
+			p+=3;
+		}
+		else
+		{
+			str+=*p++;
+		}
+	}
+	return str;
+}
 
+// GNU/SUN Unicode Format
+template <>
+inline CString<wchar_t> Format(const wchar_t* format, va_list args)
+{
+	CUniString strNormalized=Simple::MsvcToGccFormatSpec(format);
 
-	// Insert at front
-	chainmember(p).m_pNext=m_pFirst;
-	m_pFirst=p;
-
-	// Update iterate position
-	if (m_pIterElem)
+	// vswprintf can't measure, so retry with a bigger buffer.  Each attempt
+	// consumes the va_list so it must work on a fresh copy.
+	int iLen=256;
+	while (true)
 	{
-		m_pIterElem=GetPrevious(m_pIterElem);
+		CString<wchar_t> buf;
+		va_list args2;
+		va_copy(args2, args);
+		int iResult=vswprintf(buf.GetBuffer(iLen), iLen+1, strNormalized.sz(), args2);
+		va_end(args2);
+		if (iResult>=0)
+			return buf;
+		if (iLen>=0x1000000)
+			return CString<wchar_t>();
+		iLen*=2;
 	}
-
-	m_iSize++;
 }
 
 
-template_linkedlist
-void CLinkedList_template::Add(_CLinkedList& OtherList)
+// GNU/SUN Ansi Format
+template <>
+inline CString<char> Format(const char* format, va_list args)
 {
+	// Sun compiler core dumps if passing null as first param to vsnprintf, so pass short
+	// buffer to calculate length
+	char tmp[2];
+	va_list args2;
+	va_copy(args2, args);
+    int iLen = vsnprintf(tmp, _countof(tmp), format, args2);
+	va_end(args2);
+	if (iLen<0)
+		return CString<char>();
 
-	if (!OtherList.m_pFirst)
-		return;
-
-	if (m_pFirst)
-		{
-		T* pOtherFirst=OtherList.GetFirst();
-		T* pOtherLast=OtherList.GetLast();
-		T* pThisFirst=GetFirst();
-		T* pThisLast=GetLast();
-
-		chainmember(pThisFirst).m_pPrev=pOtherLast;
-		chainmember(pOtherFirst).m_pPrev=pThisLast;
-		chainmember(pThisLast).m_pNext=pOtherFirst;
-		}
-	else
-		{
-		m_pFirst=OtherList.m_pFirst;
-		}
-
-	// Update size...
-	m_iSize+=OtherList.m_iSize;
+	// Now do the actual formatting...
+	CString<char> buf;
+	char* pszBuf=buf.GetBuffer(iLen);
+	if (pszBuf)
+		vsnprintf(pszBuf, iLen+1, format, args);
 
-	// Reset other list
-	OtherList.m_pFirst=NULL;
-	OtherList.m_iSize=0;
-	OtherList.m_pCurrent=NULL;
-	OtherList.m_pIterElem=NULL;
+	return buf;
 }
 
-// Insert an element at end of start of a list
-template_linkedlist
-void CLinkedList_template::Add(T* p)
+#endif	// !MSVC
+
+template <>
+inline CString<wchar_t> Format(const wchar_t* format, ...)
 {
-#ifdef _DEBUG
-	ASSERT(chainmember(p).m_pPrev==NULL);
-	ASSERT(chainmember(p).m_pNext==NULL);
-	ASSERT(!Contains(p));
-#endif
+    va_list  args;
+    va_start(args, format);
 
-	// Semantics...
-	TSem::OnAdd(p, this);
+	CString<wchar_t> strRetv=Format(format, args);
 
-	if (m_pFirst)
-		{
-		chainmember(chainmember(m_pFirst).m_pPrev).m_pNext=p;
-		chainmember(p).m_pPrev=chainmember(m_pFirst).m_pPrev;
-		chainmember(p).m_pNext=NULL;
-		chainmember(m_pFirst).m_pPrev=p;
-		}
-	else
-		{
-		m_pFirst=p;
-		chainmember(p).m_pNext=NULL;
-		chainmember(p).m_pPrev=p;
-		}
+	va_end(args);
 
-	m_iSize++;
+	return strRetv;
 }
 
-
-
-template_linkedlist
-void CLinkedList_template::Insert(T* p, T* pBefore)
+template <>
+inline CString<char> Format(const char* format, ...)
 {
-#ifdef _DEBUG
-	ASSERT(chainmember(p).m_pPrev==NULL);
-	ASSERT(chainmember(p).m_pNext==NULL);
-#endif
+    va_list  args;
+    va_start(args, format);
 
-	// Insert at end?
-	if (!pBefore)
-		{
-		Add(p);
-		return;
-		}
+	CString<char> strRetv=Format(format, args);
 
-	ASSERT(Contains(pBefore));
+	va_end(args);
 
-	// Insert at start
-	if (pBefore==m_pFirst)
-		{
-		Prepend(p);
-		return;
-		}
+	return strRetv;
+}
 
-	TSem::OnAdd(p, this);
 
-	// Work out if insert position is before the current iterate position
-	bool bBeforeIteratePos=IsBeforeIteratePos(pBefore);
+/////////////////////////////////////////////////////////////////////////////
+// Implementation of CFormat
 
-	// Insert in middle
-	chainmember(p).m_pNext=pBefore;
-	chainmember(p).m_pPrev=chainmember(pBefore).m_pPrev;
-	chainmember(chainmember(p).m_pNext).m_pPrev=p;
-	chainmember(chainmember(p).m_pPrev).m_pNext=p;
+// Pairs of decimal digits "00".."99" for converting two digits per divide
+template <int iDummy=0>
+struct CFormatDigitsHolder
+{
+	static const char m_szDigits[201];
+};
+template <int iDummy> const char CFormatDigitsHolder<iDummy>::m_szDigits[201]=
+	"00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839" "40414243444546474849"
+	"50515253545556575859" "60616263646566676869" "70717273747576777879" "80818283848586878889" "90919293949596979899";
 
-	// Update size
-	m_iSize++;
+// Write decimal digits backwards ending at pEnd, returns pointer to first digit
+template <class T, class TUnsigned>
+T* slxFormatDigits(T* pEnd, TUnsigned nValue)
+{
+	const char* pszDigits=CFormatDigitsHolder<>::m_szDigits;
+	T* p=pEnd;
+	while (nValue>=100)
+	{
+		unsigned int i=(unsigned int)(nValue % 100)*2;
+		nValue/=100;
+		*--p=(T)pszDigits[i+1];
+		*--p=(T)pszDigits[i];
+	}
+	if (nValue>=10)
+	{
+		unsigned int i=(unsigned int)nValue*2;
+		*--p=(T)pszDigits[i+1];
+		*--p=(T)pszDigits[i];
+	}
+	else
+	{
+		*--p=(T)('0'+(unsigned int)nValue);
+	}
+	return p;
+}
 
-	// Update iterate position
-	if (bBeforeIteratePos)
+// Constructor
+template <class T, class TAlloc>
+CFormat<T,TAlloc>::CFormat(int iInitialSize) :
+	m_pBuf(NULL),
+	m_iLength(0),
+	m_iCapacity(0)
+{
+	Reserve(iInitialSize>0 ? iInitialSize : 0);
+	m_pBuf[0]='\0';
+}
+
+// Reserve - make room for iExtra more characters (plus terminator), returns write position
+template <class T, class TAlloc>
+T* CFormat<T,TAlloc>::Reserve(int iExtra)
+{
+	if (m_iLength+iExtra+1>m_iCapacity)
 	{
-		m_pIterElem=GetPrevious(m_pIterElem);
+		m_pBuf=m_str.GrowBuffer(m_iLength+iExtra+1);
+		m_iCapacity=m_str.GetHeader()->m_iMemSize;
 	}
+	return m_pBuf+m_iLength;
 }
 
+// Append string
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::Append(const T* psz, int iLen)
+{
+	if (!psz)
+		return *this;
+	if (iLen<0)
+		iLen=SChar<T>::Length(psz);
 
-// Work out if an element is before the current iterate position
-template_linkedlist
-bool CLinkedList_template::IsBeforeIteratePos(T* pElem) const
+	T* p=Reserve(iLen);
+	memcpy(p, psz, iLen*sizeof(T));
+	m_iLength+=iLen;
+	m_pBuf[m_iLength]='\0';
+	return *this;
+}
+
+// Append repeated character
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::Append(T ch, int iCount)
 {
-	if (!m_pIterElem)
-		return false;
+	T* p=Reserve(iCount);
+	for (int i=0; i<iCount; i++)
+		p[i]=ch;
+	m_iLength+=iCount;
+	m_pBuf[m_iLength]='\0';
+	return *this;
+}
 
-	ASSERT(m_iSize!=0);
-	ASSERT(Contains(pElem));
+// AppendInteger
+template <class T, class TAlloc>
+template <class TUnsigned>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::AppendInteger(TUnsigned nValue, bool bNegative, int iWidth, T chFill)
+{
+	T sz[24];
+	T* pEnd=sz+_countof(sz);
+	T* p=slxFormatDigits(pEnd, nValue);
 
-	if (m_pIterElem==pElem)
-		return true;
+	int iDigits=(int)(pEnd-p);
+	int iSign=bNegative ? 1 : 0;
+	int iPad=iWidth-iDigits-iSign;
+	if (iPad<0)
+		iPad=0;
 
-	// Need to scan either before current iterate position or after, choose the smaller one
-	if (m_iIterPos<m_iSize/2)
+	T* pDest=Reserve(iPad+iSign+iDigits);
+
+	// Zero fill goes after the sign, anything else before it
+	if (chFill=='0')
 	{
-		// Scan first half
-		for (T* p=m_pIterElem; p!=NULL; p=GetPrevious(p))
-		{
-			if (p==pElem)
-				return true;
-		}
-		return false;
+		if (bNegative)
+			*pDest++='-';
+		for (int i=0; i<iPad; i++)
+			*pDest++=chFill;
 	}
 	else
 	{
-		// Scan second half
-		for (T* p=m_pIterElem; p!=NULL; p=chainmember(p).m_pNext)
-		{
-			if (p==pElem)
-				return false;
-		}
-		return true;
+		for (int i=0; i<iPad; i++)
+			*pDest++=chFill;
+		if (bNegative)
+			*pDest++='-';
 	}
-}
 
-template_linkedlist
-T* CLinkedList_template::Detach(T* p)
-{
-	RemoveOrDetach(p, true);
-	return p;
+	memcpy(pDest, p, iDigits*sizeof(T));
+	m_iLength+=iPad+iSign+iDigits;
+	m_pBuf[m_iLength]='\0';
+	return *this;
 }
 
-template_linkedlist
-void CLinkedList_template::Remove(T* p)
+// AppendHex
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::AppendHex(unsigned long long nValue, int iMinDigits, bool bUpper)
 {
-	RemoveOrDetach(p, false);
-}
+	const char* pszHex=bUpper ? "0123456789ABCDEF" : "0123456789abcdef";
 
-template_linkedlist
-void CLinkedList_template::RemoveOrDetach(T* p, bool bDetach)
-{
-	ASSERT(p!=NULL);
-	ASSERT(Contains(p));
-
-	// Update iterate position
-	if (IsBeforeIteratePos(p))
-	{
-		if (m_iIterPos==m_iSize-2)
-		{
-			// New iterate position will be last, clear iterate position
-			m_pIterElem=NULL;
-		}
-		else
-		{
-			// Move iterate position forward...
-			m_pIterElem=GetNext(m_pIterElem);
-		}
-	}
+	// Count digits
+	int iDigits=1;
+	for (unsigned long long n=nValue>>4; n; n>>=4)
+		iDigits++;
+	if (iDigits<iMinDigits)
+		iDigits=iMinDigits;
 
-	// Deleting current item?
-	if (p==m_pCurrent)
+	T* p=Reserve(iDigits);
+	for (int i=iDigits-1; i>=0; i--)
 	{
-		if (m_bLastIterForward)
-			m_pCurrent=m_pCurrent==m_pFirst ? NULL : chainmember(m_pCurrent).m_pPrev;
-		else
-			m_pCurrent=chainmember(m_pCurrent).m_pNext;
+		p[i]=(T)pszHex[nValue & 0xF];
+		nValue>>=4;
 	}
+	m_iLength+=iDigits;
+	m_pBuf[m_iLength]='\0';
+	return *this;
+}
 
-	if (m_pFirst==p)
-		{
-		// Removing first element
-
-		// Only remaining item?
-		if (chainmember(m_pFirst).m_pPrev==m_pFirst)
-			{
-			// Empty list
-			m_pFirst=NULL;
-			}
-		else
-			{
-			ASSERT(chainmember(m_pFirst).m_pNext);
-
-			// Maintain the last item pointer...
-			chainmember(chainmember(m_pFirst).m_pNext).m_pPrev=chainmember(m_pFirst).m_pPrev;
-			m_pFirst=chainmember(m_pFirst).m_pNext;
-			}
-		}
-	else if (chainmember(m_pFirst).m_pPrev==p)
-		{
-		// Clear previous item's next pointer
-		chainmember(chainmember(p).m_pPrev).m_pNext=NULL;
-
-		// Store the new last element
-		chainmember(m_pFirst).m_pPrev=chainmember(p).m_pPrev;
-		}
-	else
-		{
-		// Removing internal element
-		ASSERT(chainmember(p).m_pPrev!=NULL);
-		ASSERT(chainmember(p).m_pNext!=NULL);
-		chainmember(chainmember(p).m_pPrev).m_pNext=chainmember(p).m_pNext;
-		chainmember(chainmember(p).m_pNext).m_pPrev=chainmember(p).m_pPrev;
-		}
-
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(const T* psz)
+{
+	return Append(psz);
+}
 
-#ifdef _DEBUG
-	chainmember(p).m_pNext=NULL;
-	chainmember(p).m_pPrev=NULL;
-#endif
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(const TAlt* psz)
+{
+	CString<T> str;
+	str.Assign(psz);
+	return Append(str.sz(), str.GetLength());
+}
 
-	if (bDetach)
-		TSem::OnDetach(p, this);
-	else
-		TSem::OnRemove(p, this);
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(T ch)
+{
+	return Append(ch, 1);
+}
 
-	m_iSize--;
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(int iValue)
+{
+	return AppendInteger(iValue<0 ? 0U-(unsigned int)iValue : (unsigned int)iValue, iValue<0);
 }
 
-template_linkedlist
-void CLinkedList_template::RemoveAll()
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(unsigned int nValue)
 {
-	while (m_pFirst)
-	{
-		Remove(m_pFirst);
-	}
-	m_pIterElem=NULL;
+	return AppendInteger(nValue, false);
 }
 
-template_linkedlist
-bool CLinkedList_template::Contains(T* p) const
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(long iValue)
 {
-	T* pIter=m_pFirst;
-	while (pIter)
-		{
-		if (pIter==p)
-			return true;
-		pIter=chainmember(pIter).m_pNext;
-		}
-	return false;
+	return AppendInteger(iValue<0 ? 0UL-(unsigned long)iValue : (unsigned long)iValue, iValue<0);
 }
 
-template_linkedlist
-bool CLinkedList_template::IsEmpty() const
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(unsigned long nValue)
 {
-	return m_iSize==0;
+	return AppendInteger(nValue, false);
 }
 
-template_linkedlist
-int CLinkedList_template::GetSize() const
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(long long iValue)
 {
-	return m_iSize;
+	return AppendInteger(iValue<0 ? 0ULL-(unsigned long long)iValue : (unsigned long long)iValue, iValue<0);
 }
 
-template_linkedlist
-T* CLinkedList_template::GetFirst() const
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(unsigned long long nValue)
 {
-	return m_pFirst;
+	return AppendInteger(nValue, false);
 }
 
-template_linkedlist
-T* CLinkedList_template::GetLast() const
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(double dblValue)
 {
-	return m_pFirst ? chainmember(m_pFirst).m_pPrev : NULL;
+	return *this << FormatFloat(dblValue, 6);
 }
 
-template_linkedlist
-T* CLinkedList_template::GetNext(T* p) const
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(const CFormatHex& hex)
 {
-	ASSERT(Contains(p));
-	return chainmember(p).m_pNext;
+	return AppendHex(hex.m_nValue, hex.m_iMinDigits, hex.m_bUpper);
 }
 
-template_linkedlist
-T* CLinkedList_template::GetPrevious(T* p) const
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(const CFormatPad& pad)
 {
-	ASSERT(Contains(p));
-	if (p==m_pFirst)
-		return NULL;
-	else
-		return chainmember(p).m_pPrev;
+	unsigned long long nValue=pad.m_iValue<0 ? 0ULL-(unsigned long long)pad.m_iValue : (unsigned long long)pad.m_iValue;
+	return AppendInteger(nValue, pad.m_iValue<0, pad.m_iWidth, (T)pad.m_chFill);
 }
 
+// Floating point isn't a fast path - hand it to the C runtime
+template <class T, class TAlloc>
+CFormat<T,TAlloc>& CFormat<T,TAlloc>::operator<<(const CFormatFloat& flt)
+{
+	char sz[64];
+#if defined(_MSC_VER) && (_MSC_VER>=1400)
+	int iLen=_snprintf_s(sz, _countof(sz), _TRUNCATE, "%.*f", flt.m_iPrecision, flt.m_dblValue);
+#elif defined(_MSC_VER)
+	int iLen=_snprintf(sz, _countof(sz), "%.*f", flt.m_iPrecision, flt.m_dblValue);
+#else
+	int iLen=snprintf(sz, _countof(sz), "%.*f", flt.m_iPrecision, flt.m_dblValue);
+#endif
+	if (iLen<0 || iLen>=(int)_countof(sz))
+		iLen=(int)strlen(sz);
+
+	// Output is plain ASCII so widen directly
+	T* p=Reserve(iLen);
+	for (int i=0; i<iLen; i++)
+		p[i]=(T)sz[i];
+	m_iLength+=iLen;
+	m_pBuf[m_iLength]='\0';
+	return *this;
+}
 
-template_linkedlist
-bool CLinkedList_template::IsEOF() const
+template <class T, class TAlloc>
+CFormat<T,TAlloc>::operator CString<T,TAlloc>() const
 {
-	return m_pFirst==NULL || (m_pCurrent==NULL && m_bLastIterForward);
+	return ToString();
 }
 
+// sz
+template <class T, class TAlloc>
+const T* CFormat<T,TAlloc>::sz() const
+{
+	return m_pBuf;
+}
 
-template_linkedlist
-bool CLinkedList_template::IsBOF() const
+// GetLength
+template <class T, class TAlloc>
+int CFormat<T,TAlloc>::GetLength() const
 {
-	return m_pFirst==NULL || (m_pCurrent==NULL && !m_bLastIterForward);
+	return m_iLength;
 }
 
+// ToString - returns the built string without copying it.  The buffer is then
+// shared so the next append goes through CString's copy on write
+template <class T, class TAlloc>
+CString<T,TAlloc> CFormat<T,TAlloc>::ToString() const
+{
+	m_str.GetHeader()->m_iLength=m_iLength;
+	m_iCapacity=0;
+	return m_str;
+}
 
-template_linkedlist
-void CLinkedList_template::MoveFirst()
+// Empty
+template <class T, class TAlloc>
+void CFormat<T,TAlloc>::Empty()
 {
-	m_pCurrent=m_pFirst;
-	m_bLastIterForward=true;
+	m_iLength=0;
+	Reserve(0);
+	m_pBuf[0]='\0';
 }
 
 
-template_linkedlist
-void CLinkedList_template::MoveLast()
+
+/////////////////////////////////////////////////////////////////////////////
+// Implementation of CVector
+
+#define VECDATAPTR(x) (void*)(((char*)m_pData) + sizeof(m_pData[0])*(x))
+
+// Constructor
+template <class T, class TSem, class TArg, class TAlloc>
+CVector<T,TSem,TArg,TAlloc>::CVector()
 {
-	m_pCurrent=GetLast();
-	m_bLastIterForward=false;
+	m_pData=NULL;
+	m_iSize=0;
+	m_iMemSize=0;
+#ifdef SIMPLELIB_ALLOC_STATS
+	m_iStatsCategory=CAllocStats::catVector;
+#endif
 }
 
-
-template_linkedlist
-void CLinkedList_template::MoveNext()
+// Destructor
+template <class T, class TSem, class TArg, class TAlloc>
+CVector<T,TSem,TArg,TAlloc>::~CVector()
 {
-	if (m_pCurrent)
-		m_pCurrent=chainmember(m_pCurrent).m_pNext;
-	else
-		if (m_bLastIterForward)
-			m_pCurrent=m_pFirst;
-	m_bLastIterForward=true;
+	RemoveAll();
+	if (m_pData)
+	{
+		SIMPLELIB_STAT_FREE(m_iStatsCategory, m_iMemSize*sizeof(T));
+		TAlloc::Free(m_pData);
+	}
 }
 
-template_linkedlist
-void CLinkedList_template::MovePrevious()
+// Reallocate memory
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::GrowTo(int iRequiredSize)
 {
-	if (m_pCurrent)
+	// Quit if already big enough
+	if (iRequiredSize<=m_iMemSize)
+		return;
+
+	// Work out how big to make it
+	int iNewSize=iRequiredSize*2;
+	if (iNewSize<16)
+		iNewSize=16;
+
+	if (m_pData)
 	{
-		if (m_pCurrent==m_pFirst)
-			m_pCurrent=NULL;
-		else
-			m_pCurrent=chainmember(m_pCurrent).m_pPrev;
+		// Reallocate memory
+		ASSERT(m_iMemSize!=0);
+		m_pData=(T*)TAlloc::Realloc(m_pData, iNewSize*sizeof(T));
+		SIMPLELIB_STAT_REALLOC(m_iStatsCategory, m_iMemSize*sizeof(T), iNewSize*sizeof(T));
 	}
 	else
-		if (!m_bLastIterForward)
-			m_pCurrent=GetLast();
-	m_bLastIterForward=false;
+	{
+		// Allocate memory
+		ASSERT(m_iMemSize==0);
+		m_pData=(T*)TAlloc::Alloc(iNewSize*sizeof(T));
+		SIMPLELIB_STAT_ALLOC(m_iStatsCategory, iNewSize*sizeof(T));
+	}
+
+	// Store new sizes
+	m_iMemSize=iNewSize;
 }
 
-template_linkedlist
-T* CLinkedList_template::Current() const
+// Set size...
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::SetSize(int iRequiredSize, const TArg& val)
 {
-	ASSERT(m_pCurrent!=NULL);
-	return m_pCurrent;
+	GrowTo(iRequiredSize);
+	while (GetSize()<iRequiredSize)
+		Add(val);
+	while (GetSize()>iRequiredSize)
+		Pop();
 }
 
-
-template_linkedlist
-T* CLinkedList_template::GetAt(int iPos) const
+// Release extra memory
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::FreeExtra()
 {
-	ASSERT(iPos>=0 && iPos<GetSize());
+	// Quit if no extra memory allocated
+	if (m_iMemSize==m_iSize)
+		return;
 
-	// First
-	if (iPos==0)
+	// Free or realloc memory...
+	if (m_iSize==0)
 	{
-		m_pIterElem=NULL;
-		m_iIterPos=-1;
-		return GetFirst();
+		SIMPLELIB_STAT_FREE(m_iStatsCategory, m_iMemSize*sizeof(T));
+		TAlloc::Free(m_pData);
+		m_pData=NULL;
 	}
-
-	// Second?
-	if (iPos==1)
+	else
 	{
-		m_iIterPos=1;
-		return m_pIterElem=GetNext(GetFirst());
+		m_pData=(T*)TAlloc::Realloc(m_pData, m_iSize*sizeof(T));
+		SIMPLELIB_STAT_REALLOC(m_iStatsCategory, m_iMemSize*sizeof(T), m_iSize*sizeof(T));
 	}
 
-	// Last?
-	if (iPos==m_iSize-1)
-	{
-		m_pIterElem=NULL;
-		m_iIterPos=-1;
-		return GetLast();
-	}
+	// Store new memory size
+	m_iMemSize=m_iSize;
+}
 
-	// Second last?
-	if (iPos==m_iSize-2)
-	{
-		m_iIterPos=iPos;
-		return m_pIterElem=GetPrevious(GetLast());
-	}
+// InsertAt
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::InsertAt(int iPosition, const T& val)
+{
+	InsertAtInternal(iPosition, &val, 1);
+}
 
-	// Check for next/prev/current from current iterate position
-	if (m_pIterElem)
-	{
-		if (iPos==m_iIterPos)
-		{
-			return m_pIterElem;
-		}
-		if (iPos==m_iIterPos+1)
-		{
-			m_iIterPos=iPos;
-			return m_pIterElem=GetNext(m_pIterElem);
-		}
-		if (iPos==m_iIterPos-1)
-		{
-			m_iIterPos=iPos;
-			return m_pIterElem=GetPrevious(m_pIterElem);
-		}
-	}
-
-	int iDistanceFromIterPos=abs(m_iIterPos-iPos);
-	int iDistanceFromStart=iPos;
-	int iDistanceFromEnd=(m_iSize-1)-iPos;
-
-	if (m_pIterElem && iDistanceFromIterPos<iDistanceFromEnd && iDistanceFromIterPos<iDistanceFromEnd)
-	{
-		while (m_iIterPos<iPos)
-		{
-			m_pIterElem=chainmember(m_pIterElem).m_pNext;
-			m_iIterPos++;
-		}
-		while (m_iIterPos>iPos)
-		{
-			m_pIterElem=chainmember(m_pIterElem).m_pPrev;
-			m_iIterPos--;
-		}
-	}
-	else
-	{
-		if (iDistanceFromStart<iDistanceFromEnd)
-		{
-			m_pIterElem=m_pFirst;
-			for (int i=0; i<iPos; i++)
-				m_pIterElem=chainmember(m_pIterElem).m_pNext;
-		}
-		else
-		{
-			m_pIterElem=GetLast();
-			for (int i=0; i<iDistanceFromEnd; i++)
-			{
-				m_pIterElem=chainmember(m_pIterElem).m_pPrev;
-			}
-		}
-	}
-
-	// Done
-	m_iIterPos=iPos;
-	return m_pIterElem;
-}
-
-template_linkedlist
-T* CLinkedList_template::operator[](int iPos) const
+template <class T, class TSem, class TArg, class TAlloc> template <class TSem2, class TArg2, class TAlloc2>
+void CVector<T,TSem,TArg,TAlloc>::Add(CVector<T, TSem2, TArg2, TAlloc2>& vec)
 {
-	return GetAt(iPos);
+	InsertAtInternal(GetSize(), vec.GetBuffer(), vec.GetSize());
 }
 
-// Stack operators
-template_linkedlist
-void CLinkedList_template::Push(T* val)
+template <class T, class TSem, class TArg, class TAlloc> template <class TSem2, class TArg2, class TAlloc2>
+void CVector<T,TSem,TArg,TAlloc>::InsertAt(int iPosition, CVector<T, TSem2, TArg2, TAlloc2>& vec)
 {
-	Add(val);
+	InsertAtInternal(iPosition, vec.GetBuffer(), vec.GetSize());
 }
 
-template_linkedlist
-bool CLinkedList_template::Pop(T*& val)
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::Swap(CVector<T, TSem, TArg, TAlloc>& other)
 {
-	if (IsEmpty())
-	{
-		val=NULL;
-		return false;
-	}
-	else
+	int tempSize = m_iSize;
+	m_iSize = other.m_iSize;
+	other.m_iSize = tempSize;
+
+	int tempMemSize = m_iMemSize;
+	m_iMemSize = other.m_iMemSize;
+	other.m_iMemSize = tempMemSize;
+
+	T* tempData = m_pData;
+	m_pData = other.m_pData;
+	other.m_pData = tempData;
+
+#ifdef SIMPLELIB_ALLOC_STATS
+	// Buffers are still charged to their previous owner's category, so
+	// record that and then move the bytes back to each vector's own category
+	if (m_iStatsCategory!=other.m_iStatsCategory)
 	{
-		val=Detach(GetLast());
-		return true;
+		int iCategory=m_iStatsCategory;
+		int iOtherCategory=other.m_iStatsCategory;
+		m_iStatsCategory=iOtherCategory;
+		other.m_iStatsCategory=iCategory;
+		SetStatsCategory(iCategory);
+		other.SetStatsCategory(iOtherCategory);
 	}
-
+#endif
 }
 
-template_linkedlist
-T* CLinkedList_template::Pop()
+#ifdef SIMPLELIB_ALLOC_STATS
+// SetStatsCategory - any buffer already allocated is moved to the new category
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::SetStatsCategory(int iCategory)
 {
-	T* p;
-	Pop(p);
-	return p;
-}
+	if (iCategory==m_iStatsCategory)
+		return;
 
-template_linkedlist
-bool CLinkedList_template::Top(T*& val) const
-{
-	if (IsEmpty())
-	{
-		val=NULL;
-		return false;
-	}
-	else
+	if (m_pData)
 	{
-		val=GetLast();
-		return true;
+		SIMPLELIB_STAT_FREE(m_iStatsCategory, m_iMemSize*sizeof(T));
+		SIMPLELIB_STAT_ALLOC(iCategory, m_iMemSize*sizeof(T));
 	}
+	m_iStatsCategory=iCategory;
 }
+#endif
 
-template_linkedlist
-T* CLinkedList_template::Top() const
+
+// ReplaceAt
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::ReplaceAt(int iPosition, const T& val)
 {
-	return GetLast();
+	ASSERT(iPosition>=0 && iPosition<GetSize());
+
+	TSem::OnRemove(m_pData[iPosition], this);
+
+	Destructor(m_pData+iPosition);
+
+	Constructor(m_pData+iPosition, TSem::OnAdd(val, this));
 }
 
-template_linkedlist
-void CLinkedList_template::Enqueue(T* val)
+// Swap
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::Swap(int iPosA, int iPosB)
 {
-	Add(val);
+	ASSERT(iPosA>=0 && iPosA<GetSize());
+	ASSERT(iPosB>=0 && iPosB<GetSize());
+
+	// Redundant?
+	if (iPosA==iPosB)
+		return;
+
+	// Swap it
+	T temp=m_pData[iPosA];
+	Destructor(m_pData+iPosA);
+	Constructor(m_pData+iPosA, m_pData[iPosB]);
+	Destructor(m_pData+iPosB);
+	Constructor(m_pData+iPosB, temp);
 }
 
-template_linkedlist
-bool CLinkedList_template::Dequeue(T*& val)
+// Move
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::Move(int iFrom, int iTo)
 {
-	if (IsEmpty())
+	ASSERT(iFrom>=0 && iFrom<GetSize());
+	ASSERT(iTo>=0 && iTo<GetSize());
+
+	// Redundant?
+	if (iFrom==iTo)
+		return;
+
+	T temp=m_pData[iFrom];
+	Destructor(m_pData+iFrom);
+	if (iTo<iFrom)
 	{
-		val=NULL;
-		return false;
+		memmove(VECDATAPTR(iTo+1), VECDATAPTR(iTo), (iFrom-iTo)*sizeof(T));
 	}
 	else
 	{
-		val=Detach(GetFirst());
-		return true;
+		memmove(VECDATAPTR(iFrom), VECDATAPTR(iFrom+1), (iTo-iFrom)*sizeof(T));
 	}
+	Constructor(m_pData+iTo, temp);
 }
 
-template_linkedlist
-T* CLinkedList_template::Dequeue()
+// Insert at a position
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::InsertAtInternal(int iPosition, const T* pVal, int iCount)
 {
-	T* p;
-	Dequeue(p);
-	return p;
-}
+	if (iCount<1)
+		return;
 
-template_linkedlist
-T* CLinkedList_template::Peek() const
-{
-	return GetFirst();
-}
+	ASSERT(iPosition>=0);
+	ASSERT(iPosition<=GetSize());
 
-template_linkedlist
-bool CLinkedList_template::Peek(T*& val) const
-{
-	val=GetFirst();
-	return !IsEmpty();
-}
+	// Make sure have room
+	GrowTo(m_iSize+iCount);
 
-/////////////////////////////////////////////////////////////////////////////
-// CPlex implementation
+	// Shuffle memory
+	if (iPosition<m_iSize)
+		memmove(VECDATAPTR(iPosition+iCount), VECDATAPTR(iPosition), (m_iSize-iPosition)*sizeof(T));
 
-// Constructor
-template <class T>
-CPlex<T>::CPlex(int iBlockSize)
-{
-	if (iBlockSize==-1)
+	// Store pointer
+	for (int i=0; i<iCount; i++)
 	{
-		iBlockSize=(256-sizeof(BLOCK))/sizeof(T);
+		Constructor(m_pData+iPosition+i, TSem::OnAdd(*(pVal+i), this));
 	}
 
-	if (iBlockSize<4)
-		iBlockSize=4;
+	// Update size
+	m_iSize+=iCount;
+}
 
-	m_iBlockSize=iBlockSize;
+// Add
+template <class T, class TSem, class TArg, class TAlloc>
+inline int CVector<T,TSem,TArg,TAlloc>::Add(const T& val)
+{
+	// Grow if necessary
+	if (m_iSize+1>m_iMemSize)
+		GrowTo(m_iSize+1);
 
-	m_pHead=NULL;
-	m_pFreeList=NULL;
-	m_iCount=0;
+	Constructor(m_pData+m_iSize, TSem::OnAdd(val, this));
+	m_iSize++;
+	return m_iSize-1;
 }
 
-// Destructor
-template <class T>
-CPlex<T>::~CPlex()
+// Remove a particular item
+template <class T, class TSem, class TArg, class TAlloc>
+int CVector<T,TSem,TArg,TAlloc>::Remove(const TArg& val)
 {
-	FreeAll();
+	int iPos=Find(val);
+	if (iPos>=0)
+		RemoveAt(iPos);
+	return iPos;
 }
 
-// Allocate a new item
-template <class T>
-T* CPlex<T>::Alloc()
+// RemoveAt
+template <class T, class TSem, class TArg, class TAlloc>
+inline void CVector<T,TSem,TArg,TAlloc>::RemoveAt(int iPosition)
 {
-	// If no free list, create a new block
-	if (!m_pFreeList)
-		{
-		// Allocate a new block
-		BLOCK* pNewBlock=(BLOCK*)malloc(sizeof(BLOCK) + m_iBlockSize * sizeof(T));
-
-		// Add to list of blocks
-		pNewBlock->m_pNext=m_pHead;
-		m_pHead=pNewBlock;
+	ASSERT(iPosition>=0);
+	ASSERT(iPosition<GetSize());
 
-		// Setup free list chain
-		m_pFreeList=(FREEITEM*)&pNewBlock->m_bData[0];
-		FREEITEM* p=m_pFreeList;
-		for (int i=0; i<m_iBlockSize-1; i++)
-			{
-			p->m_pNext=reinterpret_cast<FREEITEM*>(reinterpret_cast<char*>(p)+sizeof(T));
-			p=p->m_pNext;
-			}
+	TSem::OnRemove(m_pData[iPosition], this);
+	Destructor(m_pData+iPosition);
 
-		// NULL terminate the list
-		p->m_pNext=NULL;
-		}
+	// Shuffle memory
+	if (iPosition<GetSize()-1)
+		memmove(VECDATAPTR(iPosition), VECDATAPTR(iPosition+1), (m_iSize-iPosition-1)*sizeof(T));
 
-	// Remove top item from the free list
-	T* p=(T*)m_pFreeList;
-	m_pFreeList=m_pFreeList->m_pNext;
+	// Update size
+	m_iSize--;
+}
 
-	// Update count
-	m_iCount++;
+// RemoveAt
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::RemoveAt(int iPosition, int iCount)
+{
+	// Quit if nothing to do!
+	if (iCount==0)
+		return;
 
-	new ((void*)p) T;
+	ASSERT(iPosition>=0);
+	ASSERT(iPosition<GetSize());
+	ASSERT(iPosition+iCount-1<GetSize());
+	ASSERT(m_iSize-iCount>=0);
 
-	// Return pointer
-	return (T*)p;
+	for (int i=0; i<iCount; i++)
+	{
+		TSem::OnRemove(m_pData[iPosition+i], this);
+		Destructor(m_pData+iPosition+i);
+	}
+
+	// Shuffle emory
+	if (iPosition+iCount<GetSize())
+		memmove(VECDATAPTR(iPosition), VECDATAPTR(iPosition+iCount), (m_iSize-iPosition-iCount)*sizeof(T));
+
+	// Update size
+	m_iSize-=iCount;
 }
 
-template <class T>
-void CPlex<T>::Free(T* p)
+// DetachAt
+template <class T, class TSem, class TArg, class TAlloc>
+inline T CVector<T,TSem,TArg,TAlloc>::DetachAt(int iPosition)
 {
-	ASSERT(m_iCount>0);
+	ASSERT(iPosition>=0);
+	ASSERT(iPosition<GetSize());
 
-	Destructor(p);
+	T temp=GetAt(iPosition);
 
-	if (m_iCount==1)
-		{
-		// When freeing last item, free everything!
-		FreeAll();
-		}
-	else
-		{
-		// Add to list of free items
-		FREEITEM* pNewFreeItem=(FREEITEM*)p;
-		pNewFreeItem->m_pNext=m_pFreeList;
-		m_pFreeList=pNewFreeItem;
+	TSem::OnDetach(m_pData[iPosition], this);
+	Destructor(m_pData+iPosition);
 
-		// Update count
-		m_iCount--;
-		}
+	// Shuffle memory
+	if (iPosition<GetSize()-1)
+		memmove(VECDATAPTR(iPosition), VECDATAPTR(iPosition+1), (m_iSize-iPosition-1)*sizeof(T));
+
+	// Update size
+	m_iSize--;
+
+	return temp;
 }
 
-template <class T>
-void CPlex<T>::FreeAll()
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::Detach(const TArg& val)
 {
-	// Release all blocks
-	BLOCK* pBlock=m_pHead;
-	while (pBlock)
-		{
-		// Save next
-		BLOCK* pNext=pBlock->m_pNext;
+	int iIndex=Find(val);
+	ASSERT(iIndex>=0);
+	DetachAt(iIndex);
+}
 
-		// Free it
-		free(pBlock);
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::DetachAll()
+{
+	for (int i=GetSize()-1; i>=0; i--)
+		DetachAt(i);
+}
 
-		// Move on
-		pBlock=pNext;
-		}
 
-	// Reset state
-	m_pHead=NULL;
-	m_pFreeList=NULL;
-	m_iCount=0;
+// RemoveAll
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::RemoveAll()
+{
+	if (m_iSize)
+	{
+		RemoveAt(0, m_iSize);
+		m_iSize=0;
+//		FreeExtra();		// Removed as performance enhancement when frequent adding/remove all
+	}
 }
 
-template <class T>
-int CPlex<T>::GetCount() const
+// GetAt
+template <class T, class TSem, class TArg, class TAlloc>
+inline T& CVector<T,TSem,TArg,TAlloc>::GetAt(int iPosition) const
 {
-	return m_iCount;
+	ASSERT(iPosition>=0);
+	ASSERT(iPosition<GetSize());
+
+	return m_pData[iPosition];
 }
 
-template <class T>
-void CPlex<T>::SetBlockSize(int iNewBlockSize)
+// operator[]
+template <class T, class TSem, class TArg, class TAlloc>
+inline T& CVector<T,TSem,TArg,TAlloc>::operator[](int iPosition) const
 {
-	ASSERT(m_pHead==NULL && "SetBlockSize only support when plex is empty");
-	m_iBlockSize=iNewBlockSize;
+	return GetAt(iPosition);
 }
 
+// GetBuffer
+template <class T, class TSem, class TArg, class TAlloc>
+inline T* CVector<T,TSem,TArg,TAlloc>::GetBuffer() const
+{
+	return m_pData;
+}
 
-/////////////////////////////////////////////////////////////////////////////
-// CMap implementation
+// begin
+template <class T, class TSem, class TArg, class TAlloc>
+inline T* CVector<T,TSem,TArg,TAlloc>::begin() const
+{
+	return m_pData;
+}
 
-// Constructor
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::CMap() :
-	m_pRoot(&m_Leaf),
-	m_iSize(0)
+// end
+template <class T, class TSem, class TArg, class TAlloc>
+inline T* CVector<T,TSem,TArg,TAlloc>::end() const
 {
-	m_Leaf.m_pParent = NULL;
-	m_Leaf.m_pLeft= &m_Leaf;
-	m_Leaf.m_pRight = &m_Leaf;
-	m_Leaf.m_bRed = false;
-	m_iIterPos=-1;
-	m_pIterNode=NULL;
+	return m_pData+m_iSize;
 }
 
-// Destructor
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::~CMap()
+// GetSize
+template <class T, class TSem, class TArg, class TAlloc>
+inline int CVector<T,TSem,TArg,TAlloc>::GetSize() const
 {
-	FreeNode(m_pRoot);
+	return m_iSize;
+}
+
+// Find (linear)
+template <class T, class TSem, class TArg, class TAlloc>
+int CVector<T,TSem,TArg,TAlloc>::Find(const TArg& val, int iStartAfter) const
+{
+	// Find an item
+	for (int i=iStartAfter+1; i<m_iSize; i++)
+	{
+		if (TSem::Compare(m_pData[i], val)==0)
+			return i;
+	}
+
+	// Not found
+	return -1;
 }
 
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-inline int CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::GetSize() const
+// QuickSort
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::QuickSort()
 {
-	return m_iSize;
+	slxIntroSort(m_pData, m_iSize, SCompareSem<TSem>());
 }
 
+// QuickSort
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::QuickSort(int (SIMPLECDECL *pfnCompare)(const T& a, const T& b))
+{
+	slxIntroSort(m_pData, m_iSize, SCompareFn<T>(pfnCompare));
+}
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-inline bool CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::IsEmpty() const
+// QuickSort
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::QuickSort(int (SIMPLECDECL *pfnCompare)(void* ctx, const T& a, const T& b), void* ctx)
 {
-	return m_iSize==0;
+	slxIntroSort(m_pData, m_iSize, SCompareFnEx<T>(pfnCompare, ctx));
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-typename CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::CKeyPair CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::operator[](int iIndex) const
+// QuickSort
+template <class T, class TSem, class TArg, class TAlloc> template <class TCompare>
+void CVector<T,TSem,TArg,TAlloc>::QuickSort(const TCompare& cmp)
 {
-	ASSERT(iIndex>=0 && iIndex<m_iSize);
-#ifdef _DEBUG_CHECKS
-	CheckAll();
-#endif
+	slxIntroSort(m_pData, m_iSize, cmp);
+}
 
-	if (iIndex==0)
-	{
-		m_iIterPos=0;
-		m_pIterNode=m_pFirst;
-		return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
-	}
+// RadixSort
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::RadixSort()
+{
+	slxRadixSort(m_pData, m_iSize);
+}
 
-	if (iIndex==m_iSize-1)
-	{
-		m_iIterPos=m_iSize-1;
-		m_pIterNode=m_pLast;
-		return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
-	}
+#ifdef SIMPLELIB_HAS_THREADS
 
-	if (iIndex==m_iIterPos)
-	{
-		return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
-	}
+// ParallelSort
+template <class T, class TSem, class TArg, class TAlloc>
+void CVector<T,TSem,TArg,TAlloc>::ParallelSort(int iThreads)
+{
+	slxParallelSort(m_pData, m_iSize, SCompareSem<TSem>(), iThreads);
+}
 
-	if (iIndex==m_iIterPos+1)
-	{
-		m_iIterPos=iIndex;
-		m_pIterNode=m_pIterNode->m_pNext;
-		return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
-	}
+// ParallelSort
+template <class T, class TSem, class TArg, class TAlloc> template <class TCompare>
+void CVector<T,TSem,TArg,TAlloc>::ParallelSort(const TCompare& cmp, int iThreads)
+{
+	slxParallelSort(m_pData, m_iSize, cmp, iThreads);
+}
 
-	if (iIndex==m_iIterPos-1)
-	{
-		m_iIterPos=iIndex;
-		m_pIterNode=m_pIterNode->m_pPrev;
-		return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
-	}
+#endif
 
-	int iDistanceFromIterPos=abs(m_iIterPos-iIndex);
-	int iDistanceFromStart=iIndex;
-	int iDistanceFromEnd=(m_iSize-1)-iIndex;
+// QuickSearch
+template <class T, class TSem, class TArg, class TAlloc>
+bool CVector<T,TSem,TArg,TAlloc>::QuickSearch(const TArg& key, int& iPosition) const
+{
+	return Simple::slxQuickSearch<T,const TArg&>(key, m_pData, m_iSize, SCompareSem<TSem>(), iPosition);
+}
 
-	if (m_iIterPos>=0 && iDistanceFromIterPos<iDistanceFromEnd && iDistanceFromIterPos<iDistanceFromEnd)
-	{
-		while (m_iIterPos<iIndex)
-		{
-			m_pIterNode=m_pIterNode->m_pNext;
-			m_iIterPos++;
-		}
-		while (m_iIterPos>iIndex)
-		{
-			m_pIterNode=m_pIterNode->m_pPrev;
-			m_iIterPos--;
-		}
-	}
-	else
-	{
-		if (iDistanceFromStart<iDistanceFromEnd)
-		{
-			m_pIterNode=m_pFirst;
-			for (int i=0; i<iIndex; i++)
-				m_pIterNode=m_pIterNode->m_pNext;
-		}
-		else
-		{
-			m_pIterNode=m_pLast;
-			for (int i=0; i<iDistanceFromEnd; i++)
-			{
-				m_pIterNode=m_pIterNode->m_pPrev;
-			}
-		}
-	}
 
-	m_iIterPos=iIndex;
+// QuickSearch
+template <class T, class TSem, class TArg, class TAlloc>
+bool CVector<T,TSem,TArg,TAlloc>::QuickSearch(const TArg& key, int (SIMPLECDECL *pfnCompare)(const T& a, const TArg& b), int& iPosition) const
+{
+	return Simple::slxQuickSearch<T,const TArg&>(key, m_pData, m_iSize, pfnCompare, iPosition);
+}
 
-#ifdef _DEBUG_CHECKS
-	CheckAll();
-#endif
-	return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
+// QuickSearchEx
+template <class T, class TSem, class TArg, class TAlloc>
+bool CVector<T,TSem,TArg,TAlloc>::QuickSearch(const TArg& key, void* ctx, int (SIMPLECDECL *pfnCompare)(void* ctx, const T& a, const TArg& b), int& iPosition) const
+{
+	return Simple::slxQuickSearchEx<T,const TArg&>(key, ctx, m_pData, m_iSize, pfnCompare, iPosition);
 }
 
+template <class T, class TSem, class TArg, class TAlloc> template <class TKey>
+bool CVector<T,TSem,TArg,TAlloc>::QuickSearchKey(TKey key, int (SIMPLECDECL *pfnCompare)(const T& a, TKey b), int& iPosition) const
+{
+	return slxQuickSearch<T, TKey>(key, GetBuffer(), GetSize(), pfnCompare, iPosition);
+}
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::Add(const TKey& Key, const TValue& Value)
+template <class T, class TSem, class TArg, class TAlloc> template <class TKey>
+bool CVector<T,TSem,TArg,TAlloc>::QuickSearchKey(TKey key, void* ctx, int (SIMPLECDECL *pfnCompare)(void* ctx, const T& a, TKey b), int& iPosition) const
 {
-	CNode* pNode = m_pRoot;
-	CNode* pParent = NULL;
+	return slxQuickSearchEx<T, TKey>(key, ctx, GetBuffer(), GetSize(), pfnCompare, iPosition);
+}
 
-	int iCompare=0;
-	while (pNode != &m_Leaf)
-	{
-		pParent = pNode;
-		iCompare = TKeySem::Compare(Key, pNode->m_KeyPair.m_Key);
+template <class T, class TSem, class TArg, class TAlloc> template <class TKey, class TCompare>
+bool CVector<T,TSem,TArg,TAlloc>::QuickSearchKey(TKey key, const TCompare& cmp, int& iPosition) const
+{
+	return slxQuickSearch<T, TKey, const TCompare&>(key, GetBuffer(), GetSize(), cmp, iPosition);
+}
 
-		if (iCompare < 0)
-			pNode = pNode->m_pLeft;
-		else if (iCompare > 0)
-			pNode = pNode->m_pRight;
-		else
-		{
-			// Found a duplicate, replace it. We replace the key too, since
-			// equivalence is not always exact (e.g. case insensitive strings)
-			TKeySem::OnRemove(pNode->m_KeyPair.m_Key, this);
-			TValueSem::OnRemove(pNode->m_KeyPair.m_Value, this);
-			pNode->m_KeyPair.m_Value = TValueSem::OnAdd(Value, this);
-			pNode->m_KeyPair.m_Key = TKeySem::OnAdd(Key, this);
-			#ifdef _DEBUG_CHECKS
-			CheckAll();
-			#endif
-			return;
-		}
-	}
 
-	CNode* pNew = m_NodePlex.Alloc();
-	pNew->m_pParent = pParent;
-	pNew->m_pLeft = &m_Leaf;
-	pNew->m_pRight = &m_Leaf;
-	pNew->m_bRed = true;
-	pNew->m_KeyPair.m_Value = TValueSem::OnAdd(Value, this);
-	pNew->m_KeyPair.m_Key = TKeySem::OnAdd(Key, this);
+template <class T, class TSem, class TArg, class TAlloc> template <class TKey>
+int CVector<T,TSem,TArg,TAlloc>::FindKey(TKey key, int (SIMPLECDECL *pfnCompare)(const T& a, TKey b), int iStartAfter) const
+{
+	return slxFind(key, GetBuffer()+iStartAfter+1, GetBuffer()+GetSize(), pfnCompare);
+}
 
-	if (pParent)
+template <class T, class TSem, class TArg, class TAlloc> template <class TKey>
+int CVector<T,TSem,TArg,TAlloc>::FindKey(TKey key, void* ctx, int (SIMPLECDECL *pfnCompare)(void* ctx, const T& a, TKey b), int iStartAfter) const
+{
+	return slxFindEx(key, ctx, GetBuffer()+iStartAfter+1, GetBuffer()+GetSize(), pfnCompare);
+}
+
+
+// IsEmpty
+template <class T, class TSem, class TArg, class TAlloc>
+inline bool CVector<T,TSem,TArg,TAlloc>::IsEmpty() const
+{
+	return GetSize()==0;
+}
+
+// Push
+template <class T, class TSem, class TArg, class TAlloc>
+inline void CVector<T,TSem,TArg,TAlloc>::Push(const TArg& val)
+{
+	Add(val);
+}
+
+// Pop
+template <class T, class TSem, class TArg, class TAlloc>
+inline bool CVector<T,TSem,TArg,TAlloc>::Pop(T& val)
+{
+	if (m_iSize==0)
+		return false;
+
+	// Update size
+	m_iSize--;
+
+	val=m_pData[m_iSize];
+
+	TSem::OnDetach(m_pData[m_iSize], this);
+	Destructor(m_pData+m_iSize);
+
+	return true;
+}
+
+// Pop
+template <class T, class TSem, class TArg, class TAlloc>
+inline T CVector<T,TSem,TArg,TAlloc>::Pop()
+{
+	ASSERT(!IsEmpty());
+	return DetachAt(GetSize()-1);
+}
+
+// Top
+template <class T, class TSem, class TArg, class TAlloc>
+inline T& CVector<T,TSem,TArg,TAlloc>::Top() const
+{
+	ASSERT(!IsEmpty());
+	return GetAt(GetSize()-1);
+}
+
+// Top
+template <class T, class TSem, class TArg, class TAlloc>
+inline bool CVector<T,TSem,TArg,TAlloc>::Top(T& val) const
+{
+	if (IsEmpty())
+		return false;
+	val=Top();
+	return true;
+}
+
+// Enqueue
+template <class T, class TSem, class TArg, class TAlloc>
+inline void CVector<T,TSem,TArg,TAlloc>::Enqueue(const TArg& val)
+{
+	Add(val);
+}
+
+// Dequeue
+template <class T, class TSem, class TArg, class TAlloc>
+inline T CVector<T,TSem,TArg,TAlloc>::Dequeue()
+{
+	ASSERT(!IsEmpty());
+	return DetachAt(0);
+}
+
+// Dequeue
+template <class T, class TSem, class TArg, class TAlloc>
+inline bool CVector<T,TSem,TArg,TAlloc>::Dequeue(T& val)
+{
+	if (IsEmpty())
+		return false;
+
+	val=Dequeue();
+	return true;
+}
+
+// Peek
+template <class T, class TSem, class TArg, class TAlloc>
+inline T& CVector<T,TSem,TArg,TAlloc>::Peek() const
+{
+	ASSERT(!IsEmpty());
+	return GetAt(0);
+}
+
+// Peek
+template <class T, class TSem, class TArg, class TAlloc>
+inline bool CVector<T,TSem,TArg,TAlloc>::Peek(T& val) const
+{
+	if (IsEmpty())
+		return false;
+	val=Peek();
+	return true;
+}
+
+
+#undef VECDATAPTR
+
+/////////////////////////////////////////////////////////////////////////////
+// CSortedVector implementation
+
+// Constructor
+template <class T, class TSem, class TArg>
+CSortedVector<T,TSem,TArg>::CSortedVector()
+{
+	m_pfnCompare=NULL;
+	m_bAllowDuplicates=true;
+	m_bDefaultCompare=false;
+	m_ctx=NULL;
+	m_pfnCompareEx=NULL;
+
+	// Setup default sort order
+	Resort(NULL, true);
+};
+
+// Destructor
+template <class T, class TSem, class TArg>
+CSortedVector<T,TSem,TArg>::~CSortedVector()
+{
+};
+
+// Add
+template <class T, class TSem, class TArg>
+int CSortedVector<T,TSem,TArg>::Add(const TArg& val)
+{
+	if (m_pfnCompareEx)
 	{
-		if (iCompare<0)
-		{
-			pParent->m_pLeft = pNew;
-			pNew->m_pNext=pParent;
-			pNew->m_pPrev=pParent->m_pPrev;
-		}
-		else if (iCompare>0)
-		{
-			pParent->m_pRight = pNew;
-			pNew->m_pPrev=pParent;
-			pNew->m_pNext=pParent->m_pNext;
-		}
-		else
+		int iPos=0;
+		if (m_vec.QuickSearch(val, m_ctx, m_pfnCompareEx, iPos))
 		{
-			ASSERT(false);
+			if (!m_bAllowDuplicates)
+				return -1-iPos;		// position of existing item = -retv-1;
+
+			// Insert duplicate after existing entries...
+			while (iPos<GetSize() && m_pfnCompareEx(m_ctx, val, GetAt(iPos))==0)
+				iPos++;
 		}
+
+		m_vec.InsertAt(iPos, val);
+		return iPos;
 	}
-	else
+
+	int iPos=0;
+	if (m_bDefaultCompare ? m_vec.QuickSearch(val, iPos) : m_vec.QuickSearch(val, m_pfnCompare, iPos))
 	{
-		m_pRoot = pNew;
-		pNew->m_pPrev=NULL;
-		pNew->m_pNext=NULL;
-	}
+		if (!m_bAllowDuplicates)
+			return -1-iPos;		// position of existing item = -retv-1;
 
-	// Fix up traverse links
-	if (pNew->m_pPrev)
-		pNew->m_pPrev->m_pNext=pNew;
-	else
-		m_pFirst=pNew;
+		// Insert duplicate after existing entries...
+		while (iPos<GetSize() && m_pfnCompare(val, GetAt(iPos))==0)
+			iPos++;
+	}
 
-	if (pNew->m_pNext)
-		pNew->m_pNext->m_pPrev=pNew;
-	else
-		m_pLast=pNew;
+	m_vec.InsertAt(iPos, val);
+	return iPos;
+}
 
-	if (m_pIterNode)
+// Add (bulk) - sorts the new items once and merges them in, rather than a
+// search and insert for each.  Same results as adding one at a time: with
+// duplicates disallowed the first of any equal items wins (the others get
+// their semantics OnRemove, as per CIndex), otherwise duplicates go after
+// existing equal entries in the order given.
+template <class T, class TSem, class TArg>
+void CSortedVector<T,TSem,TArg>::Add(const T* pVals, int iCount)
+{
+	if (m_pfnCompareEx)
 	{
-		int iCompare=TKeySem::Compare(Key, m_pIterNode->m_KeyPair.m_Key);
-
-		ASSERT(iCompare!=0);
-
-		// If the new key is before the current iterate position, update the iterate position
-		if (iCompare<0)
-		{
-			m_pIterNode=m_pIterNode->m_pPrev;
-		}
+		AddInternal(pVals, iCount, SCompareFnEx<T>(m_pfnCompareEx, m_ctx));
+		return;
 	}
+	if (m_bDefaultCompare)
+		AddInternal(pVals, iCount, SCompareSem<TSem>());
+	else
+		AddInternal(pVals, iCount, SCompareFn<T>(m_pfnCompare));
+}
 
-	// Now rebalance the tree.
+template <class T, class TSem, class TArg> template <class TCompare>
+void CSortedVector<T,TSem,TArg>::AddInternal(const T* pVals, int iCount, const TCompare& cmp)
+{
+	if (iCount<1)
+		return;
 
-	pNode = pNew;
+	// Sort copies of the new items (no semantics yet)
+	CVector<T> vecNew;
+	for (int i=0; i<iCount; i++)
+		vecNew.Add(pVals[i]);
+	slxStableSort(vecNew.GetBuffer(), vecNew.GetSize(), cmp);
 
-	while (pNode != m_pRoot && pNode->m_pParent->m_bRed)
+	// Drop duplicates
+	if (!m_bAllowDuplicates)
 	{
-		pParent = pNode->m_pParent;
-		CNode* pGrandParent = pParent->m_pParent;
-
-		if (pParent == pGrandParent->m_pLeft)
+		CVector<T> vecUnique;
+		CVector<T> vecDropped;
+		int iExisting=0;
+		for (int i=0; i<vecNew.GetSize(); i++)
 		{
-			CNode* pUncle = pGrandParent->m_pRight;
+			// Existing entries are sorted too, so walk them in step
+			while (iExisting<m_vec.GetSize() && cmp(m_vec[iExisting], vecNew[i])<0)
+				iExisting++;
 
-			if (pUncle->m_bRed)
+			if ((i>0 && cmp(vecNew[i-1], vecNew[i])==0) ||
+				(iExisting<m_vec.GetSize() && cmp(m_vec[iExisting], vecNew[i])==0))
 			{
-				pParent->m_bRed = false;
-				pUncle->m_bRed = false;
-				pGrandParent->m_bRed = true;
-				pNode = pGrandParent;
+				vecDropped.Add(vecNew[i]);
+				continue;
 			}
-			else
-			{
-				if (pNode == pParent->m_pRight)
-				{
-					pNode = pParent;
-					RotateLeft(pNode);
-				}
 
-				pNode->m_pParent->m_bRed = false;
-				pNode->m_pParent->m_pParent->m_bRed = true;
-				RotateRight(pNode->m_pParent->m_pParent);
-			}
+			vecUnique.Add(vecNew[i]);
 		}
+		vecNew.Swap(vecUnique);
+
+		// Dropped items were passed to us, so get their semantics OnRemove (once
+		// nothing compares against them any more)
+		for (int i=0; i<vecDropped.GetSize(); i++)
+			TSem::OnRemove(vecDropped[i], this);
+	}
+
+	int iOld=m_vec.GetSize();
+	int iNew=vecNew.GetSize();
+	if (iNew==0)
+		return;
+
+	// Append (applying semantics), then merge the two sorted runs in place from the
+	// back.  Ties go to the new item first from the back, ie: after the existing ones.
+	m_vec.Add(vecNew);
+
+	T* pData=m_vec.GetBuffer();
+	T* pTemp=(T*)malloc(sizeof(T)*iNew);
+	memcpy((void*)pTemp, (void*)(pData+iOld), sizeof(T)*iNew);
+
+	int i=iOld-1;
+	int j=iNew-1;
+	int k=iOld+iNew-1;
+	while (j>=0)
+	{
+		if (i>=0 && cmp(pData[i], pTemp[j])>0)
+			memcpy((void*)&pData[k--], (void*)&pData[i--], sizeof(T));
 		else
-		{
-			CNode* pUncle = pGrandParent->m_pLeft;
+			memcpy((void*)&pData[k--], (void*)&pTemp[j--], sizeof(T));
+	}
 
-			if (pUncle->m_bRed)
-			{
-				pParent->m_bRed = false;
-				pUncle->m_bRed = false;
-				pGrandParent->m_bRed = true;
-				pNode = pGrandParent;
-			}
-			else
-			{
-				if (pNode == pParent->m_pLeft)
-				{
-					pNode = pParent;
-					RotateRight(pNode);
-				}
+	free(pTemp);
+}
 
-				pNode->m_pParent->m_bRed = false;
-				pNode->m_pParent->m_pParent->m_bRed = true;
-				RotateLeft(pNode->m_pParent->m_pParent);
-			}
+// GetSize
+template <class T, class TSem, class TArg>
+int CSortedVector<T,TSem,TArg>::GetSize() const
+{
+	return m_vec.GetSize();
+}
+
+// Remove
+template <class T, class TSem, class TArg>
+int CSortedVector<T,TSem,TArg>::Remove(const TArg& val)
+{
+	if (m_pfnCompareEx)
+	{
+		int iPos;
+		m_vec.QuickSearch(val, m_ctx, m_pfnCompareEx, iPos);
+		if (iPos>=0)
+			RemoveAt(iPos);
+		return -1;
+	}
+
+	int iPos;
+	if (m_bDefaultCompare)
+		m_vec.QuickSearch(val, iPos);
+	else
+		m_vec.QuickSearch(val, m_pfnCompare, iPos);
+	if (iPos>=0)
+		RemoveAt(iPos);
+	return -1;
+}
+
+// RemoveAt
+template <class T, class TSem, class TArg>
+void CSortedVector<T,TSem,TArg>::RemoveAt(int iPosition)
+{
+	m_vec.RemoveAt(iPosition);
+}
+
+// DetachAt
+template <class T, class TSem, class TArg>
+T CSortedVector<T,TSem,TArg>::DetachAt(int iPosition)
+{
+	return m_vec.DetachAt(iPosition);
+}
+
+// RemoveAll
+template <class T, class TSem, class TArg>
+void CSortedVector<T,TSem,TArg>::RemoveAll()
+{
+	m_vec.RemoveAll();
+}
+
+// GetAt
+template <class T, class TSem, class TArg>
+const T& CSortedVector<T,TSem,TArg>::GetAt(int iPosition) const
+{
+	return m_vec.GetAt(iPosition);
+}
+
+// operator[]
+template <class T, class TSem, class TArg>
+const T& CSortedVector<T,TSem,TArg>::operator[](int iPosition) const
+{
+	return m_vec.GetAt(iPosition);
+}
+
+// GetBuffer
+template <class T, class TSem, class TArg>
+const T* CSortedVector<T,TSem,TArg>::GetBuffer() const
+{
+	return m_vec.GetBuffer();
+}
+
+// begin
+template <class T, class TSem, class TArg>
+const T* CSortedVector<T,TSem,TArg>::begin() const
+{
+	return m_vec.begin();
+}
+
+// end
+template <class T, class TSem, class TArg>
+const T* CSortedVector<T,TSem,TArg>::end() const
+{
+	return m_vec.end();
+}
+
+// IsEmpty
+template <class T, class TSem, class TArg>
+bool CSortedVector<T,TSem,TArg>::IsEmpty() const
+{
+	return GetSize()==0;
+}
+
+// QuickSearch
+template <class T, class TSem, class TArg>
+bool CSortedVector<T,TSem,TArg>::QuickSearch(const TArg& key, int& iPosition) const
+{
+	if (m_pfnCompareEx)
+		return m_vec.QuickSearch(key, m_ctx, m_pfnCompareEx, iPosition);
+
+	if (m_bDefaultCompare)
+		return m_vec.QuickSearch(key, iPosition);
+
+	return m_vec.QuickSearch(key, m_pfnCompare, iPosition);
+}
+
+// Find (uses linear search)
+template <class T, class TSem, class TArg>
+int CSortedVector<T,TSem,TArg>::Find(const TArg& val, int iStartAfter) const
+{
+	return m_vec.Find(val, iStartAfter);
+}
+
+// Find (uses quick search but matches prototype of CVector::Find
+template <class T, class TSem, class TArg>
+int CSortedVector<T,TSem,TArg>::Find(const TArg& key) const
+{
+	// Quick search doesn't work if duplicates are allowed.
+	if (m_bAllowDuplicates)
+	{
+		return Find(key, -1);
+	}
+
+	if (m_pfnCompareEx)
+	{
+		int iPos;
+		if (m_vec.QuickSearch(key, m_ctx, m_pfnCompareEx, iPos))
+			return iPos;
+		else
+			return -1;
+	}
+
+	int iPos;
+	if (m_bDefaultCompare ? m_vec.QuickSearch(key, iPos) : m_vec.QuickSearch(key, m_pfnCompare, iPos))
+		return iPos;
+	else
+		return -1;
+}
+
+// Resort the vertor. Specify NULL for pfnCompare to use TSem::Compare
+template <class T, class TSem, class TArg>
+void CSortedVector<T,TSem,TArg>::Resort(int (SIMPLECDECL *pfnCompare)(const T& a, const T& b), bool bAllowDuplicates)
+{
+	// If turning off allow duplicates, verify vector is empty
+	ASSERT(!m_bAllowDuplicates || bAllowDuplicates || IsEmpty());
+
+	m_pfnCompareEx=NULL;
+	m_bAllowDuplicates=bAllowDuplicates;
+	m_bDefaultCompare=(pfnCompare==NULL);
+	if (pfnCompare!=NULL)
+	{
+		m_pfnCompare=pfnCompare;
+		m_vec.QuickSort(m_pfnCompare);
+	}
+	else
+	{
+		m_pfnCompare=TSem::Compare;
+		m_vec.QuickSort();
+	}
+}
+
+// Resort the vertor with Ex comparer
+template <class T, class TSem, class TArg>
+void CSortedVector<T,TSem,TArg>::Resort(void* ctx, int (SIMPLECDECL *pfnCompare)(void* ctx, const T& a, const T& b), bool bAllowDuplicates)
+{
+	// If turning off allow duplicates, verify vector is empty
+	ASSERT(!m_bAllowDuplicates || bAllowDuplicates || IsEmpty());
+
+	m_pfnCompare=NULL;
+	m_bDefaultCompare=false;
+	m_pfnCompareEx=pfnCompare;
+	m_ctx=ctx;
+	m_bAllowDuplicates=bAllowDuplicates;
+	m_vec.QuickSort(m_pfnCompareEx, m_ctx);
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CGrid
+
+// Constructor
+template <class T, class TSem, class TArg>
+CGrid<T,TSem,TArg>::CGrid(int iWidth, int iHeight) :
+	m_iHeight(iHeight)
+{
+	SetSize(iWidth, iHeight);
+};
+
+// SetSize
+template <class T, class TSem, class TArg>
+void CGrid<T,TSem,TArg>::SetSize(int iWidth, int iHeight, const TArg& val)
+{
+	// Adjust width of existing rows
+	for (int i=0; i<m_Columns.GetSize(); i++)
+	{
+		m_Columns[i]->SetSize(iHeight, val);
+	}
+
+	// Create new rows
+	while (iWidth>m_Columns.GetSize())
+	{
+		m_Columns.Add(new CColumn(iWidth, val));
+	}
+
+	// Delete extra rows
+	while (iWidth<m_Columns.GetSize())
+	{
+		m_Columns.Pop();
+	}
+}
+
+template <class T, class TSem, class TArg>
+void CGrid<T,TSem,TArg>::InsertColumn(int iPosition, const TArg& val)
+{
+	m_Columns.InsertAt(iPosition, new CColumn(m_iHeight, val));
+}
+
+template <class T, class TSem, class TArg>
+void CGrid<T,TSem,TArg>::RemoveColumn(int iPosition)
+{
+	m_Columns.RemoveAt(iPosition);
+}
+
+template <class T, class TSem, class TArg>
+void CGrid<T,TSem,TArg>::InsertRow(int iPosition, const TArg& val)
+{
+	for (int i=0; i<m_Columns.GetSize(); i++)
+	{
+		m_Columns[i]->InsertAt(iPosition, val);
+	}
+	m_iHeight++;
+}
+
+template <class T, class TSem, class TArg>
+void CGrid<T,TSem,TArg>::RemoveRow(int iPosition)
+{
+	for (int i=0; i<m_Columns.GetSize(); i++)
+	{
+		m_Columns[i]->RemoveAt(iPosition);
+	}
+	m_iHeight--;
+}
+
+template <class T, class TSem, class TArg>
+void CGrid<T,TSem,TArg>::RemoveAll()
+{
+	m_Columns.RemoveAll();
+	m_iHeight=0;
+}
+
+template <class T, class TSem, class TArg>
+int CGrid<T,TSem,TArg>::GetWidth()
+{
+	return m_Columns.GetSize();
+}
+
+template <class T, class TSem, class TArg>
+int CGrid<T,TSem,TArg>::GetHeight()
+{
+	return m_iHeight;
+}
+
+template <class T, class TSem, class TArg>
+typename CGrid<T,TSem,TArg>::CColumn& CGrid<T,TSem,TArg>::operator[](int x)
+{
+	return *m_Columns[x];
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CFlatGrid
+
+// Constructor
+template <class T, class TSem, class TArg, class TAlloc>
+CFlatGrid<T,TSem,TArg,TAlloc>::CFlatGrid(int iWidth, int iHeight) :
+	m_pData(NULL),
+	m_iWidth(0),
+	m_iHeight(0),
+	m_iPitch(0),
+	m_iRowCapacity(0)
+{
+	SetSize(iWidth, iHeight);
+}
+
+// Destructor
+template <class T, class TSem, class TArg, class TAlloc>
+CFlatGrid<T,TSem,TArg,TAlloc>::~CFlatGrid()
+{
+	RemoveAll();
+}
+
+// ConstructCells
+template <class T, class TSem, class TArg, class TAlloc>
+void CFlatGrid<T,TSem,TArg,TAlloc>::ConstructCells(T* p, int iCount, const TArg& val)
+{
+	for (int i=0; i<iCount; i++)
+	{
+		Constructor(p+i, TSem::OnAdd(val, this));
+	}
+}
+
+// DestroyCells
+template <class T, class TSem, class TArg, class TAlloc>
+void CFlatGrid<T,TSem,TArg,TAlloc>::DestroyCells(T* p, int iCount)
+{
+	for (int i=0; i<iCount; i++)
+	{
+		TSem::OnRemove(p[i], this);
+		Destructor(p+i);
+	}
+}
+
+// Reserve - make sure there's room for a grid of at least this size
+template <class T, class TSem, class TArg, class TAlloc>
+void CFlatGrid<T,TSem,TArg,TAlloc>::Reserve(int iWidth, int iHeight)
+{
+	// Quit if already big enough
+	if (iWidth<=m_iPitch && iHeight<=m_iRowCapacity)
+		return;
+
+	// Work out new dimensions, doubling whichever has run out
+	int iNewPitch=m_iPitch;
+	if (iWidth>iNewPitch)
+	{
+		iNewPitch=max(iWidth, m_iPitch*2);
+		if (iNewPitch<4)
+			iNewPitch=4;
+	}
+	int iNewRows=m_iRowCapacity;
+	if (iHeight>iNewRows)
+	{
+		iNewRows=max(iHeight, m_iRowCapacity*2);
+		if (iNewRows<4)
+			iNewRows=4;
+	}
+
+	if (iNewPitch==m_iPitch && m_pData)
+	{
+		// Just adding rows, existing layout doesn't change
+		m_pData=(T*)TAlloc::Realloc(m_pData, iNewPitch*iNewRows*sizeof(T));
+	}
+	else
+	{
+		// Pitch changed, copy each row across
+		T* pNewData=(T*)TAlloc::Alloc(iNewPitch*iNewRows*sizeof(T));
+		if (m_pData)
+		{
+			for (int y=0; y<m_iHeight; y++)
+			{
+				memcpy(pNewData+y*iNewPitch, m_pData+y*m_iPitch, m_iWidth*sizeof(T));
+			}
+			TAlloc::Free(m_pData);
+		}
+		m_pData=pNewData;
+	}
+
+	// Store new sizes
+	m_iPitch=iNewPitch;
+	m_iRowCapacity=iNewRows;
+}
+
+// SetSize
+template <class T, class TSem, class TArg, class TAlloc>
+void CFlatGrid<T,TSem,TArg,TAlloc>::SetSize(int iWidth, int iHeight, const TArg& val)
+{
+	// Remove extra rows
+	while (m_iHeight>iHeight)
+	{
+		m_iHeight--;
+		DestroyCells(GetRow(m_iHeight), m_iWidth);
+	}
+
+	// Remove extra columns
+	if (m_iWidth>iWidth)
+	{
+		for (int y=0; y<m_iHeight; y++)
+		{
+			DestroyCells(GetRow(y)+iWidth, m_iWidth-iWidth);
+		}
+		m_iWidth=iWidth;
+	}
+
+	if (iWidth==m_iWidth && iHeight==m_iHeight)
+		return;
+
+	Reserve(iWidth, iHeight);
+
+	// Widen existing rows
+	for (int y=0; y<m_iHeight; y++)
+	{
+		ConstructCells(GetRow(y)+m_iWidth, iWidth-m_iWidth, val);
+	}
+	m_iWidth=iWidth;
+
+	// Add new rows
+	while (m_iHeight<iHeight)
+	{
+		ConstructCells(GetRow(m_iHeight), m_iWidth, val);
+		m_iHeight++;
+	}
+}
+
+// InsertColumn
+template <class T, class TSem, class TArg, class TAlloc>
+void CFlatGrid<T,TSem,TArg,TAlloc>::InsertColumn(int iPosition, const TArg& val)
+{
+	ASSERT(iPosition>=0 && iPosition<=m_iWidth);
+
+	Reserve(m_iWidth+1, m_iHeight);
+
+	for (int y=0; y<m_iHeight; y++)
+	{
+		T* pRow=GetRow(y);
+		memmove(pRow+iPosition+1, pRow+iPosition, (m_iWidth-iPosition)*sizeof(T));
+		Constructor(pRow+iPosition, TSem::OnAdd(val, this));
+	}
+	m_iWidth++;
+}
+
+// RemoveColumn
+template <class T, class TSem, class TArg, class TAlloc>
+void CFlatGrid<T,TSem,TArg,TAlloc>::RemoveColumn(int iPosition)
+{
+	ASSERT(iPosition>=0 && iPosition<m_iWidth);
+
+	for (int y=0; y<m_iHeight; y++)
+	{
+		T* pRow=GetRow(y);
+		DestroyCells(pRow+iPosition, 1);
+		memmove(pRow+iPosition, pRow+iPosition+1, (m_iWidth-iPosition-1)*sizeof(T));
+	}
+	m_iWidth--;
+}
+
+// InsertRow
+template <class T, class TSem, class TArg, class TAlloc>
+void CFlatGrid<T,TSem,TArg,TAlloc>::InsertRow(int iPosition, const TArg& val)
+{
+	ASSERT(iPosition>=0 && iPosition<=m_iHeight);
+
+	Reserve(m_iWidth, m_iHeight+1);
+
+	// Rows are all m_iPitch apart so move everything below in one go
+	memmove(GetRow(iPosition+1), GetRow(iPosition), (m_iHeight-iPosition)*m_iPitch*sizeof(T));
+	ConstructCells(GetRow(iPosition), m_iWidth, val);
+	m_iHeight++;
+}
+
+// RemoveRow
+template <class T, class TSem, class TArg, class TAlloc>
+void CFlatGrid<T,TSem,TArg,TAlloc>::RemoveRow(int iPosition)
+{
+	ASSERT(iPosition>=0 && iPosition<m_iHeight);
+
+	DestroyCells(GetRow(iPosition), m_iWidth);
+	memmove(GetRow(iPosition), GetRow(iPosition+1), (m_iHeight-iPosition-1)*m_iPitch*sizeof(T));
+	m_iHeight--;
+}
+
+// RemoveAll
+template <class T, class TSem, class TArg, class TAlloc>
+void CFlatGrid<T,TSem,TArg,TAlloc>::RemoveAll()
+{
+	for (int y=0; y<m_iHeight; y++)
+	{
+		DestroyCells(GetRow(y), m_iWidth);
+	}
+
+	if (m_pData)
+		TAlloc::Free(m_pData);
+
+	m_pData=NULL;
+	m_iWidth=0;
+	m_iHeight=0;
+	m_iPitch=0;
+	m_iRowCapacity=0;
+}
+
+template <class T, class TSem, class TArg, class TAlloc>
+int CFlatGrid<T,TSem,TArg,TAlloc>::GetWidth() const
+{
+	return m_iWidth;
+}
+
+template <class T, class TSem, class TArg, class TAlloc>
+int CFlatGrid<T,TSem,TArg,TAlloc>::GetHeight() const
+{
+	return m_iHeight;
+}
+
+template <class T, class TSem, class TArg, class TAlloc>
+int CFlatGrid<T,TSem,TArg,TAlloc>::GetPitch() const
+{
+	return m_iPitch;
+}
+
+template <class T, class TSem, class TArg, class TAlloc>
+T& CFlatGrid<T,TSem,TArg,TAlloc>::GetAt(int x, int y) const
+{
+	ASSERT(x>=0 && x<m_iWidth);
+	ASSERT(y>=0 && y<m_iHeight);
+	return m_pData[y*m_iPitch+x];
+}
+
+template <class T, class TSem, class TArg, class TAlloc>
+T* CFlatGrid<T,TSem,TArg,TAlloc>::GetRow(int y) const
+{
+	return m_pData+y*m_iPitch;
+}
+
+template <class T, class TSem, class TArg, class TAlloc>
+T* CFlatGrid<T,TSem,TArg,TAlloc>::GetBuffer() const
+{
+	return m_pData;
+}
+
+template <class T, class TSem, class TArg, class TAlloc>
+typename CFlatGrid<T,TSem,TArg,TAlloc>::CColumn CFlatGrid<T,TSem,TArg,TAlloc>::operator[](int x) const
+{
+	ASSERT(x>=0 && x<m_iWidth);
+	return CColumn(m_pData+x, m_iPitch);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CLinkedList
+
+#ifndef _SIMPLELIB_NO_LINKEDLIST_MULTICHAIN
+#define template_linkedlist template <class T, class TSem, CChain<T> T::* pMember>
+#define CLinkedList_template CLinkedList<T,TSem,pMember>
+#define chainmember(x) ((x)->*pMember)
+#else
+#define template_linkedlist template <class T, class TSem>
+#define CLinkedList_template CLinkedList<T,TSem>
+#define chainmember(x) ((x)->m_Chain)
+#endif
+
+template_linkedlist
+CLinkedList_template::CLinkedList()
+{
+	m_pFirst=NULL;
+	m_pCurrent=NULL;
+	m_iSize=0;
+	m_iIterPos=-1;
+	m_pIterElem=NULL;
+}
+
+template_linkedlist
+CLinkedList_template::~CLinkedList()
+{
+	RemoveAll();
+}
+
+template_linkedlist
+void CLinkedList_template::Prepend(T* p)
+{
+#ifdef _DEBUG
+	ASSERT(chainmember(p).m_pPrev==NULL);
+	ASSERT(chainmember(p).m_pNext==NULL);
+	ASSERT(!Contains(p));
+#endif
+
+	// Semantics...
+	TSem::OnAdd(p, this);
+
+	if (m_pFirst)
+		{
+		// Save the last element pointer
+		chainmember(p).m_pPrev=chainmember(m_pFirst).m_pPrev;
+
+		// Link the old first to the new first...
+		chainmember(m_pFirst).m_pPrev=p;
+		}
+	else
+		{
+		// Set the last element as the new element
+		chainmember(p).m_pPrev=p;
+		}
+
+
+	// Insert at front
+	chainmember(p).m_pNext=m_pFirst;
+	m_pFirst=p;
+
+	// Update iterate position
+	if (m_pIterElem)
+	{
+		m_pIterElem=GetPrevious(m_pIterElem);
+	}
+
+	m_iSize++;
+}
+
+
+template_linkedlist
+void CLinkedList_template::Add(_CLinkedList& OtherList)
+{
+
+	if (!OtherList.m_pFirst)
+		return;
+
+	if (m_pFirst)
+		{
+		T* pOtherFirst=OtherList.GetFirst();
+		T* pOtherLast=OtherList.GetLast();
+		T* pThisFirst=GetFirst();
+		T* pThisLast=GetLast();
+
+		chainmember(pThisFirst).m_pPrev=pOtherLast;
+		chainmember(pOtherFirst).m_pPrev=pThisLast;
+		chainmember(pThisLast).m_pNext=pOtherFirst;
+		}
+	else
+		{
+		m_pFirst=OtherList.m_pFirst;
+		}
+
+	// Update size...
+	m_iSize+=OtherList.m_iSize;
+
+	// Reset other list
+	OtherList.m_pFirst=NULL;
+	OtherList.m_iSize=0;
+	OtherList.m_pCurrent=NULL;
+	OtherList.m_pIterElem=NULL;
+}
+
+// Insert an element at end of start of a list
+template_linkedlist
+void CLinkedList_template::Add(T* p)
+{
+#ifdef _DEBUG
+	ASSERT(chainmember(p).m_pPrev==NULL);
+	ASSERT(chainmember(p).m_pNext==NULL);
+	ASSERT(!Contains(p));
+#endif
+
+	// Semantics...
+	TSem::OnAdd(p, this);
+
+	if (m_pFirst)
+		{
+		chainmember(chainmember(m_pFirst).m_pPrev).m_pNext=p;
+		chainmember(p).m_pPrev=chainmember(m_pFirst).m_pPrev;
+		chainmember(p).m_pNext=NULL;
+		chainmember(m_pFirst).m_pPrev=p;
+		}
+	else
+		{
+		m_pFirst=p;
+		chainmember(p).m_pNext=NULL;
+		chainmember(p).m_pPrev=p;
+		}
+
+	m_iSize++;
+}
+
+
+
+template_linkedlist
+void CLinkedList_template::Insert(T* p, T* pBefore)
+{
+#ifdef _DEBUG
+	ASSERT(chainmember(p).m_pPrev==NULL);
+	ASSERT(chainmember(p).m_pNext==NULL);
+#endif
+
+	// Insert at end?
+	if (!pBefore)
+		{
+		Add(p);
+		return;
+		}
+
+	ASSERT(Contains(pBefore));
+
+	// Insert at start
+	if (pBefore==m_pFirst)
+		{
+		Prepend(p);
+		return;
+		}
+
+	TSem::OnAdd(p, this);
+
+	// Work out if insert position is before the current iterate position
+	bool bBeforeIteratePos=IsBeforeIteratePos(pBefore);
+
+	// Insert in middle
+	chainmember(p).m_pNext=pBefore;
+	chainmember(p).m_pPrev=chainmember(pBefore).m_pPrev;
+	chainmember(chainmember(p).m_pNext).m_pPrev=p;
+	chainmember(chainmember(p).m_pPrev).m_pNext=p;
+
+	// Update size
+	m_iSize++;
+
+	// Update iterate position
+	if (bBeforeIteratePos)
+	{
+		m_pIterElem=GetPrevious(m_pIterElem);
+	}
+}
+
+
+// Work out if an element is before the current iterate position
+template_linkedlist
+bool CLinkedList_template::IsBeforeIteratePos(T* pElem) const
+{
+	if (!m_pIterElem)
+		return false;
+
+	ASSERT(m_iSize!=0);
+	ASSERT(Contains(pElem));
+
+	if (m_pIterElem==pElem)
+		return true;
+
+	// Need to scan either before current iterate position or after, choose the smaller one
+	if (m_iIterPos<m_iSize/2)
+	{
+		// Scan first half
+		for (T* p=m_pIterElem; p!=NULL; p=GetPrevious(p))
+		{
+			if (p==pElem)
+				return true;
+		}
+		return false;
+	}
+	else
+	{
+		// Scan second half
+		for (T* p=m_pIterElem; p!=NULL; p=chainmember(p).m_pNext)
+		{
+			if (p==pElem)
+				return false;
+		}
+		return true;
+	}
+}
+
+template_linkedlist
+T* CLinkedList_template::Detach(T* p)
+{
+	RemoveOrDetach(p, true);
+	return p;
+}
+
+template_linkedlist
+void CLinkedList_template::Remove(T* p)
+{
+	RemoveOrDetach(p, false);
+}
+
+template_linkedlist
+void CLinkedList_template::RemoveOrDetach(T* p, bool bDetach)
+{
+	ASSERT(p!=NULL);
+	ASSERT(Contains(p));
+
+	// Update iterate position
+	if (IsBeforeIteratePos(p))
+	{
+		if (m_iIterPos==m_iSize-2)
+		{
+			// New iterate position will be last, clear iterate position
+			m_pIterElem=NULL;
+		}
+		else
+		{
+			// Move iterate position forward...
+			m_pIterElem=GetNext(m_pIterElem);
+		}
+	}
+
+	// Deleting current item?
+	if (p==m_pCurrent)
+	{
+		if (m_bLastIterForward)
+			m_pCurrent=m_pCurrent==m_pFirst ? NULL : chainmember(m_pCurrent).m_pPrev;
+		else
+			m_pCurrent=chainmember(m_pCurrent).m_pNext;
+	}
+
+	if (m_pFirst==p)
+		{
+		// Removing first element
+
+		// Only remaining item?
+		if (chainmember(m_pFirst).m_pPrev==m_pFirst)
+			{
+			// Empty list
+			m_pFirst=NULL;
+			}
+		else
+			{
+			ASSERT(chainmember(m_pFirst).m_pNext);
+
+			// Maintain the last item pointer...
+			chainmember(chainmember(m_pFirst).m_pNext).m_pPrev=chainmember(m_pFirst).m_pPrev;
+			m_pFirst=chainmember(m_pFirst).m_pNext;
+			}
+		}
+	else if (chainmember(m_pFirst).m_pPrev==p)
+		{
+		// Clear previous item's next pointer
+		chainmember(chainmember(p).m_pPrev).m_pNext=NULL;
+
+		// Store the new last element
+		chainmember(m_pFirst).m_pPrev=chainmember(p).m_pPrev;
+		}
+	else
+		{
+		// Removing internal element
+		ASSERT(chainmember(p).m_pPrev!=NULL);
+		ASSERT(chainmember(p).m_pNext!=NULL);
+		chainmember(chainmember(p).m_pPrev).m_pNext=chainmember(p).m_pNext;
+		chainmember(chainmember(p).m_pNext).m_pPrev=chainmember(p).m_pPrev;
+		}
+
+
+#ifdef _DEBUG
+	chainmember(p).m_pNext=NULL;
+	chainmember(p).m_pPrev=NULL;
+#endif
+
+	if (bDetach)
+		TSem::OnDetach(p, this);
+	else
+		TSem::OnRemove(p, this);
+
+	m_iSize--;
+}
+
+template_linkedlist
+void CLinkedList_template::RemoveAll()
+{
+	while (m_pFirst)
+	{
+		Remove(m_pFirst);
+	}
+	m_pIterElem=NULL;
+}
+
+template_linkedlist
+bool CLinkedList_template::Contains(T* p) const
+{
+	T* pIter=m_pFirst;
+	while (pIter)
+		{
+		if (pIter==p)
+			return true;
+		pIter=chainmember(pIter).m_pNext;
+		}
+	return false;
+}
+
+template_linkedlist
+bool CLinkedList_template::IsEmpty() const
+{
+	return m_iSize==0;
+}
+
+template_linkedlist
+int CLinkedList_template::GetSize() const
+{
+	return m_iSize;
+}
+
+template_linkedlist
+T* CLinkedList_template::GetFirst() const
+{
+	return m_pFirst;
+}
+
+template_linkedlist
+T* CLinkedList_template::GetLast() const
+{
+	return m_pFirst ? chainmember(m_pFirst).m_pPrev : NULL;
+}
+
+template_linkedlist
+T* CLinkedList_template::GetNext(T* p) const
+{
+	ASSERT(Contains(p));
+	return chainmember(p).m_pNext;
+}
+
+template_linkedlist
+T* CLinkedList_template::GetPrevious(T* p) const
+{
+	ASSERT(Contains(p));
+	if (p==m_pFirst)
+		return NULL;
+	else
+		return chainmember(p).m_pPrev;
+}
+
+template_linkedlist
+typename CLinkedList_template::CIterator CLinkedList_template::begin() const
+{
+	return CIterator(this, m_pFirst);
+}
+
+template_linkedlist
+typename CLinkedList_template::CIterator CLinkedList_template::end() const
+{
+	return CIterator(this, NULL);
+}
+
+// Unchecked versions of GetNext/GetPrevious for the iterator (no Contains
+// assert, and ChainPrev wraps from first to last)
+template_linkedlist
+T* CLinkedList_template::ChainNext(T* p)
+{
+	return chainmember(p).m_pNext;
+}
+
+template_linkedlist
+T* CLinkedList_template::ChainPrev(T* p)
+{
+	return chainmember(p).m_pPrev;
+}
+
+
+template_linkedlist
+bool CLinkedList_template::IsEOF() const
+{
+	return m_pFirst==NULL || (m_pCurrent==NULL && m_bLastIterForward);
+}
+
+
+template_linkedlist
+bool CLinkedList_template::IsBOF() const
+{
+	return m_pFirst==NULL || (m_pCurrent==NULL && !m_bLastIterForward);
+}
+
+
+template_linkedlist
+void CLinkedList_template::MoveFirst()
+{
+	m_pCurrent=m_pFirst;
+	m_bLastIterForward=true;
+}
+
+
+template_linkedlist
+void CLinkedList_template::MoveLast()
+{
+	m_pCurrent=GetLast();
+	m_bLastIterForward=false;
+}
+
+
+template_linkedlist
+void CLinkedList_template::MoveNext()
+{
+	if (m_pCurrent)
+		m_pCurrent=chainmember(m_pCurrent).m_pNext;
+	else
+		if (m_bLastIterForward)
+			m_pCurrent=m_pFirst;
+	m_bLastIterForward=true;
+}
+
+template_linkedlist
+void CLinkedList_template::MovePrevious()
+{
+	if (m_pCurrent)
+	{
+		if (m_pCurrent==m_pFirst)
+			m_pCurrent=NULL;
+		else
+			m_pCurrent=chainmember(m_pCurrent).m_pPrev;
+	}
+	else
+		if (!m_bLastIterForward)
+			m_pCurrent=GetLast();
+	m_bLastIterForward=false;
+}
+
+template_linkedlist
+T* CLinkedList_template::Current() const
+{
+	ASSERT(m_pCurrent!=NULL);
+	return m_pCurrent;
+}
+
+
+template_linkedlist
+T* CLinkedList_template::GetAt(int iPos) const
+{
+	ASSERT(iPos>=0 && iPos<GetSize());
+
+	// First
+	if (iPos==0)
+	{
+		m_pIterElem=NULL;
+		m_iIterPos=-1;
+		return GetFirst();
+	}
+
+	// Second?
+	if (iPos==1)
+	{
+		m_iIterPos=1;
+		return m_pIterElem=GetNext(GetFirst());
+	}
+
+	// Last?
+	if (iPos==m_iSize-1)
+	{
+		m_pIterElem=NULL;
+		m_iIterPos=-1;
+		return GetLast();
+	}
+
+	// Second last?
+	if (iPos==m_iSize-2)
+	{
+		m_iIterPos=iPos;
+		return m_pIterElem=GetPrevious(GetLast());
+	}
+
+	// Check for next/prev/current from current iterate position
+	if (m_pIterElem)
+	{
+		if (iPos==m_iIterPos)
+		{
+			return m_pIterElem;
+		}
+		if (iPos==m_iIterPos+1)
+		{
+			m_iIterPos=iPos;
+			return m_pIterElem=GetNext(m_pIterElem);
+		}
+		if (iPos==m_iIterPos-1)
+		{
+			m_iIterPos=iPos;
+			return m_pIterElem=GetPrevious(m_pIterElem);
+		}
+	}
+
+	int iDistanceFromIterPos=abs(m_iIterPos-iPos);
+	int iDistanceFromStart=iPos;
+	int iDistanceFromEnd=(m_iSize-1)-iPos;
+
+	if (m_pIterElem && iDistanceFromIterPos<iDistanceFromEnd && iDistanceFromIterPos<iDistanceFromEnd)
+	{
+		while (m_iIterPos<iPos)
+		{
+			m_pIterElem=chainmember(m_pIterElem).m_pNext;
+			m_iIterPos++;
+		}
+		while (m_iIterPos>iPos)
+		{
+			m_pIterElem=chainmember(m_pIterElem).m_pPrev;
+			m_iIterPos--;
+		}
+	}
+	else
+	{
+		if (iDistanceFromStart<iDistanceFromEnd)
+		{
+			m_pIterElem=m_pFirst;
+			for (int i=0; i<iPos; i++)
+				m_pIterElem=chainmember(m_pIterElem).m_pNext;
+		}
+		else
+		{
+			m_pIterElem=GetLast();
+			for (int i=0; i<iDistanceFromEnd; i++)
+			{
+				m_pIterElem=chainmember(m_pIterElem).m_pPrev;
+			}
+		}
+	}
+
+	// Done
+	m_iIterPos=iPos;
+	return m_pIterElem;
+}
+
+template_linkedlist
+T* CLinkedList_template::operator[](int iPos) const
+{
+	return GetAt(iPos);
+}
+
+// Stack operators
+template_linkedlist
+void CLinkedList_template::Push(T* val)
+{
+	Add(val);
+}
+
+template_linkedlist
+bool CLinkedList_template::Pop(T*& val)
+{
+	if (IsEmpty())
+	{
+		val=NULL;
+		return false;
+	}
+	else
+	{
+		val=Detach(GetLast());
+		return true;
+	}
+
+}
+
+template_linkedlist
+T* CLinkedList_template::Pop()
+{
+	T* p;
+	Pop(p);
+	return p;
+}
+
+template_linkedlist
+bool CLinkedList_template::Top(T*& val) const
+{
+	if (IsEmpty())
+	{
+		val=NULL;
+		return false;
+	}
+	else
+	{
+		val=GetLast();
+		return true;
+	}
+}
+
+template_linkedlist
+T* CLinkedList_template::Top() const
+{
+	return GetLast();
+}
+
+template_linkedlist
+void CLinkedList_template::Enqueue(T* val)
+{
+	Add(val);
+}
+
+template_linkedlist
+bool CLinkedList_template::Dequeue(T*& val)
+{
+	if (IsEmpty())
+	{
+		val=NULL;
+		return false;
+	}
+	else
+	{
+		val=Detach(GetFirst());
+		return true;
+	}
+}
+
+template_linkedlist
+T* CLinkedList_template::Dequeue()
+{
+	T* p;
+	Dequeue(p);
+	return p;
+}
+
+template_linkedlist
+T* CLinkedList_template::Peek() const
+{
+	return GetFirst();
+}
+
+template_linkedlist
+bool CLinkedList_template::Peek(T*& val) const
+{
+	val=GetFirst();
+	return !IsEmpty();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// CPlex implementation
+
+// Constructor
+template <class T, class TAlloc>
+CPlex<T,TAlloc>::CPlex(int iBlockSize)
+{
+	if (iBlockSize==-1)
+	{
+		iBlockSize=(256-sizeof(BLOCK))/ITEM_SIZE;
+	}
+
+	if (iBlockSize<4)
+		iBlockSize=4;
+
+	m_iBlockSize=iBlockSize;
+
+	m_pHead=NULL;
+	m_pFreeList=NULL;
+	m_iCount=0;
+#ifdef SIMPLELIB_ALLOC_STATS
+	m_iStatsCategory=CAllocStats::catPlex;
+#endif
+}
+
+// Destructor
+template <class T, class TAlloc>
+CPlex<T,TAlloc>::~CPlex()
+{
+	FreeAll();
+}
+
+// Allocate a new item
+template <class T, class TAlloc>
+T* CPlex<T,TAlloc>::Alloc()
+{
+	// If no free list, create a new block
+	if (!m_pFreeList)
+		{
+		// Allocate a new block
+		BLOCK* pNewBlock=(BLOCK*)TAlloc::Alloc(sizeof(BLOCK) + m_iBlockSize * ITEM_SIZE);
+		SIMPLELIB_STAT_ALLOC(m_iStatsCategory, sizeof(BLOCK) + m_iBlockSize * ITEM_SIZE);
+
+		// Add to list of blocks
+		pNewBlock->m_pNext=m_pHead;
+		m_pHead=pNewBlock;
+
+		// Setup free list chain
+		m_pFreeList=(FREEITEM*)&pNewBlock->m_bData[0];
+		FREEITEM* p=m_pFreeList;
+		for (int i=0; i<m_iBlockSize-1; i++)
+			{
+			p->m_pNext=reinterpret_cast<FREEITEM*>(reinterpret_cast<char*>(p)+ITEM_SIZE);
+			p=p->m_pNext;
+			}
+
+		// NULL terminate the list
+		p->m_pNext=NULL;
+		}
+
+	// Remove top item from the free list
+	T* p=(T*)m_pFreeList;
+	m_pFreeList=m_pFreeList->m_pNext;
+
+	// Update count
+	m_iCount++;
+
+	new ((void*)p) T;
+
+	// Return pointer
+	return (T*)p;
+}
+
+template <class T, class TAlloc>
+void CPlex<T,TAlloc>::Free(T* p)
+{
+	ASSERT(m_iCount>0);
+
+	Destructor(p);
+
+	if (m_iCount==1)
+		{
+		// When freeing last item, free everything!
+		FreeAll();
+		}
+	else
+		{
+		// Add to list of free items
+		FREEITEM* pNewFreeItem=(FREEITEM*)p;
+		pNewFreeItem->m_pNext=m_pFreeList;
+		m_pFreeList=pNewFreeItem;
+
+		// Update count
+		m_iCount--;
+		}
+}
+
+template <class T, class TAlloc>
+void CPlex<T,TAlloc>::FreeAll()
+{
+	// Release all blocks
+	BLOCK* pBlock=m_pHead;
+	while (pBlock)
+		{
+		// Save next
+		BLOCK* pNext=pBlock->m_pNext;
+
+		// Free it
+		SIMPLELIB_STAT_FREE(m_iStatsCategory, sizeof(BLOCK) + m_iBlockSize * ITEM_SIZE);
+		TAlloc::Free(pBlock);
+
+		// Move on
+		pBlock=pNext;
+		}
+
+	// Reset state
+	m_pHead=NULL;
+	m_pFreeList=NULL;
+	m_iCount=0;
+}
+
+template <class T, class TAlloc>
+int CPlex<T,TAlloc>::GetCount() const
+{
+	return m_iCount;
+}
+
+template <class T, class TAlloc>
+void CPlex<T,TAlloc>::SetBlockSize(int iNewBlockSize)
+{
+	ASSERT(m_pHead==NULL && "SetBlockSize only support when plex is empty");
+	m_iBlockSize=iNewBlockSize;
+}
+
+#ifdef SIMPLELIB_ALLOC_STATS
+template <class T, class TAlloc>
+void CPlex<T,TAlloc>::SetStatsCategory(int iCategory)
+{
+	ASSERT(m_pHead==NULL && "SetStatsCategory only support when plex is empty");
+	m_iStatsCategory=iCategory;
+}
+#endif
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CMap implementation
+
+// Constructor
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::CMap() :
+	m_pRoot(&m_Leaf),
+	m_iSize(0)
+{
+	m_Leaf.m_pParent = NULL;
+	m_Leaf.m_pLeft= &m_Leaf;
+	m_Leaf.m_pRight = &m_Leaf;
+	m_Leaf.m_bRed = false;
+	m_iIterPos=-1;
+	m_pIterNode=NULL;
+}
+
+// Destructor
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::~CMap()
+{
+	FreeNode(m_pRoot);
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+inline int CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::GetSize() const
+{
+	return m_iSize;
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+inline typename CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::CIterator CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::begin() const
+{
+	return CIterator(this, m_pFirst);
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+inline typename CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::CIterator CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::end() const
+{
+	return CIterator(this, NULL);
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+inline bool CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::IsEmpty() const
+{
+	return m_iSize==0;
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+typename CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::CKeyPair CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::operator[](int iIndex) const
+{
+	ASSERT(iIndex>=0 && iIndex<m_iSize);
+#ifdef _DEBUG_CHECKS
+	CheckAll();
+#endif
+
+	if (iIndex==0)
+	{
+		m_iIterPos=0;
+		m_pIterNode=m_pFirst;
+		return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
+	}
+
+	if (iIndex==m_iSize-1)
+	{
+		m_iIterPos=m_iSize-1;
+		m_pIterNode=m_pLast;
+		return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
+	}
+
+	if (iIndex==m_iIterPos)
+	{
+		return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
+	}
+
+	if (iIndex==m_iIterPos+1)
+	{
+		m_iIterPos=iIndex;
+		m_pIterNode=m_pIterNode->m_pNext;
+		return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
+	}
+
+	if (iIndex==m_iIterPos-1)
+	{
+		m_iIterPos=iIndex;
+		m_pIterNode=m_pIterNode->m_pPrev;
+		return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
+	}
+
+	int iDistanceFromIterPos=abs(m_iIterPos-iIndex);
+	int iDistanceFromStart=iIndex;
+	int iDistanceFromEnd=(m_iSize-1)-iIndex;
+
+	if (m_iIterPos>=0 && iDistanceFromIterPos<iDistanceFromEnd && iDistanceFromIterPos<iDistanceFromEnd)
+	{
+		while (m_iIterPos<iIndex)
+		{
+			m_pIterNode=m_pIterNode->m_pNext;
+			m_iIterPos++;
+		}
+		while (m_iIterPos>iIndex)
+		{
+			m_pIterNode=m_pIterNode->m_pPrev;
+			m_iIterPos--;
+		}
+	}
+	else
+	{
+		if (iDistanceFromStart<iDistanceFromEnd)
+		{
+			m_pIterNode=m_pFirst;
+			for (int i=0; i<iIndex; i++)
+				m_pIterNode=m_pIterNode->m_pNext;
+		}
+		else
+		{
+			m_pIterNode=m_pLast;
+			for (int i=0; i<iDistanceFromEnd; i++)
+			{
+				m_pIterNode=m_pIterNode->m_pPrev;
+			}
+		}
+	}
+
+	m_iIterPos=iIndex;
+
+#ifdef _DEBUG_CHECKS
+	CheckAll();
+#endif
+	return CKeyPair(m_pIterNode->m_KeyPair.m_Key, m_pIterNode->m_KeyPair.m_Value);
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::Add(const TKey& Key, const TValue& Value)
+{
+	CNode* pNode = m_pRoot;
+	CNode* pParent = NULL;
+
+	int iCompare=0;
+	while (pNode != &m_Leaf)
+	{
+		pParent = pNode;
+		iCompare = TKeySem::Compare(Key, pNode->m_KeyPair.m_Key);
+
+		if (iCompare < 0)
+			pNode = pNode->m_pLeft;
+		else if (iCompare > 0)
+			pNode = pNode->m_pRight;
+		else
+		{
+			// Found a duplicate, replace it. We replace the key too, since
+			// equivalence is not always exact (e.g. case insensitive strings)
+			TKeySem::OnRemove(pNode->m_KeyPair.m_Key, this);
+			TValueSem::OnRemove(pNode->m_KeyPair.m_Value, this);
+			pNode->m_KeyPair.m_Value = TValueSem::OnAdd(Value, this);
+			pNode->m_KeyPair.m_Key = TKeySem::OnAdd(Key, this);
+			#ifdef _DEBUG_CHECKS
+			CheckAll();
+			#endif
+			return;
+		}
+	}
+
+	CNode* pNew = m_NodePlex.Alloc();
+	pNew->m_pParent = pParent;
+	pNew->m_pLeft = &m_Leaf;
+	pNew->m_pRight = &m_Leaf;
+	pNew->m_bRed = true;
+	pNew->m_KeyPair.m_Value = TValueSem::OnAdd(Value, this);
+	pNew->m_KeyPair.m_Key = TKeySem::OnAdd(Key, this);
+
+	if (pParent)
+	{
+		if (iCompare<0)
+		{
+			pParent->m_pLeft = pNew;
+			pNew->m_pNext=pParent;
+			pNew->m_pPrev=pParent->m_pPrev;
+		}
+		else if (iCompare>0)
+		{
+			pParent->m_pRight = pNew;
+			pNew->m_pPrev=pParent;
+			pNew->m_pNext=pParent->m_pNext;
+		}
+		else
+		{
+			ASSERT(false);
+		}
+	}
+	else
+	{
+		m_pRoot = pNew;
+		pNew->m_pPrev=NULL;
+		pNew->m_pNext=NULL;
+	}
+
+	// Fix up traverse links
+	if (pNew->m_pPrev)
+		pNew->m_pPrev->m_pNext=pNew;
+	else
+		m_pFirst=pNew;
+
+	if (pNew->m_pNext)
+		pNew->m_pNext->m_pPrev=pNew;
+	else
+		m_pLast=pNew;
+
+	if (m_pIterNode)
+	{
+		int iCompare=TKeySem::Compare(Key, m_pIterNode->m_KeyPair.m_Key);
+
+		ASSERT(iCompare!=0);
+
+		// If the new key is before the current iterate position, update the iterate position
+		if (iCompare<0)
+		{
+			m_pIterNode=m_pIterNode->m_pPrev;
+		}
+	}
+
+	// Now rebalance the tree.
+
+	pNode = pNew;
+
+	while (pNode != m_pRoot && pNode->m_pParent->m_bRed)
+	{
+		pParent = pNode->m_pParent;
+		CNode* pGrandParent = pParent->m_pParent;
+
+		if (pParent == pGrandParent->m_pLeft)
+		{
+			CNode* pUncle = pGrandParent->m_pRight;
+
+			if (pUncle->m_bRed)
+			{
+				pParent->m_bRed = false;
+				pUncle->m_bRed = false;
+				pGrandParent->m_bRed = true;
+				pNode = pGrandParent;
+			}
+			else
+			{
+				if (pNode == pParent->m_pRight)
+				{
+					pNode = pParent;
+					RotateLeft(pNode);
+				}
+
+				pNode->m_pParent->m_bRed = false;
+				pNode->m_pParent->m_pParent->m_bRed = true;
+				RotateRight(pNode->m_pParent->m_pParent);
+			}
+		}
+		else
+		{
+			CNode* pUncle = pGrandParent->m_pLeft;
+
+			if (pUncle->m_bRed)
+			{
+				pParent->m_bRed = false;
+				pUncle->m_bRed = false;
+				pGrandParent->m_bRed = true;
+				pNode = pGrandParent;
+			}
+			else
+			{
+				if (pNode == pParent->m_pLeft)
+				{
+					pNode = pParent;
+					RotateRight(pNode);
+				}
+
+				pNode->m_pParent->m_bRed = false;
+				pNode->m_pParent->m_pParent->m_bRed = true;
+				RotateLeft(pNode->m_pParent->m_pParent);
+			}
+		}
+	}
+
+	m_pRoot->m_bRed = false;
+	m_iSize++;
+
+	#ifdef _DEBUG_CHECKS
+	CheckAll();
+	#endif
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::Remove(const TKeyArg& Key)
+{
+	RemoveOrDetach(Key, NULL);
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+TValue CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::Detach(const TKeyArg& Key)
+{
+	TValue val;
+	RemoveOrDetach(Key, &val);
+	return val;
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+const TValue& CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::Get(const TKeyArg& Key, const TValue& Default) const
+{
+	CNode* pNode=FindNode(Key);
+	if (!pNode)
+		return Default;
+
+	return pNode->m_KeyPair.m_Value;
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+bool CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::Find(const TKeyArg& Key, TValue& Value) const
+{
+	CNode* pNode=FindNode(Key);
+	if (!pNode)
+		return false;
+	Value=pNode->m_KeyPair.m_Value;
+	return true;
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+bool CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::HasKey(const TKeyArg& Key) const
+{
+	return FindNode(Key)!=NULL;
+}
+
+
+
+
+#ifdef _DEBUG
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::CheckAll()
+{
+	CheckTree();
+	CheckChain();
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::CheckChain()
+{
+	if (m_pFirst)
+	{
+		ASSERT(m_pFirst->m_pPrev==NULL);
+		ASSERT(m_pLast!=NULL);
+		ASSERT(m_pLast->m_pNext==NULL);
+
+		int i=0;
+		CNode* pNode=m_pFirst;
+		while (pNode)
+		{
+			if (pNode->m_pPrev)
+			{
+				ASSERT(pNode->m_pPrev->m_pNext==pNode);
+			}
+			else
+			{
+				ASSERT(pNode==m_pFirst);
+			}
+
+			if (pNode->m_pNext)
+			{
+				// Check order
+				int iCompare=TKeySem::Compare(pNode->m_KeyPair.m_Key, pNode->m_pNext->m_KeyPair.m_Key);
+				ASSERT(iCompare<0);
+
+				ASSERT(pNode->m_pNext->m_pPrev==pNode);
+			}
+			else
+			{
+				ASSERT(pNode==m_pLast);
+			}
+
+			if (i==m_iIterPos)
+			{
+				ASSERT(m_pIterNode==pNode);
+			}
+
+			pNode=pNode->m_pNext;
+			i++;
+		}
+
+		if (m_iIterPos>=0)
+		{
+			ASSERT(m_pIterNode!=NULL);
+		}
+
+
+		ASSERT(i==m_iSize);
+	}
+
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+bool CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::CheckTree(CNode* pNode)
+{
+	int lh = 1, rh = 1;
+
+	if (!pNode)
+		pNode = m_pRoot;
+
+	if (pNode->m_pLeft != &m_Leaf)
+		lh = CheckTree(pNode->m_pLeft);
+
+	if (pNode->m_pRight != &m_Leaf)
+		rh = CheckTree(pNode->m_pRight);
+
+	ASSERT(lh == rh);
+
+	return !!(lh + !pNode->m_bRed);
+}
+#endif
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::FreeNode(CNode* pNode)
+{
+	if (pNode && pNode!=&m_Leaf)
+	{
+		FreeNode(pNode->m_pLeft);
+		FreeNode(pNode->m_pRight);
+		TKeySem::OnRemove(pNode->m_KeyPair.m_Key, this);
+		TValueSem::OnRemove(pNode->m_KeyPair.m_Value, this);
+		m_NodePlex.Free(pNode);
+	}
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+typename CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::CNode* CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::nextNode(CNode* pNode)
+{
+	if (pNode->m_pRight != &m_Leaf)
+	{
+		pNode = pNode->m_pRight;
+
+		while (pNode->m_pLeft != &m_Leaf)
+			pNode = pNode->m_pLeft;
+
+		return pNode;
+	}
+
+	CNode* pParent = pNode->m_pParent;
+
+	while (pParent != &m_Leaf && pNode == &m_Leaf)
+	{
+		pNode = pParent;
+		pParent = pParent->m_pParent;
+	}
+
+	return pParent;
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::RotateLeft(CNode* x)
+{
+	CNode* parent = m_Leaf.m_pParent;
+	CNode* y = x->m_pRight;
+
+	// Turn y's left subtree into x's right subtree
+
+	x->m_pRight = y->m_pLeft;
+	x->m_pRight->m_pParent = x;
+
+	// Link x's parent to y
+
+	y->m_pParent = x->m_pParent;
+
+	if (x != m_pRoot)
+	{
+		if (x->m_pParent->m_pLeft == x)
+			x->m_pParent->m_pLeft = y;
+		else
+			x->m_pParent->m_pRight = y;
+	}
+	else
+		m_pRoot = y;
+
+	// Put x on y's left
+
+	y->m_pLeft = x;
+	x->m_pParent = y;
+	m_Leaf.m_pParent = parent;
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::RotateRight(CNode* y)
+{
+	CNode* parent = m_Leaf.m_pParent;
+	CNode* x = y->m_pLeft;
+
+	// Turn x's right subtree into y's left subtree
+
+	y->m_pLeft = x->m_pRight;
+	y->m_pLeft->m_pParent = y;
+
+	// Link y's parent to x
+
+	x->m_pParent = y->m_pParent;
+
+	if (y != m_pRoot)
+	{
+		if (y->m_pParent->m_pLeft == y)
+			y->m_pParent->m_pLeft = x;
+		else
+			y->m_pParent->m_pRight = x;
+	}
+	else
+		m_pRoot = x;
+
+	// Put y on x's right
+
+	x->m_pRight = y;
+	y->m_pParent = x;
+	m_Leaf.m_pParent = parent;
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::RemoveOrDetach(const TKeyArg& Key, TValue* pvalDetached)
+{
+
+#ifdef _DEBUG_CHECKS
+	CheckAll();
+#endif
+
+	CNode* z = m_pRoot;
+
+	while (z != &m_Leaf)
+	{
+		int iCompare = TKeySem::Compare(Key, z->m_KeyPair.m_Key);
+
+		if (iCompare < 0)
+			z = z->m_pLeft;
+		else if (iCompare > 0)
+			z = z->m_pRight;
+		else
+			break;
+	}
+
+	if (z == &m_Leaf)
+		return;
+
+	CNode* y = (z->m_pLeft == &m_Leaf || z->m_pRight == &m_Leaf) ?	z : nextNode(z);
+
+	CNode* x = (y->m_pLeft != &m_Leaf) ? y->m_pLeft : y->m_pRight;
+
+	// Ensure that x->m_pParent is correct.
+	// This is needed in case x == &m_Leaf
+
+	x->m_pParent = y->m_pParent;
+
+	if (y != m_pRoot)
+	{
+		if (y->m_pParent->m_pLeft == y)
+			y->m_pParent->m_pLeft = x;
+		else
+			y->m_pParent->m_pRight = x;
+	}
+	else
+		m_pRoot = x;
+
+
+	if (m_pIterNode)
+	{
+		int iCompare=TKeySem::Compare(Key, m_pIterNode->m_KeyPair.m_Key);
+		if (iCompare<=0)
+		{
+			m_pIterNode=m_pIterNode->m_pNext;
+		}
+	}
+
+	TKeySem::OnRemove(z->m_KeyPair.m_Key, this);
+	if (!pvalDetached)
+	{
+		TValueSem::OnRemove(z->m_KeyPair.m_Value, this);
+	}
+	else
+	{
+		TValueSem::OnDetach(z->m_KeyPair.m_Value, this);
+		*pvalDetached=z->m_KeyPair.m_Value;
+	}
+
+
+	if (y != z)
+	{
+		// deleting value in z, but keeping z node and moving value from y node
+		z->m_KeyPair.m_Key = y->m_KeyPair.m_Key;
+		z->m_KeyPair.m_Value = y->m_KeyPair.m_Value;
+		z->m_pNext = y->m_pNext;
+		if (z->m_pNext)
+			z->m_pNext->m_pPrev=z;
+		else
+			m_pLast=z;
+
+		if (m_pIterNode==y)
+			m_pIterNode=z;
+	}
+	else
+	{
+		// Update linked list
+		if (z->m_pPrev)
+			z->m_pPrev->m_pNext=z->m_pNext;
+		else
+			m_pFirst=z->m_pNext;
+
+		if (z->m_pNext)
+			z->m_pNext->m_pPrev=z->m_pPrev;
+		else
+			m_pLast=z->m_pPrev;
+
+		if (m_pIterNode==z)
+		{
+			m_pIterNode=m_pIterNode->m_pNext;
+			if (!m_pIterNode)
+			{
+				m_iIterPos=-1;
+			}
+		}
+	}
+
+	// Rebalance the tree (see page 274 of Introduction to Algorithms)
+
+	if (!y->m_bRed)
+	{
+		CNode* pNode = x;
+
+		while (pNode != m_pRoot && !pNode->m_bRed)
+		{
+			if (pNode == pNode->m_pParent->m_pLeft)
+			{
+				CNode* pSibling = pNode->m_pParent->m_pRight;
+
+				if (pSibling->m_bRed)
+				{
+					// Case 1: Sibling is m_bRed
+					pSibling->m_bRed = false;
+					pNode->m_pParent->m_bRed = true;
+					RotateLeft(pNode->m_pParent);
+					pSibling = pNode->m_pParent->m_pRight;
+				}
+				if (!pSibling->m_pLeft->m_bRed && !pSibling->m_pRight->m_bRed)
+				{
+					// Case 2: Sibling and its children are all black
+					pSibling->m_bRed = true;
+					pNode = pNode->m_pParent;
+					continue;
+				}
+				else if (!pSibling->m_pRight->m_bRed)
+				{
+					// Case 3: Sibling and its right child are both black
+					pSibling->m_pLeft->m_bRed = false;
+					pSibling->m_bRed = true;
+					RotateRight(pSibling);
+					pSibling = pNode->m_pParent->m_pRight;
+				}
+
+				// Case 4: Sibling and its left child are both black
+				pSibling->m_bRed = pNode->m_pParent->m_bRed;
+				pNode->m_pParent->m_bRed = false;
+				pSibling->m_pRight->m_bRed = false;
+				RotateLeft(pNode->m_pParent);
+				pNode = m_pRoot;
+			}
+			else
+			{
+				CNode* pSibling = pNode->m_pParent->m_pLeft;
+
+				if (pSibling->m_bRed)
+				{
+					// Case 5: Sibling is m_bRed
+					pSibling->m_bRed = false;
+					pNode->m_pParent->m_bRed = true;
+					RotateRight(pNode->m_pParent);
+					pSibling = pNode->m_pParent->m_pLeft;
+				}
+				if (!pSibling->m_pLeft->m_bRed && !pSibling->m_pRight->m_bRed)
+				{
+					// Case 6: Sibling and its children are all black
+					pSibling->m_bRed = true;
+					pNode = pNode->m_pParent;
+					continue;
+				}
+				else if (!pSibling->m_pLeft->m_bRed)
+				{
+					// Case 7: Sibling and its left child are both black
+					pSibling->m_pRight->m_bRed = false;
+					pSibling->m_bRed = true;
+					RotateLeft(pSibling);
+					pSibling = pNode->m_pParent->m_pLeft;
+				}
+
+				// Case 8: Sibling and its right child are both black
+				pSibling->m_bRed = pNode->m_pParent->m_bRed;
+				pNode->m_pParent->m_bRed = false;
+				pSibling->m_pLeft->m_bRed = false;
+				RotateRight(pNode->m_pParent);
+				pNode = m_pRoot;
+			}
+		}
+
+		pNode->m_bRed = false;
+	}
+
+	m_NodePlex.Free(y);
+	m_iSize--;
+
+	#ifdef _DEBUG_CHECKS
+	CheckAll();
+	#endif
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::RemoveAll()
+{
+	FreeNode(m_pRoot);
+	m_pRoot = &m_Leaf;
+	m_pFirst = NULL;
+	m_pLast = NULL;
+	m_iSize = 0;
+	m_iIterPos=-1;
+	m_pIterNode=NULL;
+
+	#ifdef _DEBUG_CHECKS
+	CheckAll();
+	#endif
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+typename CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::CNode* CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>::FindNode(const TKeyArg& Key) const
+{
+	CNode* pNode = m_pRoot;
+
+	while (pNode != &m_Leaf)
+	{
+		int iCompare = TKeySem::Compare(Key, pNode->m_KeyPair.m_Key);
+
+		if (iCompare < 0)
+			pNode = pNode->m_pLeft;
+		else if (iCompare > 0)
+			pNode = pNode->m_pRight;
+		else
+			return pNode;
+	}
+
+	return NULL;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Hashing routines
+
+/*
+* SuperFastHash.cpp
+* Copyright 2004-2007 by Paul Hsieh
+* http://www.azillionmonkeys.com/qed/hash.html
+
+  This code is covered by Paul Hsieh derivative licence
+    http://www.azillionmonkeys.com/qed/license-derivative.html
+*/
+
+
+#undef get16bits
+#if (defined(__GNUC__) && defined(__i386__)) || defined(__WATCOMC__) \
+	|| defined(_MSC_VER) || defined (__BORLANDC__) || defined (__TURBOC__)
+#define get16bits(d) (*((const unsigned short *) (d)))
+#endif
+
+#if !defined (get16bits)
+#define get16bits(d) ((((unsigned long)(((const uint8_t *)(d))[1])) << 8)\
+	+(unsigned long)(((const uint8_t *)(d))[0]) )
+#endif
+
+inline unsigned long SuperFastHash (const char * data, int len) {
+	unsigned long hash = len, tmp;
+	int rem;
+
+	if (len <= 0 || data == NULL) return 0;
+
+	rem = len & 3;
+	len >>= 2;
+
+	/* Main loop */
+	for (;len > 0; len--) {
+		hash  += get16bits (data);
+		tmp    = (get16bits (data+2) << 11) ^ hash;
+		hash   = (hash << 16) ^ tmp;
+		data  += 2*sizeof (unsigned short);
+		hash  += hash >> 11;
+	}
+
+	/* Handle end cases */
+	switch (rem) {
+	case 3: hash += get16bits (data);
+		hash ^= hash << 16;
+		hash ^= data[sizeof (unsigned short)] << 18;
+		hash += hash >> 11;
+		break;
+	case 2: hash += get16bits (data);
+		hash ^= hash << 11;
+		hash += hash >> 17;
+		break;
+	case 1: hash += *data;
+		hash ^= hash << 10;
+		hash += hash >> 1;
+	}
+
+	/* Force "avalanching" of final 127 bits */
+	hash ^= hash << 3;
+	hash += hash >> 5;
+	hash ^= hash << 4;
+	hash += hash >> 17;
+	hash ^= hash << 25;
+	hash += hash >> 6;
+
+	return hash;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CHashMap
+
+// Minimum hash table size - must be a power of two
+#define MIN_TABLE_SIZE	64
+#define REALLOC_PERCENT	70
+
+
+// Constructor
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::CHashMap(int iInitialSize) :
+	m_iInitialSize(iInitialSize)
+{
+#ifdef SIMPLELIB_ALLOC_STATS
+	m_NodePlex.SetStatsCategory(CAllocStats::catHashMap);
+	m_Table.SetStatsCategory(CAllocStats::catHashMap);
+#endif
+}
+
+// Destructor
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::~CHashMap()
+{
+	RemoveAll();
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+inline int CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::GetSize() const
+{
+	return m_List.GetSize();
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+inline typename CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::CIterator CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::begin() const
+{
+	return CIterator(m_List.begin());
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+inline typename CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::CIterator CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::end() const
+{
+	return CIterator(m_List.end());
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+inline bool CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::IsEmpty() const
+{
+	return m_List.IsEmpty();
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+typename CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::CKeyPair CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::operator[](int iIndex) const
+{
+	ASSERT(iIndex>=0 && iIndex<m_List.GetSize());
+
+	// Get node from list
+	CNode* pNode=m_List.GetAt(iIndex);
+
+	// Create key pair
+	return CKeyPair(pNode->m_KeyPair.m_Key, pNode->m_KeyPair.m_Value);
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::InitHashTable(int iSize)
+{
+	// Get the first power of two thats as big as the desired size
+	int iTableSize = MIN_TABLE_SIZE;
+	while(iTableSize < iSize)
+		iTableSize <<= 1;
+
+	// Allocate the table
+	m_Table.SetSize(iTableSize, NULL);
+
+	// Pre-calculate constants that are based on the table size
+	m_nHashMask = m_Table.GetSize()-1;
+	m_iThreshold = m_Table.GetSize() * REALLOC_PERCENT / 100;
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::Rehash(int iNewSize)
+{
+	// Resize the table
+	InitHashTable(iNewSize);
+
+	// Clear it
+	memset(m_Table.GetBuffer(), 0, sizeof(CNode*) * iNewSize);
+
+	// Insert each node into the new table
+	CNode* pNode=m_List.GetFirst();
+	while (pNode)
+	{
+		// Hash the key
+		unsigned int nHash = THash::Hash(pNode->m_KeyPair.m_Key) & m_nHashMask;
+
+		// Add to table
+		pNode->m_pHashNext=m_Table[nHash];
+		m_Table.ReplaceAt(nHash, pNode);
+
+		// Get next node
+		pNode=pNode->m_Chain.m_pNext;
+	}
+}
+
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::Add(const TKey& Key, const TValue& Value)
+{
+	// Make sure table created
+	if (!m_Table.GetSize())
+		InitHashTable(m_iInitialSize);
+
+	// Hash the key
+	unsigned int nHash = THash::Hash(Key) & m_nHashMask;
+
+	// Check for duplicate and just replace value if found
+	CNode* pNode=m_Table[nHash];
+	while (pNode)
+	{
+		if (TKeySem::Compare(Key, pNode->m_KeyPair.m_Key)==0)
+		{
+			// Replace value
+			TKeySem::OnRemove(pNode->m_KeyPair.m_Key, this);
+			TValueSem::OnRemove(pNode->m_KeyPair.m_Value, this);
+			pNode->m_KeyPair.m_Value = TValueSem::OnAdd(Value, this);
+			pNode->m_KeyPair.m_Key = TKeySem::OnAdd(Key, this);
+			return;
 		}
+
+		// Next
+		pNode=pNode->m_pHashNext;
 	}
 
-	m_pRoot->m_bRed = false;
-	m_iSize++;
 
-	#ifdef _DEBUG_CHECKS
-	CheckAll();
-	#endif
+	// Create a new node
+	CNode* pNew = m_NodePlex.Alloc();
+	pNew->m_KeyPair.m_Value = TValueSem::OnAdd(Value, this);
+	pNew->m_KeyPair.m_Key = TKeySem::OnAdd(Key, this);
+
+	// Setup collision chain
+	pNew->m_pHashNext=m_Table[nHash];
+	m_Table.ReplaceAt(nHash, pNew);
+
+	/// Add to navigation link
+	m_List.Add(pNew);
+
+	// Time to rehash?
+	if(m_List.GetSize() > m_iThreshold)
+		Rehash(m_Table.GetSize() * 2);
+
+	// Done!
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::Remove(const TKeyArg& Key)
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::Remove(const TKeyArg& Key)
 {
 	RemoveOrDetach(Key, NULL);
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-TValue CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::Detach(const TKeyArg& Key)
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+TValue CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::Detach(const TKeyArg& Key)
 {
 	TValue val;
 	RemoveOrDetach(Key, &val);
 	return val;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-const TValue& CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::Get(const TKeyArg& Key, const TValue& Default) const
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+const TValue& CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::Get(const TKeyArg& Key, const TValue& Default) const
 {
 	CNode* pNode=FindNode(Key);
 	if (!pNode)
@@ -3189,8 +6130,8 @@ const TValue& CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::Get(const TKeyArg
 	return pNode->m_KeyPair.m_Value;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-bool CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::Find(const TKeyArg& Key, TValue& Value) const
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+bool CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::Find(const TKeyArg& Key, TValue& Value) const
 {
 	CNode* pNode=FindNode(Key);
 	if (!pNode)
@@ -3199,921 +6140,1677 @@ bool CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::Find(const TKeyArg& Key, T
 	return true;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-bool CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::HasKey(const TKeyArg& Key) const
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+bool CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::HasKey(const TKeyArg& Key) const
 {
 	return FindNode(Key)!=NULL;
 }
 
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+typename CHashMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, THash, TAlloc>::CNode* CHashMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, THash, TAlloc>::FindNode(const TKeyArg& Key) const
+{
+	if (IsEmpty())
+		return NULL;
 
+	// Hash the key
+	unsigned int nHash = THash::Hash(Key) & m_nHashMask;
 
+	// Check for duplicate and just replace value if found
+	CNode* pNode=m_Table[nHash];
+	while (pNode)
+	{
+		if (TKeySem::Compare(Key, pNode->m_KeyPair.m_Key)==0)
+			return pNode;
 
-#ifdef _DEBUG
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::CheckAll()
-{
-	CheckTree();
-	CheckChain();
+		pNode=pNode->m_pHashNext;
+	}
+
+	return NULL;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::CheckChain()
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::RemoveOrDetach(const TKeyArg& Key, TValue* pvalDetached)
 {
-	if (m_pFirst)
-	{
-		ASSERT(m_pFirst->m_pPrev==NULL);
-		ASSERT(m_pLast!=NULL);
-		ASSERT(m_pLast->m_pNext==NULL);
+	if (IsEmpty())
+		return;
 
-		int i=0;
-		CNode* pNode=m_pFirst;
-		while (pNode)
+	// Hash the key
+	unsigned int nHash = THash::Hash(Key) & m_nHashMask;
+
+	// Check for duplicate and just replace value if found
+	CNode* pNode=m_Table[nHash];
+	CNode* pPrev=NULL;
+	while (pNode)
+	{
+		// Match?
+		if (TKeySem::Compare(Key, pNode->m_KeyPair.m_Key)==0)
 		{
-			if (pNode->m_pPrev)
+			// Do release semantics
+			TKeySem::OnRemove(pNode->m_KeyPair.m_Key, this);
+			if (!pvalDetached)
 			{
-				ASSERT(pNode->m_pPrev->m_pNext==pNode);
+				TValueSem::OnRemove(pNode->m_KeyPair.m_Value, this);
 			}
 			else
 			{
-				ASSERT(pNode==m_pFirst);
+				TValueSem::OnDetach(pNode->m_KeyPair.m_Value, this);
+				*pvalDetached=pNode->m_KeyPair.m_Value;
 			}
 
-			if (pNode->m_pNext)
-			{
-				// Check order
-				int iCompare=TKeySem::Compare(pNode->m_KeyPair.m_Key, pNode->m_pNext->m_KeyPair.m_Key);
-				ASSERT(iCompare<0);
-
-				ASSERT(pNode->m_pNext->m_pPrev==pNode);
-			}
+			// Remove from hash list
+			if (pPrev)
+				pPrev->m_pHashNext=pNode->m_pHashNext;
 			else
-			{
-				ASSERT(pNode==m_pLast);
-			}
+				m_Table.ReplaceAt(nHash, pNode->m_pHashNext);
 
-			if (i==m_iIterPos)
-			{
-				ASSERT(m_pIterNode==pNode);
-			}
+			// Remove from list
+			m_List.Remove(pNode);
+			m_NodePlex.Free(pNode);
 
-			pNode=pNode->m_pNext;
-			i++;
+			return;
 		}
 
-		if (m_iIterPos>=0)
+		pPrev=pNode;
+		pNode=pNode->m_pHashNext;
+	}
+
+	// Not found
+
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash, class TAlloc>
+void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash,TAlloc>::RemoveAll()
+{
+	// Call release semantics on all keys and values
+	CNode* pNode;
+	while ((pNode=m_List.GetFirst()))
+	{
+		TKeySem::OnRemove(pNode->m_KeyPair.m_Key, this);
+		TValueSem::OnRemove(pNode->m_KeyPair.m_Value, this);
+		m_List.Remove(pNode);
+		m_NodePlex.Free(pNode);
+	}
+
+	// Clear the list
+	m_Table.RemoveAll();
+	m_nHashMask=0;
+	m_iThreshold=0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// CIndex
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::CIndex()
+{
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::~CIndex()
+{
+	RemoveAll();
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+int CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::GetSize() const
+{
+	return m_Entries.GetSize();
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+bool CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::IsEmpty() const
+{
+	return GetSize()==0;
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+typename CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::CKeyPair CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::operator[](int iIndex) const
+{
+	ASSERT(iIndex>=0 && iIndex<GetSize());
+	return CKeyPair(m_Entries[iIndex]);
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::Add(const TKey& Key, const TValue& Value)
+{
+	int iPos;
+	if (m_Entries.template QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos))
+	{
+		m_Entries.ReplaceAt(iPos, CEntry(TKeySem::OnAdd(Key, this), TValueSem::OnAdd(Value, this)));
+	}
+	else
+	{
+		m_Entries.InsertAt(iPos, CEntry(TKeySem::OnAdd(Key, this), TValueSem::OnAdd(Value, this)));
+	}
+}
+
+// Add (bulk) - sorts the new entries once and merges with the existing ones.
+// Same results as adding one at a time: later entries replace earlier ones
+// with the same key (which get their semantics OnRemove, as per CMap).
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::Add(const TKey* pKeys, const TValue* pValues, int iCount)
+{
+	if (iCount<1)
+		return;
+
+	// Take ownership of everything passed in, then sort by key keeping input order for equal keys
+	CVector<CEntry> vecNew;
+	for (int i=0; i<iCount; i++)
+		vecNew.Add(CEntry(TKeySem::OnAdd(pKeys[i], this), TValueSem::OnAdd(pValues[i], this)));
+	slxStableSort(vecNew.GetBuffer(), vecNew.GetSize(), SCompareFn<CEntry>(CEntry::Compare));
+
+	// Merge
+	CVector<CEntry, SValue, CEntry, TAlloc> vecMerged;
+	int i=0;
+	int j=0;
+	while (j<vecNew.GetSize())
+	{
+		// Last of a run of equal keys wins
+		if (j+1<vecNew.GetSize() && CEntry::Compare(vecNew[j], vecNew[j+1])==0)
 		{
-			ASSERT(m_pIterNode!=NULL);
+			TKeySem::OnRemove(vecNew[j].m_Key, this);
+			TValueSem::OnRemove(vecNew[j].m_Value, this);
+			j++;
+			continue;
 		}
 
+		// Existing entries before this one
+		while (i<m_Entries.GetSize() && CEntry::Compare(m_Entries[i], vecNew[j])<0)
+			vecMerged.Add(m_Entries[i++]);
 
-		ASSERT(i==m_iSize);
+		// Replacing an existing entry?
+		if (i<m_Entries.GetSize() && CEntry::Compare(m_Entries[i], vecNew[j])==0)
+		{
+			TKeySem::OnRemove(m_Entries[i].m_Key, this);
+			TValueSem::OnRemove(m_Entries[i].m_Value, this);
+			i++;
+		}
+
+		vecMerged.Add(vecNew[j++]);
+	}
+	while (i<m_Entries.GetSize())
+		vecMerged.Add(m_Entries[i++]);
+
+	m_Entries.Swap(vecMerged);
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::Remove(const TKeyArg& Key)
+{
+	int iPos;
+	if (m_Entries.template QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos))
+	{
+		TKeySem::OnRemove(m_Entries[iPos].m_Key,this);
+		TValueSem::OnRemove(m_Entries[iPos].m_Value,this);
+		m_Entries.RemoveAt(iPos);
+	}
+
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+void CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::RemoveAll()
+{
+	for (int i=0; i<m_Entries.GetSize(); i++)
+	{
+		TKeySem::OnRemove(m_Entries[i].m_Key,this);
+		TValueSem::OnRemove(m_Entries[i].m_Value,this);
+	}
+	m_Entries.RemoveAll();
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+TValue CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::Detach(const TKeyArg& Key)
+{
+	int iPos;
+	if (m_Entries.template QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos))
+	{
+		TValue v=m_Entries[iPos].m_Value;
+		TKeySem::OnRemove(m_Entries[iPos].m_Key,this);
+		TValueSem::OnDetach(m_Entries[iPos].m_Value,this);
+		m_Entries.RemoveAt(iPos);
+		return v;
+	}
+	return TValue();
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+const TValue& CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::Get(const TKeyArg& Key, const TValue& Default) const
+{
+	int iPos;
+	if (m_Entries.template QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos))
+	{
+		return m_Entries[iPos].m_Value;
+	}
+	else
+	{
+		return Default;
+	}
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+bool CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::Find(const TKeyArg& Key, TValue& Value) const
+{
+	int iPos;
+	if (m_Entries.template QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos))
+	{
+		Value=m_Entries[iPos].m_Value;
+		return true;
+	}
+	else
+	{
+		return false;
 	}
+}
+
+template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+bool CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg, TAlloc>::HasKey(const TKeyArg& Key) const
+{
+	int iPos;
+	return m_Entries.template QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos);
+}
 
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CBTreeMap
+
+#define template_btree template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class TAlloc>
+#define CBTreeMap_ CBTreeMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc>
+
+// Constructor
+template_btree
+CBTreeMap_::CBTreeMap() :
+	m_pRoot(NULL),
+	m_pFirst(NULL),
+	m_pLast(NULL),
+	m_iSize(0),
+	m_pIterLeaf(NULL),
+	m_iIterBase(0)
+{
+}
+
+// Destructor
+template_btree
+CBTreeMap_::~CBTreeMap()
+{
+	RemoveAll();
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-bool CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::CheckTree(CNode* pNode)
+template_btree
+inline int CBTreeMap_::GetSize() const
 {
-	int lh = 1, rh = 1;
-
-	if (!pNode)
-		pNode = m_pRoot;
-
-	if (pNode->m_pLeft != &m_Leaf)
-		lh = CheckTree(pNode->m_pLeft);
+	return m_iSize;
+}
 
-	if (pNode->m_pRight != &m_Leaf)
-		rh = CheckTree(pNode->m_pRight);
+template_btree
+inline bool CBTreeMap_::IsEmpty() const
+{
+	return m_iSize==0;
+}
 
-	ASSERT(lh == rh);
+// Nodes are raw memory, keys and values are constructed only in the slots in use
+template_btree
+typename CBTreeMap_::CLeaf* CBTreeMap_::AllocLeaf()
+{
+	CLeaf* pLeaf=(CLeaf*)TAlloc::Alloc(sizeof(CLeaf));
+	pLeaf->m_bLeaf=true;
+	pLeaf->m_iCount=0;
+	pLeaf->m_pPrev=NULL;
+	pLeaf->m_pNext=NULL;
+	return pLeaf;
+}
 
-	return !!(lh + !pNode->m_bRed);
+template_btree
+typename CBTreeMap_::CInner* CBTreeMap_::AllocInner()
+{
+	CInner* pInner=(CInner*)TAlloc::Alloc(sizeof(CInner));
+	pInner->m_bLeaf=false;
+	pInner->m_iCount=0;
+	return pInner;
 }
-#endif
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::FreeNode(CNode* pNode)
+template_btree
+void CBTreeMap_::FreeNode(CNode* pNode)
 {
-	if (pNode && pNode!=&m_Leaf)
+	if (pNode->m_bLeaf)
 	{
-		FreeNode(pNode->m_pLeft);
-		FreeNode(pNode->m_pRight);
-		TKeySem::OnRemove(pNode->m_KeyPair.m_Key, this);
-		TValueSem::OnRemove(pNode->m_KeyPair.m_Value, this);
-		m_NodePlex.Free(pNode);
+		CLeaf* pLeaf=static_cast<CLeaf*>(pNode);
+		for (int i=0; i<pLeaf->m_iCount; i++)
+		{
+			TKeySem::OnRemove(pLeaf->m_Keys[i], this);
+			TValueSem::OnRemove(pLeaf->m_Values[i], this);
+			Destructor(&pLeaf->m_Keys[i]);
+			Destructor(&pLeaf->m_Values[i]);
+		}
+	}
+	else
+	{
+		CInner* pInner=static_cast<CInner*>(pNode);
+		for (int i=0; i<pInner->m_iCount; i++)
+		{
+			FreeNode(pInner->m_pChildren[i]);
+			if (i>0)
+				Destructor(&pInner->m_Keys[i-1]);
+		}
 	}
+	TAlloc::Free(pNode);
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-typename CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::CNode* CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::nextNode(CNode* pNode)
+// Index of first key >= Key
+template_btree
+int CBTreeMap_::LeafLowerBound(CLeaf* pLeaf, const TKeyArg& Key) const
 {
-	if (pNode->m_pRight != &m_Leaf)
+	int iLo=0;
+	int iHi=pLeaf->m_iCount;
+	while (iLo<iHi)
 	{
-		pNode = pNode->m_pRight;
-
-		while (pNode->m_pLeft != &m_Leaf)
-			pNode = pNode->m_pLeft;
+		int iMid=(iLo+iHi)/2;
+		if (TKeySem::Compare(pLeaf->m_Keys[iMid], Key)<0)
+			iLo=iMid+1;
+		else
+			iHi=iMid;
+	}
+	return iLo;
+}
 
-		return pNode;
+// Index of child that would contain Key (ie: number of separators <= Key)
+template_btree
+int CBTreeMap_::ChildIndex(CInner* pInner, const TKeyArg& Key) const
+{
+	int iLo=0;
+	int iHi=pInner->m_iCount-1;
+	while (iLo<iHi)
+	{
+		int iMid=(iLo+iHi)/2;
+		if (TKeySem::Compare(pInner->m_Keys[iMid], Key)<=0)
+			iLo=iMid+1;
+		else
+			iHi=iMid;
 	}
+	return iLo;
+}
 
-	CNode* pParent = pNode->m_pParent;
+template_btree
+bool CBTreeMap_::FindEntry(const TKeyArg& Key, CLeaf*& pLeaf, int& iPos) const
+{
+	if (!m_pRoot)
+		return false;
 
-	while (pParent != &m_Leaf && pNode == &m_Leaf)
+	CNode* pNode=m_pRoot;
+	while (!pNode->m_bLeaf)
 	{
-		pNode = pParent;
-		pParent = pParent->m_pParent;
+		CInner* pInner=static_cast<CInner*>(pNode);
+		pNode=pInner->m_pChildren[ChildIndex(pInner, Key)];
 	}
 
-	return pParent;
+	pLeaf=static_cast<CLeaf*>(pNode);
+	iPos=LeafLowerBound(pLeaf, Key);
+	return iPos<pLeaf->m_iCount && TKeySem::Compare(pLeaf->m_Keys[iPos], Key)==0;
 }
 
-
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::RotateLeft(CNode* x)
+template_btree
+int CBTreeMap_::NodeSize(CNode* pNode) const
 {
-	CNode* parent = m_Leaf.m_pParent;
-	CNode* y = x->m_pRight;
+	if (pNode->m_bLeaf)
+		return pNode->m_iCount;
 
-	// Turn y's left subtree into x's right subtree
+	CInner* pInner=static_cast<CInner*>(pNode);
+	int iSize=0;
+	for (int i=0; i<pInner->m_iCount; i++)
+		iSize+=pInner->m_iSizes[i];
+	return iSize;
+}
 
-	x->m_pRight = y->m_pLeft;
-	x->m_pRight->m_pParent = x;
+template_btree
+typename CBTreeMap_::CKeyPair CBTreeMap_::operator[](int iIndex) const
+{
+	ASSERT(iIndex>=0 && iIndex<GetSize());
 
-	// Link x's parent to y
+	// Cached leaf or one of its neighbours?
+	if (m_pIterLeaf)
+	{
+		if (iIndex>=m_iIterBase+m_pIterLeaf->m_iCount && iIndex<m_iIterBase+m_pIterLeaf->m_iCount+LeafSize && m_pIterLeaf->m_pNext)
+		{
+			m_iIterBase+=m_pIterLeaf->m_iCount;
+			m_pIterLeaf=m_pIterLeaf->m_pNext;
+		}
+		else if (iIndex<m_iIterBase && iIndex>=m_iIterBase-LeafSize && m_pIterLeaf->m_pPrev)
+		{
+			m_pIterLeaf=m_pIterLeaf->m_pPrev;
+			m_iIterBase-=m_pIterLeaf->m_iCount;
+		}
 
-	y->m_pParent = x->m_pParent;
+		int iPos=iIndex-m_iIterBase;
+		if (iPos>=0 && iPos<m_pIterLeaf->m_iCount)
+			return CKeyPair(m_pIterLeaf->m_Keys[iPos], m_pIterLeaf->m_Values[iPos]);
+	}
 
-	if (x != m_pRoot)
+	// Descend using the subtree sizes
+	int iBase=0;
+	CNode* pNode=m_pRoot;
+	while (!pNode->m_bLeaf)
 	{
-		if (x->m_pParent->m_pLeft == x)
-			x->m_pParent->m_pLeft = y;
-		else
-			x->m_pParent->m_pRight = y;
+		CInner* pInner=static_cast<CInner*>(pNode);
+		int i=0;
+		while (iIndex-iBase>=pInner->m_iSizes[i])
+		{
+			iBase+=pInner->m_iSizes[i];
+			i++;
+		}
+		pNode=pInner->m_pChildren[i];
 	}
-	else
-		m_pRoot = y;
 
-	// Put x on y's left
+	m_pIterLeaf=static_cast<CLeaf*>(pNode);
+	m_iIterBase=iBase;
 
-	y->m_pLeft = x;
-	x->m_pParent = y;
-	m_Leaf.m_pParent = parent;
+	int iPos=iIndex-iBase;
+	return CKeyPair(m_pIterLeaf->m_Keys[iPos], m_pIterLeaf->m_Values[iPos]);
 }
 
-
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::RotateRight(CNode* y)
+template_btree
+int CBTreeMap_::LowerBound(const TKeyArg& Key) const
 {
-	CNode* parent = m_Leaf.m_pParent;
-	CNode* x = y->m_pLeft;
-
-	// Turn x's right subtree into y's left subtree
-
-	y->m_pLeft = x->m_pRight;
-	y->m_pLeft->m_pParent = y;
-
-	// Link y's parent to x
-
-	x->m_pParent = y->m_pParent;
+	if (!m_pRoot)
+		return 0;
 
-	if (y != m_pRoot)
+	int iBase=0;
+	CNode* pNode=m_pRoot;
+	while (!pNode->m_bLeaf)
 	{
-		if (y->m_pParent->m_pLeft == y)
-			y->m_pParent->m_pLeft = x;
-		else
-			y->m_pParent->m_pRight = x;
+		CInner* pInner=static_cast<CInner*>(pNode);
+		int iChild=ChildIndex(pInner, Key);
+		for (int i=0; i<iChild; i++)
+			iBase+=pInner->m_iSizes[i];
+		pNode=pInner->m_pChildren[iChild];
 	}
-	else
-		m_pRoot = x;
 
-	// Put y on x's right
+	// Prime the operator[] cache, most likely the caller is about to iterate from here
+	m_pIterLeaf=static_cast<CLeaf*>(pNode);
+	m_iIterBase=iBase;
 
-	x->m_pRight = y;
-	y->m_pParent = x;
-	m_Leaf.m_pParent = parent;
+	return iBase+LeafLowerBound(m_pIterLeaf, Key);
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::RemoveOrDetach(const TKeyArg& Key, TValue* pvalDetached)
+// Insert into subtree, returns true if a new entry was added (false if replaced).
+// If the node had to be split, the new right hand node and its separator are returned.
+template_btree
+bool CBTreeMap_::Insert(CNode* pNode, const TKey& Key, const TValue& Value, TKey& SplitKey, CNode*& pSplitNode)
 {
+	pSplitNode=NULL;
 
-#ifdef _DEBUG_CHECKS
-	CheckAll();
-#endif
-
-	CNode* z = m_pRoot;
-
-	while (z != &m_Leaf)
+	if (pNode->m_bLeaf)
 	{
-		int iCompare = TKeySem::Compare(Key, z->m_KeyPair.m_Key);
+		CLeaf* pLeaf=static_cast<CLeaf*>(pNode);
+		int iPos=LeafLowerBound(pLeaf, Key);
 
-		if (iCompare < 0)
-			z = z->m_pLeft;
-		else if (iCompare > 0)
-			z = z->m_pRight;
-		else
-			break;
-	}
+		if (iPos<pLeaf->m_iCount && TKeySem::Compare(Key, pLeaf->m_Keys[iPos])==0)
+		{
+			// Found a duplicate, replace it (key too, see CMap::Add)
+			TKeySem::OnRemove(pLeaf->m_Keys[iPos], this);
+			TValueSem::OnRemove(pLeaf->m_Values[iPos], this);
+			pLeaf->m_Values[iPos]=TValueSem::OnAdd(Value, this);
+			pLeaf->m_Keys[iPos]=TKeySem::OnAdd(Key, this);
+			return false;
+		}
 
-	if (z == &m_Leaf)
-		return;
+		// Make room and insert
+		int iMove=pLeaf->m_iCount-iPos;
+		memmove((void*)&pLeaf->m_Keys[iPos+1], &pLeaf->m_Keys[iPos], iMove*sizeof(TKey));
+		memmove((void*)&pLeaf->m_Values[iPos+1], &pLeaf->m_Values[iPos], iMove*sizeof(TValue));
+		Constructor(&pLeaf->m_Values[iPos], TValueSem::OnAdd(Value, this));
+		Constructor(&pLeaf->m_Keys[iPos], TKeySem::OnAdd(Key, this));
+		pLeaf->m_iCount++;
 
-	CNode* y = (z->m_pLeft == &m_Leaf || z->m_pRight == &m_Leaf) ?	z : nextNode(z);
+		if (pLeaf->m_iCount>LeafSize)
+		{
+			// Split, upper half moves to a new leaf
+			CLeaf* pRight=AllocLeaf();
+			int iKeep=pLeaf->m_iCount/2;
+			pRight->m_iCount=pLeaf->m_iCount-iKeep;
+			memcpy((void*)pRight->m_Keys, &pLeaf->m_Keys[iKeep], pRight->m_iCount*sizeof(TKey));
+			memcpy((void*)pRight->m_Values, &pLeaf->m_Values[iKeep], pRight->m_iCount*sizeof(TValue));
+			pLeaf->m_iCount=iKeep;
+
+			// Link it in
+			pRight->m_pPrev=pLeaf;
+			pRight->m_pNext=pLeaf->m_pNext;
+			if (pLeaf->m_pNext)
+				pLeaf->m_pNext->m_pPrev=pRight;
+			else
+				m_pLast=pRight;
+			pLeaf->m_pNext=pRight;
 
-	CNode* x = (y->m_pLeft != &m_Leaf) ? y->m_pLeft : y->m_pRight;
+			SplitKey=pRight->m_Keys[0];
+			pSplitNode=pRight;
+		}
+		return true;
+	}
 
-	// Ensure that x->m_pParent is correct.
-	// This is needed in case x == &m_Leaf
+	CInner* pInner=static_cast<CInner*>(pNode);
+	int iChild=ChildIndex(pInner, Key);
 
-	x->m_pParent = y->m_pParent;
+	CNode* pChildSplit;
+	if (!Insert(pInner->m_pChildren[iChild], Key, Value, SplitKey, pChildSplit))
+		return false;
 
-	if (y != m_pRoot)
+	if (!pChildSplit)
 	{
-		if (y->m_pParent->m_pLeft == y)
-			y->m_pParent->m_pLeft = x;
-		else
-			y->m_pParent->m_pRight = x;
+		pInner->m_iSizes[iChild]++;
+		return true;
 	}
-	else
-		m_pRoot = x;
 
-
-	if (m_pIterNode)
+	// Child was split, insert the new child after it
+	int iMove=pInner->m_iCount-iChild-1;
+	memmove((void*)&pInner->m_Keys[iChild+1], &pInner->m_Keys[iChild], iMove*sizeof(TKey));
+	memmove(&pInner->m_pChildren[iChild+2], &pInner->m_pChildren[iChild+1], iMove*sizeof(CNode*));
+	memmove(&pInner->m_iSizes[iChild+2], &pInner->m_iSizes[iChild+1], iMove*sizeof(int));
+	Constructor(&pInner->m_Keys[iChild], SplitKey);
+	pInner->m_pChildren[iChild+1]=pChildSplit;
+	pInner->m_iSizes[iChild+1]=NodeSize(pChildSplit);
+	pInner->m_iSizes[iChild]=NodeSize(pInner->m_pChildren[iChild]);
+	pInner->m_iCount++;
+
+	if (pInner->m_iCount>InnerSize)
 	{
-		int iCompare=TKeySem::Compare(Key, m_pIterNode->m_KeyPair.m_Key);
-		if (iCompare<=0)
-		{
-			m_pIterNode=m_pIterNode->m_pNext;
-		}
+		// Split, middle separator moves up to the parent
+		CInner* pRight=AllocInner();
+		int iKeep=pInner->m_iCount/2;
+		pRight->m_iCount=pInner->m_iCount-iKeep;
+		memcpy((void*)pRight->m_Keys, &pInner->m_Keys[iKeep], (pRight->m_iCount-1)*sizeof(TKey));
+		memcpy(pRight->m_pChildren, &pInner->m_pChildren[iKeep], pRight->m_iCount*sizeof(CNode*));
+		memcpy(pRight->m_iSizes, &pInner->m_iSizes[iKeep], pRight->m_iCount*sizeof(int));
+		pInner->m_iCount=iKeep;
+
+		SplitKey=pInner->m_Keys[iKeep-1];
+		Destructor(&pInner->m_Keys[iKeep-1]);
+		pSplitNode=pRight;
 	}
+	return true;
+}
 
-	TKeySem::OnRemove(z->m_KeyPair.m_Key, this);
-	if (!pvalDetached)
+template_btree
+void CBTreeMap_::Add(const TKey& Key, const TValue& Value)
+{
+	if (!m_pRoot)
 	{
-		TValueSem::OnRemove(z->m_KeyPair.m_Value, this);
+		m_pFirst=m_pLast=AllocLeaf();
+		m_pRoot=m_pFirst;
 	}
-	else
+
+	TKey SplitKey;
+	CNode* pSplitNode;
+	if (!Insert(m_pRoot, Key, Value, SplitKey, pSplitNode))
+		return;
+
+	m_iSize++;
+	m_pIterLeaf=NULL;
+
+	if (pSplitNode)
 	{
-		TValueSem::OnDetach(z->m_KeyPair.m_Value, this);
-		*pvalDetached=z->m_KeyPair.m_Value;
+		// Root was split, grow the tree by one level
+		CInner* pRoot=AllocInner();
+		pRoot->m_iCount=2;
+		Constructor(&pRoot->m_Keys[0], SplitKey);
+		pRoot->m_pChildren[0]=m_pRoot;
+		pRoot->m_pChildren[1]=pSplitNode;
+		pRoot->m_iSizes[0]=NodeSize(m_pRoot);
+		pRoot->m_iSizes[1]=NodeSize(pSplitNode);
+		m_pRoot=pRoot;
 	}
 
+	#ifdef _DEBUG_CHECKS
+	CheckAll();
+	#endif
+}
+
+// Merge child iLeft+1 into child iLeft
+template_btree
+void CBTreeMap_::Merge(CInner* pParent, int iLeft)
+{
+	CNode* pLeftNode=pParent->m_pChildren[iLeft];
+	CNode* pRightNode=pParent->m_pChildren[iLeft+1];
 
-	if (y != z)
+	if (pLeftNode->m_bLeaf)
 	{
-		// deleting value in z, but keeping z node and moving value from y node
-		z->m_KeyPair.m_Key = y->m_KeyPair.m_Key;
-		z->m_KeyPair.m_Value = y->m_KeyPair.m_Value;
-		z->m_pNext = y->m_pNext;
-		if (z->m_pNext)
-			z->m_pNext->m_pPrev=z;
+		CLeaf* pLeft=static_cast<CLeaf*>(pLeftNode);
+		CLeaf* pRight=static_cast<CLeaf*>(pRightNode);
+		memcpy((void*)&pLeft->m_Keys[pLeft->m_iCount], pRight->m_Keys, pRight->m_iCount*sizeof(TKey));
+		memcpy((void*)&pLeft->m_Values[pLeft->m_iCount], pRight->m_Values, pRight->m_iCount*sizeof(TValue));
+		pLeft->m_iCount+=pRight->m_iCount;
+
+		pLeft->m_pNext=pRight->m_pNext;
+		if (pRight->m_pNext)
+			pRight->m_pNext->m_pPrev=pLeft;
 		else
-			m_pLast=z;
-
-		if (m_pIterNode==y)
-			m_pIterNode=z;
+			m_pLast=pLeft;
 	}
 	else
 	{
-		// Update linked list
-		if (z->m_pPrev)
-			z->m_pPrev->m_pNext=z->m_pNext;
-		else
-			m_pFirst=z->m_pNext;
+		// Separator comes down from the parent between the two sets of children
+		CInner* pLeft=static_cast<CInner*>(pLeftNode);
+		CInner* pRight=static_cast<CInner*>(pRightNode);
+		Constructor(&pLeft->m_Keys[pLeft->m_iCount-1], pParent->m_Keys[iLeft]);
+		memcpy((void*)&pLeft->m_Keys[pLeft->m_iCount], pRight->m_Keys, (pRight->m_iCount-1)*sizeof(TKey));
+		memcpy(&pLeft->m_pChildren[pLeft->m_iCount], pRight->m_pChildren, pRight->m_iCount*sizeof(CNode*));
+		memcpy(&pLeft->m_iSizes[pLeft->m_iCount], pRight->m_iSizes, pRight->m_iCount*sizeof(int));
+		pLeft->m_iCount+=pRight->m_iCount;
+	}
 
-		if (z->m_pNext)
-			z->m_pNext->m_pPrev=z->m_pPrev;
-		else
-			m_pLast=z->m_pPrev;
+	TAlloc::Free(pRightNode);
 
-		if (m_pIterNode==z)
+	// Remove the separator and right child from the parent
+	pParent->m_iSizes[iLeft]+=pParent->m_iSizes[iLeft+1];
+	Destructor(&pParent->m_Keys[iLeft]);
+	int iMove=pParent->m_iCount-iLeft-2;
+	memmove((void*)&pParent->m_Keys[iLeft], &pParent->m_Keys[iLeft+1], iMove*sizeof(TKey));
+	memmove(&pParent->m_pChildren[iLeft+1], &pParent->m_pChildren[iLeft+2], iMove*sizeof(CNode*));
+	memmove(&pParent->m_iSizes[iLeft+1], &pParent->m_iSizes[iLeft+2], iMove*sizeof(int));
+	pParent->m_iCount--;
+}
+
+// Fix up an underfull child by borrowing from a sibling, or merging with one
+template_btree
+void CBTreeMap_::Rebalance(CInner* pParent, int iChild)
+{
+	CNode* pNode=pParent->m_pChildren[iChild];
+	CNode* pLeftNode=iChild>0 ? pParent->m_pChildren[iChild-1] : NULL;
+	CNode* pRightNode=iChild+1<pParent->m_iCount ? pParent->m_pChildren[iChild+1] : NULL;
+	int iMin=pNode->m_bLeaf ? LeafMin : InnerMin;
+
+	if (pLeftNode && pLeftNode->m_iCount>iMin)
+	{
+		// Borrow last entry/child of left sibling
+		if (pNode->m_bLeaf)
 		{
-			m_pIterNode=m_pIterNode->m_pNext;
-			if (!m_pIterNode)
-			{
-				m_iIterPos=-1;
-			}
+			CLeaf* pLeaf=static_cast<CLeaf*>(pNode);
+			CLeaf* pLeft=static_cast<CLeaf*>(pLeftNode);
+			memmove((void*)&pLeaf->m_Keys[1], pLeaf->m_Keys, pLeaf->m_iCount*sizeof(TKey));
+			memmove((void*)&pLeaf->m_Values[1], pLeaf->m_Values, pLeaf->m_iCount*sizeof(TValue));
+			pLeft->m_iCount--;
+			memcpy((void*)&pLeaf->m_Keys[0], &pLeft->m_Keys[pLeft->m_iCount], sizeof(TKey));
+			memcpy((void*)&pLeaf->m_Values[0], &pLeft->m_Values[pLeft->m_iCount], sizeof(TValue));
+			pLeaf->m_iCount++;
+
+			pParent->m_Keys[iChild-1]=pLeaf->m_Keys[0];
+			pParent->m_iSizes[iChild-1]--;
+			pParent->m_iSizes[iChild]++;
+		}
+		else
+		{
+			CInner* pInner=static_cast<CInner*>(pNode);
+			CInner* pLeft=static_cast<CInner*>(pLeftNode);
+			memmove((void*)&pInner->m_Keys[1], pInner->m_Keys, (pInner->m_iCount-1)*sizeof(TKey));
+			memmove(&pInner->m_pChildren[1], pInner->m_pChildren, pInner->m_iCount*sizeof(CNode*));
+			memmove(&pInner->m_iSizes[1], pInner->m_iSizes, pInner->m_iCount*sizeof(int));
+
+			// Rotate separators through the parent
+			pLeft->m_iCount--;
+			memcpy((void*)&pInner->m_Keys[0], &pParent->m_Keys[iChild-1], sizeof(TKey));
+			memcpy((void*)&pParent->m_Keys[iChild-1], &pLeft->m_Keys[pLeft->m_iCount-1], sizeof(TKey));
+			pInner->m_pChildren[0]=pLeft->m_pChildren[pLeft->m_iCount];
+			pInner->m_iSizes[0]=pLeft->m_iSizes[pLeft->m_iCount];
+			pInner->m_iCount++;
+
+			pParent->m_iSizes[iChild-1]-=pInner->m_iSizes[0];
+			pParent->m_iSizes[iChild]+=pInner->m_iSizes[0];
 		}
 	}
-
-	// Rebalance the tree (see page 274 of Introduction to Algorithms)
-
-	if (!y->m_bRed)
+	else if (pRightNode && pRightNode->m_iCount>iMin)
 	{
-		CNode* pNode = x;
-
-		while (pNode != m_pRoot && !pNode->m_bRed)
+		// Borrow first entry/child of right sibling
+		if (pNode->m_bLeaf)
 		{
-			if (pNode == pNode->m_pParent->m_pLeft)
-			{
-				CNode* pSibling = pNode->m_pParent->m_pRight;
-
-				if (pSibling->m_bRed)
-				{
-					// Case 1: Sibling is m_bRed
-					pSibling->m_bRed = false;
-					pNode->m_pParent->m_bRed = true;
-					RotateLeft(pNode->m_pParent);
-					pSibling = pNode->m_pParent->m_pRight;
-				}
-				if (!pSibling->m_pLeft->m_bRed && !pSibling->m_pRight->m_bRed)
-				{
-					// Case 2: Sibling and its children are all black
-					pSibling->m_bRed = true;
-					pNode = pNode->m_pParent;
-					continue;
-				}
-				else if (!pSibling->m_pRight->m_bRed)
-				{
-					// Case 3: Sibling and its right child are both black
-					pSibling->m_pLeft->m_bRed = false;
-					pSibling->m_bRed = true;
-					RotateRight(pSibling);
-					pSibling = pNode->m_pParent->m_pRight;
-				}
-
-				// Case 4: Sibling and its left child are both black
-				pSibling->m_bRed = pNode->m_pParent->m_bRed;
-				pNode->m_pParent->m_bRed = false;
-				pSibling->m_pRight->m_bRed = false;
-				RotateLeft(pNode->m_pParent);
-				pNode = m_pRoot;
-			}
-			else
-			{
-				CNode* pSibling = pNode->m_pParent->m_pLeft;
+			CLeaf* pLeaf=static_cast<CLeaf*>(pNode);
+			CLeaf* pRight=static_cast<CLeaf*>(pRightNode);
+			memcpy((void*)&pLeaf->m_Keys[pLeaf->m_iCount], &pRight->m_Keys[0], sizeof(TKey));
+			memcpy((void*)&pLeaf->m_Values[pLeaf->m_iCount], &pRight->m_Values[0], sizeof(TValue));
+			pLeaf->m_iCount++;
+			pRight->m_iCount--;
+			memmove((void*)pRight->m_Keys, &pRight->m_Keys[1], pRight->m_iCount*sizeof(TKey));
+			memmove((void*)pRight->m_Values, &pRight->m_Values[1], pRight->m_iCount*sizeof(TValue));
+
+			pParent->m_Keys[iChild]=pRight->m_Keys[0];
+			pParent->m_iSizes[iChild]++;
+			pParent->m_iSizes[iChild+1]--;
+		}
+		else
+		{
+			CInner* pInner=static_cast<CInner*>(pNode);
+			CInner* pRight=static_cast<CInner*>(pRightNode);
+
+			// Rotate separators through the parent
+			memcpy((void*)&pInner->m_Keys[pInner->m_iCount-1], &pParent->m_Keys[iChild], sizeof(TKey));
+			memcpy((void*)&pParent->m_Keys[iChild], &pRight->m_Keys[0], sizeof(TKey));
+			pInner->m_pChildren[pInner->m_iCount]=pRight->m_pChildren[0];
+			pInner->m_iSizes[pInner->m_iCount]=pRight->m_iSizes[0];
+			pInner->m_iCount++;
+
+			pRight->m_iCount--;
+			memmove((void*)pRight->m_Keys, &pRight->m_Keys[1], (pRight->m_iCount-1)*sizeof(TKey));
+			memmove(pRight->m_pChildren, &pRight->m_pChildren[1], pRight->m_iCount*sizeof(CNode*));
+			memmove(pRight->m_iSizes, &pRight->m_iSizes[1], pRight->m_iCount*sizeof(int));
+
+			int iMoved=pInner->m_iSizes[pInner->m_iCount-1];
+			pParent->m_iSizes[iChild]+=iMoved;
+			pParent->m_iSizes[iChild+1]-=iMoved;
+		}
+	}
+	else if (pLeftNode)
+	{
+		Merge(pParent, iChild-1);
+	}
+	else if (pRightNode)
+	{
+		Merge(pParent, iChild);
+	}
+}
 
-				if (pSibling->m_bRed)
-				{
-					// Case 5: Sibling is m_bRed
-					pSibling->m_bRed = false;
-					pNode->m_pParent->m_bRed = true;
-					RotateRight(pNode->m_pParent);
-					pSibling = pNode->m_pParent->m_pLeft;
-				}
-				if (!pSibling->m_pLeft->m_bRed && !pSibling->m_pRight->m_bRed)
-				{
-					// Case 6: Sibling and its children are all black
-					pSibling->m_bRed = true;
-					pNode = pNode->m_pParent;
-					continue;
-				}
-				else if (!pSibling->m_pLeft->m_bRed)
-				{
-					// Case 7: Sibling and its left child are both black
-					pSibling->m_pRight->m_bRed = false;
-					pSibling->m_bRed = true;
-					RotateLeft(pSibling);
-					pSibling = pNode->m_pParent->m_pLeft;
-				}
+// Remove from subtree, returns true if found
+template_btree
+bool CBTreeMap_::RemoveFrom(CNode* pNode, const TKeyArg& Key, TValue* pvalDetached)
+{
+	if (pNode->m_bLeaf)
+	{
+		CLeaf* pLeaf=static_cast<CLeaf*>(pNode);
+		int iPos=LeafLowerBound(pLeaf, Key);
+		if (iPos>=pLeaf->m_iCount || TKeySem::Compare(pLeaf->m_Keys[iPos], Key)!=0)
+			return false;
 
-				// Case 8: Sibling and its right child are both black
-				pSibling->m_bRed = pNode->m_pParent->m_bRed;
-				pNode->m_pParent->m_bRed = false;
-				pSibling->m_pLeft->m_bRed = false;
-				RotateRight(pNode->m_pParent);
-				pNode = m_pRoot;
-			}
+		TKeySem::OnRemove(pLeaf->m_Keys[iPos], this);
+		if (!pvalDetached)
+		{
+			TValueSem::OnRemove(pLeaf->m_Values[iPos], this);
+		}
+		else
+		{
+			*pvalDetached=pLeaf->m_Values[iPos];
+			TValueSem::OnDetach(pLeaf->m_Values[iPos], this);
 		}
+		Destructor(&pLeaf->m_Keys[iPos]);
+		Destructor(&pLeaf->m_Values[iPos]);
 
-		pNode->m_bRed = false;
+		int iMove=pLeaf->m_iCount-iPos-1;
+		memmove((void*)&pLeaf->m_Keys[iPos], &pLeaf->m_Keys[iPos+1], iMove*sizeof(TKey));
+		memmove((void*)&pLeaf->m_Values[iPos], &pLeaf->m_Values[iPos+1], iMove*sizeof(TValue));
+		pLeaf->m_iCount--;
+		return true;
 	}
 
-	m_NodePlex.Free(y);
+	CInner* pInner=static_cast<CInner*>(pNode);
+	int iChild=ChildIndex(pInner, Key);
+	if (!RemoveFrom(pInner->m_pChildren[iChild], Key, pvalDetached))
+		return false;
+
+	pInner->m_iSizes[iChild]--;
+
+	CNode* pChild=pInner->m_pChildren[iChild];
+	if (pChild->m_iCount<(pChild->m_bLeaf ? (int)LeafMin : (int)InnerMin))
+		Rebalance(pInner, iChild);
+
+	return true;
+}
+
+template_btree
+void CBTreeMap_::RemoveOrDetach(const TKeyArg& Key, TValue* pvalDetached)
+{
+	if (!m_pRoot || !RemoveFrom(m_pRoot, Key, pvalDetached))
+		return;
+
 	m_iSize--;
+	m_pIterLeaf=NULL;
+
+	if (m_pRoot->m_bLeaf)
+	{
+		// Last entry gone?
+		if (m_pRoot->m_iCount==0)
+		{
+			TAlloc::Free(m_pRoot);
+			m_pRoot=NULL;
+			m_pFirst=NULL;
+			m_pLast=NULL;
+		}
+	}
+	else if (m_pRoot->m_iCount==1)
+	{
+		// Shrink the tree by one level
+		CNode* pOldRoot=m_pRoot;
+		m_pRoot=static_cast<CInner*>(pOldRoot)->m_pChildren[0];
+		TAlloc::Free(pOldRoot);
+	}
 
 	#ifdef _DEBUG_CHECKS
 	CheckAll();
 	#endif
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::RemoveAll()
+template_btree
+void CBTreeMap_::Remove(const TKeyArg& Key)
 {
-	FreeNode(m_pRoot);
-	m_pRoot = &m_Leaf;
-	m_pFirst = NULL;
-	m_pLast = NULL;
-	m_iSize = 0;
-	m_iIterPos=-1;
-	m_pIterNode=NULL;
+	RemoveOrDetach(Key, NULL);
+}
 
-	#ifdef _DEBUG_CHECKS
-	CheckAll();
-	#endif
+template_btree
+TValue CBTreeMap_::Detach(const TKeyArg& Key)
+{
+	TValue val=TValue();
+	RemoveOrDetach(Key, &val);
+	return val;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-typename CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::CNode* CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg>::FindNode(const TKeyArg& Key) const
+template_btree
+void CBTreeMap_::RemoveAll()
 {
-	CNode* pNode = m_pRoot;
+	if (m_pRoot)
+		FreeNode(m_pRoot);
+	m_pRoot=NULL;
+	m_pFirst=NULL;
+	m_pLast=NULL;
+	m_iSize=0;
+	m_pIterLeaf=NULL;
+}
 
-	while (pNode != &m_Leaf)
+template_btree
+const TValue& CBTreeMap_::Get(const TKeyArg& Key, const TValue& Default) const
+{
+	CLeaf* pLeaf;
+	int iPos;
+	if (FindEntry(Key, pLeaf, iPos))
+		return pLeaf->m_Values[iPos];
+	else
+		return Default;
+}
+
+template_btree
+bool CBTreeMap_::Find(const TKeyArg& Key, TValue& Value) const
+{
+	CLeaf* pLeaf;
+	int iPos;
+	if (!FindEntry(Key, pLeaf, iPos))
+		return false;
+
+	Value=pLeaf->m_Values[iPos];
+	return true;
+}
+
+template_btree
+bool CBTreeMap_::HasKey(const TKeyArg& Key) const
+{
+	CLeaf* pLeaf;
+	int iPos;
+	return FindEntry(Key, pLeaf, iPos);
+}
+
+#ifdef _DEBUG
+
+template_btree
+void CBTreeMap_::CheckAll()
+{
+	if (!m_pRoot)
 	{
-		int iCompare = TKeySem::Compare(Key, pNode->m_KeyPair.m_Key);
+		ASSERT(m_iSize==0 && m_pFirst==NULL && m_pLast==NULL);
+		return;
+	}
 
-		if (iCompare < 0)
-			pNode = pNode->m_pLeft;
-		else if (iCompare > 0)
-			pNode = pNode->m_pRight;
-		else
-			return pNode;
+	int iLeafDepth=-1;
+	CLeaf* pPrevLeaf=NULL;
+	ASSERT(CheckNode(m_pRoot, 0, iLeafDepth, pPrevLeaf)==m_iSize);
+	ASSERT(pPrevLeaf==m_pLast);
+}
+
+// Checks ordering, fill, sizes and leaf chain, returns number of entries below pNode
+template_btree
+int CBTreeMap_::CheckNode(CNode* pNode, int iDepth, int& iLeafDepth, CLeaf*& pPrevLeaf)
+{
+	if (pNode->m_bLeaf)
+	{
+		CLeaf* pLeaf=static_cast<CLeaf*>(pNode);
+		ASSERT(pNode==m_pRoot || pLeaf->m_iCount>=LeafMin);
+		ASSERT(pLeaf->m_iCount<=LeafSize);
+		for (int i=1; i<pLeaf->m_iCount; i++)
+			ASSERT(TKeySem::Compare(pLeaf->m_Keys[i-1], pLeaf->m_Keys[i])<0);
+
+		// All leaves at the same depth and chained in order
+		if (iLeafDepth<0)
+			iLeafDepth=iDepth;
+		ASSERT(iDepth==iLeafDepth);
+		ASSERT(pLeaf->m_pPrev==pPrevLeaf);
+		ASSERT(pPrevLeaf ? pPrevLeaf->m_pNext==pLeaf : m_pFirst==pLeaf);
+		pPrevLeaf=pLeaf;
+
+		return pLeaf->m_iCount;
 	}
 
-	return NULL;
+	CInner* pInner=static_cast<CInner*>(pNode);
+	ASSERT(pNode==m_pRoot ? pInner->m_iCount>=2 : pInner->m_iCount>=InnerMin);
+	ASSERT(pInner->m_iCount<=InnerSize);
+
+	int iTotal=0;
+	for (int i=0; i<pInner->m_iCount; i++)
+	{
+		int iSize=CheckNode(pInner->m_pChildren[i], iDepth+1, iLeafDepth, pPrevLeaf);
+		ASSERT(iSize==pInner->m_iSizes[i]);
+		iTotal+=iSize;
+
+		// Separators bound the keys in the children either side
+		CLeaf* pChildLast=pPrevLeaf;
+		if (i>0)
+		{
+			CNode* p=pInner->m_pChildren[i];
+			while (!p->m_bLeaf)
+				p=static_cast<CInner*>(p)->m_pChildren[0];
+			ASSERT(TKeySem::Compare(static_cast<CLeaf*>(p)->m_Keys[0], pInner->m_Keys[i-1])>=0);
+		}
+		if (i<pInner->m_iCount-1)
+			ASSERT(TKeySem::Compare(pChildLast->m_Keys[pChildLast->m_iCount-1], pInner->m_Keys[i])<0);
+	}
+	return iTotal;
 }
 
+#endif
+
+#undef template_btree
+#undef CBTreeMap_
+
+
+
 
 /////////////////////////////////////////////////////////////////////////////
-// Hashing routines
+// Implementation of CIntrusiveHashSet
 
-/*
-* SuperFastHash.cpp
-* Copyright 2004-2007 by Paul Hsieh
-* http://www.azillionmonkeys.com/qed/hash.html
+#ifndef _SIMPLELIB_NO_LINKEDLIST_MULTICHAIN
 
-  This code is covered by Paul Hsieh derivative licence
-    http://www.azillionmonkeys.com/qed/license-derivative.html
-*/
+#define template_ihs template <class T, class TKey, TKey T::* pKey, class TSem, class TKeySem, class THash, CHashChain<T> T::* pLink>
+#define CIntrusiveHashSet_ CIntrusiveHashSet<T,TKey,pKey,TSem,TKeySem,THash,pLink>
 
+// Constructor
+template_ihs
+CIntrusiveHashSet_::CIntrusiveHashSet(int iInitialSize) :
+	m_nHashMask(0),
+	m_iSize(0),
+	m_iThreshold(0),
+	m_iInitialSize(iInitialSize)
+{
+}
 
-#undef get16bits
-#if (defined(__GNUC__) && defined(__i386__)) || defined(__WATCOMC__) \
-	|| defined(_MSC_VER) || defined (__BORLANDC__) || defined (__TURBOC__)
-#define get16bits(d) (*((const unsigned short *) (d)))
-#endif
+// Destructor
+template_ihs
+CIntrusiveHashSet_::~CIntrusiveHashSet()
+{
+	RemoveAll();
+}
 
-#if !defined (get16bits)
-#define get16bits(d) ((((unsigned long)(((const uint8_t *)(d))[1])) << 8)\
-	+(unsigned long)(((const uint8_t *)(d))[0]) )
-#endif
+// Rehash
+template_ihs
+void CIntrusiveHashSet_::Rehash(int iNewSize)
+{
+	// Get the first power of two thats as big as the desired size
+	int iTableSize=MIN_TABLE_SIZE;
+	while (iTableSize<iNewSize)
+		iTableSize<<=1;
 
-inline unsigned long SuperFastHash (const char * data, int len) {
-	unsigned long hash = len, tmp;
-	int rem;
+	// Collect all items into one chain
+	T* pAll=NULL;
+	for (int i=0; i<m_Table.GetSize(); i++)
+	{
+		T* p=m_Table[i];
+		while (p)
+		{
+			T* pNext=(p->*pLink).m_pHashNext;
+			(p->*pLink).m_pHashNext=pAll;
+			pAll=p;
+			p=pNext;
+		}
+	}
 
-	if (len <= 0 || data == NULL) return 0;
+	// Resize the table
+	m_Table.RemoveAll();
+	m_Table.SetSize(iTableSize, NULL);
+	m_nHashMask=iTableSize-1;
+	m_iThreshold=iTableSize*REALLOC_PERCENT/100;
 
-	rem = len & 3;
-	len >>= 2;
+	// Reinsert
+	while (pAll)
+	{
+		T* pNext=(pAll->*pLink).m_pHashNext;
+		unsigned int nHash=THash::Hash(pAll->*pKey) & m_nHashMask;
+		(pAll->*pLink).m_pHashNext=m_Table[nHash];
+		m_Table.ReplaceAt(nHash, pAll);
+		pAll=pNext;
+	}
+}
 
-	/* Main loop */
-	for (;len > 0; len--) {
-		hash  += get16bits (data);
-		tmp    = (get16bits (data+2) << 11) ^ hash;
-		hash   = (hash << 16) ^ tmp;
-		data  += 2*sizeof (unsigned short);
-		hash  += hash >> 11;
+// FindLink - returns the link pointing to the item with a key, or to the NULL at the end of its bucket
+template_ihs
+T** CIntrusiveHashSet_::FindLink(const TKey& Key) const
+{
+	ASSERT(m_Table.GetSize()>0);
+
+	T** ppLink=&m_Table[THash::Hash(Key) & m_nHashMask];
+	while (*ppLink)
+	{
+		if (TKeySem::Compare((*ppLink)->*pKey, Key)==0)
+			break;
+		ppLink=&((*ppLink)->*pLink).m_pHashNext;
 	}
+	return ppLink;
+}
 
-	/* Handle end cases */
-	switch (rem) {
-	case 3: hash += get16bits (data);
-		hash ^= hash << 16;
-		hash ^= data[sizeof (unsigned short)] << 18;
-		hash += hash >> 11;
-		break;
-	case 2: hash += get16bits (data);
-		hash ^= hash << 11;
-		hash += hash >> 17;
-		break;
-	case 1: hash += *data;
-		hash ^= hash << 10;
-		hash += hash >> 1;
+// Add - replaces any existing item with the same key
+template_ihs
+void CIntrusiveHashSet_::Add(T* p)
+{
+	ASSERT(p!=NULL);
+
+	// Make sure table created
+	if (m_Table.IsEmpty())
+		Rehash(m_iInitialSize);
+
+	T** ppLink=FindLink(p->*pKey);
+	if (*ppLink)
+	{
+		// Replace existing
+		T* pOld=*ppLink;
+		ASSERT(pOld!=p && "Item already in set");
+		(p->*pLink).m_pHashNext=(pOld->*pLink).m_pHashNext;
+		*ppLink=p;
+		(pOld->*pLink).m_pHashNext=NULL;
+		TSem::OnRemove(pOld, this);
+		return;
 	}
 
-	/* Force "avalanching" of final 127 bits */
-	hash ^= hash << 3;
-	hash += hash >> 5;
-	hash ^= hash << 4;
-	hash += hash >> 17;
-	hash ^= hash << 25;
-	hash += hash >> 6;
+	// Append to bucket
+	(p->*pLink).m_pHashNext=NULL;
+	*ppLink=p;
+	m_iSize++;
 
-	return hash;
+	if (m_iSize>m_iThreshold)
+		Rehash(m_Table.GetSize()*2);
 }
 
+// Detach - remove without invoking semantics
+template_ihs
+T* CIntrusiveHashSet_::Detach(T* p)
+{
+	ASSERT(p!=NULL);
 
-/////////////////////////////////////////////////////////////////////////////
-// CHashMap
+	T** ppLink=FindLink(p->*pKey);
+	ASSERT(*ppLink==p && "Item not in set");
+	if (*ppLink!=p)
+		return NULL;
 
-// Minimum hash table size - must be a power of two
-#define MIN_TABLE_SIZE	64
-#define REALLOC_PERCENT	70
+	*ppLink=(p->*pLink).m_pHashNext;
+	(p->*pLink).m_pHashNext=NULL;
+	m_iSize--;
+	return p;
+}
+
+// Remove
+template_ihs
+void CIntrusiveHashSet_::Remove(T* p)
+{
+	if (Detach(p))
+		TSem::OnRemove(p, this);
+}
 
+// RemoveKey
+template_ihs
+bool CIntrusiveHashSet_::RemoveKey(const TKey& Key)
+{
+	T* p=Find(Key);
+	if (!p)
+		return false;
+	Remove(p);
+	return true;
+}
 
-// Constructor
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::CHashMap(int iInitialSize) :
-	m_iInitialSize(iInitialSize)
+// RemoveAll
+template_ihs
+void CIntrusiveHashSet_::RemoveAll()
+{
+	for (int i=0; i<m_Table.GetSize(); i++)
+	{
+		T* p=m_Table[i];
+		while (p)
+		{
+			T* pNext=(p->*pLink).m_pHashNext;
+			(p->*pLink).m_pHashNext=NULL;
+			TSem::OnRemove(p, this);
+			p=pNext;
+		}
+	}
+	m_Table.RemoveAll();
+	m_nHashMask=0;
+	m_iThreshold=0;
+	m_iSize=0;
+}
+
+// Find
+template_ihs
+T* CIntrusiveHashSet_::Find(const TKey& Key) const
+{
+	if (m_Table.IsEmpty())
+		return NULL;
+	return *FindLink(Key);
+}
+
+// HasKey
+template_ihs
+bool CIntrusiveHashSet_::HasKey(const TKey& Key) const
 {
+	return Find(Key)!=NULL;
 }
 
-// Destructor
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::~CHashMap()
+// GetSize
+template_ihs
+int CIntrusiveHashSet_::GetSize() const
 {
-	RemoveAll();
+	return m_iSize;
 }
 
-
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-inline int CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::GetSize() const
+// IsEmpty
+template_ihs
+bool CIntrusiveHashSet_::IsEmpty() const
 {
-	return m_List.GetSize();
+	return m_iSize==0;
 }
 
+// FirstFrom - first item in or after a bucket
+template_ihs
+T* CIntrusiveHashSet_::FirstFrom(unsigned int nBucket) const
+{
+	for (int i=(int)nBucket; i<m_Table.GetSize(); i++)
+	{
+		if (m_Table[i])
+			return m_Table[i];
+	}
+	return NULL;
+}
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-inline bool CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::IsEmpty() const
+// GetFirst
+template_ihs
+T* CIntrusiveHashSet_::GetFirst() const
 {
-	return m_List.IsEmpty();
+	return FirstFrom(0);
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-typename CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::CKeyPair CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::operator[](int iIndex) const
+// GetNext
+template_ihs
+T* CIntrusiveHashSet_::GetNext(T* p) const
 {
-	ASSERT(iIndex>=0 && iIndex<m_List.GetSize());
+	if ((p->*pLink).m_pHashNext)
+		return (p->*pLink).m_pHashNext;
+	return FirstFrom((THash::Hash(p->*pKey) & m_nHashMask)+1);
+}
 
-	// Get node from list
-	CNode* pNode=m_List.GetAt(iIndex);
+#undef template_ihs
+#undef CIntrusiveHashSet_
 
-	// Create key pair
-	return CKeyPair(pNode->m_KeyPair.m_Key, pNode->m_KeyPair.m_Value);
-}
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::InitHashTable(int iSize)
-{
-	// Get the first power of two thats as big as the desired size
-	int iTableSize = MIN_TABLE_SIZE;
-	while(iTableSize < iSize)
-		iTableSize <<= 1;
 
-	// Allocate the table
-	m_Table.SetSize(iTableSize, NULL);
+/////////////////////////////////////////////////////////////////////////////
+// Implementation of CLruCache
 
-	// Pre-calculate constants that are based on the table size
-	m_nHashMask = m_Table.GetSize()-1;
-	m_iThreshold = m_Table.GetSize() * REALLOC_PERCENT / 100;
+#define template_lru template <class T, class TKey, TKey T::* pKey, class TSem, class TKeySem, class THash, CHashChain<T> T::* pLink, CChain<T> T::* pChain>
+#define CLruCache_ CLruCache<T,TKey,pKey,TSem,TKeySem,THash,pLink,pChain>
+
+// Constructor
+template_lru
+CLruCache_::CLruCache(int iCapacity) :
+	m_pMostRecent(NULL),
+	m_pLeastRecent(NULL),
+	m_iCapacity(iCapacity)
+{
+	ASSERT(iCapacity>0);
 }
 
+// Destructor
+template_lru
+CLruCache_::~CLruCache()
+{
+	RemoveAll();
+}
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::Rehash(int iNewSize)
+// Link - put at the most recent end
+template_lru
+void CLruCache_::Link(T* p)
 {
-	// Resize the table
-	InitHashTable(iNewSize);
+	(p->*pChain).m_pPrev=NULL;
+	(p->*pChain).m_pNext=m_pMostRecent;
+	if (m_pMostRecent)
+		(m_pMostRecent->*pChain).m_pPrev=p;
+	else
+		m_pLeastRecent=p;
+	m_pMostRecent=p;
+}
 
-	// Clear it
-	memset(m_Table.GetBuffer(), 0, sizeof(CNode*) * iNewSize);
+// Unlink
+template_lru
+void CLruCache_::Unlink(T* p)
+{
+	T* pPrev=(p->*pChain).m_pPrev;
+	T* pNext=(p->*pChain).m_pNext;
 
-	// Insert each node into the new table
-	CNode* pNode=m_List.GetFirst();
-	while (pNode)
-	{
-		// Hash the key
-		unsigned int nHash = THash::Hash(pNode->m_KeyPair.m_Key) & m_nHashMask;
+	if (pPrev)
+		(pPrev->*pChain).m_pNext=pNext;
+	else
+		m_pMostRecent=pNext;
 
-		// Add to table
-		pNode->m_pHashNext=m_Table[nHash];
-		m_Table.ReplaceAt(nHash, pNode);
+	if (pNext)
+		(pNext->*pChain).m_pPrev=pPrev;
+	else
+		m_pLeastRecent=pPrev;
 
-		// Get next node
-		pNode=pNode->m_Chain.m_pNext;
-	}
+	(p->*pChain).m_pPrev=NULL;
+	(p->*pChain).m_pNext=NULL;
 }
 
-
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::Add(const TKey& Key, const TValue& Value)
+// Trim - evict least recently used items until within capacity
+template_lru
+void CLruCache_::Trim()
 {
-	// Make sure table created
-	if (!m_Table.GetSize())
-		InitHashTable(m_iInitialSize);
-
-	// Hash the key
-	unsigned int nHash = THash::Hash(Key) & m_nHashMask;
-
-	// Check for duplicate and just replace value if found
-	CNode* pNode=m_Table[nHash];
-	while (pNode)
+	while (m_Index.GetSize()>m_iCapacity)
 	{
-		if (TKeySem::Compare(Key, pNode->m_KeyPair.m_Key)==0)
-		{
-			// Replace value
-			TKeySem::OnRemove(pNode->m_KeyPair.m_Key, this);
-			TValueSem::OnRemove(pNode->m_KeyPair.m_Value, this);
-			pNode->m_KeyPair.m_Value = TValueSem::OnAdd(Value, this);
-			pNode->m_KeyPair.m_Key = TKeySem::OnAdd(Key, this);
-			return;
-		}
-
-		// Next
-		pNode=pNode->m_pHashNext;
+		Remove(m_pLeastRecent);
 	}
+}
 
+// Add - replaces any existing item with the same key (re-adding an item
+// that's already cached just marks it most recently used)
+template_lru
+void CLruCache_::Add(T* p)
+{
+	ASSERT(p!=NULL);
 
-	// Create a new node
-	CNode* pNew = m_NodePlex.Alloc();
-	pNew->m_KeyPair.m_Value = TValueSem::OnAdd(Value, this);
-	pNew->m_KeyPair.m_Key = TKeySem::OnAdd(Key, this);
-
-	// Setup collision chain
-	pNew->m_pHashNext=m_Table[nHash];
-	m_Table.ReplaceAt(nHash, pNew);
+	// Replacing an existing item?
+	T* pOld=m_Index.Find(p->*pKey);
+	if (pOld==p)
+	{
+		Touch(p);
+		return;
+	}
+	if (pOld)
+		Remove(pOld);
 
-	/// Add to navigation link
-	m_List.Add(pNew);
+	m_Index.Add(p);
+	Link(p);
+	Trim();
+}
 
-	// Time to rehash?
-	if(m_List.GetSize() > m_iThreshold)
-		Rehash(m_Table.GetSize() * 2);
+// Find - returns the item and marks it most recently used
+template_lru
+T* CLruCache_::Find(const TKey& Key)
+{
+	T* p=m_Index.Find(Key);
+	if (p)
+		Touch(p);
+	return p;
+}
 
-	// Done!
+// Peek - returns the item without changing its position
+template_lru
+T* CLruCache_::Peek(const TKey& Key) const
+{
+	return m_Index.Find(Key);
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::Remove(const TKeyArg& Key)
+// Touch - mark an item as most recently used
+template_lru
+void CLruCache_::Touch(T* p)
 {
-	RemoveOrDetach(Key, NULL);
+	if (p==m_pMostRecent)
+		return;
+	Unlink(p);
+	Link(p);
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-TValue CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::Detach(const TKeyArg& Key)
+// Detach - remove without invoking semantics
+template_lru
+T* CLruCache_::Detach(T* p)
 {
-	TValue val;
-	RemoveOrDetach(Key, &val);
-	return val;
+	if (!m_Index.Detach(p))
+		return NULL;
+	Unlink(p);
+	return p;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-const TValue& CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::Get(const TKeyArg& Key, const TValue& Default) const
+// Remove
+template_lru
+void CLruCache_::Remove(T* p)
 {
-	CNode* pNode=FindNode(Key);
-	if (!pNode)
-		return Default;
+	if (Detach(p))
+		TSem::OnRemove(p, this);
+}
 
-	return pNode->m_KeyPair.m_Value;
+// RemoveAll
+template_lru
+void CLruCache_::RemoveAll()
+{
+	while (m_pLeastRecent)
+	{
+		Remove(m_pLeastRecent);
+	}
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-bool CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::Find(const TKeyArg& Key, TValue& Value) const
+// SetCapacity
+template_lru
+void CLruCache_::SetCapacity(int iCapacity)
 {
-	CNode* pNode=FindNode(Key);
-	if (!pNode)
-		return false;
-	Value=pNode->m_KeyPair.m_Value;
-	return true;
+	ASSERT(iCapacity>0);
+	m_iCapacity=iCapacity;
+	Trim();
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-bool CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::HasKey(const TKeyArg& Key) const
+// GetCapacity
+template_lru
+int CLruCache_::GetCapacity() const
 {
-	return FindNode(Key)!=NULL;
+	return m_iCapacity;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-typename CHashMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, THash>::CNode* CHashMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, THash>::FindNode(const TKeyArg& Key) const
+// GetSize
+template_lru
+int CLruCache_::GetSize() const
 {
-	if (IsEmpty())
-		return NULL;
+	return m_Index.GetSize();
+}
 
-	// Hash the key
-	unsigned int nHash = THash::Hash(Key) & m_nHashMask;
+// IsEmpty
+template_lru
+bool CLruCache_::IsEmpty() const
+{
+	return m_Index.IsEmpty();
+}
 
-	// Check for duplicate and just replace value if found
-	CNode* pNode=m_Table[nHash];
-	while (pNode)
-	{
-		if (TKeySem::Compare(Key, pNode->m_KeyPair.m_Key)==0)
-			return pNode;
+// GetMostRecent
+template_lru
+T* CLruCache_::GetMostRecent() const
+{
+	return m_pMostRecent;
+}
 
-		pNode=pNode->m_pHashNext;
-	}
+// GetLeastRecent
+template_lru
+T* CLruCache_::GetLeastRecent() const
+{
+	return m_pLeastRecent;
+}
 
-	return NULL;
+// GetNext
+template_lru
+T* CLruCache_::GetNext(T* p) const
+{
+	return (p->*pChain).m_pNext;
 }
 
+#undef template_lru
+#undef CLruCache_
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::RemoveOrDetach(const TKeyArg& Key, TValue* pvalDetached)
-{
-	if (IsEmpty())
-		return;
+#endif	// _SIMPLELIB_NO_LINKEDLIST_MULTICHAIN
 
-	// Hash the key
-	unsigned int nHash = THash::Hash(Key) & m_nHashMask;
 
-	// Check for duplicate and just replace value if found
-	CNode* pNode=m_Table[nHash];
-	CNode* pPrev=NULL;
-	while (pNode)
-	{
-		// Match?
-		if (TKeySem::Compare(Key, pNode->m_KeyPair.m_Key)==0)
-		{
-			// Do release semantics
-			TKeySem::OnRemove(pNode->m_KeyPair.m_Key, this);
-			if (!pvalDetached)
-			{
-				TValueSem::OnRemove(pNode->m_KeyPair.m_Value, this);
-			}
-			else
-			{
-				TValueSem::OnDetach(pNode->m_KeyPair.m_Value, this);
-				*pvalDetached=pNode->m_KeyPair.m_Value;
-			}
 
-			// Remove from hash list
-			if (pPrev)
-				pPrev->m_pHashNext=pNode->m_pHashNext;
-			else
-				m_Table.ReplaceAt(nHash, pNode->m_pHashNext);
 
-			// Remove from list
-			m_List.Remove(pNode);
-			m_NodePlex.Free(pNode);
+/////////////////////////////////////////////////////////////////////////////
+// Implementation of CStringPool
 
-			return;
-		}
+// Case folding used when hashing case insensitively.  Must agree with the
+// folding done by SChar<T>::CompareI
+inline unsigned int slxFoldCase(char ch)
+{
+	return (unsigned int)tolower((unsigned char)ch);
+}
 
-		pPrev=pNode;
-		pNode=pNode->m_pHashNext;
-	}
+inline unsigned int slxFoldCase(wchar_t ch)
+{
+	return (unsigned int)towlower(ch);
+}
 
-	// Not found
+// Constructor
+template <class T, class TSem, class TAlloc>
+CStringPool<T,TSem,TAlloc>::CStringPool(int iSlabSize) :
+	m_pHead(NULL),
+	m_iSlabSize(iSlabSize<256 ? 256 : iSlabSize),
+	m_cbUsed(0),
+	m_nHashMask(0)
+{
+	RemoveAll();
+}
 
+// Destructor
+template <class T, class TSem, class TAlloc>
+CStringPool<T,TSem,TAlloc>::~CStringPool()
+{
+	RemoveAll();
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg, class THash>
-void CHashMap<TKey,TValue,TKeySem,TValueSem,TKeyArg,THash>::RemoveAll()
+// RemoveAll - releases all strings, only the empty string (ID 0) remains
+template <class T, class TSem, class TAlloc>
+void CStringPool<T,TSem,TAlloc>::RemoveAll()
 {
-	// Call release semantics on all keys and values
-	CNode* pNode;
-	while ((pNode=m_List.GetFirst()))
+	while (m_pHead)
 	{
-		TKeySem::OnRemove(pNode->m_KeyPair.m_Key, this);
-		TValueSem::OnRemove(pNode->m_KeyPair.m_Value, this);
-		m_List.Remove(pNode);
-		m_NodePlex.Free(pNode);
+		SLAB* pNext=m_pHead->m_pNext;
+		TAlloc::Free(m_pHead);
+		m_pHead=pNext;
 	}
 
-	// Clear the list
+	m_Entries.RemoveAll();
 	m_Table.RemoveAll();
 	m_nHashMask=0;
-	m_iThreshold=0;
-}
-
-/////////////////////////////////////////////////////////////////////////////
-// CIndex
+	m_cbUsed=0;
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::CIndex()
-{
+	ENTRY e;
+	e.m_psz=SChar<T>::EmptyString();
+	e.m_iLength=0;
+	e.m_nHash=0;
+	m_Entries.Add(e);
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::~CIndex()
+// Hash
+template <class T, class TSem, class TAlloc>
+unsigned int CStringPool<T,TSem,TAlloc>::Hash(const T* psz, int iLength)
 {
-	RemoveAll();
-}
+	if (!SIgnoresCase<TSem>::Value)
+		return (unsigned int)SuperFastHash((const char*)psz, iLength*sizeof(T));
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-int CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::GetSize() const
-{
-	return m_Entries.GetSize();
+	// FNV-1a over the folded characters
+	unsigned int nHash=2166136261U;
+	for (int i=0; i<iLength; i++)
+	{
+		nHash^=slxFoldCase(psz[i]);
+		nHash*=16777619U;
+	}
+	return nHash;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-bool CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::IsEmpty() const
+// Equal
+template <class T, class TSem, class TAlloc>
+bool CStringPool<T,TSem,TAlloc>::Equal(const T* a, const T* b, int iLength)
 {
-	return GetSize()==0;
+	if (SIgnoresCase<TSem>::Value)
+		return slxStrEqualI(a, b, iLength);
+	else
+		return memcmp(a, b, iLength*sizeof(T))==0;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-typename CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::CKeyPair CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::operator[](int iIndex) const
+// FindSlot - returns the table slot holding the string, or the empty slot where it would go
+template <class T, class TSem, class TAlloc>
+int CStringPool<T,TSem,TAlloc>::FindSlot(const T* psz, int iLength, unsigned int nHash) const
 {
-	ASSERT(iIndex>=0 && iIndex<GetSize());
-	return CKeyPair(m_Entries[iIndex]);
+	ASSERT(m_Table.GetSize()>0);
+
+	int iSlot=(int)(nHash & m_nHashMask);
+	while (true)
+	{
+		int iID=m_Table[iSlot];
+		if (iID==0)
+			return iSlot;
+
+		const ENTRY& e=m_Entries[iID];
+		if (e.m_nHash==nHash && e.m_iLength==iLength && Equal(e.m_psz, psz, iLength))
+			return iSlot;
+
+		iSlot=(iSlot+1) & m_nHashMask;
+	}
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::Add(const TKey& Key, const TValue& Value)
+// Rehash
+template <class T, class TSem, class TAlloc>
+void CStringPool<T,TSem,TAlloc>::Rehash(int iNewSize)
 {
-	int iPos;
-#ifdef _MSC_VER
-	if (m_Entries.QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos))
-#else
-	if (m_Entries.QuickSearchKey(Key, &CEntry::CompareKey, iPos))
-#endif
+	m_Table.RemoveAll();
+	m_Table.SetSize(iNewSize, 0);
+	m_nHashMask=iNewSize-1;
+
+	for (int i=1; i<m_Entries.GetSize(); i++)
 	{
-		m_Entries.ReplaceAt(iPos, CEntry(TKeySem::OnAdd(Key, this), TValueSem::OnAdd(Value, this)));
+		int iSlot=(int)(m_Entries[i].m_nHash & m_nHashMask);
+		while (m_Table[iSlot]!=0)
+			iSlot=(iSlot+1) & m_nHashMask;
+		m_Table.ReplaceAt(iSlot, i);
 	}
-	else
+}
+
+// Store - copy a string into the current slab, starting a new one if needed
+template <class T, class TSem, class TAlloc>
+T* CStringPool<T,TSem,TAlloc>::Store(const T* psz, int iLength)
+{
+	int iRequired=iLength+1;
+	if (!m_pHead || m_pHead->m_iSize-m_pHead->m_iUsed<iRequired)
 	{
-		m_Entries.InsertAt(iPos, CEntry(TKeySem::OnAdd(Key, this), TValueSem::OnAdd(Value, this)));
+		// Long strings get a slab to themselves, behind the current one so
+		// its free space isn't lost
+		int iSize=iRequired>m_iSlabSize/4 ? iRequired : m_iSlabSize;
+		SLAB* pSlab=(SLAB*)TAlloc::Alloc(sizeof(SLAB)+iSize*sizeof(T));
+		pSlab->m_iSize=iSize;
+		pSlab->m_iUsed=0;
+
+		if (m_pHead && iSize!=m_iSlabSize)
+		{
+			pSlab->m_pNext=m_pHead->m_pNext;
+			m_pHead->m_pNext=pSlab;
+		}
+		else
+		{
+			pSlab->m_pNext=m_pHead;
+			m_pHead=pSlab;
+		}
+
+		// Dedicated slab?
+		if (pSlab!=m_pHead)
+		{
+			pSlab->m_iUsed=iRequired;
+			m_cbUsed+=iRequired*sizeof(T);
+			T* pszStore=reinterpret_cast<T*>(pSlab+1);
+			memcpy(pszStore, psz, iLength*sizeof(T));
+			pszStore[iLength]=0;
+			return pszStore;
+		}
 	}
+
+	T* pszStore=reinterpret_cast<T*>(m_pHead+1)+m_pHead->m_iUsed;
+	memcpy(pszStore, psz, iLength*sizeof(T));
+	pszStore[iLength]=0;
+	m_pHead->m_iUsed+=iRequired;
+	m_cbUsed+=iRequired*sizeof(T);
+	return pszStore;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::Remove(const TKeyArg& Key)
+// Intern - returns the ID of the string, adding it if not already in the pool
+template <class T, class TSem, class TAlloc>
+int CStringPool<T,TSem,TAlloc>::Intern(const T* psz, int iLength)
 {
-	int iPos;
-#ifdef _MSC_VER
-	if (m_Entries.QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos))
-#else
-	if (m_Entries.QuickSearchKey(Key, &CEntry::CompareKey, iPos))
-#endif
-	{
-		TKeySem::OnRemove(m_Entries[iPos].m_Key,this);
-		TValueSem::OnRemove(m_Entries[iPos].m_Value,this);
-		m_Entries.RemoveAt(iPos);
-	}
+	if (!psz)
+		return 0;
+	if (iLength<0)
+		iLength=SChar<T>::Length(psz);
+	if (iLength==0)
+		return 0;
 
+	// Grow table, keeping it at most half full
+	if ((m_Entries.GetSize())*2>m_Table.GetSize())
+		Rehash(m_Table.GetSize() ? m_Table.GetSize()*2 : 64);
+
+	unsigned int nHash=Hash(psz, iLength);
+	int iSlot=FindSlot(psz, iLength, nHash);
+	if (m_Table[iSlot]!=0)
+		return m_Table[iSlot];
+
+	// Add new entry
+	ENTRY e;
+	e.m_psz=Store(psz, iLength);
+	e.m_iLength=iLength;
+	e.m_nHash=nHash;
+	int iID=m_Entries.Add(e);
+	m_Table.ReplaceAt(iSlot, iID);
+	return iID;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-void CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::RemoveAll()
+// InternString - returns the pooled copy of the string
+template <class T, class TSem, class TAlloc>
+const T* CStringPool<T,TSem,TAlloc>::InternString(const T* psz, int iLength)
 {
-	for (int i=0; i<m_Entries.GetSize(); i++)
-	{
-		TKeySem::OnRemove(m_Entries[i].m_Key,this);
-		TValueSem::OnRemove(m_Entries[i].m_Value,this);
-	}
-	m_Entries.RemoveAll();
+	return m_Entries[Intern(psz, iLength)].m_psz;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-TValue CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::Detach(const TKeyArg& Key)
+// Find - returns the ID of a string, or -1 if not in the pool
+template <class T, class TSem, class TAlloc>
+int CStringPool<T,TSem,TAlloc>::Find(const T* psz, int iLength) const
 {
-	int iPos;
-#ifdef _MSC_VER
-	if (m_Entries.QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos))
-#else
-	if (m_Entries.QuickSearchKey(Key, &CEntry::CompareKey, iPos))
-#endif
-	{
-		TValue v=m_Entries[iPos].m_Value;
-		TKeySem::OnRemove(m_Entries[iPos].m_Key,this);
-		TValueSem::OnDetach(m_Entries[iPos].m_Value,this);
-		m_Entries.RemoveAt(iPos);
-		return v;
-	}
-	return TValue();
+	if (!psz)
+		return 0;
+	if (iLength<0)
+		iLength=SChar<T>::Length(psz);
+	if (iLength==0)
+		return 0;
+	if (m_Table.IsEmpty())
+		return -1;
+
+	int iID=m_Table[FindSlot(psz, iLength, Hash(psz, iLength))];
+	return iID ? iID : -1;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-const TValue& CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::Get(const TKeyArg& Key, const TValue& Default) const
+// GetString
+template <class T, class TSem, class TAlloc>
+const T* CStringPool<T,TSem,TAlloc>::GetString(int iID) const
 {
-	int iPos;
-#ifdef _MSC_VER
-	if (m_Entries.QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos))
-#else
-	if (m_Entries.QuickSearchKey(Key, &CEntry::CompareKey, iPos))
-#endif
-	{
-		return m_Entries[iPos].m_Value;
-	}
-	else
-	{
-		return Default;
-	}
+	ASSERT(iID>=0 && iID<m_Entries.GetSize() && "Invalid string pool ID");
+	return m_Entries[iID].m_psz;
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-bool CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::Find(const TKeyArg& Key, TValue& Value) const
+// operator[]
+template <class T, class TSem, class TAlloc>
+const T* CStringPool<T,TSem,TAlloc>::operator[](int iID) const
 {
-	int iPos;
-#ifdef _MSC_VER
-	if (m_Entries.QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos))
-#else
-	if (m_Entries.QuickSearchKey(Key, &CEntry::CompareKey, iPos))
-#endif
-	{
-		Value=m_Entries[iPos].m_Value;
-		return true;
-	}
-	else
-	{
-		return false;
-	}
+	return GetString(iID);
 }
 
-template <class TKey, class TValue, class TKeySem, class TValueSem, class TKeyArg>
-bool CIndex<TKey,TValue,TKeySem,TValueSem, TKeyArg>::HasKey(const TKeyArg& Key) const
+// GetLength
+template <class T, class TSem, class TAlloc>
+int CStringPool<T,TSem,TAlloc>::GetLength(int iID) const
 {
-	int iPos;
-#ifdef _MSC_VER
-	return m_Entries.QuickSearchKey<TKeyArg>(Key, &CEntry::CompareKey, iPos);
-#else
-	return m_Entries.QuickSearchKey(Key, &CEntry::CompareKey, iPos);
-#endif
+	ASSERT(iID>=0 && iID<m_Entries.GetSize() && "Invalid string pool ID");
+	return m_Entries[iID].m_iLength;
 }
 
+// GetCount - number of strings in the pool, including the empty string
+template <class T, class TSem, class TAlloc>
+int CStringPool<T,TSem,TAlloc>::GetCount() const
+{
+	return m_Entries.GetSize();
+}
 
-
+// GetBytesUsed - bytes of string data stored (excluding slab slack and index)
+template <class T, class TSem, class TAlloc>
+size_t CStringPool<T,TSem,TAlloc>::GetBytesUsed() const
+{
+	return m_cbUsed;
+}
 
 
 
@@ -4382,6 +8079,286 @@ T* CRingBuffer<T,TSem>::RewindPtr(T* p) const
 }
 
 
+#ifdef SIMPLELIB_HAS_ATOMIC
+
+/////////////////////////////////////////////////////////////////////////////
+// Implementation of CMpmcQueue
+
+// Constructor
+template <class T, class TSem>
+CMpmcQueue<T,TSem>::CMpmcQueue(int iCapacity)
+{
+	// Round up to power of two
+	size_t iSize=2;
+	while (iSize<(size_t)iCapacity)
+		iSize*=2;
+
+	m_Mask=iSize-1;
+	m_pCells=(CELL*)malloc(sizeof(CELL)*iSize);
+
+	// Each cell starts out ready for the producer at its own index
+	for (size_t i=0; i<iSize; i++)
+		new ((void*)&m_pCells[i].m_Sequence) std::atomic<size_t>(i);
+
+	m_EnqueuePos.store(0, std::memory_order_relaxed);
+	m_DequeuePos.store(0, std::memory_order_relaxed);
+}
+
+// Destructor
+template <class T, class TSem>
+CMpmcQueue<T,TSem>::~CMpmcQueue()
+{
+	// Release anything left in the queue
+	size_t iPos=m_DequeuePos.load(std::memory_order_relaxed);
+	size_t iEnd=m_EnqueuePos.load(std::memory_order_relaxed);
+	for (; iPos!=iEnd; iPos++)
+	{
+		CELL* pCell=&m_pCells[iPos & m_Mask];
+		TSem::OnRemove(pCell->m_Data, this);
+		Destructor(&pCell->m_Data);
+	}
+
+	free(m_pCells);
+}
+
+template <class T, class TSem>
+bool CMpmcQueue<T,TSem>::Enqueue(const T& t)
+{
+	CELL* pCell;
+	size_t iPos=m_EnqueuePos.load(std::memory_order_relaxed);
+	while (true)
+	{
+		pCell=&m_pCells[iPos & m_Mask];
+		size_t iSeq=pCell->m_Sequence.load(std::memory_order_acquire);
+		intptr_t iDiff=(intptr_t)iSeq-(intptr_t)iPos;
+
+		if (iDiff==0)
+		{
+			// Cell is free, try to claim it
+			if (m_EnqueuePos.compare_exchange_weak(iPos, iPos+1, std::memory_order_relaxed))
+				break;
+		}
+		else if (iDiff<0)
+		{
+			// Cell still holds an item from the previous lap - full
+			return false;
+		}
+		else
+		{
+			// Another producer got in first
+			iPos=m_EnqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	Constructor(&pCell->m_Data, TSem::OnAdd(t, this));
+
+	// Publish to consumers
+	pCell->m_Sequence.store(iPos+1, std::memory_order_release);
+	return true;
+}
+
+template <class T, class TSem>
+bool CMpmcQueue<T,TSem>::Dequeue(T& t)
+{
+	CELL* pCell;
+	size_t iPos=m_DequeuePos.load(std::memory_order_relaxed);
+	while (true)
+	{
+		pCell=&m_pCells[iPos & m_Mask];
+		size_t iSeq=pCell->m_Sequence.load(std::memory_order_acquire);
+		intptr_t iDiff=(intptr_t)iSeq-(intptr_t)(iPos+1);
+
+		if (iDiff==0)
+		{
+			// Cell has been published, try to claim it
+			if (m_DequeuePos.compare_exchange_weak(iPos, iPos+1, std::memory_order_relaxed))
+				break;
+		}
+		else if (iDiff<0)
+		{
+			// Nothing published here yet - empty
+			return false;
+		}
+		else
+		{
+			// Another consumer got in first
+			iPos=m_DequeuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	t=pCell->m_Data;
+	TSem::OnDetach(pCell->m_Data, this);
+	Destructor(&pCell->m_Data);
+
+	// Hand the cell back to producers for the next lap
+	pCell->m_Sequence.store(iPos+m_Mask+1, std::memory_order_release);
+	return true;
+}
+
+template <class T, class TSem>
+int CMpmcQueue<T,TSem>::GetCapacity() const
+{
+	return (int)(m_Mask+1);
+}
+
+template <class T, class TSem>
+int CMpmcQueue<T,TSem>::GetSizeApprox() const
+{
+	size_t iDequeue=m_DequeuePos.load(std::memory_order_relaxed);
+	size_t iEnqueue=m_EnqueuePos.load(std::memory_order_relaxed);
+	intptr_t iSize=(intptr_t)(iEnqueue-iDequeue);
+	if (iSize<0)
+		return 0;
+	if (iSize>(intptr_t)(m_Mask+1))
+		return (int)(m_Mask+1);
+	return (int)iSize;
+}
+
+template <class T, class TSem>
+bool CMpmcQueue<T,TSem>::IsEmptyApprox() const
+{
+	return GetSizeApprox()==0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Implementation of CWorkStealingDeque
+
+// Constructor
+template <class T, class TSem>
+CWorkStealingDeque<T,TSem>::CWorkStealingDeque(int iInitialCapacity)
+{
+	int64_t iSize=2;
+	while (iSize<iInitialCapacity)
+		iSize*=2;
+
+	m_iTop.store(0, std::memory_order_relaxed);
+	m_iBottom.store(0, std::memory_order_relaxed);
+	m_pArray.store(AllocArray(iSize), std::memory_order_relaxed);
+}
+
+// Destructor
+template <class T, class TSem>
+CWorkStealingDeque<T,TSem>::~CWorkStealingDeque()
+{
+	// Release anything left in the deque
+	ARRAY* pArray=m_pArray.load(std::memory_order_relaxed);
+	int64_t iBottom=m_iBottom.load(std::memory_order_relaxed);
+	for (int64_t i=m_iTop.load(std::memory_order_relaxed); i<iBottom; i++)
+	{
+		T t=pArray->Get(i);
+		TSem::OnRemove(t, this);
+	}
+
+	free(pArray);
+	for (int i=0; i<m_Retired.GetSize(); i++)
+		free(m_Retired[i]);
+}
+
+template <class T, class TSem>
+typename CWorkStealingDeque<T,TSem>::ARRAY* CWorkStealingDeque<T,TSem>::AllocArray(int64_t iCapacity)
+{
+	ARRAY* pArray=(ARRAY*)malloc(sizeof(ARRAY)+sizeof(std::atomic<T>)*(size_t)(iCapacity-1));
+	pArray->m_iMask=iCapacity-1;
+	for (int64_t i=0; i<iCapacity; i++)
+		new ((void*)&pArray->m_Items[i]) std::atomic<T>();
+	return pArray;
+}
+
+// Double the buffer size (owner thread only)
+template <class T, class TSem>
+typename CWorkStealingDeque<T,TSem>::ARRAY* CWorkStealingDeque<T,TSem>::Grow(ARRAY* pArray, int64_t iTop, int64_t iBottom)
+{
+	ARRAY* pNew=AllocArray((pArray->m_iMask+1)*2);
+	for (int64_t i=iTop; i<iBottom; i++)
+		pNew->Put(i, pArray->Get(i));
+
+	// Thieves may still be reading the old array
+	m_Retired.Add(pArray);
+	m_pArray.store(pNew, std::memory_order_release);
+	return pNew;
+}
+
+template <class T, class TSem>
+void CWorkStealingDeque<T,TSem>::Push(const T& t)
+{
+	int64_t iBottom=m_iBottom.load(std::memory_order_relaxed);
+	int64_t iTop=m_iTop.load(std::memory_order_acquire);
+	ARRAY* pArray=m_pArray.load(std::memory_order_relaxed);
+
+	if (iBottom-iTop>pArray->m_iMask)
+		pArray=Grow(pArray, iTop, iBottom);
+
+	pArray->Put(iBottom, TSem::OnAdd(t, this));
+
+	// Publish to thieves
+	m_iBottom.store(iBottom+1, std::memory_order_release);
+}
+
+template <class T, class TSem>
+bool CWorkStealingDeque<T,TSem>::Pop(T& t)
+{
+	int64_t iBottom=m_iBottom.load(std::memory_order_relaxed)-1;
+	ARRAY* pArray=m_pArray.load(std::memory_order_relaxed);
+	m_iBottom.store(iBottom, std::memory_order_seq_cst);
+	int64_t iTop=m_iTop.load(std::memory_order_seq_cst);
+
+	if (iTop>iBottom)
+	{
+		// Empty
+		m_iBottom.store(iBottom+1, std::memory_order_relaxed);
+		return false;
+	}
+
+	t=pArray->Get(iBottom);
+	if (iTop==iBottom)
+	{
+		// Last item, race thieves for it
+		bool bWon=m_iTop.compare_exchange_strong(iTop, iTop+1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		m_iBottom.store(iBottom+1, std::memory_order_relaxed);
+		if (!bWon)
+			return false;
+	}
+
+	TSem::OnDetach(t, this);
+	return true;
+}
+
+template <class T, class TSem>
+bool CWorkStealingDeque<T,TSem>::Steal(T& t)
+{
+	int64_t iTop=m_iTop.load(std::memory_order_seq_cst);
+	int64_t iBottom=m_iBottom.load(std::memory_order_seq_cst);
+	if (iTop>=iBottom)
+		return false;
+
+	ARRAY* pArray=m_pArray.load(std::memory_order_acquire);
+	T temp=pArray->Get(iTop);
+	if (!m_iTop.compare_exchange_strong(iTop, iTop+1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return false;
+
+	t=temp;
+	TSem::OnDetach(t, this);
+	return true;
+}
+
+template <class T, class TSem>
+int CWorkStealingDeque<T,TSem>::GetSizeApprox() const
+{
+	int64_t iBottom=m_iBottom.load(std::memory_order_relaxed);
+	int64_t iTop=m_iTop.load(std::memory_order_relaxed);
+	return iBottom>iTop ? (int)(iBottom-iTop) : 0;
+}
+
+template <class T, class TSem>
+bool CWorkStealingDeque<T,TSem>::IsEmptyApprox() const
+{
+	return GetSizeApprox()==0;
+}
+
+#endif	// SIMPLELIB_HAS_ATOMIC
+
+
 /////////////////////////////////////////////////////////////////////////////
 // CPool
 
@@ -4452,20 +8429,34 @@ void CPool<T>::FreeExtra(int iNewMinSize)
 
 // WHAT THE HELL IS THIS???
 // It's a cross platform version of __declspec(selectany) to store
-// the global pointer to the first type entry
+// the global list of types and the ID lookup table.  All zero initialized
+// so types can register in any order during static initialization.
 class CDynType;
 template <int iDummy=0>
-struct CDynTypeFirstHolder
+struct CDynTypeRegistry
 {
 	static CDynType* m_pFirst;
+	static CDynType** m_ppTable;		// Open addressed, by type ID
+	static int m_iTableSize;
+	static int m_iCount;				// Types in m_ppTable
 };
-template <int iDummy> CDynType* CDynTypeFirstHolder<iDummy>::m_pFirst=NULL;
+template <int iDummy> CDynType* CDynTypeRegistry<iDummy>::m_pFirst=NULL;
+template <int iDummy> CDynType** CDynTypeRegistry<iDummy>::m_ppTable=NULL;
+template <int iDummy> int CDynTypeRegistry<iDummy>::m_iTableSize=0;
+template <int iDummy> int CDynTypeRegistry<iDummy>::m_iCount=0;
+
+inline unsigned int slxDynTypeHash(int iID)
+{
+	return (unsigned int)iID * 2654435761U;
+}
 
 
-inline CDynType::CDynType(int iID, void* (*pfnCreate)(), const wchar_t* pszName) :
+inline CDynType::CDynType(int iID, void* (*pfnCreate)(), const wchar_t* pszName, CDynType* const* ppChain, int iDepth) :
 	m_iID(iID),
 	m_pfnCreate(pfnCreate),
-	m_strName(pszName)
+	m_pszName(pszName),
+	m_ppChain(ppChain),
+	m_iDepth(iDepth)
 {
 #ifdef _DEBUG
 	// Check for duplicate type id's
@@ -4475,34 +8466,81 @@ inline CDynType::CDynType(int iID, void* (*pfnCreate)(), const wchar_t* pszName)
 	}
 #endif
 
-	m_pNext=CDynTypeFirstHolder<>::m_pFirst;
-	CDynTypeFirstHolder<>::m_pFirst=this;
+	m_pNext=CDynTypeRegistry<>::m_pFirst;
+	CDynTypeRegistry<>::m_pFirst=this;
+
+	if (iID!=0)
+		Register(this);
+}
+
+// Register - add a type to the ID lookup table.  Only called during static
+// initialization so lookups afterwards are read only (and thread safe)
+inline void CDynType::Register(CDynType* pType)
+{
+	typedef CDynTypeRegistry<> R;
+
+	// Grow at 50% full, re-adding everything from the type list
+	if ((R::m_iCount+1)*2>R::m_iTableSize)
+	{
+		int iNewSize=R::m_iTableSize ? R::m_iTableSize*2 : 64;
+		CDynType** ppNewTable=(CDynType**)calloc(iNewSize, sizeof(CDynType*));
+		if (!ppNewTable)
+			return;
+		free(R::m_ppTable);
+		R::m_ppTable=ppNewTable;
+		R::m_iTableSize=iNewSize;
+		R::m_iCount=0;
+
+		for (CDynType* p=R::m_pFirst; p; p=p->m_pNext)
+		{
+			if (p->m_iID!=0 && p!=pType)
+				Register(p);
+		}
+	}
+
+	unsigned int nMask=R::m_iTableSize-1;
+	unsigned int nSlot=slxDynTypeHash(pType->m_iID) & nMask;
+	while (R::m_ppTable[nSlot])
+		nSlot=(nSlot+1) & nMask;
+	R::m_ppTable[nSlot]=pType;
+	R::m_iCount++;
 }
 
 inline CDynType* CDynType::GetTypeFromID(int iID)
 {
-	CDynType* p=CDynTypeFirstHolder<>::m_pFirst;
-	while (p)
+	typedef CDynTypeRegistry<> R;
+	if (iID==0 || !R::m_ppTable)
+		return NULL;
+
+	unsigned int nMask=R::m_iTableSize-1;
+	unsigned int nSlot=slxDynTypeHash(iID) & nMask;
+	while (CDynType* p=R::m_ppTable[nSlot])
 	{
 		if (p->m_iID==iID)
 			return p;
-		p=p->m_pNext;
+		nSlot=(nSlot+1) & nMask;
 	}
 	return NULL;
 }
 
 inline CDynType* CDynType::GetTypeFromName(const wchar_t* pszName)
 {
-	CDynType* p=CDynTypeFirstHolder<>::m_pFirst;
+	CDynType* p=CDynTypeRegistry<>::m_pFirst;
 	while (p)
 	{
-		if (IsEqualString(p->m_strName, pszName))
+		if (p->m_pszName && IsEqualString(p->m_pszName, pszName))
 			return p;
 		p=p->m_pNext;
 	}
 	return NULL;
 }
 
+inline void* CDynType::CreateInstanceFromID(int iID)
+{
+	CDynType* pType=GetTypeFromID(iID);
+	return pType ? pType->CreateInstance() : NULL;
+}
+
 
 inline void* CDynType::CreateInstance() const
 {
@@ -4517,10 +8555,50 @@ inline int CDynType::GetID() const
 
 inline const wchar_t* CDynType::GetName() const
 {
-	return m_strName;
+	return m_pszName;
+}
+
+inline int CDynType::GetDepth() const
+{
+	return m_iDepth;
+}
+
+inline CDynType* CDynType::GetBaseType() const
+{
+	return m_iDepth>1 ? m_ppChain[m_iDepth-2] : NULL;
+}
+
+// IsKindOf - check if this type is pType or derived from it
+inline bool CDynType::IsKindOf(const CDynType* pType) const
+{
+	if (pType==this)
+		return true;
+	if (!pType || !m_ppChain || pType->m_iDepth<1 || pType->m_iDepth>m_iDepth)
+		return false;
+	return m_ppChain[pType->m_iDepth-1]==pType;
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+// CDynTypeChainTable
+
+template <class TSelf>
+CDynType* const CDynTypeChainTable<TSelf>::m_Types[SIMPLELIB_DYNTYPE_MAXDEPTH]=
+{
+	CDynTypeChain<TSelf, 0>::Get(),
+	CDynTypeChain<TSelf, 1>::Get(),
+	CDynTypeChain<TSelf, 2>::Get(),
+	CDynTypeChain<TSelf, 3>::Get(),
+	CDynTypeChain<TSelf, 4>::Get(),
+	CDynTypeChain<TSelf, 5>::Get(),
+	CDynTypeChain<TSelf, 6>::Get(),
+	CDynTypeChain<TSelf, 7>::Get(),
+#if SIMPLELIB_DYNTYPE_MAXDEPTH>8
+#error SIMPLELIB_DYNTYPE_MAXDEPTH>8 needs more entries in CDynTypeChainTable
+#endif
+};
+
+
 
 /////////////////////////////////////////////////////////////////////////////
 // CDynamicBase
@@ -4543,6 +8621,12 @@ CDynType* CDynamicBase<TSelf,TBase>::QueryType()
 	return GetType();
 }
 
+template <class TSelf, class TBase>
+CDynType* const* CDynamicBase<TSelf,TBase>::QueryTypeChain()
+{
+	return CDynTypeChainTable<TSelf>::m_Types;
+}
+
 template <class TSelf, class TBase>
 CDynType* CDynamicBase<TSelf,TBase>::GetType()
 {
@@ -4557,7 +8641,7 @@ const wchar_t* CDynamicBase<TSelf,TBase>::GetTypeName()
 
 
 template <class TSelf, class TBase>
-CDynType CDynamic<TSelf,TBase>::dyntype(0,NULL,TSelf::GetTypeName());
+CDynType CDynamic<TSelf,TBase>::dyntype(0,NULL,TSelf::GetTypeName(),CDynTypeChainTable<TSelf>::m_Types,TSelf::DynTypeDepth);
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -4576,7 +8660,7 @@ void* CDynamicCreatable<TSelf,TBase,iID>::CreateInstance()
 }
 
 template <class TSelf, class TBase, int iID>
-CDynType CDynamicCreatable<TSelf,TBase,iID>::dyntype(iID?iID:TSelf::GenerateTypeID(),TSelf::CreateInstance,TSelf::GetTypeName());
+CDynType CDynamicCreatable<TSelf,TBase,iID>::dyntype(iID?iID:TSelf::GenerateTypeID(),TSelf::CreateInstance,TSelf::GetTypeName(),CDynTypeChainTable<TSelf>::m_Types,TSelf::DynTypeDepth);
 
 
 #endif		// _SIMPLELIB_NO_DYNAMIC
@@ -34,15 +34,66 @@
 #include <wchar.h>
 #include <ctype.h>
 #include <wctype.h>
+#include <limits.h>
+#include <stddef.h>
+#include <iterator>
 
 #if defined(_WIN32)
 #include <malloc.h>
 #endif
 
+// SIMD string kernels (define SIMPLELIB_NO_SIMD to use the scalar versions only)
+#ifndef SIMPLELIB_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#define SIMPLELIB_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define SIMPLELIB_AVX2
+#include <immintrin.h>
+#endif
+#if defined(SIMPLELIB_SSE2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// Lock free containers need C++11 atomics (define SIMPLELIB_NO_ATOMIC to leave them out)
+#ifndef SIMPLELIB_NO_ATOMIC
+#if __cplusplus>=201103L || (defined(_MSC_VER) && _MSC_VER>=1700)
+#define SIMPLELIB_HAS_ATOMIC
+#include <atomic>
+#endif
+#endif
+
+#if defined(SIMPLELIB_STRING_ATOMIC_REFCOUNT) && !defined(SIMPLELIB_HAS_ATOMIC)
+#error SIMPLELIB_STRING_ATOMIC_REFCOUNT requires C++11 atomics
+#endif
+
+// Parallel algorithms need C++11 threads (define SIMPLELIB_NO_THREADS to leave them out)
+#if defined(SIMPLELIB_HAS_ATOMIC) && !defined(SIMPLELIB_NO_THREADS)
+#define SIMPLELIB_HAS_THREADS
+#include <thread>
+#endif
+
 #ifdef _MSC_VER
 #define SIMPLEAPI __stdcall
+#define SIMPLECDECL __cdecl
 #else
 #define SIMPLEAPI
+#define SIMPLECDECL
+#endif
+
+#ifdef _MSC_VER
+#define SIMPLELIB_THREADLOCAL __declspec(thread)
+#else
+#define SIMPLELIB_THREADLOCAL __thread
+#endif
+
+// Used where compile time evaluation lets tables be statically initialized
+#if __cplusplus>=201103L || (defined(_MSC_VER) && _MSC_VER>=1900)
+#define SIMPLELIB_CONSTEXPR constexpr
+#else
+#define SIMPLELIB_CONSTEXPR
 #endif
 
 
@@ -53,7 +104,6 @@ typedef __int64 int64_t;
 typedef unsigned __int64 uint64_t;
 #else
 #include <stdint.h>
-typedef unsigned long long int uint64_t;
 #endif
 
 
@@ -76,8 +126,6 @@ typedef unsigned long long int uint64_t;
 
 #ifdef __GNUG__
 #define MAX_PATH 4096
-#define _cdecl
-#define __cdecl
 #define _stricmp strcasecmp
 #define _wcsicmp Simple::lazy_wcsicmp
 #define _wcsnicmp Simple::lazy_wcsnicmp
@@ -162,13 +210,7 @@ inline void __CRTDECL operator delete(void *, void *)
 #endif
 
 #else
-inline void* operator new(size_t, void* pMem)
-{
-	return pMem;
-}
-inline void operator delete(void* pMem, void*)
-{
-}
+#include <new>
 #endif
 
 template<class T, class T2> inline
@@ -187,6 +229,49 @@ void Destructor(T *ptr)
 namespace Simple
 {
 
+// Lazy man's version of wcsicmp for compilers that don't support it
+inline int lazy_wcsicmp(const wchar_t* psz1, const wchar_t* psz2)
+{
+	while (*psz1 || *psz2)
+	{
+		int icmp=int(towupper(*psz1++))-int(towupper(*psz2++));
+		if (icmp!=0)
+			return icmp;
+	}
+
+	return 0;
+}
+
+inline int lazy_wcsnicmp(const wchar_t* psz1, const wchar_t* psz2, size_t len)
+{
+	while ((*psz1 || *psz2) && len)
+	{
+		int icmp=int(towupper(*psz1++))-int(towupper(*psz2++));
+		if (icmp!=0)
+			return icmp;
+
+		len--;
+	}
+
+	return 0;
+}
+
+inline int lazy_strnicmp(const char* psz1, const char* psz2, size_t len)
+{
+	while ((*psz1 || *psz2) && len)
+	{
+		int icmp=int(towupper(*psz1++))-int(towupper(*psz2++));
+		if (icmp!=0)
+			return icmp;
+
+		len--;
+	}
+
+	return 0;
+}
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // Character template - used to get char <-> wchar_t opposite type in
 //						templatized manner
@@ -288,6 +373,232 @@ public:
 };
 #endif
 
+/////////////////////////////////////////////////////////////////////////////
+// Allocation statistics
+
+/*
+
+Define SIMPLELIB_ALLOC_STATS to have CVector, CString, CPlex and CHashMap count
+allocations, reallocs, frees and bytes (current, peak and total) per container
+type.  Without it the hooks compile to nothing.
+
+Counters are atomic when SIMPLELIB_HAS_ATOMIC is available so containers on
+different threads can be counted safely.
+
+Anything still allocated when the program exits is reported to stderr (define
+SIMPLELIB_ALLOC_STATS_NO_REPORT to turn that off).  Note that static containers
+destroyed after the report will show up as leaks.
+
+A CHashMap's bucket table and node blocks are counted against catHashMap rather
+than catVector/catPlex.
+
+eg:
+
+	CAllocStats::Dump();
+
+	ALLOCSTATS stats=CAllocStats::Get(CAllocStats::catString);
+	printf("%i strings outstanding\n", (int)(stats.iAllocs-stats.iFrees));
+
+*/
+
+#ifdef SIMPLELIB_ALLOC_STATS
+
+struct ALLOCSTATS
+{
+	int64_t	iAllocs;
+	int64_t	iReallocs;
+	int64_t	iFrees;
+	int64_t	iBytesTotal;		// All bytes ever handed out (including realloc growth)
+	int64_t	iBytesCurrent;
+	int64_t	iBytesPeak;
+};
+
+class CAllocStats
+{
+public:
+	enum
+	{
+		catVector,
+		catString,
+		catPlex,
+		catHashMap,
+		catMax,
+	};
+
+// Hooks
+	static void OnAlloc(int iCategory, size_t cb);
+	static void OnRealloc(int iCategory, size_t cbOld, size_t cbNew);
+	static void OnFree(int iCategory, size_t cb);
+
+// Operations
+	static ALLOCSTATS Get(int iCategory);
+	static const char* GetCategoryName(int iCategory);
+	static void Reset();
+	static void Dump(FILE* pFile=stderr);
+	static bool ReportLeaks(FILE* pFile=stderr);
+};
+
+#define SIMPLELIB_STAT_ALLOC(cat, cb)				CAllocStats::OnAlloc(cat, cb)
+#define SIMPLELIB_STAT_REALLOC(cat, cbOld, cbNew)	CAllocStats::OnRealloc(cat, cbOld, cbNew)
+#define SIMPLELIB_STAT_FREE(cat, cb)				CAllocStats::OnFree(cat, cb)
+
+#else
+
+#define SIMPLELIB_STAT_ALLOC(cat, cb)
+#define SIMPLELIB_STAT_REALLOC(cat, cbOld, cbNew)
+#define SIMPLELIB_STAT_FREE(cat, cb)
+
+#endif	// SIMPLELIB_ALLOC_STATS
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Allocation policies - control where container memory comes from
+
+/*
+
+Allocation policy classes supply the raw memory for string buffers, vector
+buffers and map/hashmap nodes.  SHeap (the default) is plain malloc/realloc/free.
+
+SArena allocates from the CArena that's current on the calling thread (see
+CArenaScope).  Frees are effectively no-ops and everything is released in one
+shot when the arena is freed, which suits parse-then-discard work (eg: loading
+resource tables from an NE file).  Each block remembers which arena it came
+from so containers can keep growing after the scope ends - but they must be
+destroyed before the arena is.
+
+eg:
+
+	CArena arena;
+	{
+		CArenaScope scope(arena);
+
+		CVector<RESOURCE_ENTRY, SValue, RESOURCE_ENTRY, SArena>		vecEntries;
+		CMap<int, CAnsiString, SValue, SValue, int, SArena>			mapNames;
+		CString<char, SArena>										strName("ICON");
+
+		... parse, use, destroy ...
+	}
+	arena.FreeAll();
+
+CLinkedList is intrusive and never allocates.  Items for it can be created with
+CArena::New and added with SArenaObject semantics.
+
+*/
+
+// Heap allocation (default)
+class SHeap
+{
+public:
+	static void* Alloc(size_t cb)
+		{ return malloc(cb); }
+	static void* Realloc(void* p, size_t cb)
+		{ return realloc(p, cb); }
+	static void Free(void* p)
+		{ free(p); }
+};
+
+
+// CArena - monotonic block allocator
+class CArena
+{
+public:
+// Construction
+	CArena(size_t cbBlockSize=65536);
+	~CArena();
+
+// Operations
+	void* Alloc(size_t cb);
+	void* Realloc(void* p, size_t cb);
+	void Free(void* p);
+	void FreeAll();
+	size_t GetBytesUsed() const;
+
+	template <class T>
+	T* New()
+	{
+		void* p=Alloc(sizeof(T));
+		return p ? new (p) T() : NULL;
+	}
+
+	static CArena* GetCurrent();
+	static CArena* FromPointer(void* p);
+
+// Implementation
+protected:
+	// Every allocation is prefixed with its owner and size so Realloc/Free
+	// work without the caller knowing either
+	union ALLOCHDR
+	{
+		struct
+		{
+			CArena*	pArena;
+			size_t	cbSize;
+		} info;
+		double		dAlign;
+		void*		pAlign[2];
+	};
+
+	union BLOCK
+	{
+		struct
+		{
+			BLOCK*	pNext;
+			size_t	cbSize;
+			size_t	cbUsed;
+		} info;
+		ALLOCHDR	align[2];
+	};
+
+	BLOCK*		m_pHead;
+	size_t		m_cbBlockSize;
+	size_t		m_cbUsed;
+
+	BLOCK* NewBlock(size_t cbMin);
+
+private:
+// Unsupported
+	CArena(const CArena& Other);
+	CArena& operator=(const CArena& Other);
+};
+
+
+// CArenaScope - makes an arena current on this thread for its lifetime
+class CArenaScope
+{
+public:
+	CArenaScope(CArena& arena);
+	~CArenaScope();
+
+protected:
+	CArena*		m_pPrev;
+};
+
+
+// Arena allocation
+class SArena
+{
+public:
+	static void* Alloc(size_t cb)
+	{
+		CArena* pArena=CArena::GetCurrent();
+		ASSERT(pArena!=NULL && "SArena allocation with no current arena (see CArenaScope)");
+		return pArena->Alloc(cb);
+	}
+	static void* Realloc(void* p, size_t cb)
+	{
+		if (!p)
+			return Alloc(cb);
+		return CArena::FromPointer(p)->Realloc(p, cb);
+	}
+	static void Free(void* p)
+	{
+		if (p)
+			CArena::FromPointer(p)->Free(p);
+	}
+};
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // String Class
 
@@ -297,7 +608,13 @@ Simple string class stores a string.  Normally NULL terminated but not
 necessarily so.
 
 Implements "copy on write" for effecient copy of CString to CString
-	(eg: function return values etc...)
+	(eg: function return values etc...)  Copies share the buffer until one
+	of them is modified (GetBuffer, Append etc) - reading, including
+	operator[], never copies.
+
+Define SIMPLELIB_STRING_ATOMIC_REFCOUNT to make the share count atomic so
+	copies of a string can be passed to, and released on, other threads.
+	(Each CString object itself is still single threaded)
 
 Also, implemented with internal data prefixed to string memory so string class can be
 	passed as a string pointer for sprintf type functions. (ie: the whole class is same
@@ -313,28 +630,31 @@ Also, Format for easy sprintf type formatting:
 	CString<char> strName("Topten Software");
 	CString<char> strGreeting=Format("Hello World from %s", strName);
 
+The optional TAlloc parameter selects the allocation policy for the string
+buffer (see SHeap/SArena).
+
 */
 
 class CAnyString;
 
-template <class T>
+template <class T, class TAlloc=SHeap>
 class CString
 {
 	typedef typename SChar<T>::TAlt TAlt;
 public:
 // Construction
 	CString();
-	CString(const CString<T>& Other);
+	CString(const CString<T,TAlloc>& Other);
 	CString(const T* psz, int iLen=-1);
 	CString(const CAnyString& Other);
 	~CString();
 
 // Types
-	typedef CString<T> _CString;
+	typedef CString<T,TAlloc> _CString;
 
 // Operators
-	CString<T>& operator=(const CString<T>& Other);
-	CString<T>& operator=(const T* psz);
+	CString<T,TAlloc>& operator=(const CString<T,TAlloc>& Other);
+	CString<T,TAlloc>& operator=(const T* psz);
 	operator const T* () const;
 	const T* sz() const;
 	const T& operator[] (int iPos);
@@ -345,7 +665,7 @@ public:
 	T* GrowBuffer(int iNewSize);			// Smart grow for appending, doubles buffer size when too small
 	void Empty();
 	bool IsEmpty() const;
-	bool Assign(const CString<T>& Other);
+	bool Assign(const CString<T,TAlloc>& Other);
 	bool Assign(const T* psz, int iLen=-1);
 	bool Assign(const TAlt* psz, int iLen=-1);
 	int GetLength() const;
@@ -354,19 +674,19 @@ public:
 	bool Append(const T ch);
 	bool Insert(int iPos, const T* psz, int iLen=-1);
 	bool Delete(int iPos, int iLen=-1);
-	CString<T>& operator+=(const T* psz);
-	CString<T>& operator+=(T ch);
-	CString<T> ToUpper();
-	CString<T> ToLower();
+	CString<T,TAlloc>& operator+=(const T* psz);
+	CString<T,TAlloc>& operator+=(T ch);
+	CString<T,TAlloc> ToUpper();
+	CString<T,TAlloc> ToLower();
 	int Compare(const T* psz);
-	CString<T> Left(int iCount);
-	CString<T> Right(int iCount);
-	CString<T> SubStr(int iFrom, int iCount=-1);
-	CString<T> Mid(int iFrom, int iCount=-1);
+	CString<T,TAlloc> Left(int iCount);
+	CString<T,TAlloc> Right(int iCount);
+	CString<T,TAlloc> SubStr(int iFrom, int iCount=-1);
+	CString<T,TAlloc> Mid(int iFrom, int iCount=-1);
 	int Find(const T* psz, int startOffset = 0);
 	int FindI(const T* psz, int startOffset = 0);
-	CString<T> Replace(const T* find, const T* replace, int maxReplacements = -1, int startOffset = 0);
-	CString<T> ReplaceI(const T* find, const T* replace, int maxReplacements = -1, int startOffset = 0);
+	CString<T,TAlloc> Replace(const T* find, const T* replace, int maxReplacements = -1, int startOffset = 0);
+	CString<T,TAlloc> ReplaceI(const T* find, const T* replace, int maxReplacements = -1, int startOffset = 0);
 	bool StartsWith(const T* find);
 	bool StartsWithI(const T* find);
 	bool EndsWith(const T* find);
@@ -408,16 +728,27 @@ public:
 protected:
 	struct CHeader
 	{
+#ifdef SIMPLELIB_STRING_ATOMIC_REFCOUNT
+		std::atomic<int> m_iRef;
+#else
 		int m_iRef;
+#endif
 		int	m_iMemSize;
-		int m_iLength;
+		int m_iLength;			// -1 if not known (always known once shared with atomic refcount)
 		T	m_sz[1];
 	};
 
 	CHeader* GetHeader() const { return m_psz ? outerclassptr(CHeader, m_sz, m_psz) : NULL; }
 	void SetHeader(CHeader* pHeader) { m_psz=pHeader ? pHeader->m_sz : NULL; }
 
+	static void InitRef(CHeader* pHeader);
+	static void AddRef(CHeader* pHeader);
+	static bool ReleaseRef(CHeader* pHeader);		// Returns true when last reference released
+	static bool IsShared(CHeader* pHeader);
+
 	T*	m_psz;
+
+	template <class T2, class TAlloc2> friend class CFormat;
 };
 
 typedef CString<char>		CAnsiString;
@@ -465,47 +796,6 @@ inline CString<wchar_t> CAnyString::As<wchar_t>() const
 
 
 
-// Lazy man's version of wcsicmp for compilers that don't support it
-inline int lazy_wcsicmp(const wchar_t* psz1, const wchar_t* psz2)
-{
-	while (*psz1 || *psz2)
-	{
-		int icmp=int(towupper(*psz1++))-int(towupper(*psz2++));
-		if (icmp!=0)
-			return icmp;
-	}
-
-	return 0;
-}
-
-inline int lazy_wcsnicmp(const wchar_t* psz1, const wchar_t* psz2, size_t len)
-{
-	while ((*psz1 || *psz2) && len)
-	{
-		int icmp=int(towupper(*psz1++))-int(towupper(*psz2++));
-		if (icmp!=0)
-			return icmp;
-
-		len--;
-	}
-
-	return 0;
-}
-
-inline int lazy_strnicmp(const char* psz1, const char* psz2, size_t len)
-{
-	while ((*psz1 || *psz2) && len)
-	{
-		int icmp=int(towupper(*psz1++))-int(towupper(*psz2++));
-		if (icmp!=0)
-			return icmp;
-
-		len--;
-	}
-
-	return 0;
-}
-
 // For case insensitive FindKey on CVector<CUniString> - vec.FindKey(L"XYZ", FindKeyI)
 inline int FindKeyI(const CUniString& str1, const wchar_t* psz2)
 {
@@ -716,49 +1006,78 @@ inline CString<char16_t> w_2_c16(const wchar_t* psz, int iLen=-1)
 #define w_2_c16(x) ((const char16_t*)(x))
 #endif
 
+// ASCII fast paths (SIMD where available), return number of characters converted
+// before the first non-ASCII character
+int slxAsciiToWide(const char* psz, wchar_t* pszDest, int iLen);
+int slxWideToAscii(const wchar_t* psz, char* pszDest, int iLen);
+
+// Convert into a caller supplied buffer, returns length converted (excluding the
+// NULL terminator) or -1 if the buffer is too small.  Runs of ASCII are copied
+// directly, anything else goes through the C runtime's multibyte conversion.
+int slxMbToWide(const char* psz, int iLen, wchar_t* pszDest, int cchDest);
+int slxWideToMb(const wchar_t* psz, int iLen, char* pszDest, int cchDest);
+
+// (Single return of a named local in these so the result isn't copied)
 inline CUniString a2w(const char* psz, int iLen=-1)
 {
-	if (!psz)
-		return 0;
-
 	CUniString str;
-
-	if (iLen<0)
-	{
-		iLen=int(strlen(psz));
-		mbstowcs(str.GetBuffer(int(iLen*2+1)), psz, iLen+1);
-	}
-	else
+	if (psz)
 	{
-		char* pszTemp=(char*)alloca(iLen+1);
-		memcpy(pszTemp, psz, iLen);
-		pszTemp[iLen]='\0';
-		mbstowcs(str.GetBuffer(int(iLen*2+1)), pszTemp, iLen+1);
-	}
+		if (iLen<0)
+			iLen=int(strlen(psz));
 
+		// Never produces more wide characters than there are bytes
+		slxMbToWide(psz, iLen, str.GetBuffer(iLen+1), iLen+1);
+	}
 	return str;
 }
 
 inline CAnsiString w2a(const wchar_t* psz, int iLen=-1)
 {
-	if (!psz)
-		return 0;
-
 	CAnsiString str;
-
-	if (iLen<0)
+	if (psz)
 	{
-		iLen=int(wcslen(psz));
-		wcstombs(str.GetBuffer(int(iLen*2+1)), psz, iLen+1);
+		if (iLen<0)
+			iLen=int(wcslen(psz));
+
+		// Try a buffer that's big enough for most text, then the worst case
+		if (slxWideToMb(psz, iLen, str.GetBuffer(iLen*2+1), iLen*2+1)<0)
+		{
+			int cchMax=iLen*int(MB_CUR_MAX)+1;
+			slxWideToMb(psz, iLen, str.GetBuffer(cchMax), cchMax);
+		}
 	}
-	else
+	return str;
+}
+
+// Windows code page 1252 - what the emulator uses for ANSI strings.  Characters
+// that can't be represented convert to '?'
+int slxCp1252ToWide(const char* psz, int iLen, wchar_t* pszDest, int cchDest);
+int slxWideToCp1252(const wchar_t* psz, int iLen, char* pszDest, int cchDest);
+
+inline CUniString cp1252_2_w(const char* psz, int iLen=-1)
+{
+	CUniString str;
+	if (psz)
 	{
-		wchar_t* pszTemp=(wchar_t*)alloca((iLen+1)*2);
-		memcpy(pszTemp, psz, iLen*2);
-		pszTemp[iLen]=L'\0';
-		wcstombs(str.GetBuffer(int(iLen*2+1)), pszTemp, iLen+1);
+		if (iLen<0)
+			iLen=int(strlen(psz));
+
+		slxCp1252ToWide(psz, iLen, str.GetBuffer(iLen+1), iLen+1);
 	}
+	return str;
+}
+
+inline CAnsiString w_2_cp1252(const wchar_t* psz, int iLen=-1)
+{
+	CAnsiString str;
+	if (psz)
+	{
+		if (iLen<0)
+			iLen=int(wcslen(psz));
 
+		slxWideToCp1252(psz, iLen, str.GetBuffer(iLen+1), iLen+1);
+	}
 	return str;
 }
 
@@ -785,33 +1104,199 @@ template <class TSrc>
 CAnsiString t2a(const TSrc* psz) { return t2t<char, TSrc>(psz); }
 
 
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-#pragma warning(default:4996)
-#endif
+// CT2T - converts into an inline buffer, only allocating when the result doesn't
+// fit.  For passing strings between narrow and wide APIs.
+//
+//		pModule->Load(CT2T<wchar_t, char>(pszName));
 
+int slxConvertString(const char* psz, int iLen, wchar_t* pszDest, int cchDest);
+int slxConvertString(const wchar_t* psz, int iLen, char* pszDest, int cchDest);
+int slxConvertString(const char* psz, int iLen, char* pszDest, int cchDest);
+int slxConvertString(const wchar_t* psz, int iLen, wchar_t* pszDest, int cchDest);
 
-}	// Close namespace while defining global scope Compare functions
+template <class TDest, class TSrc, int iInlineSize=128>
+class CT2T
+{
+public:
+// Construction
+	CT2T(const TSrc* psz, int iLen=-1)
+	{
+		m_psz=NULL;
+		m_iLength=0;
+		if (!psz)
+			return;
+
+		if (iLen<0)
+			iLen=CString<TSrc>::len(psz);
+
+		m_iLength=slxConvertString(psz, iLen, m_szBuf, iInlineSize);
+		if (m_iLength>=0)
+		{
+			m_psz=m_szBuf;
+		}
+		else
+		{
+			m_str=t2t<TDest,TSrc>(psz, iLen);
+			m_psz=m_str;
+			m_iLength=m_str.GetLength();
+		}
+	}
+
+// Operations
+	operator const TDest*() const { return m_psz; }
+	const TDest* sz() const { return m_psz; }
+	int GetLength() const { return m_iLength; }
+
+protected:
+	TDest			m_szBuf[iInlineSize];
+	CString<TDest>	m_str;
+	const TDest*	m_psz;
+	int				m_iLength;
+
+private:
+// Unsupported
+	CT2T(const CT2T& Other);
+	CT2T& operator=(const CT2T& Other);
+};
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CFormat - type safe string builder
+
+/*
+
+Chained alternative to Format() for the common cases.  Each argument is
+formatted by its own overload so there's no format string to parse, no
+MSVC/GCC specifier differences and mismatched arguments are compile errors.
+Integers and hex are converted directly into the string buffer.
+
+eg:
+
+	CUniString str=CFormat<wchar_t>() << L"Loaded " << iCount << L" modules from " << strPath;
+
+	// %08X and %.2f equivalents
+	CAnsiString str=CFormat<char>() << "seg " << FormatHex(wSeg, 4, true) << " " << FormatFloat(dbl, 2);
+
+	// %5i equivalent
+	CAnsiString str=CFormat<char>() << FormatPad(iValue, 5);
+
+*/
+
+struct CFormatHex
+{
+	unsigned long long	m_nValue;
+	int					m_iMinDigits;
+	bool				m_bUpper;
+};
+
+struct CFormatPad
+{
+	long long	m_iValue;
+	int			m_iWidth;
+	int			m_chFill;
+};
+
+struct CFormatFloat
+{
+	double	m_dblValue;
+	int		m_iPrecision;
+};
+
+inline CFormatHex FormatHex(unsigned long long nValue, int iMinDigits=0, bool bUpper=false)
+{
+	CFormatHex hex={ nValue, iMinDigits, bUpper };
+	return hex;
+}
+
+inline CFormatPad FormatPad(long long iValue, int iWidth, int chFill=' ')
+{
+	CFormatPad pad={ iValue, iWidth, chFill };
+	return pad;
+}
+
+inline CFormatFloat FormatFloat(double dblValue, int iPrecision=6)
+{
+	CFormatFloat flt={ dblValue, iPrecision };
+	return flt;
+}
+
+template <class T, class TAlloc=SHeap>
+class CFormat
+{
+	typedef typename SChar<T>::TAlt TAlt;
+public:
+// Construction
+	CFormat(int iInitialSize=64);
+
+// Operators
+	CFormat& operator<<(const T* psz);
+	CFormat& operator<<(const TAlt* psz);
+	template <class TAlloc2>
+	CFormat& operator<<(const CString<T,TAlloc2>& str)
+		{ return Append(str.sz(), str.GetLength()); }
+	CFormat& operator<<(T ch);
+	CFormat& operator<<(int iValue);
+	CFormat& operator<<(unsigned int nValue);
+	CFormat& operator<<(long iValue);
+	CFormat& operator<<(unsigned long nValue);
+	CFormat& operator<<(long long iValue);
+	CFormat& operator<<(unsigned long long nValue);
+	CFormat& operator<<(double dblValue);
+	CFormat& operator<<(const CFormatHex& hex);
+	CFormat& operator<<(const CFormatPad& pad);
+	CFormat& operator<<(const CFormatFloat& flt);
+	operator CString<T,TAlloc>() const;
+
+// Operations
+	CFormat& Append(const T* psz, int iLen=-1);
+	CFormat& Append(T ch, int iCount=1);
+	const T* sz() const;
+	int GetLength() const;
+	CString<T,TAlloc> ToString() const;
+	void Empty();
+
+// Implementation
+protected:
+	CString<T,TAlloc>	m_str;
+	T*					m_pBuf;
+	int					m_iLength;
+	mutable int			m_iCapacity;		// Zero while m_str is shared
+
+	T* Reserve(int iExtra);
+	template <class TUnsigned>
+	CFormat& AppendInteger(TUnsigned nValue, bool bNegative, int iWidth=0, T chFill=' ');
+	CFormat& AppendHex(unsigned long long nValue, int iMinDigits, bool bUpper);
+};
+
+
+#if defined(_MSC_VER) && (_MSC_VER>=1400)
+#pragma warning(default:4996)
+#endif
+
+
+}	// Close namespace while defining global scope Compare functions
 
 
 template <class T>
-int _cdecl Compare(const T& a, const T& b)
+int SIMPLECDECL Compare(const T& a, const T& b)
 {
 	return a > b ? 1 : a < b ? -1 : 0;
 }
 
 inline int Compare(const char* psz1, const char* psz2)			{ return strcmp(psz1, psz2); }
 inline int Compare(const wchar_t* psz1, const wchar_t* psz2)	{ return wcscmp(psz1, psz2); }
-inline int __cdecl CompareI(const char* psz1, const char* psz2)			{ return _stricmp(psz1, psz2); }
-inline int __cdecl CompareI(const wchar_t* psz1, const wchar_t* psz2)	{ return _wcsicmp(psz1, psz2); }
+inline int SIMPLECDECL CompareI(const char* psz1, const char* psz2)			{ return _stricmp(psz1, psz2); }
+inline int SIMPLECDECL CompareI(const wchar_t* psz1, const wchar_t* psz2)	{ return _wcsicmp(psz1, psz2); }
 
-template <class T>
-int Compare(Simple::CString<T> const& str1, Simple::CString<T> const& str2)
+template <class T, class TAlloc>
+int Compare(Simple::CString<T,TAlloc> const& str1, Simple::CString<T,TAlloc> const& str2)
 {
 	return Compare(static_cast<const T*>(str1), static_cast<const T*>(str2));
 }
 
-template <class T>
-int __cdecl CompareI(Simple::CString<T> const& str1, Simple::CString<T> const& str2)
+template <class T, class TAlloc>
+int SIMPLECDECL CompareI(Simple::CString<T,TAlloc> const& str1, Simple::CString<T,TAlloc> const& str2)
 {
 	return CompareI(static_cast<const T*>(str1), static_cast<const T*>(str2));
 }
@@ -861,7 +1346,7 @@ public:
 		{ }
 
 	template <class T1, class T2>
-	static int __cdecl Compare(const T1& a, const T2& b)
+	static int SIMPLECDECL Compare(const T1& a, const T2& b)
 		{ return ::Compare(a,b); }
 
 };
@@ -883,7 +1368,30 @@ public:
 		{ }
 
 	template <class T>
-	static int __cdecl Compare(const T& a, const T& b)
+	static int SIMPLECDECL Compare(const T& a, const T& b)
+		{ return ::Compare(a,b); }
+
+};
+
+// Arena object semantics (objects created with CArena::New are destructed
+// on removal, their memory is reclaimed when the arena is freed)
+class SArenaObject
+{
+public:
+	template <class T, class TOwner>
+	static const T& OnAdd(const T& val, TOwner* pOwner)
+		{ return val; }
+
+	template <class T, class TOwner>
+	static void OnRemove(T& val, TOwner* pOwner)
+		{ Destructor(val); }
+
+	template <class T, class TOwner>
+	static void OnDetach(T& val, TOwner* pOwner)
+		{ }
+
+	template <class T>
+	static int SIMPLECDECL Compare(const T& a, const T& b)
 		{ return ::Compare(a,b); }
 
 };
@@ -929,6 +1437,72 @@ public:
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+// Radix sort keys
+
+/*
+
+SRadixKey<T> maps a value to an unsigned integer (TKey) that sorts in the same
+order, for CVector::RadixSort.  Specialize it for other types (eg: to sort
+structs by an integer member):
+
+	template <>
+	class SRadixKey<RESOURCE_ENTRY>
+	{
+	public:
+		typedef unsigned int TKey;
+		static TKey Key(const RESOURCE_ENTRY& e) { return e.id; }
+	};
+
+*/
+
+template <class T>
+class SRadixKey
+{
+	// No default, see above
+};
+
+template <class T>
+class SRadixKey<T*>
+{
+public:
+	typedef size_t TKey;
+	static TKey Key(T* p) { return (TKey)p; }
+};
+
+#define SIMPLELIB_RADIXKEY_UNSIGNED(T) \
+	template <> class SRadixKey<T> { public: typedef T TKey; static TKey Key(T v) { return v; } };
+#define SIMPLELIB_RADIXKEY_SIGNED(T, TU) \
+	template <> class SRadixKey<T> { public: typedef TU TKey; static TKey Key(T v) { return (TU)v ^ ((TU)1 << (sizeof(TU)*8-1)); } };
+
+SIMPLELIB_RADIXKEY_UNSIGNED(unsigned char)
+SIMPLELIB_RADIXKEY_UNSIGNED(unsigned short)
+SIMPLELIB_RADIXKEY_UNSIGNED(unsigned int)
+SIMPLELIB_RADIXKEY_UNSIGNED(unsigned long)
+SIMPLELIB_RADIXKEY_SIGNED(signed char, unsigned char)
+SIMPLELIB_RADIXKEY_SIGNED(short, unsigned short)
+SIMPLELIB_RADIXKEY_SIGNED(int, unsigned int)
+SIMPLELIB_RADIXKEY_SIGNED(long, unsigned long)
+#if !defined(_MSC_VER) || (_MSC_VER>=1400)
+SIMPLELIB_RADIXKEY_UNSIGNED(unsigned long long)
+SIMPLELIB_RADIXKEY_SIGNED(long long, unsigned long long)
+#endif
+
+#undef SIMPLELIB_RADIXKEY_UNSIGNED
+#undef SIMPLELIB_RADIXKEY_SIGNED
+
+// Plain char may be signed or unsigned
+template <>
+class SRadixKey<char>
+{
+public:
+	typedef unsigned char TKey;
+	static TKey Key(char v) { return (TKey)((unsigned char)v ^ ((char)-1<0 ? 0x80 : 0)); }
+};
+
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // Simple Vector Class
 
@@ -959,7 +1533,7 @@ eg:
 */
 
 // CVector
-template <class T, class TSem=SValue, class TArg=T>
+template <class T, class TSem=SValue, class TArg=T, class TAlloc=SHeap>
 class CVector
 {
 public:
@@ -971,7 +1545,7 @@ public:
 	typedef TSem SSemantics;
 	typedef T CValue;
 	typedef TArg CArg;
-	typedef CVector<T,TSem,TArg>	_CVector;
+	typedef CVector<T,TSem,TArg,TAlloc>	_CVector;
 
 // Operations
 	void GrowTo(int iRequiredSize);
@@ -995,37 +1569,62 @@ public:
 	int GetSize() const;
 	bool IsEmpty() const;
 
-	template <class TSem2, class TArg2>
-	void Add(CVector<T, TSem2, TArg2>& vec);
+	template <class TSem2, class TArg2, class TAlloc2>
+	void Add(CVector<T, TSem2, TArg2, TAlloc2>& vec);
+
+	template <class TSem2, class TArg2, class TAlloc2>
+	void InsertAt(int iPosition, CVector<T, TSem2, TArg2, TAlloc2>& vec);
 
-	template <class TSem2, class TArg2>
-	void InsertAt(int iPosition, CVector<T, TSem2, TArg2>& vec);
+	void Swap(CVector<T, TSem, TArg, TAlloc>& other);
 
-	void Swap(CVector<T, TSem, TArg>& other);
+#ifdef SIMPLELIB_ALLOC_STATS
+	void SetStatsCategory(int iCategory);
+#endif
+
+// STL style iteration
+//		Iterators are plain pointers, so random access - range-for, <algorithm>
+//		and the parallel algorithms all work.  Algorithms that assign over
+//		elements (eg: std::remove_if) bypass semantics, reordering is fine.
+	typedef T* iterator;
+	typedef const T* const_iterator;
+	T* begin() const;
+	T* end() const;
 
 
 
 // Search and sort
+//		QuickSort is an introsort.  The TCompare versions take a functor with
+//		int operator()(const T& a, const T& b) which the compiler can inline.
+//		RadixSort works on types with an SRadixKey specialization (integers
+//		and pointers built in).
 	int Find(const TArg& val, int iStartAfter=-1) const;
 	void QuickSort();
-	void QuickSort(int (_cdecl *pfnCompare)(T const& a, T const& b));
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-	void QuickSort(int (__cdecl *pfnCompare)(void* ctx, T const& a, T const& b), void* ctx);
+	void QuickSort(int (SIMPLECDECL *pfnCompare)(T const& a, T const& b));
+	void QuickSort(int (SIMPLECDECL *pfnCompare)(void* ctx, T const& a, T const& b), void* ctx);
+	template <class TCompare>
+	void QuickSort(const TCompare& cmp);
+	void RadixSort();
+#ifdef SIMPLELIB_HAS_THREADS
+	void ParallelSort(int iThreads=0);
+	template <class TCompare>
+	void ParallelSort(const TCompare& cmp, int iThreads=0);
 #endif
 	bool QuickSearch(const TArg& key, int& iPosition) const;
-	bool QuickSearch(const TArg& key, int (__cdecl *pfnCompare)(T const& a, TArg const& b), int& iPosition) const;
-	bool QuickSearch(const TArg& key, void* ctx, int (__cdecl *pfnCompare)(void* ctx, T const& a, TArg const& b), int& iPosition) const;
+	bool QuickSearch(const TArg& key, int (SIMPLECDECL *pfnCompare)(T const& a, TArg const& b), int& iPosition) const;
+	bool QuickSearch(const TArg& key, void* ctx, int (SIMPLECDECL *pfnCompare)(void* ctx, T const& a, TArg const& b), int& iPosition) const;
 
 // FindKey and QuickSearchKey allow search by a key that is a different type than the vector elements
 //			eg: useful for searching on member variable of a the vector element type.
 	template <class TKey>
-	int FindKey(TKey key, int (__cdecl *pfnCompare)(T const& a, TKey b), int iStartAfter=-1) const;
+	int FindKey(TKey key, int (SIMPLECDECL *pfnCompare)(T const& a, TKey b), int iStartAfter=-1) const;
 	template <class TKey>
-	bool QuickSearchKey(TKey key, int (__cdecl *pfnCompare)(T const& a, TKey b), int& iPosition) const;
+	bool QuickSearchKey(TKey key, int (SIMPLECDECL *pfnCompare)(T const& a, TKey b), int& iPosition) const;
 	template <class TKey>
-	int FindKey(TKey key, void* ctx, int (__cdecl *pfnCompare)(void* ctx, T const& a, TKey b), int iStartAfter=-1) const;
+	int FindKey(TKey key, void* ctx, int (SIMPLECDECL *pfnCompare)(void* ctx, T const& a, TKey b), int iStartAfter=-1) const;
 	template <class TKey>
-	bool QuickSearchKey(TKey key, void* ctx, int (__cdecl *pfnCompare)(void* ctx, T const& a, TKey b), int& iPosition) const;
+	bool QuickSearchKey(TKey key, void* ctx, int (SIMPLECDECL *pfnCompare)(void* ctx, T const& a, TKey b), int& iPosition) const;
+	template <class TKey, class TCompare>
+	bool QuickSearchKey(TKey key, const TCompare& cmp, int& iPosition) const;
 
 
 
@@ -1047,6 +1646,9 @@ protected:
 	int		m_iSize;
 	int		m_iMemSize;
 	T*		m_pData;
+#ifdef SIMPLELIB_ALLOC_STATS
+	int		m_iStatsCategory;
+#endif
 
 	void InsertAtInternal(int iPosition, const T* pVal, int iCount);
 
@@ -1068,12 +1670,12 @@ public:
 	CUniStringVector() {};
 	virtual ~CUniStringVector() {};
 
-	static int __cdecl FindFunc(const CUniString& a, const wchar_t* psz)
+	static int SIMPLECDECL FindFunc(const CUniString& a, const wchar_t* psz)
 	{
 		return wcscmp(a, psz);
 	}
 
-	static int __cdecl FindFuncI(const CUniString& a, const wchar_t* psz)
+	static int SIMPLECDECL FindFuncI(const CUniString& a, const wchar_t* psz)
 	{
 		return _wcsicmp(a, psz);
 	}
@@ -1115,9 +1717,15 @@ public:
 	typedef TSem SSemantics;
 	typedef T CValue;
 	typedef CSortedVector<T,TSem,TArg>	_CSortedVector;
+	typedef const T* iterator;
+	typedef const T* const_iterator;
 
 // Operations
 	int Add(const TArg& val);
+	void Add(const T* pVals, int iCount);
+	template <class TSem2, class TArg2, class TAlloc2>
+	void Add(CVector<T, TSem2, TArg2, TAlloc2>& vec)
+		{ Add(vec.GetBuffer(), vec.GetSize()); }
 	int GetSize() const;
 	int Remove(const TArg& val);
 	void RemoveAt(int iPosition);
@@ -1130,29 +1738,32 @@ public:
 	bool QuickSearch(const TArg& key, int& iPosition) const;
 	int Find(const TArg& key, int iStartAfter) const;
 	int Find(const TArg& key) const;
-	void Resort(int (_cdecl *pfnCompare)(const T& a, const T& b), bool bAllowDuplicates=true);
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-	void Resort(void* ctx, int (__cdecl *pfnCompare)(void* ctx, const T& a, const T& b), bool bAllowDuplicates=true);
-#endif
+	void Resort(int (SIMPLECDECL *pfnCompare)(const T& a, const T& b), bool bAllowDuplicates=true);
+	void Resort(void* ctx, int (SIMPLECDECL *pfnCompare)(void* ctx, const T& a, const T& b), bool bAllowDuplicates=true);
 	template <class TKey>
-	bool FindKey(TKey key, int (__cdecl *pfnCompare)(T const& a, TKey b), int& iPos) const
+	bool FindKey(TKey key, int (SIMPLECDECL *pfnCompare)(T const& a, TKey b), int& iPos) const
 	{
 		return m_vec.QuickSearchKey(key, pfnCompare, iPos);
 	}
 	template <class TKey>
-	bool FindKey(TKey key, void* ctx, int (__cdecl *pfnCompare)(void* ctx, T const& a, TKey b), int& iPos) const
+	bool FindKey(TKey key, void* ctx, int (SIMPLECDECL *pfnCompare)(void* ctx, T const& a, TKey b), int& iPos) const
 	{
 		return m_vec.QuickSearchKey(key, ctx, pfnCompare, iPos);
 	}
 
+// STL style iteration (read only, to keep the sort order)
+	const T* begin() const;
+	const T* end() const;
+
 private:
 	CVector<T,TSem,TArg>		m_vec;
 	bool						m_bAllowDuplicates;
-	int (__cdecl *m_pfnCompare)(const T& a, const T& b);
-#if defined(_MSC_VER) && (_MSC_VER>=1400)
-	int (__cdecl *m_pfnCompareEx)(void* ctx, const T& a, const T& b);
+	bool						m_bDefaultCompare;		// m_pfnCompare is TSem::Compare, use inlined version
+	int (SIMPLECDECL *m_pfnCompare)(const T& a, const T& b);
+	int (SIMPLECDECL *m_pfnCompareEx)(void* ctx, const T& a, const T& b);
 	void*						m_ctx;
-#endif
+	template <class TCompare>
+	void AddInternal(const T* pVals, int iCount, const TCompare& cmp);
 	CSortedVector(const CSortedVector& Other);
 	CSortedVector& operator=(const CSortedVector& Other);
 };
@@ -1181,7 +1792,7 @@ public:
 	public:
 		CColumn(int iHeight, const TArg& val)
 		{
-			SetSize(iHeight, val);
+			this->SetSize(iHeight, val);
 		}
 	};
 
@@ -1193,6 +1804,81 @@ protected:
 };
 
 
+/////////////////////////////////////////////////////////////////////////////
+// CFlatGrid
+
+/*
+
+Same idea as CGrid but all cells live in one row-major block, so walking along
+a row (or the whole grid) is a sequential memory scan.  Rows are GetPitch()
+cells apart - the pitch and row capacity double as the grid grows, so repeated
+InsertColumn/InsertRow calls are amortised like CVector::Add.
+
+Cells are relocated with memmove, same as CVector.
+
+eg:
+
+	CFlatGrid<DWORD>	grid(32, 32);
+
+	grid[x][y]=rgb;					// same indexing as CGrid
+	DWORD* pRow=grid.GetRow(y);		// contiguous row of GetWidth() cells
+
+*/
+
+template <class T, class TSem=SValue, class TArg=T, class TAlloc=SHeap>
+class CFlatGrid
+{
+public:
+// Construction
+	CFlatGrid(int iWidth=0, int iHeight=0);
+	virtual ~CFlatGrid();
+
+// Operations
+	void SetSize(int iWidth, int iHeight, const TArg& val=T());
+	void Reserve(int iWidth, int iHeight);
+	void InsertColumn(int iPosition, const TArg& val=T());
+	void RemoveColumn(int iPosition);
+	void InsertRow(int iPosition, const TArg& val=T());
+	void RemoveRow(int iPosition);
+	void RemoveAll();
+	int GetWidth() const;
+	int GetHeight() const;
+	int GetPitch() const;
+	T& GetAt(int x, int y) const;
+	T* GetRow(int y) const;
+	T* GetBuffer() const;
+
+	// Column accessor so grid[x][y] works as it does for CGrid
+	class CColumn
+	{
+	public:
+		CColumn(T* p, int iPitch) : m_p(p), m_iPitch(iPitch) {}
+		T& operator[](int y) const { return m_p[y*m_iPitch]; }
+	protected:
+		T*	m_p;
+		int	m_iPitch;
+	};
+
+	CColumn operator[](int x) const;
+
+// Implementation
+protected:
+	T*		m_pData;
+	int		m_iWidth;
+	int		m_iHeight;
+	int		m_iPitch;			// Allocated cells per row
+	int		m_iRowCapacity;		// Allocated rows
+
+	void ConstructCells(T* p, int iCount, const TArg& val);
+	void DestroyCells(T* p, int iCount);
+
+private:
+// Unsupported
+	CFlatGrid(const CFlatGrid& Other);
+	CFlatGrid& operator=(const CFlatGrid& Other);
+};
+
+
 /////////////////////////////////////////////////////////////////////////////
 // CLinkedList
 
@@ -1238,6 +1924,13 @@ for (List.MoveLast(); !List.IsBOF(); List.MovePrevious())
 	List.Current()->blah();
 }
 
+// Or with range-for (doesn't disturb the list's own iteration position, but
+// don't remove the current item)
+for (CItem* p : List)
+{
+	p->blah();
+}
+
 */
 
 
@@ -1300,6 +1993,36 @@ public:
 	void MovePrevious();
 	T* Current() const;
 
+// STL style iteration - bidirectional, dereferences to T*
+	class CIterator
+	{
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef T* value_type;
+		typedef ptrdiff_t difference_type;
+		typedef T* const* pointer;
+		typedef T* reference;
+
+		CIterator() : m_pList(NULL), m_p(NULL) {}
+		CIterator(const _CLinkedList* pList, T* p) : m_pList(pList), m_p(p) {}
+
+		T* operator*() const { return m_p; }
+		CIterator& operator++() { m_p=_CLinkedList::ChainNext(m_p); return *this; }
+		CIterator operator++(int) { CIterator it(*this); ++*this; return it; }
+		CIterator& operator--() { m_p=m_p ? _CLinkedList::ChainPrev(m_p) : m_pList->GetLast(); return *this; }
+		CIterator operator--(int) { CIterator it(*this); --*this; return it; }
+		bool operator==(const CIterator& other) const { return m_p==other.m_p; }
+		bool operator!=(const CIterator& other) const { return m_p!=other.m_p; }
+
+	protected:
+		const _CLinkedList*	m_pList;
+		T*					m_p;
+	};
+	typedef CIterator iterator;
+	typedef CIterator const_iterator;
+	CIterator begin() const;
+	CIterator end() const;
+
 // Pseudo random access
 	T* GetAt(int iPos) const;
 	T* operator[](int iPos) const;
@@ -1330,6 +2053,8 @@ protected:
 
 	bool IsBeforeIteratePos(T* p) const;
 	void RemoveOrDetach(T* p, bool bDetach);
+	static T* ChainNext(T* p);
+	static T* ChainPrev(T* p);
 
 private:
 // Unsupported
@@ -1342,7 +2067,7 @@ private:
 // CPlex - segmented memory allocator used for allocating nodes in
 //				CMap and CHashMap
 
-template <class T>
+template <class T, class TAlloc=SHeap>
 class CPlex
 {
 public:
@@ -1356,6 +2081,9 @@ public:
 	void FreeAll();
 	int GetCount() const;
 	void SetBlockSize(int iNewBlockSize);
+#ifdef SIMPLELIB_ALLOC_STATS
+	void SetStatsCategory(int iCategory);
+#endif
 
 
 protected:
@@ -1378,10 +2106,17 @@ protected:
 		FREEITEM*	m_pNext;
 	};
 
+	// Free items are chained through the item storage, so round each item
+	// up to hold (and align) a FREEITEM pointer
+	enum { ITEM_SIZE=((sizeof(T)+sizeof(FREEITEM)-1)/sizeof(FREEITEM))*sizeof(FREEITEM) };
+
 	BLOCK*		m_pHead;
 	FREEITEM*	m_pFreeList;
 	int			m_iCount;
 	int			m_iBlockSize;
+#ifdef SIMPLELIB_ALLOC_STATS
+	int			m_iStatsCategory;
+#endif
 };
 
 
@@ -1425,7 +2160,7 @@ eg:
 	}
 */
 
-template <class TKey, class TValue, class TKeySem=SValue, class TValueSem=SValue, class TKeyArg=TKey >
+template <class TKey, class TValue, class TKeySem=SValue, class TValueSem=SValue, class TKeyArg=TKey, class TAlloc=SHeap >
 class CMap
 {
 
@@ -1435,7 +2170,7 @@ public:
 	virtual ~CMap();
 
 // Types
-	typedef CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg> _CMap;
+	typedef CMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc> _CMap;
 
 
 // Type used as return value from operator[]
@@ -1513,7 +2248,7 @@ protected:
 	CNode* FindNode(const TKeyArg& Key) const;
 
 // Attributes
-	CPlex<CNode>	m_NodePlex;
+	CPlex<CNode,TAlloc>	m_NodePlex;
 	CNode*			m_pRoot;
 	CNode*			m_pFirst;
 	CNode*			m_pLast;
@@ -1522,6 +2257,39 @@ protected:
 	mutable CNode*	m_pIterNode;
 	int				m_iSize;
 
+public:
+// STL style iteration - bidirectional in key order, dereferences to a
+// CKeyPair (as operator[]).  O(1) per step, unlike stepping operator[] after
+// the map has been modified.
+	class CIterator
+	{
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef CKeyPair value_type;
+		typedef ptrdiff_t difference_type;
+		typedef void pointer;
+		typedef CKeyPair reference;
+
+		CIterator() : m_pMap(NULL), m_pNode(NULL) {}
+		CIterator(const _CMap* pMap, CNode* pNode) : m_pMap(pMap), m_pNode(pNode) {}
+
+		CKeyPair operator*() const { return CKeyPair(m_pNode->m_KeyPair.m_Key, m_pNode->m_KeyPair.m_Value); }
+		CIterator& operator++() { m_pNode=m_pNode->m_pNext; return *this; }
+		CIterator operator++(int) { CIterator it(*this); ++*this; return it; }
+		CIterator& operator--() { m_pNode=m_pNode ? m_pNode->m_pPrev : m_pMap->m_pLast; return *this; }
+		CIterator operator--(int) { CIterator it(*this); --*this; return it; }
+		bool operator==(const CIterator& other) const { return m_pNode==other.m_pNode; }
+		bool operator!=(const CIterator& other) const { return m_pNode!=other.m_pNode; }
+
+	protected:
+		const _CMap*	m_pMap;
+		CNode*			m_pNode;
+	};
+	typedef CIterator iterator;
+	typedef CIterator const_iterator;
+	CIterator begin() const;
+	CIterator end() const;
+
 private:
 // Unsupported
 	CMap(const CMap& Other);
@@ -1534,7 +2302,7 @@ private:
 /////////////////////////////////////////////////////////////////////////////
 // CIndex
 
-template <class TKey, class TValue, class TKeySem=SValue, class TValueSem=SValue, class TKeyArg=TKey >
+template <class TKey, class TValue, class TKeySem=SValue, class TValueSem=SValue, class TKeyArg=TKey, class TAlloc=SHeap >
 class CIndex
 {
 
@@ -1544,7 +2312,7 @@ public:
 	virtual ~CIndex();
 
 // Types
-	typedef CIndex<TKey, TValue, TKeySem, TValueSem, TKeyArg> _CIndex;
+	typedef CIndex<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc> _CIndex;
 
 	class CEntry
 	{
@@ -1602,6 +2370,7 @@ public:
 	bool IsEmpty() const;
 	CKeyPair operator[](int iIndex) const;
 	void Add(const TKey& Key, const TValue& Value);
+	void Add(const TKey* pKeys, const TValue* pValues, int iCount);
 	void Remove(const TKeyArg& Key);
 	void RemoveAll();
 	TValue Detach(const TKeyArg& Key);
@@ -1610,7 +2379,7 @@ public:
 	bool HasKey(const TKeyArg& Key) const;
 
 protected:
-	CVector<CEntry, SValue>			m_Entries;
+	CVector<CEntry, SValue, CEntry, TAlloc>	m_Entries;
 
 private:
 // Unsupported
@@ -1620,6 +2389,156 @@ private:
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+// CBTreeMap
+
+/*
+
+Ordered map with the same interface and semantics support as CMap, implemented
+as a B+-tree.  Entries are stored in arrays within leaf nodes that are linked
+together for iteration, and each interior node records the entry count below
+each child so index access is O(log n).  Far fewer allocations and much better
+cache behaviour than CMap for large maps.
+
+Supports:
+	* Random access - operator[](int iIndex), O(1) when stepping sequentially
+	* LowerBound - index of first entry >= a key, for range scans
+	* Insert/Delete during iteration (indicies shift as per CMap)
+	* Semantics
+
+Keys and values are relocated with memmove as they move between nodes (same
+requirement as CVector).  Interior nodes hold copies of keys as separators,
+these don't get key semantics applied.
+
+eg:
+
+	CBTreeMap<int, CMyObject*, SValue, SOwnedPtr> map;
+	map.Add(10, new CMyObject());
+
+	// Iterate all entries with keys in range 100 to 199
+	for (int i=map.LowerBound(100); i<map.GetSize() && map[i].Key<200; i++)
+	{
+		...
+	}
+
+*/
+
+template <class TKey, class TValue, class TKeySem=SValue, class TValueSem=SValue, class TKeyArg=TKey, class TAlloc=SHeap >
+class CBTreeMap
+{
+public:
+// Constructor
+			CBTreeMap();
+	virtual ~CBTreeMap();
+
+// Types
+	typedef CBTreeMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, TAlloc> _CBTreeMap;
+
+// Type used as return value from operator[]
+	class CKeyPair
+	{
+	public:
+		CKeyPair(const TKey& Key, TValue& Value) :
+			Key(Key),
+			Value(Value)
+		{
+		}
+		CKeyPair(const CKeyPair& Other) :
+			Key(Other.Key),
+			Value(Other.Value)
+		{
+		}
+
+		const TKey&	Key;
+		TValue&	Value;
+
+#ifdef _MSC_VER
+	private:
+		// See CMap::CKeyPair
+		CKeyPair& operator=(const CKeyPair& Other);
+#endif
+	};
+
+// Operations
+	int GetSize() const;
+	bool IsEmpty() const;
+	CKeyPair operator[](int iIndex) const;
+	void Add(const TKey& Key, const TValue& Value);
+	void Remove(const TKeyArg& Key);
+	void RemoveAll();
+	TValue Detach(const TKeyArg& Key);
+	const TValue& Get(const TKeyArg& Key, const TValue& Default=TValue()) const;
+	bool Find(const TKeyArg& Key, TValue& Value) const;
+	bool HasKey(const TKeyArg& Key) const;
+	int LowerBound(const TKeyArg& Key) const;
+
+	#ifdef _DEBUG
+	void CheckAll();
+	#endif
+
+// Implementation
+protected:
+	enum
+	{
+		LeafSize=32,				// Max entries per leaf
+		InnerSize=32,				// Max children per interior node
+		LeafMin=LeafSize/2,
+		InnerMin=InnerSize/2,
+	};
+
+	// Arrays have one extra slot so a node can overflow before being split
+	struct CNode
+	{
+		bool	m_bLeaf;
+		int		m_iCount;			// Entries in a leaf, children in an interior node
+	};
+	struct CLeaf : public CNode
+	{
+		CLeaf*	m_pPrev;
+		CLeaf*	m_pNext;
+		TKey	m_Keys[LeafSize+1];
+		TValue	m_Values[LeafSize+1];
+	};
+	struct CInner : public CNode
+	{
+		TKey	m_Keys[InnerSize];	// m_Keys[i] separates m_pChildren[i] and m_pChildren[i+1]
+		CNode*	m_pChildren[InnerSize+1];
+		int		m_iSizes[InnerSize+1];	// Total entries below each child
+	};
+
+// Operations
+	CLeaf* AllocLeaf();
+	CInner* AllocInner();
+	void FreeNode(CNode* pNode);
+	int LeafLowerBound(CLeaf* pLeaf, const TKeyArg& Key) const;
+	int ChildIndex(CInner* pInner, const TKeyArg& Key) const;
+	bool FindEntry(const TKeyArg& Key, CLeaf*& pLeaf, int& iPos) const;
+	int NodeSize(CNode* pNode) const;
+	bool Insert(CNode* pNode, const TKey& Key, const TValue& Value, TKey& SplitKey, CNode*& pSplitNode);
+	bool RemoveFrom(CNode* pNode, const TKeyArg& Key, TValue* pvalDetached);
+	void Rebalance(CInner* pParent, int iChild);
+	void Merge(CInner* pParent, int iLeft);
+	void RemoveOrDetach(const TKeyArg& Key, TValue* pvalDetached);
+#ifdef _DEBUG
+	int CheckNode(CNode* pNode, int iDepth, int& iLeafDepth, CLeaf*& pPrevLeaf);
+#endif
+
+// Attributes
+	CNode*			m_pRoot;
+	CLeaf*			m_pFirst;
+	CLeaf*			m_pLast;
+	int				m_iSize;
+	mutable CLeaf*	m_pIterLeaf;		// Cached leaf from last operator[]
+	mutable int		m_iIterBase;		// Index of first entry in m_pIterLeaf
+
+private:
+// Unsupported
+	CBTreeMap(const CBTreeMap& Other);
+	CBTreeMap& operator=(const CBTreeMap& Other);
+};
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // Hashing functions and semantics
 
@@ -1655,21 +2574,21 @@ public:
 	}
 };
 
-template <>
-class SHash<CString<wchar_t> >
+template <class TAlloc>
+class SHash<CString<wchar_t,TAlloc> >
 {
 public:
-	static unsigned long Hash(const CString<wchar_t>& Key)
+	static unsigned long Hash(const CString<wchar_t,TAlloc>& Key)
 	{
 		return SuperFastHash((const char*)static_cast<const wchar_t*>(Key), Key.GetLength()*sizeof(wchar_t));
 	}
 };
 
-template <>
-class SHash<CString<char> >
+template <class TAlloc>
+class SHash<CString<char,TAlloc> >
 {
 public:
-	static unsigned long Hash(const CString<char>& Key)
+	static unsigned long Hash(const CString<char,TAlloc>& Key)
 	{
 		return SuperFastHash(static_cast<const char*>(Key), Key.GetLength()*sizeof(char));
 	}
@@ -1680,7 +2599,7 @@ public:
 /////////////////////////////////////////////////////////////////////////////
 // CHashMap
 
-template <class TKey, class TValue, class TKeySem=SValue, class TValueSem=SValue, class TKeyArg=TKey, class THash=SHash<TKeyArg> >
+template <class TKey, class TValue, class TKeySem=SValue, class TValueSem=SValue, class TKeyArg=TKey, class THash=SHash<TKeyArg>, class TAlloc=SHeap >
 class CHashMap
 {
 
@@ -1690,7 +2609,7 @@ public:
 	virtual ~CHashMap();
 
 	// Types
-	typedef CHashMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, THash> _CHashMap;
+	typedef CHashMap<TKey, TValue, TKeySem, TValueSem, TKeyArg, THash, TAlloc> _CHashMap;
 
 
 	// Type used as return value from operator[]
@@ -1746,8 +2665,8 @@ protected:
 		CChain<CNode>	m_Chain;
 	};
 
-	CPlex<CNode>		m_NodePlex;		// Node allocator
-	CVector<CNode*>		m_Table;		// Hash table
+	CPlex<CNode,TAlloc>	m_NodePlex;		// Node allocator
+	CVector<CNode*,SValue,CNode*,TAlloc>	m_Table;	// Hash table
 	CLinkedList<CNode>	m_List;			// Navigation list
 	unsigned int		m_nHashMask;	// Mask of hash value -> hash table
 	int					m_iThreshold;	// Size at which to rehash
@@ -1759,6 +2678,37 @@ protected:
 	void RemoveOrDetach(const TKeyArg& Key, TValue* pvalDetached);
 	CNode* FindNode(const TKeyArg& Key) const;
 
+public:
+	// STL style iteration - bidirectional in insertion order, dereferences to
+	// a CKeyPair (as operator[]).  Walks the navigation list so O(1) per step.
+	class CIterator
+	{
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef CKeyPair value_type;
+		typedef ptrdiff_t difference_type;
+		typedef void pointer;
+		typedef CKeyPair reference;
+
+		CIterator() {}
+		CIterator(const typename CLinkedList<CNode>::CIterator& it) : m_it(it) {}
+
+		CKeyPair operator*() const { CNode* p=*m_it; return CKeyPair(p->m_KeyPair.m_Key, p->m_KeyPair.m_Value); }
+		CIterator& operator++() { ++m_it; return *this; }
+		CIterator operator++(int) { CIterator it(*this); ++m_it; return it; }
+		CIterator& operator--() { --m_it; return *this; }
+		CIterator operator--(int) { CIterator it(*this); --m_it; return it; }
+		bool operator==(const CIterator& other) const { return m_it==other.m_it; }
+		bool operator!=(const CIterator& other) const { return m_it!=other.m_it; }
+
+	protected:
+		typename CLinkedList<CNode>::CIterator	m_it;
+	};
+	typedef CIterator iterator;
+	typedef CIterator const_iterator;
+	CIterator begin() const;
+	CIterator end() const;
+
 	// Attributes
 private:
 	// Unsupported
@@ -1768,6 +2718,248 @@ private:
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+// CStringPool
+
+/*
+
+String interning pool.  Each distinct string is stored once, NULL terminated,
+in large slabs and identified by a small integer ID.  IDs and string pointers
+stay valid until RemoveAll or the pool is destroyed, so containers can be keyed
+on the ID (or the pointer) and compare with a single integer compare instead
+of a string compare.
+
+ID 0 is always the empty string (and what a NULL string interns to), so a zero
+initialized ID is a valid empty name.
+
+Pass SCaseInsensitive as TSem to intern case insensitively - the first spelling
+interned is the one that's kept.
+
+eg:
+
+	CStringPool<wchar_t, SCaseInsensitive>	poolModules;
+
+	int idKernel=poolModules.Intern(L"KERNEL");
+	ASSERT(poolModules.Intern(L"Kernel")==idKernel);
+	ASSERT(poolModules.Find(L"USER")<0);
+
+	CMap<int, CModule*>	mapModules;		// keyed on interned ID
+	mapModules.Add(idKernel, pModule);
+
+*/
+
+// SIgnoresCase - whether semantics class compares strings case insensitively
+template <class TSem>
+class SIgnoresCase
+{
+public:
+	enum { Value=false };
+};
+
+template <>
+class SIgnoresCase<SCaseInsensitive>
+{
+public:
+	enum { Value=true };
+};
+
+template <class T, class TSem=SValue, class TAlloc=SHeap>
+class CStringPool
+{
+public:
+// Construction
+	CStringPool(int iSlabSize=4096);
+	virtual ~CStringPool();
+
+// Operations
+	int Intern(const T* psz, int iLength=-1);
+	const T* InternString(const T* psz, int iLength=-1);
+	int Find(const T* psz, int iLength=-1) const;
+	const T* GetString(int iID) const;
+	const T* operator[](int iID) const;
+	int GetLength(int iID) const;
+	int GetCount() const;
+	size_t GetBytesUsed() const;
+	void RemoveAll();
+
+// Implementation
+protected:
+	struct SLAB
+	{
+		SLAB*	m_pNext;
+		int		m_iSize;			// In characters
+		int		m_iUsed;
+	};
+	struct ENTRY
+	{
+		const T*		m_psz;
+		int				m_iLength;
+		unsigned int	m_nHash;
+	};
+
+	SLAB*		m_pHead;
+	int			m_iSlabSize;
+	size_t		m_cbUsed;
+	CVector<ENTRY, SValue, ENTRY, TAlloc>	m_Entries;
+	CVector<int, SValue, int, TAlloc>		m_Table;		// Open addressed, entry IDs, 0=empty slot
+	unsigned int							m_nHashMask;
+
+	static unsigned int Hash(const T* psz, int iLength);
+	static bool Equal(const T* a, const T* b, int iLength);
+	int FindSlot(const T* psz, int iLength, unsigned int nHash) const;
+	T* Store(const T* psz, int iLength);
+	void Rehash(int iNewSize);
+
+private:
+	// Unsupported
+	CStringPool(const CStringPool& Other);
+	CStringPool& operator=(const CStringPool& Other);
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CIntrusiveHashSet and CLruCache
+
+/*
+
+Intrusive hash set - items carry their own hash chain link (and key) so adding
+and removing never allocates, apart from the bucket table itself.
+
+To Use:  Add a CHashChain<T> m_HashChain to the item, and tell the set which
+member is the key:
+
+eg:
+
+class CIcon
+{
+	int					m_iID;
+	CHashChain<CIcon>	m_HashChain;
+	CChain<CIcon>		m_Chain;			// only needed for CLruCache
+	...
+};
+
+CIntrusiveHashSet<CIcon, int, &CIcon::m_iID>				setIcons;
+CIntrusiveHashSet<CIcon, int, &CIcon::m_iID, SOwnedPtr>		setIcons;		// For auto delete
+
+Adding an item whose key is already in the set replaces (removes) the old one.
+
+CLruCache combines an intrusive hash set with a CChain recency list.  Find
+moves the item to the front, and adding beyond the capacity removes the least
+recently used item - both O(1) with no allocations.  Use SOwnedPtr to delete
+evicted items, or a custom semantics class to be told about evictions.
+
+CLruCache<CIcon, int, &CIcon::m_iID, SOwnedPtr>	cacheIcons(64);
+
+CIcon* pIcon=cacheIcons.Find(iID);
+if (!pIcon)
+{
+	pIcon=LoadIcon(iID);
+	cacheIcons.Add(pIcon);		// may delete least recently used icon
+}
+
+Both need pointer to member template parameters, so aren't available with
+_SIMPLELIB_NO_LINKEDLIST_MULTICHAIN.
+
+*/
+
+template <class T>
+struct CHashChain
+{
+	CHashChain()
+	{
+		m_pHashNext=NULL;
+	}
+	T*	m_pHashNext;
+};
+
+#ifndef _SIMPLELIB_NO_LINKEDLIST_MULTICHAIN
+
+template <class T, class TKey, TKey T::* pKey, class TSem=SValue, class TKeySem=SValue, class THash=SHash<TKey>, CHashChain<T> T::* pLink=&T::m_HashChain>
+class CIntrusiveHashSet
+{
+public:
+// Construction
+			CIntrusiveHashSet(int iInitialSize=64);
+	virtual ~CIntrusiveHashSet();
+
+// Operations
+	void Add(T* p);
+	void Remove(T* p);
+	T* Detach(T* p);
+	bool RemoveKey(const TKey& Key);
+	void RemoveAll();
+	T* Find(const TKey& Key) const;
+	bool HasKey(const TKey& Key) const;
+	int GetSize() const;
+	bool IsEmpty() const;
+
+// Iteration (in no particular order)
+	T* GetFirst() const;
+	T* GetNext(T* p) const;
+
+// Implementation
+protected:
+	CVector<T*>		m_Table;
+	unsigned int	m_nHashMask;
+	int				m_iSize;
+	int				m_iThreshold;
+	int				m_iInitialSize;
+
+	void Rehash(int iNewSize);
+	T** FindLink(const TKey& Key) const;
+	T* FirstFrom(unsigned int nBucket) const;
+
+private:
+// Unsupported
+	CIntrusiveHashSet(const CIntrusiveHashSet& Other);
+	CIntrusiveHashSet& operator=(const CIntrusiveHashSet& Other);
+};
+
+
+template <class T, class TKey, TKey T::* pKey, class TSem=SValue, class TKeySem=SValue, class THash=SHash<TKey>, CHashChain<T> T::* pLink=&T::m_HashChain, CChain<T> T::* pChain=&T::m_Chain>
+class CLruCache
+{
+public:
+// Construction
+			CLruCache(int iCapacity);
+	virtual ~CLruCache();
+
+// Operations
+	void Add(T* p);
+	T* Find(const TKey& Key);
+	T* Peek(const TKey& Key) const;
+	void Touch(T* p);
+	void Remove(T* p);
+	T* Detach(T* p);
+	void RemoveAll();
+	void SetCapacity(int iCapacity);
+	int GetCapacity() const;
+	int GetSize() const;
+	bool IsEmpty() const;
+	T* GetMostRecent() const;
+	T* GetLeastRecent() const;
+	T* GetNext(T* p) const;			// Next less recently used
+
+// Implementation
+protected:
+	CIntrusiveHashSet<T, TKey, pKey, SValue, TKeySem, THash, pLink>	m_Index;
+	T*		m_pMostRecent;
+	T*		m_pLeastRecent;
+	int		m_iCapacity;
+
+	void Link(T* p);
+	void Unlink(T* p);
+	void Trim();
+
+private:
+// Unsupported
+	CLruCache(const CLruCache& Other);
+	CLruCache& operator=(const CLruCache& Other);
+};
+
+#endif	// _SIMPLELIB_NO_LINKEDLIST_MULTICHAIN
+
+
 /////////////////////////////////////////////////////////////////////////////
 // CRingBuffer
 
@@ -1834,6 +3026,143 @@ private:
 
 
 
+#ifdef SIMPLELIB_HAS_ATOMIC
+
+/////////////////////////////////////////////////////////////////////////////
+// CMpmcQueue
+
+/*
+
+Bounded lock free queue, safe for any number of concurrent readers and writers.
+(Dmitry Vyukov's algorithm - each cell carries a sequence number that tells
+producers and consumers whether it's ready for them, so the only contention is
+a compare-exchange on the enqueue or dequeue position)
+
+Capacity is rounded up to a power of two.  Enqueue fails when full, Dequeue
+fails when empty - neither ever blocks.
+
+*/
+
+template <class T, class TSem=SValue>
+class CMpmcQueue
+{
+public:
+// Construction
+			CMpmcQueue(int iCapacity);
+	virtual ~CMpmcQueue();
+
+// Types
+	typedef CMpmcQueue<T,TSem> _CMpmcQueue;
+
+// Operations
+	bool Enqueue(const T& t);
+	bool Dequeue(T& t);
+	int GetCapacity() const;
+	int GetSizeApprox() const;
+	bool IsEmptyApprox() const;
+
+// Implementation
+protected:
+	enum { CacheLineSize=64 };
+
+	struct CELL
+	{
+		std::atomic<size_t>	m_Sequence;
+		T					m_Data;
+	};
+
+// Attributes
+	char				m_Pad0[CacheLineSize];
+	CELL*				m_pCells;
+	size_t				m_Mask;
+	char				m_Pad1[CacheLineSize];
+	std::atomic<size_t>	m_EnqueuePos;
+	char				m_Pad2[CacheLineSize];
+	std::atomic<size_t>	m_DequeuePos;
+	char				m_Pad3[CacheLineSize];
+
+private:
+// Unsupported
+	CMpmcQueue(const CMpmcQueue& Other);
+	CMpmcQueue& operator=(const CMpmcQueue& Other);
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+// CWorkStealingDeque
+
+/*
+
+Chase-Lev work stealing deque.  The owning thread pushes and pops at the bottom
+(LIFO, no contention unless it's down to the last item) while any number of
+other threads steal from the top (FIFO).  Grows as needed - retired buffers
+are kept until the deque is destroyed since a thief may still be reading one.
+
+Items are stored in std::atomic<T> so T must be trivially copyable - typically
+a pointer to a task.  Steal can fail spuriously when it loses a race with
+another thief or the owner; callers should treat that as "try elsewhere".
+
+(Memory ordering follows Le, Pop, Cohen and Zappa Nardelli, "Correct and
+Efficient Work-Stealing for Weak Memory Models", with seq_cst accesses in
+place of the standalone fences)
+
+*/
+
+template <class T, class TSem=SValue>
+class CWorkStealingDeque
+{
+public:
+// Construction
+			CWorkStealingDeque(int iInitialCapacity=64);
+	virtual ~CWorkStealingDeque();
+
+// Types
+	typedef CWorkStealingDeque<T,TSem> _CWorkStealingDeque;
+
+// Operations (owner thread only)
+	void Push(const T& t);
+	bool Pop(T& t);
+
+// Operations (any thread)
+	bool Steal(T& t);
+	int GetSizeApprox() const;
+	bool IsEmptyApprox() const;
+
+// Implementation
+protected:
+	enum { CacheLineSize=64 };
+
+	struct ARRAY
+	{
+		int64_t			m_iMask;
+		std::atomic<T>	m_Items[1];
+
+		T Get(int64_t i) const { return m_Items[i & m_iMask].load(std::memory_order_relaxed); }
+		void Put(int64_t i, const T& t) { m_Items[i & m_iMask].store(t, std::memory_order_relaxed); }
+	};
+
+	ARRAY* AllocArray(int64_t iCapacity);
+	ARRAY* Grow(ARRAY* pArray, int64_t iTop, int64_t iBottom);
+
+// Attributes
+	char					m_Pad0[CacheLineSize];
+	std::atomic<int64_t>	m_iTop;
+	char					m_Pad1[CacheLineSize];
+	std::atomic<int64_t>	m_iBottom;
+	std::atomic<ARRAY*>		m_pArray;
+	CVector<ARRAY*>			m_Retired;
+	char					m_Pad2[CacheLineSize];
+
+private:
+// Unsupported
+	CWorkStealingDeque(const CWorkStealingDeque& Other);
+	CWorkStealingDeque& operator=(const CWorkStealingDeque& Other);
+};
+
+#endif	// SIMPLELIB_HAS_ATOMIC
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // CPool
 
@@ -1996,20 +3325,21 @@ public:
 CDynamicBase and CDynamicCreatable  provide a lightweight mechanism for runtime type info.
 
 CDynamicBase - defines a dynamic object - one that can be queried for its type
+CDynamic - a dynamic object type with type info (but not createable)
 CDynamicCreatable - defines a dynamically creatable object - one that can be instantiated
 					from its type info.
 CDynType - class representing the type info for a class.
 
 Example:
 
-// CFruit is base for type below it has no base class, so no second parameter to CDynamicBase
-class CFruit : public CDynamicBase<CFruit>
+// CFruit is base for type below it has no base class, so no second parameter to CDynamic
+class CFruit : public CDynamic<CFruit>
 {
 	virtual void x()=0;
 };
 
 // CApple derives from CFruit
-class CApple : public CDynamicBase<CApple, CFruit>
+class CApple : public CDynamic<CApple, CFruit>
 {
 };
 
@@ -2033,6 +3363,7 @@ class CBanana : public CDynamicCreatable<CBanana, CFruit, 3>
 
 // To query if an object is of a particular type
 CFruit* pFruit;
+pFruit->IsKindOf<CApple>();		// true for CApple, CRedApple and CGreenApple
 pFruit->QueryAs<CBanana>();		// returns NULL if pFruit is not of type CBanana
 pFruit->As<CBanana>();			// Asserts if pFruit is not of type CBanana
 
@@ -2041,59 +3372,107 @@ CDynType* pType;							// eg: pType=CBanana::GetType()
 pFruit=(CFruit*)pType->CreateInstance();	// This will create an instance of whatever pType is the type info for
 
 // To create a type from type id parameter
-CDynType* pType=CDynType::GetType(3);		// Get type info for CBanana from its ID
-pFruit=(CFruit*)pType->CreateInstance();	// This should create an instance of CBanana
+CDynType* pType=CDynType::GetTypeFromID(3);		// Get type info for CBanana from its ID
+pFruit=(CFruit*)pType->CreateInstance();		// This should create an instance of CBanana
+pFruit=(CFruit*)CDynType::CreateInstanceFromID(3);	// Or in one step
+
+Each type records its chain of base types in a table that's built at compile
+time (indexed by depth in the hierarchy), so IsKindOf is a single compare
+regardless of depth and doesn't depend on static initialization order.  Type
+IDs are kept in a hash table as types register, so GetTypeFromID is constant
+time too.  Hierarchies can be at most SIMPLELIB_DYNTYPE_MAXDEPTH deep.
 
 */
 
 #ifndef _SIMPLELIB_NO_DYNAMIC
 
+#ifndef SIMPLELIB_DYNTYPE_MAXDEPTH
+#define SIMPLELIB_DYNTYPE_MAXDEPTH	8
+#endif
+
 // Store information about a CDynamicBase type
 class CDynType
 {
 public:
 // Construction
-	CDynType(int iID, void* (*pfnCreate)(), const wchar_t* pszName);
+	CDynType(int iID, void* (*pfnCreate)(), const wchar_t* pszName, CDynType* const* ppChain=NULL, int iDepth=0);
 
 // Given a type ID, return the CDynType for it
 	static CDynType* GetTypeFromID(int iID);
 	static CDynType* GetTypeFromName(const wchar_t* pszName);
+	static void* CreateInstanceFromID(int iID);
 
 // Operations
 	void* CreateInstance() const;
 	int GetID() const;
 	const wchar_t* GetName() const;
+	int GetDepth() const;
+	CDynType* GetBaseType() const;
+	bool IsKindOf(const CDynType* pType) const;
 
 // Implementation
 protected:
 // Attributes
 	int	m_iID;
 	void* (*m_pfnCreate)();
-	CUniString	m_strName;
+	const wchar_t*	m_pszName;
+	CDynType* const* m_ppChain;		// Base types indexed by depth, this type at m_iDepth-1
+	int m_iDepth;
 	CDynType* m_pNext;
 
 // Operations
+	static void Register(CDynType* pType);
 };
 
 // Base class for CDynamicBase classes
 class none
 {
 public:
+	enum { DynTypeDepth=0 };
 	virtual void* QueryCast(CDynType* ptype) { return NULL; }
 	virtual CDynType* QueryType() { return NULL; };
+	virtual CDynType* const* QueryTypeChain() { return NULL; }
 	static CDynType* GetType() { return NULL; };
 };
 
+// CDynTypeChain - type info of TSelf's base type at depth iDepth (or NULL).  Evaluated
+// at compile time to build each type's table of base types.
+template <class TSelf, int iDepth, int iSelfDepth=TSelf::DynTypeDepth>
+struct CDynTypeChain
+{
+	static SIMPLELIB_CONSTEXPR CDynType* Get()
+	{
+		return iDepth==iSelfDepth-1 ? &TSelf::dyntype : CDynTypeChain<typename TSelf::CDynTypeBase, iDepth>::Get();
+	}
+};
+
+template <int iDepth>
+struct CDynTypeChain<none, iDepth, 0>
+{
+	static SIMPLELIB_CONSTEXPR CDynType* Get()
+	{
+		return NULL;
+	}
+};
+
+template <class TSelf>
+struct CDynTypeChainTable
+{
+	static CDynType* const m_Types[SIMPLELIB_DYNTYPE_MAXDEPTH];
+};
+
 
 // CDynamicBase
 template <class TOwner, class TBase=none>
 class CDynamicBase : public TBase
 {
 public:
+	typedef TBase CDynTypeBase;
+	enum { DynTypeDepth=TBase::DynTypeDepth+1 };
+
 	template <class T>
 	T* As()
 	{
-		if (!this) return NULL;
 		T* p=QueryAs<T>();
 		ASSERT(p!=NULL);
 		return p;
@@ -2101,8 +3480,12 @@ public:
 	template <class T>
 	T* QueryAs()
 	{
-		if (!this) return NULL;
-		return (T*)QueryCast(&T::dyntype);
+		return IsKindOf<T>() ? (T*)QueryCast(&T::dyntype) : NULL;
+	}
+	template <class T>
+	bool IsKindOf()
+	{
+		return QueryTypeChain()[T::DynTypeDepth-1]==&T::dyntype;
 	}
 	static CDynType* GetType();
 	static CDynType* GetBaseType() { return TBase::GetType(); };
@@ -2111,7 +3494,11 @@ public:
 
 	virtual void* QueryCast(CDynType* ptype);
 	virtual CDynType* QueryType();
+	virtual CDynType* const* QueryTypeChain();
 
+private:
+	// Hierarchy too deep, increase SIMPLELIB_DYNTYPE_MAXDEPTH
+	typedef char CheckDepth[DynTypeDepth<=SIMPLELIB_DYNTYPE_MAXDEPTH ? 1 : -1];
 };
 
 template <class TOwner, class TBase=none>
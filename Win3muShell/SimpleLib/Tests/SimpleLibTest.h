@@ -0,0 +1,61 @@
+//////////////////////////////////////////////////////////////////////////
+// SimpleLibTest.h - minimal test harness for the SimpleLib test programs
+
+// Each test program is a plain executable registered with ctest.  Checks
+// report file/line on failure and the program exits non-zero if any check
+// failed.
+
+#ifndef __SIMPLELIBTEST_H
+#define __SIMPLELIBTEST_H
+
+#include <stdio.h>
+#include "../SimpleLib.h"
+
+namespace SimpleTest
+{
+
+template <int iDummy=0>
+struct CTestStateHolder
+{
+	static int m_iChecks;
+	static int m_iFailures;
+};
+template <int iDummy> int CTestStateHolder<iDummy>::m_iChecks=0;
+template <int iDummy> int CTestStateHolder<iDummy>::m_iFailures=0;
+
+inline bool Check(bool bPassed, const char* pszExpr, const char* pszFile, int iLine)
+{
+	CTestStateHolder<>::m_iChecks++;
+	if (!bPassed)
+	{
+		CTestStateHolder<>::m_iFailures++;
+		printf("%s(%i): check failed: %s\n", pszFile, iLine, pszExpr);
+		fflush(stdout);
+	}
+	return bPassed;
+}
+
+// Run one test function and report its name
+inline void Run(const char* pszName, void (*pfnTest)())
+{
+	int iFailuresBefore=CTestStateHolder<>::m_iFailures;
+	pfnTest();
+	printf("%-32s %s\n", pszName, CTestStateHolder<>::m_iFailures==iFailuresBefore ? "ok" : "FAILED");
+	fflush(stdout);
+}
+
+// Summary and exit code for main()
+inline int Finish()
+{
+	printf("%i checks, %i failures\n", CTestStateHolder<>::m_iChecks, CTestStateHolder<>::m_iFailures);
+	return CTestStateHolder<>::m_iFailures ? 1 : 0;
+}
+
+}	// namespace SimpleTest
+
+// Check an expression, evaluates to the result so a test can bail out early
+#define CHECK(x)	SimpleTest::Check(!!(x), #x, __FILE__, __LINE__)
+
+#define RUN_TEST(fn)	SimpleTest::Run(#fn, fn)
+
+#endif	// __SIMPLELIBTEST_H
@@ -0,0 +1,580 @@
+//////////////////////////////////////////////////////////////////////////
+// TestMaps.cpp - CMap, CHashMap, CBTreeMap, intrusive containers and lists
+
+#include <algorithm>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <limits.h>
+#include "SimpleLibTest.h"
+
+using namespace Simple;
+
+static int g_iLiveItems=0;
+
+class CItem
+{
+public:
+	CItem(int iID=0, int iValue=0) : m_iID(iID), m_iValue(iValue) { g_iLiveItems++; }
+	~CItem() { g_iLiveItems--; }
+
+	int					m_iID;
+	int					m_iValue;
+	CChain<CItem>		m_Chain;
+	CHashChain<CItem>	m_HashChain;
+};
+
+static void TestMapAndHashMap()
+{
+	srand(5);
+	for (int it=0; it<200; it++)
+	{
+		int n=rand()%300;
+		CMap<int, int> map;
+		CHashMap<int, int> hash;
+		std::map<int, int> ref;
+
+		for (int i=0; i<n; i++)
+		{
+			int k=rand()%500;
+			map.Add(k, i);
+			hash.Add(k, i);
+			ref[k]=i;
+		}
+		for (int i=0; i<n/4; i++)
+		{
+			int k=rand()%500;
+			map.Remove(k);
+			hash.Remove(k);
+			ref.erase(k);
+		}
+
+		if (!CHECK(map.GetSize()==(int)ref.size() && hash.GetSize()==(int)ref.size()))
+			return;
+
+		// Forward iteration is in key order
+		std::map<int, int>::iterator i=ref.begin();
+		int iCount=0;
+		for (CMap<int, int>::CKeyPair kp : map)
+		{
+			CHECK(i!=ref.end() && kp.Key==i->first && kp.Value==i->second);
+			++i;
+			iCount++;
+		}
+		CHECK(iCount==(int)ref.size());
+
+		// Reverse
+		CMap<int, int>::CIterator e=map.end();
+		std::map<int, int>::reverse_iterator r=ref.rbegin();
+		while (e!=map.begin())
+		{
+			--e;
+			CHECK((*e).Key==r->first);
+			++r;
+		}
+
+		for (int k=0; k<500; k+=17)
+		{
+			int v1=-1, v2=-1;
+			bool bFound=ref.count(k)!=0;
+			CHECK(map.Find(k, v1)==bFound && hash.Find(k, v2)==bFound);
+			if (bFound)
+				CHECK(v1==ref[k] && v2==ref[k]);
+		}
+
+		// Hash map iteration visits everything, values are writable
+		CHECK(std::distance(hash.begin(), hash.end())==(long)ref.size());
+		for (CHashMap<int, int>::CKeyPair kp : hash)
+		{
+			CHECK(ref[kp.Key]==kp.Value);
+			kp.Value++;
+		}
+		for (CHashMap<int, int>::CKeyPair kp : hash)
+			CHECK(ref[kp.Key]+1==kp.Value);
+
+		CHashMap<int, int>::CIterator he=hash.end();
+		int iHashCount=0;
+		while (he!=hash.begin())
+		{
+			--he;
+			iHashCount++;
+		}
+		CHECK(iHashCount==(int)ref.size());
+	}
+
+	// String keys
+	CHashMap<CUniString, int> strmap;
+	for (int i=0; i<3000; i++)
+		strmap.Add(Format(L"k%i", i), i);
+	for (int i=0; i<3000; i++)
+	{
+		int x;
+		if (!CHECK(strmap.Find(Format(L"k%i", i), x) && x==i))
+			break;
+	}
+}
+
+static void TestBTreeMap()
+{
+	srand(3);
+	for (int iRound=0; iRound<3; iRound++)
+	{
+		CBTreeMap<int, int> btree;
+		CMap<int, int> map;
+		int iRange=iRound==0 ? 50 : (iRound==1 ? 2000 : 20000);
+		for (int it=0; it<20000; it++)
+		{
+			int k=rand()%iRange, iOp=rand()%10;
+			if (iOp<5)
+			{
+				btree.Add(k, it);
+				map.Add(k, it);
+			}
+			else if (iOp<8)
+			{
+				btree.Remove(k);
+				map.Remove(k);
+			}
+			else if (iOp<9)
+			{
+				bool bHas=map.HasKey(k);
+				int a=btree.Detach(k), b=map.Detach(k);
+				CHECK(!bHas || a==b);
+			}
+			else
+			{
+				int a=-1, b=-1;
+				bool bFoundA=btree.Find(k, a), bFoundB=map.Find(k, b);
+				CHECK(bFoundA==bFoundB && a==b && btree.HasKey(k)==bFoundB && btree.Get(k, -7)==map.Get(k, -7));
+			}
+
+			if (!CHECK(btree.GetSize()==map.GetSize()))
+				return;
+
+			if (it%997==0)
+			{
+				for (int i=0; i<map.GetSize(); i++)
+				{
+					if (!CHECK(btree[i].Key==map[i].Key && btree[i].Value==map[i].Value))
+						return;
+				}
+				int iRef=0;
+				while (iRef<map.GetSize() && map[iRef].Key<k)
+					iRef++;
+				CHECK(btree.LowerBound(k)==iRef);
+			}
+		}
+
+		while (btree.GetSize())
+			btree.Remove(btree[rand()%btree.GetSize()].Key);
+	}
+
+	{
+		CBTreeMap<CAnsiString, int*, SCaseInsensitive, SOwnedPtr> map;
+		for (int i=0; i<5000; i++)
+			map.Add(Format("Key%i", i%3000), new int(i));
+		map.Add("KEY5", new int(1));
+		CHECK(strcmp(map[map.LowerBound("key5")].Key, "KEY5")==0);
+		for (int i=0; i<3000; i+=2)
+			map.Remove(Format("key%i", i));
+		delete map.Detach("key1");
+		CHECK(map.GetSize()==1499);
+	}
+}
+
+// Exposes the B+-tree's nodes so the structure can be checked directly
+class CBTreeMapTest : public CBTreeMap<int, int>
+{
+public:
+	// Checks separators, subtree sizes, fill and leaf depth, returns the number of leaves
+	int CheckStructure()
+	{
+		if (!m_pRoot)
+			return CHECK(m_iSize==0 && m_pFirst==NULL && m_pLast==NULL) ? 0 : -1;
+
+		int iLeafDepth=-1;
+		int iLeaves=0;
+		if (CheckNode(m_pRoot, true, INT_MIN, INT_MAX, 0, iLeafDepth, iLeaves)!=m_iSize)
+			return -1;
+		return iLeaves;
+	}
+
+	// Walks the leaf chain both ways, returns the number of leaves
+	int CheckLeafChain()
+	{
+		int iLeaves=0;
+		int iCount=0;
+		int iPrevKey=INT_MIN;
+		CLeaf* pPrev=NULL;
+		for (CLeaf* pLeaf=m_pFirst; pLeaf; pLeaf=pLeaf->m_pNext)
+		{
+			if (!CHECK(pLeaf->m_pPrev==pPrev))
+				return -1;
+			for (int i=0; i<pLeaf->m_iCount; i++)
+			{
+				if (!CHECK(iCount==0 || pLeaf->m_Keys[i]>iPrevKey))
+					return -1;
+				iPrevKey=pLeaf->m_Keys[i];
+				iCount++;
+			}
+			pPrev=pLeaf;
+			iLeaves++;
+		}
+		if (!CHECK(pPrev==m_pLast && iCount==m_iSize))
+			return -1;
+
+		int iBackward=0;
+		for (CLeaf* pLeaf=m_pLast; pLeaf; pLeaf=pLeaf->m_pPrev)
+			iBackward++;
+		return CHECK(iBackward==iLeaves) ? iLeaves : -1;
+	}
+
+protected:
+	int CheckNode(CNode* pNode, bool bRoot, int iMinKey, int iMaxKey, int iDepth, int& iLeafDepth, int& iLeaves)
+	{
+		if (pNode->m_bLeaf)
+		{
+			CLeaf* pLeaf=static_cast<CLeaf*>(pNode);
+			if (iLeafDepth<0)
+				iLeafDepth=iDepth;
+			if (!CHECK(iDepth==iLeafDepth && (bRoot || pLeaf->m_iCount>=LeafMin) && pLeaf->m_iCount<=LeafSize))
+				return -1;
+			for (int i=0; i<pLeaf->m_iCount; i++)
+			{
+				if (!CHECK(pLeaf->m_Keys[i]>=iMinKey && pLeaf->m_Keys[i]<iMaxKey))
+					return -1;
+			}
+			iLeaves++;
+			return pLeaf->m_iCount;
+		}
+
+		CInner* pInner=static_cast<CInner*>(pNode);
+		if (!CHECK((bRoot ? pInner->m_iCount>=2 : pInner->m_iCount>=InnerMin) && pInner->m_iCount<=InnerSize))
+			return -1;
+
+		int iTotal=0;
+		for (int i=0; i<pInner->m_iCount; i++)
+		{
+			int iLow=i==0 ? iMinKey : pInner->m_Keys[i-1];
+			int iHigh=i==pInner->m_iCount-1 ? iMaxKey : pInner->m_Keys[i];
+			int iSize=CheckNode(pInner->m_pChildren[i], false, iLow, iHigh, iDepth+1, iLeafDepth, iLeaves);
+			if (iSize<0 || !CHECK(iSize==pInner->m_iSizes[i]))
+				return -1;
+			iTotal+=iSize;
+		}
+		return iTotal;
+	}
+};
+
+static void CheckBTreeKeys(CBTreeMapTest& btree, const std::set<int>& keys)
+{
+	std::vector<int> vecKeys(keys.begin(), keys.end());
+	if (!CHECK(btree.GetSize()==(int)vecKeys.size()))
+		return;
+
+	// Forward and backward walks step through the leaf chain
+	bool bOK=true;
+	for (int i=0; i<btree.GetSize(); i++)
+		bOK=bOK && btree[i].Key==vecKeys[i];
+	for (int i=btree.GetSize()-1; i>=0; i--)
+		bOK=bOK && btree[i].Key==vecKeys[i];
+	CHECK(bOK);
+
+	// Random access descends by subtree size
+	for (int n=0; n<500 && btree.GetSize(); n++)
+	{
+		int i=rand()%btree.GetSize();
+		if (!CHECK(btree[i].Key==vecKeys[i] && btree[i].Value==-vecKeys[i]))
+			break;
+	}
+
+	// LowerBound gives the rank of the first key >= the one asked for
+	for (int n=0; n<500; n++)
+	{
+		int k=rand()%20000;
+		int iRank=(int)(std::lower_bound(vecKeys.begin(), vecKeys.end(), k)-vecKeys.begin());
+		if (!CHECK(btree.LowerBound(k)==iRank))
+			break;
+	}
+}
+
+static void TestBTreeMapStructure()
+{
+	srand(11);
+	CBTreeMapTest btree;
+	std::set<int> keys;
+
+	// Ascending inserts split the rightmost leaf and grow the root
+	for (int i=0; i<10000; i++)
+	{
+		btree.Add(i*2, -i*2);
+		keys.insert(i*2);
+		if (i%1000==999 && !CHECK(btree.CheckStructure()>0))
+			return;
+	}
+	int iLeaves=btree.CheckLeafChain();
+	CHECK(iLeaves==btree.CheckStructure() && iLeaves>=10000/32);
+	CheckBTreeKeys(btree, keys);
+
+	// Removing a contiguous range empties whole leaves, which get merged away
+	for (int k=4000; k<16000; k+=2)
+	{
+		btree.Remove(k);
+		keys.erase(k);
+	}
+	int iLeavesAfter=btree.CheckLeafChain();
+	CHECK(iLeavesAfter>0 && iLeavesAfter<iLeaves && iLeavesAfter==btree.CheckStructure());
+	CheckBTreeKeys(btree, keys);
+
+	// Thinning out every leaf borrows from and merges with siblings
+	for (int k=0; k<20000; k+=4)
+	{
+		btree.Remove(k);
+		keys.erase(k);
+	}
+	CHECK(btree.CheckLeafChain()==btree.CheckStructure());
+	CheckBTreeKeys(btree, keys);
+
+	// Random inserts into the gaps split interior leaves again
+	for (int n=0; n<5000; n++)
+	{
+		int k=rand()%20000;
+		btree.Add(k, -k);
+		keys.insert(k);
+	}
+	CHECK(btree.CheckLeafChain()==btree.CheckStructure());
+	CheckBTreeKeys(btree, keys);
+
+	// Down to a single leaf and then empty
+	while (btree.GetSize()>1)
+	{
+		int k=btree[rand()%btree.GetSize()].Key;
+		btree.Remove(k);
+		keys.erase(k);
+	}
+	CHECK(btree.CheckLeafChain()==1 && btree.CheckStructure()==1);
+	CheckBTreeKeys(btree, keys);
+	btree.Remove(btree[0].Key);
+	CHECK(btree.CheckLeafChain()==0 && btree.CheckStructure()==0);
+}
+
+static void TestIntrusiveHashSet()
+{
+	srand(7);
+	{
+		CIntrusiveHashSet<CItem, int, &CItem::m_iID, SOwnedPtr> set;
+		std::map<int, int> ref;
+		for (int it=0; it<50000; it++)
+		{
+			int k=rand()%3000;
+			switch (rand()%3)
+			{
+				case 0:
+					set.Add(new CItem(k, it));
+					ref[k]=it;
+					break;
+
+				case 1:
+					CHECK(set.RemoveKey(k)==(ref.erase(k)>0));
+					break;
+
+				case 2:
+				{
+					CItem* p=set.Find(k);
+					std::map<int, int>::iterator i=ref.find(k);
+					CHECK((p!=NULL)==(i!=ref.end()) && (!p || p->m_iValue==i->second));
+					break;
+				}
+			}
+			if (!CHECK(set.GetSize()==(int)ref.size()))
+				return;
+		}
+
+		std::set<int> seen;
+		for (CItem* p=set.GetFirst(); p; p=set.GetNext(p))
+			seen.insert(p->m_iID);
+		CHECK(seen.size()==ref.size());
+		CHECK(g_iLiveItems==(int)ref.size());
+	}
+	CHECK(g_iLiveItems==0);
+}
+
+static void TestLruCache()
+{
+	srand(7);
+	{
+		CLruCache<CItem, int, &CItem::m_iID, SOwnedPtr> lru(100);
+		std::list<std::pair<int, int> > ref;		// front is most recent
+		for (int it=0; it<50000; it++)
+		{
+			int k=rand()%300;
+			switch (rand()%4)
+			{
+				case 0:
+				{
+					lru.Add(new CItem(k, it));
+					for (std::list<std::pair<int, int> >::iterator i=ref.begin(); i!=ref.end(); ++i)
+					{
+						if (i->first==k)
+						{
+							ref.erase(i);
+							break;
+						}
+					}
+					ref.push_front(std::make_pair(k, it));
+					if (ref.size()>(size_t)lru.GetCapacity())
+						ref.pop_back();
+					break;
+				}
+
+				case 1:
+				{
+					CItem* p=lru.Find(k);
+					std::list<std::pair<int, int> >::iterator i=ref.begin();
+					while (i!=ref.end() && i->first!=k)
+						++i;
+					if (!CHECK((p!=NULL)==(i!=ref.end())))
+						return;
+					if (p)
+					{
+						CHECK(p->m_iValue==i->second);
+						std::pair<int, int> e=*i;
+						ref.erase(i);
+						ref.push_front(e);
+					}
+					break;
+				}
+
+				case 2:
+					if (it%1000==0)
+					{
+						int iCapacity=50+rand()%100;
+						lru.SetCapacity(iCapacity);
+						while (ref.size()>(size_t)iCapacity)
+							ref.pop_back();
+					}
+					break;
+
+				case 3:
+				{
+					CItem* p=lru.Peek(k);
+					if (p && rand()%4==0)
+					{
+						for (std::list<std::pair<int, int> >::iterator i=ref.begin(); i!=ref.end(); ++i)
+						{
+							if (i->first==k)
+							{
+								ref.erase(i);
+								break;
+							}
+						}
+						lru.Remove(p);
+					}
+					break;
+				}
+			}
+
+			if (!CHECK(lru.GetSize()==(int)ref.size()))
+				return;
+			std::list<std::pair<int, int> >::iterator i=ref.begin();
+			for (CItem* p=lru.GetMostRecent(); p; p=lru.GetNext(p), ++i)
+			{
+				if (!CHECK(p->m_iID==i->first))
+					return;
+			}
+		}
+		CHECK(g_iLiveItems==(int)ref.size());
+	}
+	CHECK(g_iLiveItems==0);
+
+	// Re-adding an item that's already cached moves it to the front
+	{
+		CLruCache<CItem, int, &CItem::m_iID, SOwnedPtr> lru(3);
+		CItem* p1=new CItem(1, 1);
+		lru.Add(p1);
+		lru.Add(new CItem(2, 2));
+		lru.Add(new CItem(3, 3));
+		lru.Add(p1);
+		CHECK(lru.GetSize()==3 && g_iLiveItems==3);
+		CHECK(lru.GetMostRecent()==p1 && p1->m_iValue==1 && lru.GetLeastRecent()->m_iID==2);
+		lru.Add(new CItem(4, 4));
+		CHECK(lru.Peek(1)==p1 && lru.Peek(2)==NULL && g_iLiveItems==3);
+	}
+	CHECK(g_iLiveItems==0);
+}
+
+static void TestLinkedList()
+{
+	{
+		CLinkedList<CItem, SOwnedPtr> list;
+		const int n=100;
+		for (int i=0; i<n; i++)
+			list.Add(new CItem(i, i));
+
+		int k=0;
+		for (CItem* p : list)
+		{
+			CHECK(p->m_iValue==k);
+			k++;
+		}
+		CHECK(k==n);
+
+		CLinkedList<CItem, SOwnedPtr>::CIterator e=list.end();
+		while (e!=list.begin())
+		{
+			--e;
+			k--;
+			CHECK((*e)->m_iValue==k);
+		}
+		CHECK(std::count_if(list.begin(), list.end(), [](CItem* p) { return p->m_iValue%2==0; })==n/2);
+
+		CItem* pFirst=list.GetFirst();
+		list.Remove(pFirst);
+		CHECK(list.GetSize()==n-1 && list.GetFirst()->m_iValue==1);
+	}
+	CHECK(g_iLiveItems==0);
+}
+
+static void TestRingBufferAndPlex()
+{
+	CRingBuffer<int> ring(4);
+	for (int i=0; i<4; i++)
+		CHECK(ring.Enqueue(i));
+	CHECK(ring.IsFull() && ring.GetSize()==4);
+	CHECK(ring.Dequeue()==0 && ring.PeekLast()==3 && ring[0]==1);
+	ring.Enqueue(4);
+	for (int i=1; i<=4; i++)
+		CHECK(ring.Dequeue()==i);
+	CHECK(ring.IsEmpty());
+
+	CPlex<int> plex(16);
+	std::vector<int*> items;
+	for (int i=0; i<1000; i++)
+	{
+		int* p=plex.Alloc();
+		*p=i;
+		items.push_back(p);
+	}
+	for (size_t i=0; i<items.size(); i+=2)
+		plex.Free(items[i]);
+	CHECK(plex.GetCount()==500);
+	bool bOK=true;
+	for (size_t i=1; i<items.size(); i+=2)
+		bOK=bOK && *items[i]==(int)i;
+	CHECK(bOK);
+	plex.FreeAll();
+	CHECK(plex.GetCount()==0);
+}
+
+int main()
+{
+	RUN_TEST(TestMapAndHashMap);
+	RUN_TEST(TestBTreeMap);
+	RUN_TEST(TestBTreeMapStructure);
+	RUN_TEST(TestIntrusiveHashSet);
+	RUN_TEST(TestLruCache);
+	RUN_TEST(TestLinkedList);
+	RUN_TEST(TestRingBufferAndPlex);
+	return SimpleTest::Finish();
+}
@@ -0,0 +1,310 @@
+//////////////////////////////////////////////////////////////////////////
+// TestMisc.cpp - allocation policies, allocation stats and dynamic types
+
+// Built with SIMPLELIB_ALLOC_STATS defined (see CMakeLists.txt)
+
+#include <thread>
+#include "SimpleLibTest.h"
+
+using namespace Simple;
+
+struct CArenaItem
+{
+	CArenaItem() : m_iValue(0) {}
+	~CArenaItem() { m_iDestroyed++; }
+
+	int					m_iValue;
+	CChain<CArenaItem>	m_Chain;
+	static int			m_iDestroyed;
+};
+int CArenaItem::m_iDestroyed=0;
+
+// Exposes the arena's allocation header for the FreeAll tests
+class CArenaTest : public CArena
+{
+public:
+	static void* Header(void* p) { return reinterpret_cast<ALLOCHDR*>(p)-1; }
+};
+
+template <class TAlloc>
+static void ExerciseContainers()
+{
+	CVector<int, SValue, int, TAlloc> vec;
+	for (int i=0; i<10000; i++)
+		vec.Add(i);
+	bool bOK=true;
+	for (int i=0; i<10000; i++)
+		bOK=bOK && vec[i]==i;
+	CHECK(bOK);
+	vec.RemoveAt(0, 5000);
+	vec.FreeExtra();
+	CHECK(vec.GetSize()==5000 && vec[0]==5000);
+
+	CMap<int, CString<char, TAlloc>, SValue, SValue, int, TAlloc> map;
+	for (int i=0; i<2000; i++)
+		map.Add(i, CString<char, TAlloc>(Format("v%i", i).sz()));
+	for (int i=0; i<2000; i+=2)
+		map.Remove(i);
+	CHECK(map.GetSize()==1000 && strcmp(map.Get(1, NULL), "v1")==0);
+
+	CHashMap<CString<wchar_t, TAlloc>, int, SValue, SValue, CString<wchar_t, TAlloc>, SHash<CString<wchar_t, TAlloc> >, TAlloc> hash;
+	for (int i=0; i<3000; i++)
+		hash.Add(Format(L"k%i", i).sz(), i);
+	for (int i=0; i<3000; i++)
+	{
+		int x;
+		if (!CHECK(hash.Find(Format(L"k%i", i).sz(), x) && x==i))
+			break;
+	}
+
+	CString<char, TAlloc> str("Hello World");
+	str+=" again";
+	CHECK(str.Mid(6, 5).Compare("World")==0);
+}
+
+static void TestArena()
+{
+	ExerciseContainers<SHeap>();
+
+	CArena arena(4096);
+	{
+		CArenaScope scope(arena);
+		CHECK(CArena::GetCurrent()==&arena);
+		ExerciseContainers<SArena>();
+
+		CLinkedList<CArenaItem, SArenaObject> list;
+		for (int i=0; i<10; i++)
+			list.Add(arena.New<CArenaItem>());
+		list.RemoveAll();
+		CHECK(CArenaItem::m_iDestroyed==10);
+
+		// Growing the last allocation happens in place
+		void* p=arena.Alloc(10);
+		void* q=arena.Realloc(p, 100);
+		CHECK(p==q);
+		size_t cbUsed=arena.GetBytesUsed();
+		arena.Free(q);
+		CHECK(arena.GetBytesUsed()<cbUsed);
+	}
+	CHECK(CArena::GetCurrent()==NULL);
+	arena.FreeAll();
+	CHECK(arena.GetBytesUsed()==0);
+
+	// Free/Realloc of an allocation that outlived FreeAll (copied out so the
+	// test doesn't read freed memory) treat it as not the last allocation
+	{
+		char* p=(char*)arena.Alloc(16);
+		strcpy(p, "survivor");
+		size_t cbHdr=p-(char*)CArenaTest::Header(p);
+		alignas(16) char buf[64];
+		memcpy(buf, p-cbHdr, cbHdr+16);
+		arena.FreeAll();
+
+		char* pOld=buf+cbHdr;
+		arena.Free(pOld);
+		CHECK(arena.GetBytesUsed()==0);
+		char* pNew=(char*)arena.Realloc(pOld, 100);
+		CHECK(pNew!=pOld && strcmp(pNew, "survivor")==0);
+		arena.FreeAll();
+	}
+
+#if !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+	// Block allocation failure returns NULL and leaves the arena usable
+	// (sanitizer allocators abort on the huge request instead)
+	CHECK(arena.Alloc(((size_t)-1)/4)==NULL);
+	void* p=arena.Alloc(10);
+	CHECK(p!=NULL);
+	CHECK(arena.Realloc(p, ((size_t)-1)/4)==NULL);
+	CHECK(arena.GetBytesUsed()>0);
+	arena.FreeAll();
+#endif
+}
+
+static void TestAllocStats()
+{
+	ALLOCSTATS before[CAllocStats::catMax];
+	for (int i=0; i<CAllocStats::catMax; i++)
+		before[i]=CAllocStats::Get(i);
+
+	{
+		CVector<int> vec;
+		for (int i=0; i<1000; i++)
+			vec.Add(i);
+		vec.FreeExtra();
+		CVector<int> other;
+		other.Add(1);
+		vec.Swap(other);
+
+		CAnsiString s("hello");
+		CAnsiString t=s;
+		t+=" world";
+		s.FreeExtra();
+
+		CHashMap<int, int> hash;
+		for (int i=0; i<500; i++)
+			hash.Add(i, i);
+		CMap<int, int> map;
+		for (int i=0; i<100; i++)
+			map.Add(i, i);
+
+		CHECK(CAllocStats::Get(CAllocStats::catVector).iBytesCurrent>before[CAllocStats::catVector].iBytesCurrent);
+		CHECK(CAllocStats::Get(CAllocStats::catString).iAllocs>before[CAllocStats::catString].iAllocs);
+
+		// Swapping across categories moves the bytes with the buffers
+		CVector<int> table;
+		table.SetStatsCategory(CAllocStats::catHashMap);
+		for (int i=0; i<10; i++)
+			table.Add(i);
+		table.FreeExtra();
+		int64_t cbVector=CAllocStats::Get(CAllocStats::catVector).iBytesCurrent;
+		int64_t cbHashMap=CAllocStats::Get(CAllocStats::catHashMap).iBytesCurrent;
+		other.Swap(table);
+		CHECK(table.GetSize()==1000 && other.GetSize()==10);
+		CHECK(CAllocStats::Get(CAllocStats::catVector).iBytesCurrent==cbVector-990*(int64_t)sizeof(int));
+		CHECK(CAllocStats::Get(CAllocStats::catHashMap).iBytesCurrent==cbHashMap+990*(int64_t)sizeof(int));
+	}
+
+	// Everything released again
+	for (int i=0; i<CAllocStats::catMax; i++)
+	{
+		ALLOCSTATS after=CAllocStats::Get(i);
+		CHECK(after.iBytesCurrent==before[i].iBytesCurrent);
+		CHECK(after.iAllocs-before[i].iAllocs==after.iFrees-before[i].iFrees);
+		CHECK(CAllocStats::GetCategoryName(i)!=NULL);
+	}
+
+	// Counters are safe to update from several threads
+	std::thread threads[4];
+	for (int t=0; t<4; t++)
+	{
+		threads[t]=std::thread([]
+		{
+			for (int j=0; j<2000; j++)
+			{
+				CVector<int> vec;
+				for (int i=0; i<50; i++)
+					vec.Add(i);
+			}
+		});
+	}
+	for (int t=0; t<4; t++)
+		threads[t].join();
+	CHECK(CAllocStats::Get(CAllocStats::catVector).iBytesCurrent==before[CAllocStats::catVector].iBytesCurrent);
+}
+
+
+// Dynamic type hierarchy
+class CFruit : public CDynamic<CFruit>
+{
+public:
+	virtual ~CFruit() {}
+	virtual int GetCalories()=0;
+};
+
+class CApple : public CDynamic<CApple, CFruit>
+{
+public:
+	static const wchar_t* GetTypeName() { return L"Apple"; }
+};
+
+class CRedApple : public CDynamicCreatable<CRedApple, CApple, 1>
+{
+public:
+	virtual int GetCalories() { return 95; }
+};
+
+class CGreenApple : public CDynamicCreatable<CGreenApple, CApple, 2>
+{
+public:
+	virtual int GetCalories() { return 80; }
+};
+
+class CBanana : public CDynamicCreatable<CBanana, CFruit, 3>
+{
+public:
+	virtual int GetCalories() { return 105; }
+	static const wchar_t* GetTypeName() { return L"Banana"; }
+};
+
+// Lots of types to make the ID registry grow
+template <int N>
+class CManyBananas : public CDynamicCreatable<CManyBananas<N>, CBanana, 100+N>
+{
+};
+
+template <int N>
+struct CRegisterBananas
+{
+	CRegisterBananas()
+	{
+		CManyBananas<N>::GetType();
+		CRegisterBananas<N-1>();
+	}
+};
+
+template <>
+struct CRegisterBananas<0>
+{
+	CRegisterBananas() {}
+};
+
+// Runs during static initialization, possibly before the dyntype objects
+// have been constructed
+struct CEarlyCheck
+{
+	CEarlyCheck()
+	{
+		CRedApple apple;
+		m_bIsFruit=apple.IsKindOf<CFruit>() && apple.IsKindOf<CApple>();
+		m_bIsBanana=apple.IsKindOf<CBanana>();
+	}
+	bool	m_bIsFruit;
+	bool	m_bIsBanana;
+} g_EarlyCheck;
+
+static void TestDynType()
+{
+	CRegisterBananas<60>();
+
+	CHECK(g_EarlyCheck.m_bIsFruit && !g_EarlyCheck.m_bIsBanana);
+
+	CFruit* pBanana=(CFruit*)CDynType::CreateInstanceFromID(3);
+	if (!CHECK(pBanana!=NULL))
+		return;
+	CHECK(pBanana->IsKindOf<CBanana>() && pBanana->IsKindOf<CFruit>() && !pBanana->IsKindOf<CApple>());
+	CHECK(pBanana->QueryAs<CBanana>()==pBanana && pBanana->QueryAs<CRedApple>()==NULL && pBanana->QueryAs<CApple>()==NULL);
+	CHECK(pBanana->GetCalories()==105);
+
+	CFruit* pApple=(CFruit*)CDynType::GetTypeFromID(1)->CreateInstance();
+	CHECK(pApple->QueryAs<CApple>()!=NULL && pApple->QueryAs<CRedApple>()!=NULL && pApple->QueryAs<CGreenApple>()==NULL);
+	CHECK(pApple->As<CFruit>()==pApple);
+
+	CHECK(CRedApple::GetType()->IsKindOf(CApple::GetType()) && CRedApple::GetType()->IsKindOf(CFruit::GetType()));
+	CHECK(!CApple::GetType()->IsKindOf(CRedApple::GetType()));
+	CHECK(CRedApple::GetType()->GetBaseType()==CApple::GetType() && CFruit::GetType()->GetBaseType()==NULL);
+	CHECK(CRedApple::GetType()->GetDepth()==3);
+	CHECK(CDynType::GetTypeFromName(L"Banana")==CBanana::GetType());
+	CHECK(wcscmp(CApple::GetType()->GetName(), L"Apple")==0);
+	CHECK(CDynType::GetTypeFromID(99)==NULL && CDynType::GetTypeFromID(0)==NULL && CDynType::CreateInstanceFromID(42)==NULL);
+
+	for (int i=1; i<=60; i++)
+	{
+		CDynType* pType=CDynType::GetTypeFromID(100+i);
+		if (!CHECK(pType && pType->GetID()==100+i && pType->IsKindOf(CBanana::GetType()) && pType->GetDepth()==3))
+			break;
+		CFruit* p=(CFruit*)pType->CreateInstance();
+		CHECK(p->IsKindOf<CBanana>() && p->QueryAs<CBanana>()!=NULL);
+		delete p;
+	}
+
+	delete pBanana;
+	delete pApple;
+}
+
+int main()
+{
+	RUN_TEST(TestArena);
+	RUN_TEST(TestAllocStats);
+	RUN_TEST(TestDynType);
+	return SimpleTest::Finish();
+}
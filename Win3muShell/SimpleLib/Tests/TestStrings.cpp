@@ -0,0 +1,446 @@
+//////////////////////////////////////////////////////////////////////////
+// TestStrings.cpp - CString, Format/CFormat, conversions and CStringPool
+
+#include <limits.h>
+#include <locale.h>
+#include <wctype.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "SimpleLibTest.h"
+
+using namespace Simple;
+
+// Brute force reference search
+template <class T>
+static int RefFind(const T* pszHay, int iHayLen, const T* pszNeedle, int iNeedleLen, int iStart, bool bNoCase)
+{
+	for (int i=iStart; i<=iHayLen-iNeedleLen; i++)
+	{
+		bool bMatch=true;
+		for (int j=0; j<iNeedleLen && bMatch; j++)
+		{
+			T a=pszHay[i+j], b=pszNeedle[j];
+			if (bNoCase)
+			{
+				a=(T)towupper(a);
+				b=(T)towupper(b);
+			}
+			bMatch=(a==b);
+		}
+		if (bMatch)
+			return i;
+	}
+	return -1;
+}
+
+template <class T>
+static void TestFindAndCase()
+{
+	srand(1);
+	const T alpha[]={ 'a', 'b', 'A', 'B', 'c', 'z', 'Z', '[', '`', '@', '{', 'x' };
+	for (int it=0; it<20000; it++)
+	{
+		int iHayLen=rand()%80, iNeedleLen=1+rand()%5;
+		T hay[128], needle[8];
+		for (int i=0; i<iHayLen; i++)
+			hay[i]=alpha[rand()%_countof(alpha)];
+		hay[iHayLen]=0;
+		for (int i=0; i<iNeedleLen; i++)
+			needle[i]=alpha[rand()%6];
+		needle[iNeedleLen]=0;
+
+		CString<T> str(hay);
+		int iStart=rand()%4;
+		if (!CHECK(str.Find(needle, iStart)==RefFind(hay, iHayLen, needle, iNeedleLen, iStart, false)))
+			return;
+		if (!CHECK(str.FindI(needle, iStart)==RefFind(hay, iHayLen, needle, iNeedleLen, iStart, true)))
+			return;
+		CHECK(str.StartsWithI(needle)==(iHayLen>=iNeedleLen && RefFind(hay, iNeedleLen, needle, iNeedleLen, 0, true)==0));
+		CHECK(str.EndsWithI(needle)==(iHayLen>=iNeedleLen && RefFind(hay+iHayLen-iNeedleLen, iNeedleLen, needle, iNeedleLen, 0, true)==0));
+
+		CString<T> strUpper=str.ToUpper(), strLower=str.ToLower();
+		for (int i=0; i<iHayLen; i++)
+		{
+			if (!CHECK(strUpper[i]==(T)towupper(hay[i]) && strLower[i]==(T)towlower(hay[i])))
+				return;
+		}
+	}
+}
+
+static void TestFindAndCaseAnsi()
+{
+	TestFindAndCase<char>();
+}
+
+static void TestFindAndCaseUnicode()
+{
+	TestFindAndCase<wchar_t>();
+}
+
+// Long strings with the odd non-ASCII character so the vector kernels cross
+// block boundaries and hand blocks back to the SChar routines; the scalar
+// versions are the reference
+template <class T>
+static void TestSimdKernels(const T* pszExtra)
+{
+	srand(3);
+	int iExtra=0;
+	while (pszExtra[iExtra])
+		iExtra++;
+
+	const T alpha[]={ 'a', 'b', 'A', 'B', 'q', 'Q', '@', '[', '`', '{' };
+	for (int it=0; it<5000; it++)
+	{
+		int iHayLen=rand()%300, iNeedleLen=1+rand()%40;
+		T hay[320], needle[48];
+		for (int i=0; i<iHayLen; i++)
+			hay[i]=rand()%50==0 ? pszExtra[rand()%iExtra] : alpha[rand()%_countof(alpha)];
+		hay[iHayLen]=0;
+
+		// Needles are usually lifted from the haystack so there's something to find
+		int iFrom=iHayLen>iNeedleLen ? rand()%(iHayLen-iNeedleLen+1) : -1;
+		for (int i=0; i<iNeedleLen; i++)
+		{
+			T ch=iFrom>=0 && rand()%8 ? hay[iFrom+i] : alpha[rand()%4];
+			if (rand()%2)
+				ch=(T)(rand()%2 ? towupper(ch) : towlower(ch));
+			needle[i]=ch;
+		}
+		needle[iNeedleLen]=0;
+
+		int iStart=iHayLen ? rand()%(iHayLen/2+1) : 0;
+		int iRef=slxStrFindScalar<T,false>(hay, iHayLen, needle, iNeedleLen, iStart);
+		int iRefI=slxStrFindScalar<T,true>(hay, iHayLen, needle, iNeedleLen, iStart);
+		if (!CHECK(slxStrFind(hay, iHayLen, needle, iNeedleLen, iStart)==iRef))
+			return;
+		if (!CHECK(slxStrFindI(hay, iHayLen, needle, iNeedleLen, iStart)==iRefI))
+			return;
+		if (iFrom>=0)
+			CHECK(slxStrEqualI(hay+iFrom, needle, iNeedleLen)==(SChar<T>::CompareI(hay+iFrom, needle, iNeedleLen)==0));
+
+		T upper[320], lower[320], refUpper[320], refLower[320];
+		memcpy(upper, hay, (iHayLen+1)*sizeof(T));
+		memcpy(lower, hay, (iHayLen+1)*sizeof(T));
+		memcpy(refUpper, hay, (iHayLen+1)*sizeof(T));
+		memcpy(refLower, hay, (iHayLen+1)*sizeof(T));
+		slxStrToUpper(upper);
+		slxStrToLower(lower);
+		SChar<T>::ToUpper(refUpper);
+		SChar<T>::ToLower(refLower);
+		if (!CHECK(memcmp(upper, refUpper, iHayLen*sizeof(T))==0 && memcmp(lower, refLower, iHayLen*sizeof(T))==0))
+			return;
+	}
+}
+
+static void TestSimdKernelsLocales()
+{
+	const char* locales[]={ "C", "C.UTF-8" };
+	for (int iLocale=0; iLocale<(int)_countof(locales); iLocale++)
+	{
+		if (!setlocale(LC_ALL, locales[iLocale]))
+			continue;
+		TestSimdKernels<char>("\xe9\xc9\x80\xff");
+		TestSimdKernels<wchar_t>(L"\xe9\xc9\x3a3\x3c3\x4e2d");
+	}
+	setlocale(LC_ALL, "C");
+}
+
+static void TestBasics()
+{
+	CAnsiString str("Hello World");
+	str+=" again";
+	CHECK(str.Mid(6, 5).Compare("World")==0);
+	CHECK(str.Left(5).Compare("Hello")==0);
+	CHECK(str.Right(5).Compare("again")==0);
+	CHECK(Compare(str.ToUpper(), CAnsiString("HELLO WORLD AGAIN"))==0);
+
+	CHECK(str.Replace(0, 5, "Goodbye"));
+	CHECK(strcmp(str, "Goodbye World again")==0);
+	CHECK(str.Delete(7, 6));
+	CHECK(strcmp(str, "Goodbye again")==0);
+	CHECK(str.Insert(0, ">> "));
+	CHECK(strcmp(str, ">> Goodbye again")==0 && str.GetLength()==16);
+
+	CAnsiString strEmpty;
+	CHECK(strEmpty.IsEmpty() && strEmpty.GetLength()==0);
+	CHECK(strEmpty.GetBuffer(-1)!=NULL);
+}
+
+// Copy on write, checked against std::string as a model
+static void TestCopyOnWrite()
+{
+	CAnsiString a("hello world");
+	CAnsiString b(a);
+	CHECK(a.sz()==b.sz());
+
+	// Reading doesn't detach
+	CHECK(b[4]=='o' && a.sz()==b.sz());
+
+	b+="!";
+	CHECK(a.sz()!=b.sz());
+	CHECK(strcmp(a, "hello world")==0 && strcmp(b, "hello world!")==0);
+
+	// Self assignment
+	CAnsiString& aref=a;
+	a=aref;
+	CHECK(strcmp(a, "hello world")==0);
+
+	{
+		CAnsiString d(a);
+		char* p=d.GetBuffer(64);
+		CHECK(p!=a.sz());
+		strcpy(p, "x");
+		CHECK(strcmp(d, "x")==0 && strcmp(a, "hello world")==0);
+	}
+
+	srand(3);
+	const int iCount=8;
+	std::vector<CAnsiString> strs(iCount);
+	std::vector<std::string> model(iCount);
+	for (int it=0; it<50000; it++)
+	{
+		int i=rand()%iCount, j=rand()%iCount;
+		switch (rand()%6)
+		{
+			case 0:
+				strs[i]=strs[j];
+				model[i]=model[j];
+				break;
+
+			case 1:
+			{
+				char ch=(char)('a'+rand()%26);
+				strs[i]+=ch;
+				model[i]+=ch;
+				break;
+			}
+
+			case 2:
+				strs[i].Empty();
+				model[i].clear();
+				break;
+
+			case 3:
+				strs[i].FreeExtra();
+				break;
+
+			case 4:
+				if (!model[i].empty())
+				{
+					int iPos=rand()%(int)model[i].size();
+					strs[i].Delete(iPos, 1);
+					model[i].erase(iPos, 1);
+				}
+				break;
+
+			case 5:
+			{
+				CAnsiString strTemp(strs[j]);
+				strs[i]=strTemp;
+				model[i]=model[j];
+				break;
+			}
+		}
+
+		for (int k=0; k<iCount; k++)
+		{
+			if (!CHECK(strs[k].GetLength()==(int)model[k].size() && (model[k].empty() || strcmp(strs[k], model[k].c_str())==0)))
+				return;
+		}
+	}
+}
+
+static void TestFormat()
+{
+	CAnsiString str=Format("%s %i %x %.2f", "abc", -42, 255, 1.5);
+	CHECK(strcmp(str, "abc -42 ff 1.50")==0);
+
+	// MSVC style %s is wide in a wide format
+	CUniString strW=Format(L"%s-%i", L"wide", 7);
+	CHECK(wcscmp(strW, L"wide-7")==0);
+
+	// Long output needs the formatter to retry with a bigger buffer
+	std::wstring strLong(1000, L'x');
+	strW=Format(L"[%s]", strLong.c_str());
+	CHECK(strW.GetLength()==1002 && strW[0]==L'[' && strW[1001]==L']');
+
+	srand(9);
+	for (int it=0; it<20000; it++)
+	{
+		long long v=((long long)rand()<<33) ^ ((long long)rand()<<10) ^ rand();
+		if (rand()%2)
+			v=-v;
+		if (it%7==0)
+			v=rand()%200-100;
+		if (it==1)
+			v=LLONG_MIN;
+		if (it==2)
+			v=LLONG_MAX;
+
+		int iv=(int)v;
+		unsigned int uv=(unsigned int)v;
+		int iWidth=rand()%25, iDigits=rand()%18;
+
+		char szRef[256];
+		snprintf(szRef, sizeof(szRef), "a%db%uc%lldd%xe%0*llXf%*lldg%0*lldh%.3fi%s",
+				iv, uv, v, uv, iDigits, (unsigned long long)v, iWidth, v, iWidth, v, (double)iv/7, "str");
+
+		CFormat<char> f(rand()%3);
+		f << 'a' << iv << "b" << uv << 'c' << v << 'd' << FormatHex(uv) << 'e' << FormatHex(v, iDigits, true)
+			<< 'f' << FormatPad(v, iWidth) << 'g' << FormatPad(v, iWidth, '0') << 'h' << FormatFloat((double)iv/7, 3)
+			<< 'i' << CAnsiString("str");
+
+		CAnsiString strResult=f;
+		if (!CHECK(strcmp(strResult, szRef)==0 && strResult.GetLength()==(int)strlen(szRef)))
+			return;
+
+		// Result is a copy, further appends don't affect it
+		f << "more";
+		CHECK(strcmp(strResult, szRef)==0);
+
+		CUniString strWide=CFormat<wchar_t>() << L"x" << iv << "narrow" << FormatHex(uv, 8);
+		wchar_t szWideRef[128];
+		swprintf(szWideRef, 128, L"x%dnarrow%08x", iv, uv);
+		if (!CHECK(wcscmp(strWide, szWideRef)==0))
+			return;
+	}
+}
+
+static void TestConversions()
+{
+	const char* locales[]={ "C", "C.UTF-8" };
+	for (int iLocale=0; iLocale<(int)_countof(locales); iLocale++)
+	{
+		const char* pszLocale=locales[iLocale];
+		if (!setlocale(LC_ALL, pszLocale))
+			continue;
+
+		bool bUtf8=iLocale==1;
+		srand(11);
+		for (int it=0; it<20000; it++)
+		{
+			int n=rand()%70;
+			std::string s;
+			for (int i=0; i<n; i++)
+			{
+				int r=rand()%20;
+				if (r==0 && bUtf8)
+					s+="\xc3\xa9";
+				else if (r==1 && !bUtf8)
+					s+=(char)(0xA0+rand()%0x5F);
+				else
+					s+=(char)(' '+rand()%90);
+			}
+
+			wchar_t szRef[256];
+			size_t nRef=mbstowcs(szRef, s.c_str(), _countof(szRef));
+			if (nRef==(size_t)-1)
+				continue;
+
+			CUniString w=a2w(s.c_str());
+			if (!CHECK(wcscmp(w, szRef)==0))
+				return;
+			CHECK(strcmp(w2a(w), s.c_str())==0);
+
+			CT2T<wchar_t, char, 32> ct(s.c_str());
+			CHECK(wcscmp(ct, szRef)==0 && ct.GetLength()==(int)wcslen(szRef));
+			CT2T<char, wchar_t, 16> ca(w);
+			CHECK(strcmp(ca, s.c_str())==0);
+		}
+	}
+	setlocale(LC_ALL, "C");
+
+	// cp1252 round trips every byte
+	for (int b=1; b<256; b++)
+	{
+		char sz[2]={ (char)b, 0 };
+		CAnsiString str=w_2_cp1252(cp1252_2_w(sz));
+		if (!CHECK((unsigned char)str[0]==b))
+			break;
+	}
+	CUniString str1252=cp1252_2_w("\x80\x99\xe9");
+	CHECK(str1252[0]==0x20AC && str1252[1]==0x2122 && str1252[2]==0xE9);
+	CHECK(strcmp(w_2_cp1252(L"a\x4e2dz"), "a?z")==0);
+
+	// utf8
+	CAnsiString strUtf8=w_2_utf8(L"caf\xe9 \x4e2d");
+	CHECK(strcmp(strUtf8, "caf\xc3\xa9 \xe4\xb8\xad")==0);
+	CHECK(wcscmp(utf8_2_w(strUtf8), L"caf\xe9 \x4e2d")==0);
+}
+
+template <class T, class TSem>
+static void TestStringPool(bool bNoCase)
+{
+	CStringPool<T, TSem> pool(300);
+	std::map<std::basic_string<T>, int> ref;
+	srand(3);
+	for (int it=0; it<20000; it++)
+	{
+		int iLen=rand()%(it%100==0 ? 400 : 8);
+		std::basic_string<T> s;
+		for (int i=0; i<iLen; i++)
+			s+=(T)("aAbBcC"[rand()%6]);
+
+		std::basic_string<T> key=s;
+		if (bNoCase)
+		{
+			for (size_t i=0; i<key.size(); i++)
+				key[i]=(T)tolower(key[i]);
+		}
+
+		int iID=pool.Intern(s.c_str(), (int)s.size());
+		if (iLen==0)
+		{
+			CHECK(iID==0);
+			continue;
+		}
+
+		typename std::map<std::basic_string<T>, int>::iterator i=ref.find(key);
+		if (i==ref.end())
+		{
+			ref[key]=iID;
+			CHECK(pool.GetLength(iID)==iLen);
+		}
+		else if (!CHECK(i->second==iID))
+		{
+			return;
+		}
+
+		std::basic_string<T> got(pool[iID]);
+		if (bNoCase)
+		{
+			for (size_t i=0; i<got.size(); i++)
+				got[i]=(T)tolower(got[i]);
+		}
+		CHECK(got==key);
+		CHECK(pool.Find(s.c_str())==iID);
+	}
+
+	CHECK(pool.GetCount()==(int)ref.size()+1);
+	T szMissing[]={ 'z', 'z', 'z', 0 };
+	CHECK(pool.Find(szMissing)==-1);
+	pool.RemoveAll();
+	CHECK(pool.GetCount()==1 && pool.Find(szMissing)==-1 && pool.Intern(szMissing)==1);
+}
+
+static void TestStringPools()
+{
+	TestStringPool<char, SValue>(false);
+	TestStringPool<wchar_t, SValue>(false);
+	TestStringPool<char, SCaseInsensitive>(true);
+	TestStringPool<wchar_t, SCaseInsensitive>(true);
+}
+
+int main()
+{
+	RUN_TEST(TestBasics);
+	RUN_TEST(TestFindAndCaseAnsi);
+	RUN_TEST(TestFindAndCaseUnicode);
+	RUN_TEST(TestSimdKernelsLocales);
+	RUN_TEST(TestCopyOnWrite);
+	RUN_TEST(TestFormat);
+	RUN_TEST(TestConversions);
+	RUN_TEST(TestStringPools);
+	return SimpleTest::Finish();
+}
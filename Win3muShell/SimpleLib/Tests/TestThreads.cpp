@@ -0,0 +1,307 @@
+//////////////////////////////////////////////////////////////////////////
+// TestThreads.cpp - lock free queues, parallel sort and shared strings
+
+// Built with SIMPLELIB_STRING_ATOMIC_REFCOUNT defined (see CMakeLists.txt)
+// and most useful run under -DSIMPLELIB_SANITIZE=thread
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "SimpleLibTest.h"
+
+using namespace Simple;
+
+static void TestMpmcQueueOrder()
+{
+	// Capacity rounds up to a power of two and a full queue refuses more
+	CMpmcQueue<int> queue(5);
+	CHECK(queue.GetCapacity()==8);
+	CHECK(queue.IsEmptyApprox());
+	int v=0;
+	CHECK(!queue.Dequeue(v));
+
+	// FIFO across many laps of the ring
+	int iNext=0, iExpect=0;
+	for (int lap=0; lap<100; lap++)
+	{
+		while (queue.Enqueue(iNext))
+			iNext++;
+		if (!CHECK(queue.GetSizeApprox()==8))
+			return;
+		int iTake=1+lap%8;
+		for (int i=0; i<iTake; i++)
+		{
+			if (!CHECK(queue.Dequeue(v) && v==iExpect++))
+				return;
+		}
+	}
+	while (queue.Dequeue(v))
+	{
+		if (!CHECK(v==iExpect++))
+			return;
+	}
+	CHECK(iExpect==iNext && queue.IsEmptyApprox());
+}
+
+static void TestMpmcQueue()
+{
+	CMpmcQueue<int> queue(1000);
+	CHECK(queue.GetCapacity()==1024);
+
+	const int iProducers=4, iConsumers=4, iCount=50000;
+	std::atomic<long long> lTotal(0);
+	std::atomic<int> iReceived(0);
+	std::vector<std::thread> threads;
+	for (int p=0; p<iProducers; p++)
+	{
+		threads.push_back(std::thread([&]
+		{
+			for (int i=1; i<=iCount; i++)
+			{
+				while (!queue.Enqueue(i))
+					std::this_thread::yield();
+			}
+		}));
+	}
+	for (int c=0; c<iConsumers; c++)
+	{
+		threads.push_back(std::thread([&]
+		{
+			int v;
+			while (iReceived.load()<iProducers*iCount)
+			{
+				if (queue.Dequeue(v))
+				{
+					lTotal+=v;
+					iReceived++;
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+		}));
+	}
+	for (size_t i=0; i<threads.size(); i++)
+		threads[i].join();
+
+	CHECK(lTotal.load()==(long long)iProducers*iCount*(iCount+1)/2);
+
+	// Owned pointers left in the queue are deleted with it
+	CMpmcQueue<int*, SOwnedPtr> owned(4);
+	owned.Enqueue(new int(1));
+	owned.Enqueue(new int(2));
+	int* p=NULL;
+	CHECK(owned.Dequeue(p) && *p==1);
+	delete p;
+}
+
+static void TestWorkStealingDeque()
+{
+	const int iCount=200000;
+	CWorkStealingDeque<int> deque(2);
+	std::atomic<long long> lTotal(0);
+	std::atomic<int> iReceived(0);
+	std::atomic<bool> bDone(false);
+
+	std::vector<std::thread> thieves;
+	for (int t=0; t<3; t++)
+	{
+		thieves.push_back(std::thread([&]
+		{
+			int v;
+			while (!bDone.load() || !deque.IsEmptyApprox())
+			{
+				if (deque.Steal(v))
+				{
+					lTotal+=v;
+					iReceived++;
+				}
+			}
+		}));
+	}
+
+	// Owner pushes and pops from its own end
+	int v;
+	for (int i=1; i<=iCount; i++)
+	{
+		deque.Push(i);
+		if (i%3==0 && deque.Pop(v))
+		{
+			lTotal+=v;
+			iReceived++;
+		}
+	}
+	while (deque.Pop(v))
+	{
+		lTotal+=v;
+		iReceived++;
+	}
+
+	bDone=true;
+	for (size_t i=0; i<thieves.size(); i++)
+		thieves[i].join();
+	while (deque.Steal(v))
+	{
+		lTotal+=v;
+		iReceived++;
+	}
+
+	CHECK(iReceived.load()==iCount);
+	CHECK(lTotal.load()==(long long)iCount*(iCount+1)/2);
+}
+
+static void TestWorkStealingDequeOrder()
+{
+	// Owner pops LIFO, thieves take FIFO, and growing keeps the contents
+	CWorkStealingDeque<int> deque(2);
+	int v=0;
+	CHECK(!deque.Pop(v) && !deque.Steal(v));
+	for (int i=0; i<1000; i++)
+		deque.Push(i);
+	CHECK(deque.GetSizeApprox()==1000);
+
+	bool bOK=true;
+	for (int i=0; i<500; i++)
+		bOK=bOK && deque.Steal(v) && v==i;
+	for (int i=999; i>=500; i--)
+		bOK=bOK && deque.Pop(v) && v==i;
+	CHECK(bOK);
+	CHECK(!deque.Pop(v) && !deque.Steal(v) && deque.IsEmptyApprox());
+}
+
+// The owner popping the last item races a thief stealing it; every item
+// must come out exactly once
+static void TestWorkStealingDequeLastItem()
+{
+	const int iRounds=200000;
+	CWorkStealingDeque<int> deque;
+	std::vector<std::atomic<int> > seen(iRounds);
+	for (int i=0; i<iRounds; i++)
+		seen[i]=0;
+	std::atomic<bool> bDone(false);
+
+	std::thread thief([&]
+	{
+		int v;
+		while (!bDone.load())
+		{
+			if (deque.Steal(v))
+				seen[v]++;
+		}
+	});
+
+	int v;
+	for (int i=0; i<iRounds; i++)
+	{
+		deque.Push(i);
+		if (deque.Pop(v))
+			seen[v]++;
+	}
+	bDone=true;
+	thief.join();
+	while (deque.Steal(v))
+		seen[v]++;
+
+	int iBad=0;
+	for (int i=0; i<iRounds; i++)
+	{
+		if (seen[i].load()!=1)
+			iBad++;
+	}
+	CHECK(iBad==0);
+}
+
+struct SDescending
+{
+	int operator()(const int& a, const int& b) const
+	{
+		return b<a ? -1 : (a<b ? 1 : 0);
+	}
+};
+
+static void TestParallelSort()
+{
+	srand(5);
+	int sizes[]={ 0, 1, 17, 1000, 100000 };
+	for (int iSize=0; iSize<(int)_countof(sizes); iSize++)
+	{
+		int n=sizes[iSize];
+		CVector<int> vec;
+		std::vector<int> ref;
+		for (int i=0; i<n; i++)
+		{
+			int x=rand()-RAND_MAX/2;
+			vec.Add(x);
+			ref.push_back(x);
+		}
+		std::sort(ref.begin(), ref.end());
+
+		CVector<int> a;
+		a.Add(vec);
+		a.ParallelSort();
+		CHECK(std::equal(a.begin(), a.end(), ref.begin()));
+
+		a.RemoveAll();
+		a.Add(vec);
+		a.ParallelSort(SDescending(), 3);
+		CHECK(std::equal(a.begin(), a.end(), ref.rbegin()));
+	}
+
+	CVector<CAnsiString> strs;
+	std::vector<std::string> ref;
+	for (int i=0; i<30000; i++)
+	{
+		char sz[16];
+		sprintf(sz, "s%i", rand()%5000);
+		strs.Add(sz);
+		ref.push_back(sz);
+	}
+	strs.ParallelSort(4);
+	std::sort(ref.begin(), ref.end());
+	bool bOK=true;
+	for (int i=0; i<strs.GetSize(); i++)
+		bOK=bOK && strcmp(strs[i], ref[i].c_str())==0;
+	CHECK(bOK);
+}
+
+static void TestSharedStrings()
+{
+#ifdef SIMPLELIB_STRING_ATOMIC_REFCOUNT
+	CUniString strShared(L"shared across threads");
+	std::vector<std::thread> threads;
+	std::atomic<int> iBad(0);
+	for (int t=0; t<4; t++)
+	{
+		threads.push_back(std::thread([strShared, &iBad]
+		{
+			for (int i=0; i<20000; i++)
+			{
+				CUniString s(strShared);
+				CUniString s2;
+				s2=s;
+				if (i%3==0)
+					s2+=L"x";
+				if (s.GetLength()!=21 || s[0]!=L's')
+					iBad++;
+			}
+		}));
+	}
+	for (size_t i=0; i<threads.size(); i++)
+		threads[i].join();
+	CHECK(iBad.load()==0);
+	CHECK(wcscmp(strShared, L"shared across threads")==0);
+#endif
+}
+
+int main()
+{
+	RUN_TEST(TestMpmcQueueOrder);
+	RUN_TEST(TestMpmcQueue);
+	RUN_TEST(TestWorkStealingDequeOrder);
+	RUN_TEST(TestWorkStealingDeque);
+	RUN_TEST(TestWorkStealingDequeLastItem);
+	RUN_TEST(TestParallelSort);
+	RUN_TEST(TestSharedStrings);
+	return SimpleTest::Finish();
+}
@@ -0,0 +1,505 @@
+//////////////////////////////////////////////////////////////////////////
+// TestVectors.cpp - CVector sorting, CSortedVector, CIndex and CFlatGrid
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+#include "SimpleLibTest.h"
+
+using namespace Simple;
+
+struct SDescending
+{
+	int operator()(const int& a, const int& b) const
+	{
+		return b<a ? -1 : (a<b ? 1 : 0);
+	}
+};
+
+static int SIMPLECDECL CompareInt(const int& a, const int& b)
+{
+	return a<b ? -1 : (a>b ? 1 : 0);
+}
+
+static int SIMPLECDECL CompareIntCtx(void* ctx, const int& a, const int& b)
+{
+	(*(int*)ctx)++;
+	return a<b ? -1 : (a>b ? 1 : 0);
+}
+
+template <class T>
+static bool IsSortedCopyOf(CVector<T>& vec, std::vector<T> ref)
+{
+	std::sort(ref.begin(), ref.end());
+	if ((int)ref.size()!=vec.GetSize())
+		return false;
+	for (size_t i=0; i<ref.size(); i++)
+	{
+		if (!(vec[(int)i]==ref[i]))
+			return false;
+	}
+	return true;
+}
+
+static bool IsDescending(CVector<int>& vec)
+{
+	for (int i=1; i<vec.GetSize(); i++)
+	{
+		if (vec[i-1]<vec[i])
+			return false;
+	}
+	return true;
+}
+
+static void TestSorts()
+{
+	srand(5);
+	int sizes[]={ 0, 1, 2, 3, 15, 16, 17, 100, 1000, 50000 };
+	for (int iSize=0; iSize<(int)_countof(sizes); iSize++)
+	{
+		for (int iPattern=0; iPattern<5; iPattern++)
+		{
+			int n=sizes[iSize];
+			CVector<int> vec;
+			std::vector<int> ref;
+			for (int i=0; i<n; i++)
+			{
+				int x;
+				switch (iPattern)
+				{
+					case 0: x=rand()-RAND_MAX/2; break;
+					case 1: x=i; break;
+					case 2: x=n-i; break;
+					case 3: x=rand()%4; break;
+					default: x=(i%2) ? i : -i; break;
+				}
+				vec.Add(x);
+				ref.push_back(x);
+			}
+
+			CVector<int> a;
+			a.Add(vec);
+			a.QuickSort();
+			CHECK(IsSortedCopyOf(a, ref));
+
+			a.RemoveAll();
+			a.Add(vec);
+			a.QuickSort(CompareInt);
+			CHECK(IsSortedCopyOf(a, ref));
+
+			a.RemoveAll();
+			a.Add(vec);
+			int iCalls=0;
+			a.QuickSort(CompareIntCtx, &iCalls);
+			CHECK(IsSortedCopyOf(a, ref));
+
+			a.RemoveAll();
+			a.Add(vec);
+			a.RadixSort();
+			CHECK(IsSortedCopyOf(a, ref));
+
+			a.RemoveAll();
+			a.Add(vec);
+			a.QuickSort(SDescending());
+			CHECK(IsDescending(a));
+
+			a.QuickSort();
+			for (int k=0; k<20 && n; k++)
+			{
+				int key=ref[rand()%n];
+				int iPos;
+				CHECK(a.QuickSearchKey(key, SCompareSem<SValue>(), iPos) && a[iPos]==key);
+			}
+		}
+	}
+
+	// Radix sort of other key types
+	{
+		CVector<long long> vec;
+		std::vector<long long> ref;
+		for (int i=0; i<20000; i++)
+		{
+			long long x=((long long)rand()<<33) ^ rand() ^ ((rand()%2) ? (long long)(1ULL<<63) : 0);
+			vec.Add(x);
+			ref.push_back(x);
+		}
+		vec.RadixSort();
+		CHECK(IsSortedCopyOf(vec, ref));
+	}
+	{
+		CVector<char> vec;
+		std::vector<char> ref;
+		for (int i=0; i<1000; i++)
+		{
+			char x=(char)rand();
+			vec.Add(x);
+			ref.push_back(x);
+		}
+		vec.RadixSort();
+		CHECK(IsSortedCopyOf(vec, ref));
+	}
+	{
+		CVector<unsigned short> vec;
+		std::vector<unsigned short> ref;
+		for (int i=0; i<1000; i++)
+		{
+			unsigned short x=(unsigned short)rand();
+			vec.Add(x);
+			ref.push_back(x);
+		}
+		vec.RadixSort();
+		CHECK(IsSortedCopyOf(vec, ref));
+	}
+
+	// Strings
+	{
+		CVector<CAnsiString> vec;
+		std::vector<std::string> ref;
+		for (int i=0; i<5000; i++)
+		{
+			char sz[16];
+			sprintf(sz, "s%i", rand()%1000);
+			vec.Add(sz);
+			ref.push_back(sz);
+		}
+		vec.QuickSort();
+		std::sort(ref.begin(), ref.end());
+		bool bOK=true;
+		for (int i=0; i<vec.GetSize(); i++)
+			bOK=bOK && strcmp(vec[i], ref[i].c_str())==0;
+		CHECK(bOK);
+	}
+
+	// Heap sort fallback
+	for (int n=0; n<300; n+=7)
+	{
+		int arr[300];
+		for (int i=0; i<n; i++)
+			arr[i]=rand()%50;
+		slxHeapSort(arr, arr+n, SCompareSem<SValue>());
+		CHECK(std::is_sorted(arr, arr+n));
+	}
+}
+
+static void TestIterators()
+{
+	srand(5);
+	for (int it=0; it<200; it++)
+	{
+		int n=rand()%300;
+		CVector<int> vec;
+		std::vector<int> ref;
+		for (int i=0; i<n; i++)
+		{
+			int x=rand()%1000;
+			vec.Add(x);
+			ref.push_back(x);
+		}
+		std::sort(vec.begin(), vec.end());
+		std::sort(ref.begin(), ref.end());
+		CHECK(std::equal(vec.begin(), vec.end(), ref.begin()));
+
+		long lTotal=0;
+		for (int x : vec)
+			lTotal+=x;
+		CHECK(lTotal==std::accumulate(ref.begin(), ref.end(), 0L));
+
+		CSortedVector<int> sorted;
+		for (int x : ref)
+			sorted.Add(x);
+		CHECK(std::equal(sorted.begin(), sorted.end(), ref.begin()));
+	}
+}
+
+struct CPair
+{
+	int k;
+	int id;
+	bool operator<(const CPair& o) const { return k<o.k; }
+	bool operator>(const CPair& o) const { return k>o.k; }
+	bool operator==(const CPair& o) const { return k==o.k; }
+};
+
+static int SIMPLECDECL ComparePair(const CPair& a, const CPair& b)
+{
+	return a.k<b.k ? -1 : (a.k>b.k ? 1 : 0);
+}
+
+static int SIMPLECDECL ComparePairDescCtx(void* ctx, const CPair& a, const CPair& b)
+{
+	(*(int*)ctx)++;
+	return a.k<b.k ? 1 : (a.k>b.k ? -1 : 0);
+}
+
+static int g_iLiveObjects=0;
+
+struct CObject
+{
+	CObject(int v) : m_iValue(v) { g_iLiveObjects++; }
+	~CObject() { g_iLiveObjects--; }
+	int m_iValue;
+};
+
+static int SIMPLECDECL CompareObject(CObject* const& a, CObject* const& b)
+{
+	return a->m_iValue<b->m_iValue ? -1 : (a->m_iValue>b->m_iValue ? 1 : 0);
+}
+
+static void TestSortedVector()
+{
+	srand(7);
+
+	// Bulk add must give the same order as adding one at a time
+	for (int iRound=0; iRound<300; iRound++)
+	{
+		bool bDups=(rand()%2)!=0;
+		int n0=rand()%200, n1=rand()%300;
+		CSortedVector<CPair> a, b;
+		a.Resort(ComparePair, bDups);
+		b.Resort(ComparePair, bDups);
+
+		int id=0;
+		for (int i=0; i<n0; i++)
+		{
+			CPair p={ rand()%100, id++ };
+			a.Add(p);
+			b.Add(p);
+		}
+
+		CVector<CPair> batch;
+		for (int i=0; i<n1; i++)
+		{
+			CPair p={ rand()%100, id++ };
+			batch.Add(p);
+		}
+		for (int i=0; i<n1; i++)
+			a.Add(batch[i]);
+		b.Add(batch);
+
+		if (!CHECK(a.GetSize()==b.GetSize()))
+			return;
+		for (int i=0; i<a.GetSize(); i++)
+		{
+			if (!CHECK(a[i].k==b[i].k && a[i].id==b[i].id))
+				return;
+		}
+	}
+
+	// Context comparator
+	{
+		int iCalls=0;
+		CSortedVector<CPair> vec;
+		vec.Resort(&iCalls, ComparePairDescCtx, true);
+		for (int i=0; i<500; i++)
+		{
+			CPair p={ rand()%100, i };
+			vec.Add(p);
+		}
+		CVector<CPair> batch;
+		for (int i=0; i<500; i++)
+		{
+			CPair p={ rand()%100, i };
+			batch.Add(p);
+		}
+		vec.Add(batch);
+		CHECK(vec.GetSize()==1000 && iCalls>0);
+		bool bOK=true;
+		for (int i=1; i<vec.GetSize(); i++)
+			bOK=bOK && vec[i-1].k>=vec[i].k;
+		CHECK(bOK);
+
+		CPair key={ vec[10].k, 0 };
+		int iPos;
+		CHECK(vec.QuickSearch(key, iPos) && vec[iPos].k==key.k);
+		CHECK(vec.Find(key)>=0);
+		vec.Remove(key);
+		CHECK(vec.GetSize()==999);
+	}
+
+	// Case insensitive, no duplicates
+	{
+		CSortedVector<CAnsiString, SCaseInsensitive> vec;
+		vec.Resort(NULL, false);
+		vec.Add("b");
+		vec.Add("A");
+		CHECK(vec.Add("B")<0);
+		CHECK(strcmp(vec[0], "A")==0);
+		CHECK(vec.Find("a")==0);
+	}
+
+	// Owned pointers
+	{
+		CSortedVector<CObject*, SOwnedPtr> vec;
+		CVector<CObject*> batch;
+		for (int i=0; i<100; i++)
+			batch.Add(new CObject(i));
+		vec.Add(batch);
+	}
+	CHECK(g_iLiveObjects==0);
+
+	// Owned pointers dropped as duplicates are deleted rather than leaked
+	{
+		CSortedVector<CObject*, SOwnedPtr> vec;
+		vec.Resort(CompareObject, false);
+		vec.Add(new CObject(1));
+		CObject* batch[]={ new CObject(2), new CObject(1), new CObject(2), new CObject(2), new CObject(3) };
+		vec.Add(batch, _countof(batch));
+		CHECK(vec.GetSize()==3 && g_iLiveObjects==3);
+		CHECK(vec[0]->m_iValue==1 && vec[1]==batch[0] && vec[2]==batch[4]);
+	}
+	CHECK(g_iLiveObjects==0);
+}
+
+static void TestIndex()
+{
+	srand(7);
+	for (int iRound=0; iRound<300; iRound++)
+	{
+		CIndex<int, int> a, b;
+		int n0=rand()%200, n1=rand()%300;
+		for (int i=0; i<n0; i++)
+		{
+			int k=rand()%150;
+			a.Add(k, i);
+			b.Add(k, i);
+		}
+
+		CVector<int> keys, values;
+		for (int i=0; i<n1; i++)
+		{
+			keys.Add(rand()%150);
+			values.Add(1000+i);
+		}
+		for (int i=0; i<n1; i++)
+			a.Add(keys[i], values[i]);
+		b.Add(keys.GetBuffer(), values.GetBuffer(), n1);
+
+		if (!CHECK(a.GetSize()==b.GetSize()))
+			return;
+		for (int i=0; i<a.GetSize(); i++)
+		{
+			if (!CHECK(a[i].Key==b[i].Key && a[i].Value==b[i].Value))
+				return;
+		}
+		if (n1)
+			CHECK(a.HasKey(keys[0]));
+	}
+
+	{
+		CIndex<int, CObject*, SValue, SOwnedPtr> index;
+		index.Add(1, new CObject(1));
+		int keys[]={ 1, 2, 2, 3 };
+		CObject* values[]={ new CObject(0), new CObject(0), new CObject(0), new CObject(0) };
+		index.Add(keys, values, 4);
+		CHECK(index.GetSize()==3 && g_iLiveObjects==3);
+	}
+	CHECK(g_iLiveObjects==0);
+
+	{
+		CIndex<CUniString, int> index;
+		index.Add(L"b", 2);
+		index.Add(L"a", 1);
+		CHECK(index.HasKey(L"a") && !index.HasKey(L"c"));
+	}
+}
+
+static void TestFlatGrid()
+{
+	srand(5);
+	for (int iRound=0; iRound<100; iRound++)
+	{
+		CFlatGrid<CAnsiString> grid;
+		std::vector<std::vector<std::string> > ref;		// ref[x][y]
+		int w=0, h=0;
+		for (int it=0; it<300; it++)
+		{
+			char sz[16];
+			sprintf(sz, "v%i", rand()%1000);
+			switch (rand()%6)
+			{
+				case 0:
+				{
+					int x=rand()%(w+1);
+					grid.InsertColumn(x, sz);
+					ref.insert(ref.begin()+x, std::vector<std::string>(h, sz));
+					w++;
+					break;
+				}
+
+				case 1:
+					if (w)
+					{
+						int x=rand()%w;
+						grid.RemoveColumn(x);
+						ref.erase(ref.begin()+x);
+						w--;
+					}
+					break;
+
+				case 2:
+				{
+					int y=rand()%(h+1);
+					grid.InsertRow(y, sz);
+					for (size_t x=0; x<ref.size(); x++)
+						ref[x].insert(ref[x].begin()+y, sz);
+					h++;
+					break;
+				}
+
+				case 3:
+					if (h)
+					{
+						int y=rand()%h;
+						grid.RemoveRow(y);
+						for (size_t x=0; x<ref.size(); x++)
+							ref[x].erase(ref[x].begin()+y);
+						h--;
+					}
+					break;
+
+				case 4:
+				{
+					int wNew=rand()%12, hNew=rand()%12;
+					grid.SetSize(wNew, hNew, sz);
+					ref.resize(wNew);
+					for (int x=0; x<wNew; x++)
+						ref[x].resize(hNew, sz);
+					w=wNew;
+					h=hNew;
+					break;
+				}
+
+				case 5:
+					if (w && h)
+					{
+						int x=rand()%w, y=rand()%h;
+						grid[x][y]=sz;
+						ref[x][y]=sz;
+					}
+					break;
+			}
+
+			if (!CHECK(grid.GetWidth()==w && grid.GetHeight()==h))
+				return;
+			for (int x=0; x<w; x++)
+			{
+				for (int y=0; y<h; y++)
+				{
+					if (!CHECK(strcmp(grid.GetAt(x, y), ref[x][y].c_str())==0 && strcmp(grid.GetRow(y)[x], ref[x][y].c_str())==0))
+						return;
+				}
+			}
+		}
+	}
+}
+
+int main()
+{
+	RUN_TEST(TestSorts);
+	RUN_TEST(TestIterators);
+	RUN_TEST(TestSortedVector);
+	RUN_TEST(TestIndex);
+	RUN_TEST(TestFlatGrid);
+	return SimpleTest::Finish();
+}